@@ -244,6 +244,19 @@
 // The item size of the FIFO is always fixed to one i.e. bytes! Furthermore, the actively used FIFO depth is reconfigured such that the depth is a multiple of the current sample size in order to avoid samples to get split up in case of a wrap in the FIFO ring buffer (depth = (max_depth / sampe_sz) * sampe_sz)!
 // This is important to remind in case you use DMAs! If the sample sizes changes, the DMA MUST BE RECONFIGURED just like the FIFOs for a different depth!!!
 
+// The EP IN and OUT software FIFOs have one writer and one reader each (the application on one
+// side, the USB driver on the other) and can skip their mutexes, see tu_fifo_config_spsc().
+// Only if tud_audio_write() / tud_audio_read() and friends are called from a single task, and
+// never while the USB task clears the FIFO (set interface, bus reset): with the mutex,
+// tu_fifo_clear() waits for the application's call to finish.
+#ifndef CFG_TUD_AUDIO_EP_IN_FIFO_SPSC
+#define CFG_TUD_AUDIO_EP_IN_FIFO_SPSC                       0
+#endif
+
+#ifndef CFG_TUD_AUDIO_EP_OUT_FIFO_SPSC
+#define CFG_TUD_AUDIO_EP_OUT_FIFO_SPSC                      0
+#endif
+
 // For PCM encoding/decoding
 
 #ifndef CFG_TUD_AUDIO_ENABLE_ENCODING
@@ -0,0 +1,251 @@
+/*
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2020 Ha Thach (tinyusb.org)
+ * Copyright (c) 2020 Reinhard Panhuber
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ * This file is part of the TinyUSB stack.
+ */
+
+#ifndef _TUSB_AUDIO_INTERLEAVE_H_
+#define _TUSB_AUDIO_INTERLEAVE_H_
+
+#include <stdint.h>
+#include "common/tusb_compiler.h"
+
+#ifdef __cplusplus
+ extern "C" {
+#endif
+
+// Copy helpers of the support FIFO encoding and decoding (2.3.1.5 Audio Streams), in a
+// header of their own so that they can be unit tested and benchmarked on their own.
+//
+// Both move the samples of one support FIFO between the FIFO (contiguous) and the
+// interleaved stream, where every n_ff_used-th sample belongs to it. The generic loops
+// copy a sample through packed (unaligned) accesses, which compile to byte loads and
+// stores on cores without unaligned access (e.g. Xtensa). The common stereo shapes,
+// two FIFOs of 2 or 4 byte samples, have fast paths with aligned half word and word
+// accesses when the pointers allow them: 2 byte samples are moved two at a time
+// through one word on the FIFO side.
+
+typedef struct{
+  uint16_t val;
+} __attribute((__packed__)) audiod_unaligned_uint16_t;
+
+typedef struct{
+  uint32_t val;
+} __attribute((__packed__)) audiod_unaligned_uint32_t;
+
+#define AUDIOD_IS_ALIGNED(_p, _n)   ((((uintptr_t) (_p)) & ((_n) - 1)) == 0)
+
+// Interleaved stream (src) to one support FIFO (dst up to dst_end); returns src past the last sample taken
+static inline uint8_t * audiod_interleaved_copy_bytes_fast_decode(uint16_t const nBytesToCopy, void * dst, uint8_t * dst_end, uint8_t * src, uint8_t const n_ff_used)
+{
+
+  // This function is an optimized version of
+  //  while((uint8_t *)dst < dst_end)
+  //  {
+  //    memcpy(dst, src, nBytesToCopy);
+  //    dst = (uint8_t *)dst + nBytesToCopy;
+  //    src += nBytesToCopy * n_ff_used;
+  //  }
+
+  // Stereo, 16 bit: two samples into one word of the FIFO
+  if (n_ff_used == 2 && nBytesToCopy == 2 && AUDIOD_IS_ALIGNED(dst, 4) && AUDIOD_IS_ALIGNED(src, 2))
+  {
+    uint32_t * d32 = (uint32_t *) dst;
+    uint16_t const * s16 = (uint16_t const *) src;
+
+    while ((uint8_t *) (d32 + 1) <= dst_end)
+    {
+#if TU_BYTE_ORDER == TU_LITTLE_ENDIAN
+      *d32++ = (uint32_t) s16[0] | ((uint32_t) s16[2] << 16);
+#else
+      *d32++ = ((uint32_t) s16[0] << 16) | (uint32_t) s16[2];
+#endif
+      s16 += 4;
+    }
+    if ((uint8_t *) d32 < dst_end)
+    {
+      *(uint16_t *) d32 = s16[0];
+      s16 += 2;
+    }
+    return (uint8_t *) s16;
+  }
+
+  // Stereo, 24/32 bit: aligned words
+  if (n_ff_used == 2 && nBytesToCopy == 4 && AUDIOD_IS_ALIGNED(dst, 4) && AUDIOD_IS_ALIGNED(src, 4))
+  {
+    uint32_t * d32 = (uint32_t *) dst;
+    uint32_t const * s32 = (uint32_t const *) src;
+
+    while ((uint8_t *) d32 < dst_end)
+    {
+      *d32++ = s32[0];
+      s32 += 2;
+    }
+    return (uint8_t *) s32;
+  }
+
+  switch (nBytesToCopy)
+  {
+    case 1:
+      while((uint8_t *)dst < dst_end)
+      {
+        *(uint8_t *)dst++ = *src;
+        src += n_ff_used;
+      }
+      break;
+
+    case 2:
+      while((uint8_t *)dst < dst_end)
+      {
+        *(audiod_unaligned_uint16_t*)dst = *(audiod_unaligned_uint16_t*)src;
+        dst += 2;
+        src += 2 * n_ff_used;
+      }
+      break;
+
+    case 3:
+      while((uint8_t *)dst < dst_end)
+      {
+        //        memcpy(dst, src, 3);
+        //        dst = (uint8_t *)dst + 3;
+        //        src += 3 * n_ff_used;
+
+        // TODO: Is there a faster way to copy 3 bytes?
+        *(uint8_t *)dst++ = *src++;
+        *(uint8_t *)dst++ = *src++;
+        *(uint8_t *)dst++ = *src++;
+
+        src += 3 * (n_ff_used - 1);
+      }
+      break;
+
+    case 4:
+      while((uint8_t *)dst < dst_end)
+      {
+        *(audiod_unaligned_uint32_t*)dst = *(audiod_unaligned_uint32_t*)src;
+        dst += 4;
+        src += 4 * n_ff_used;
+      }
+      break;
+  }
+
+  return src;
+}
+
+// One support FIFO (src up to src_end) to the interleaved stream (dst); returns dst past the last sample written
+static inline uint8_t * audiod_interleaved_copy_bytes_fast_encode(uint16_t const nBytesToCopy, uint8_t * src, uint8_t * src_end, uint8_t * dst, uint8_t const n_ff_used)
+{
+  // Stereo, 16 bit: two samples out of one word of the FIFO
+  if (n_ff_used == 2 && nBytesToCopy == 2 && AUDIOD_IS_ALIGNED(src, 4) && AUDIOD_IS_ALIGNED(dst, 2))
+  {
+    uint32_t const * s32 = (uint32_t const *) src;
+    uint16_t * d16 = (uint16_t *) dst;
+
+    while ((uint8_t const *) (s32 + 1) <= src_end)
+    {
+      uint32_t const w = *s32++;
+#if TU_BYTE_ORDER == TU_LITTLE_ENDIAN
+      d16[0] = (uint16_t) w;
+      d16[2] = (uint16_t) (w >> 16);
+#else
+      d16[0] = (uint16_t) (w >> 16);
+      d16[2] = (uint16_t) w;
+#endif
+      d16 += 4;
+    }
+    if ((uint8_t const *) s32 < src_end)
+    {
+      d16[0] = *(uint16_t const *) s32;
+      d16 += 2;
+    }
+    return (uint8_t *) d16;
+  }
+
+  // Stereo, 24/32 bit: aligned words
+  if (n_ff_used == 2 && nBytesToCopy == 4 && AUDIOD_IS_ALIGNED(src, 4) && AUDIOD_IS_ALIGNED(dst, 4))
+  {
+    uint32_t const * s32 = (uint32_t const *) src;
+    uint32_t * d32 = (uint32_t *) dst;
+
+    while ((uint8_t const *) s32 < src_end)
+    {
+      d32[0] = *s32++;
+      d32 += 2;
+    }
+    return (uint8_t *) d32;
+  }
+
+  switch (nBytesToCopy)
+  {
+    case 1:
+      while(src < src_end)
+      {
+        *dst = *src++;
+        dst += n_ff_used;
+      }
+      break;
+
+    case 2:
+      while(src < src_end)
+      {
+        *(audiod_unaligned_uint16_t*)dst = *(audiod_unaligned_uint16_t*)src;
+        src += 2;
+        dst += 2 * n_ff_used;
+      }
+      break;
+
+    case 3:
+      while(src < src_end)
+      {
+        //        memcpy(dst, src, 3);
+        //        src = (uint8_t *)src + 3;
+        //        dst += 3 * n_ff_used;
+
+        // TODO: Is there a faster way to copy 3 bytes?
+        *dst++ = *src++;
+        *dst++ = *src++;
+        *dst++ = *src++;
+
+        dst += 3 * (n_ff_used - 1);
+      }
+      break;
+
+    case 4:
+      while(src < src_end)
+      {
+        *(audiod_unaligned_uint32_t*)dst = *(audiod_unaligned_uint32_t*)src;
+        src += 4;
+        dst += 4 * n_ff_used;
+      }
+      break;
+  }
+
+  return dst;
+}
+
+#ifdef __cplusplus
+ }
+#endif
+
+#endif /* _TUSB_AUDIO_INTERLEAVE_H_ */
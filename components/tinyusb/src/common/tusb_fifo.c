@@ -27,6 +27,7 @@
 
 #include "osal/osal.h"
 #include "tusb_fifo.h"
+#include "tusb_hwfifo.h"
 
 #define TU_FIFO_DBG   0
 
@@ -38,23 +39,33 @@
 
 #if OSAL_MUTEX_REQUIRED
 
-TU_ATTR_ALWAYS_INLINE static inline void _ff_lock(osal_mutex_t mutex)
+TU_ATTR_ALWAYS_INLINE static inline void _ff_lock(tu_fifo_t* f, osal_mutex_t mutex)
 {
-  if (mutex) osal_mutex_lock(mutex, OSAL_TIMEOUT_WAIT_FOREVER);
+  if (mutex && !f->spsc) osal_mutex_lock(mutex, OSAL_TIMEOUT_WAIT_FOREVER);
 }
 
-TU_ATTR_ALWAYS_INLINE static inline void _ff_unlock(osal_mutex_t mutex)
+TU_ATTR_ALWAYS_INLINE static inline void _ff_unlock(tu_fifo_t* f, osal_mutex_t mutex)
 {
-  if (mutex) osal_mutex_unlock(mutex);
+  if (mutex && !f->spsc) osal_mutex_unlock(mutex);
 }
 
 #else
 
-#define _ff_lock(_mutex)
-#define _ff_unlock(_mutex)
+#define _ff_lock(_f, _mutex)
+#define _ff_unlock(_f, _mutex)
 
 #endif
 
+// Index hand over between the writer and the reader: the index of the other side is
+// loaded with acquire and the own one stored with release semantics
+#if defined(__GNUC__)
+  #define _ff_idx_load(_idx)         __atomic_load_n(_idx, __ATOMIC_ACQUIRE)
+  #define _ff_idx_store(_idx, _val)  __atomic_store_n(_idx, _val, __ATOMIC_RELEASE)
+#else
+  #define _ff_idx_load(_idx)         (*(_idx))
+  #define _ff_idx_store(_idx, _val)  (*(_idx) = (_val))
+#endif
+
 /** \enum tu_fifo_copy_mode_t
  * \brief Write modes intended to allow special read and write functions to be able to
  *        copy data to and from USB hardware FIFOs as needed for e.g. STM32s and others
@@ -72,8 +83,8 @@ bool tu_fifo_config(tu_fifo_t *f, void* buffer, uint16_t depth, uint16_t item_si
   // only if overflow happens once (important for unsupervised DMA applications)
   if (depth > 0x8000) return false;
 
-  _ff_lock(f->mutex_wr);
-  _ff_lock(f->mutex_rd);
+  _ff_lock(f, f->mutex_wr);
+  _ff_lock(f, f->mutex_rd);
 
   f->buffer       = (uint8_t*) buffer;
   f->depth        = depth;
@@ -82,8 +93,8 @@ bool tu_fifo_config(tu_fifo_t *f, void* buffer, uint16_t depth, uint16_t item_si
   f->rd_idx       = 0;
   f->wr_idx       = 0;
 
-  _ff_unlock(f->mutex_wr);
-  _ff_unlock(f->mutex_rd);
+  _ff_unlock(f, f->mutex_wr);
+  _ff_unlock(f, f->mutex_rd);
 
   return true;
 }
@@ -93,52 +104,16 @@ bool tu_fifo_config(tu_fifo_t *f, void* buffer, uint16_t depth, uint16_t item_si
 //--------------------------------------------------------------------+
 
 // Intended to be used to read from hardware USB FIFO in e.g. STM32 where all data is read from a constant address
-// Code adapted from dcd_synopsys.c
-// TODO generalize with configurable 1 byte or 4 byte each read
 static void _ff_push_const_addr(uint8_t * ff_buf, const void * app_buf, uint16_t len)
 {
-  volatile const uint32_t * reg_rx = (volatile const uint32_t *) app_buf;
-
-  // Reading full available 32 bit words from const app address
-  uint16_t full_words = len >> 2;
-  while(full_words--)
-  {
-    tu_unaligned_write32(ff_buf, *reg_rx);
-    ff_buf += 4;
-  }
-
-  // Read the remaining 1-3 bytes from const app address
-  uint8_t const bytes_rem = len & 0x03;
-  if ( bytes_rem )
-  {
-    uint32_t tmp32 = *reg_rx;
-    memcpy(ff_buf, &tmp32, bytes_rem);
-  }
+  tu_hwfifo_read((volatile const uint32_t *) app_buf, ff_buf, len);
 }
 
 // Intended to be used to write to hardware USB FIFO in e.g. STM32
 // where all data is written to a constant address in full word copies
 static void _ff_pull_const_addr(void * app_buf, const uint8_t * ff_buf, uint16_t len)
 {
-  volatile uint32_t * reg_tx = (volatile uint32_t *) app_buf;
-
-  // Write full available 32 bit words to const address
-  uint16_t full_words = len >> 2;
-  while(full_words--)
-  {
-    *reg_tx = tu_unaligned_read32(ff_buf);
-    ff_buf += 4;
-  }
-
-  // Write the remaining 1-3 bytes into const address
-  uint8_t const bytes_rem = len & 0x03;
-  if ( bytes_rem )
-  {
-    uint32_t tmp32 = 0;
-    memcpy(&tmp32, ff_buf, bytes_rem);
-
-    *reg_tx = tmp32;
-  }
+  tu_hwfifo_write((volatile uint32_t *) app_buf, ff_buf, len);
 }
 
 // send one item to fifo WITHOUT updating write pointer
@@ -464,10 +439,10 @@ static uint16_t _tu_fifo_write_n(tu_fifo_t* f, const void * data, uint16_t n, tu
 {
   if ( n == 0 ) return 0;
 
-  _ff_lock(f->mutex_wr);
+  _ff_lock(f, f->mutex_wr);
 
   uint16_t wr_idx = f->wr_idx;
-  uint16_t rd_idx = f->rd_idx;
+  uint16_t rd_idx = _ff_idx_load(&f->rd_idx);
 
   uint8_t const* buf8 = (uint8_t const*) data;
 
@@ -537,28 +512,28 @@ static uint16_t _tu_fifo_write_n(tu_fifo_t* f, const void * data, uint16_t n, tu
     _ff_push_n(f, buf8, n, wr_ptr, copy_mode);
 
     // Advance index
-    f->wr_idx = advance_index(f->depth, wr_idx, n);
+    _ff_idx_store(&f->wr_idx, advance_index(f->depth, wr_idx, n));
 
     TU_LOG(TU_FIFO_DBG, "\tnew_wr = %u\n", f->wr_idx);
   }
 
-  _ff_unlock(f->mutex_wr);
+  _ff_unlock(f, f->mutex_wr);
 
   return n;
 }
 
 static uint16_t _tu_fifo_read_n(tu_fifo_t* f, void * buffer, uint16_t n, tu_fifo_copy_mode_t copy_mode)
 {
-  _ff_lock(f->mutex_rd);
+  _ff_lock(f, f->mutex_rd);
 
   // Peek the data
   // f->rd_idx might get modified in case of an overflow so we can not use a local variable
-  n = _tu_fifo_peek_n(f, buffer, n, f->wr_idx, f->rd_idx, copy_mode);
+  n = _tu_fifo_peek_n(f, buffer, n, _ff_idx_load(&f->wr_idx), f->rd_idx, copy_mode);
 
   // Advance read pointer
-  f->rd_idx = advance_index(f->depth, f->rd_idx, n);
+  _ff_idx_store(&f->rd_idx, advance_index(f->depth, f->rd_idx, n));
 
-  _ff_unlock(f->mutex_rd);
+  _ff_unlock(f, f->mutex_rd);
   return n;
 }
 
@@ -669,9 +644,9 @@ bool tu_fifo_overflowed(tu_fifo_t* f)
 // Only use in case tu_fifo_overflow() returned true!
 void tu_fifo_correct_read_pointer(tu_fifo_t* f)
 {
-  _ff_lock(f->mutex_rd);
+  _ff_lock(f, f->mutex_rd);
   _ff_correct_read_index(f, f->wr_idx);
-  _ff_unlock(f->mutex_rd);
+  _ff_unlock(f, f->mutex_rd);
 }
 
 /******************************************************************************/
@@ -692,16 +667,16 @@ void tu_fifo_correct_read_pointer(tu_fifo_t* f)
 /******************************************************************************/
 bool tu_fifo_read(tu_fifo_t* f, void * buffer)
 {
-  _ff_lock(f->mutex_rd);
+  _ff_lock(f, f->mutex_rd);
 
   // Peek the data
   // f->rd_idx might get modified in case of an overflow so we can not use a local variable
-  bool ret = _tu_fifo_peek(f, buffer, f->wr_idx, f->rd_idx);
+  bool ret = _tu_fifo_peek(f, buffer, _ff_idx_load(&f->wr_idx), f->rd_idx);
 
   // Advance pointer
-  f->rd_idx = advance_index(f->depth, f->rd_idx, ret);
+  _ff_idx_store(&f->rd_idx, advance_index(f->depth, f->rd_idx, ret));
 
-  _ff_unlock(f->mutex_rd);
+  _ff_unlock(f, f->mutex_rd);
   return ret;
 }
 
@@ -746,9 +721,9 @@ uint16_t tu_fifo_read_n_const_addr_full_words(tu_fifo_t* f, void * buffer, uint1
 /******************************************************************************/
 bool tu_fifo_peek(tu_fifo_t* f, void * p_buffer)
 {
-  _ff_lock(f->mutex_rd);
-  bool ret = _tu_fifo_peek(f, p_buffer, f->wr_idx, f->rd_idx);
-  _ff_unlock(f->mutex_rd);
+  _ff_lock(f, f->mutex_rd);
+  bool ret = _tu_fifo_peek(f, p_buffer, _ff_idx_load(&f->wr_idx), f->rd_idx);
+  _ff_unlock(f, f->mutex_rd);
   return ret;
 }
 
@@ -769,9 +744,9 @@ bool tu_fifo_peek(tu_fifo_t* f, void * p_buffer)
 /******************************************************************************/
 uint16_t tu_fifo_peek_n(tu_fifo_t* f, void * p_buffer, uint16_t n)
 {
-  _ff_lock(f->mutex_rd);
-  uint16_t ret = _tu_fifo_peek_n(f, p_buffer, n, f->wr_idx, f->rd_idx, TU_FIFO_COPY_INC);
-  _ff_unlock(f->mutex_rd);
+  _ff_lock(f, f->mutex_rd);
+  uint16_t ret = _tu_fifo_peek_n(f, p_buffer, n, _ff_idx_load(&f->wr_idx), f->rd_idx, TU_FIFO_COPY_INC);
+  _ff_unlock(f, f->mutex_rd);
   return ret;
 }
 
@@ -793,12 +768,12 @@ uint16_t tu_fifo_peek_n(tu_fifo_t* f, void * p_buffer, uint16_t n)
 /******************************************************************************/
 bool tu_fifo_write(tu_fifo_t* f, const void * data)
 {
-  _ff_lock(f->mutex_wr);
+  _ff_lock(f, f->mutex_wr);
 
   bool ret;
   uint16_t const wr_idx = f->wr_idx;
 
-  if ( tu_fifo_full(f) && !f->overwritable )
+  if ( _ff_count(f->depth, wr_idx, _ff_idx_load(&f->rd_idx)) >= f->depth && !f->overwritable )
   {
     ret = false;
   }else
@@ -809,12 +784,12 @@ bool tu_fifo_write(tu_fifo_t* f, const void * data)
     _ff_push(f, data, wr_ptr);
 
     // Advance pointer
-    f->wr_idx = advance_index(f->depth, wr_idx, 1);
+    _ff_idx_store(&f->wr_idx, advance_index(f->depth, wr_idx, 1));
 
     ret = true;
   }
 
-  _ff_unlock(f->mutex_wr);
+  _ff_unlock(f, f->mutex_wr);
 
   return ret;
 }
@@ -868,14 +843,14 @@ uint16_t tu_fifo_write_n_const_addr_full_words(tu_fifo_t* f, const void * data,
 /******************************************************************************/
 bool tu_fifo_clear(tu_fifo_t *f)
 {
-  _ff_lock(f->mutex_wr);
-  _ff_lock(f->mutex_rd);
+  _ff_lock(f, f->mutex_wr);
+  _ff_lock(f, f->mutex_rd);
 
   f->rd_idx = 0;
   f->wr_idx = 0;
 
-  _ff_unlock(f->mutex_wr);
-  _ff_unlock(f->mutex_rd);
+  _ff_unlock(f, f->mutex_wr);
+  _ff_unlock(f, f->mutex_rd);
   return true;
 }
 
@@ -891,13 +866,13 @@ bool tu_fifo_clear(tu_fifo_t *f)
 /******************************************************************************/
 bool tu_fifo_set_overwritable(tu_fifo_t *f, bool overwritable)
 {
-  _ff_lock(f->mutex_wr);
-  _ff_lock(f->mutex_rd);
+  _ff_lock(f, f->mutex_wr);
+  _ff_lock(f, f->mutex_rd);
 
   f->overwritable = overwritable;
 
-  _ff_unlock(f->mutex_wr);
-  _ff_unlock(f->mutex_rd);
+  _ff_unlock(f, f->mutex_wr);
+  _ff_unlock(f, f->mutex_rd);
 
   return true;
 }
@@ -920,7 +895,7 @@ bool tu_fifo_set_overwritable(tu_fifo_t *f, bool overwritable)
 /******************************************************************************/
 void tu_fifo_advance_write_pointer(tu_fifo_t *f, uint16_t n)
 {
-  f->wr_idx = advance_index(f->depth, f->wr_idx, n);
+  _ff_idx_store(&f->wr_idx, advance_index(f->depth, f->wr_idx, n));
 }
 
 /******************************************************************************/
@@ -941,7 +916,7 @@ void tu_fifo_advance_write_pointer(tu_fifo_t *f, uint16_t n)
 /******************************************************************************/
 void tu_fifo_advance_read_pointer(tu_fifo_t *f, uint16_t n)
 {
-  f->rd_idx = advance_index(f->depth, f->rd_idx, n);
+  _ff_idx_store(&f->rd_idx, advance_index(f->depth, f->rd_idx, n));
 }
 
 /******************************************************************************/
@@ -962,7 +937,7 @@ void tu_fifo_advance_read_pointer(tu_fifo_t *f, uint16_t n)
 void tu_fifo_get_read_info(tu_fifo_t *f, tu_fifo_buffer_info_t *info)
 {
   // Operate on temporary values in case they change in between
-  uint16_t wr_idx = f->wr_idx;
+  uint16_t wr_idx = _ff_idx_load(&f->wr_idx);
   uint16_t rd_idx = f->rd_idx;
 
   uint16_t cnt = _ff_count(f->depth, wr_idx, rd_idx);
@@ -970,9 +945,9 @@ void tu_fifo_get_read_info(tu_fifo_t *f, tu_fifo_buffer_info_t *info)
   // Check overflow and correct if required - may happen in case a DMA wrote too fast
   if (cnt > f->depth)
   {
-    _ff_lock(f->mutex_rd);
+    _ff_lock(f, f->mutex_rd);
     rd_idx = _ff_correct_read_index(f, wr_idx);
-    _ff_unlock(f->mutex_rd);
+    _ff_unlock(f, f->mutex_rd);
 
     cnt = f->depth;
   }
@@ -1030,7 +1005,7 @@ void tu_fifo_get_read_info(tu_fifo_t *f, tu_fifo_buffer_info_t *info)
 void tu_fifo_get_write_info(tu_fifo_t *f, tu_fifo_buffer_info_t *info)
 {
   uint16_t wr_idx = f->wr_idx;
-  uint16_t rd_idx = f->rd_idx;
+  uint16_t rd_idx = _ff_idx_load(&f->rd_idx);
   uint16_t remain = _ff_remaining(f->depth, wr_idx, rd_idx);
 
   if (remain == 0)
@@ -40,6 +40,11 @@ extern "C" {
 // Also, this FIFO is ready to be used in combination with a DMA as the write and
 // read pointers can be updated from within a DMA ISR. Overflows are detectable
 // within a certain number (see tu_fifo_overflow()).
+// The side that moves an index publishes it with release semantics and the other
+// side loads it with acquire semantics, so the data is in the buffer before the
+// index that covers it can be seen on another core. With an RTOS the mutexes then
+// only serialize several writers (readers) among themselves: a FIFO with exactly one
+// writer and one reader can skip them, see tu_fifo_config_spsc().
 
 #include "common/tusb_common.h"
 #include "osal/osal.h"
@@ -120,6 +125,7 @@ typedef struct
 #if OSAL_MUTEX_REQUIRED
   osal_mutex_t mutex_wr;
   osal_mutex_t mutex_rd;
+  bool spsc                ; // single producer, single consumer: mutexes are not taken
 #endif
 
 } tu_fifo_t;
@@ -157,9 +163,19 @@ void tu_fifo_config_mutex(tu_fifo_t *f, osal_mutex_t wr_mutex, osal_mutex_t rd_m
   f->mutex_rd = rd_mutex;
 }
 
+// Single producer, single consumer mode: exactly one thread (or ISR) ever writes and one
+// ever reads, so neither side takes its mutex. tu_fifo_clear(), tu_fifo_set_overwritable()
+// and tu_fifo_config() must then only be called while the other side is idle.
+TU_ATTR_ALWAYS_INLINE static inline
+void tu_fifo_config_spsc(tu_fifo_t *f, bool spsc)
+{
+  f->spsc = spsc;
+}
+
 #else
 
 #define tu_fifo_config_mutex(_f, _wr_mutex, _rd_mutex)
+#define tu_fifo_config_spsc(_f, _spsc)
 
 #endif
 
@@ -0,0 +1,140 @@
+/*
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2019 William D. Jones
+ * Copyright (c) 2019 Ha Thach (tinyusb.org)
+ * Copyright (c) 2020 Jan Duempelmann
+ * Copyright (c) 2020 Reinhard Panhuber
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ * This file is part of the TinyUSB stack.
+ */
+
+#ifndef _TUSB_HWFIFO_H_
+#define _TUSB_HWFIFO_H_
+
+#include <stdint.h>
+#include "common/tusb_common.h"
+
+#ifdef __cplusplus
+ extern "C" {
+#endif
+
+// Copies between a linear buffer and the data port of a hardware FIFO, a 32 bit register
+// that every word of a packet is read from or written to (e.g. the endpoint FIFOs of the
+// DWC2). Used by the DWC2 driver for every packet of a linear buffer transfer, in its
+// interrupt handler, and by tu_fifo for transfers with a constant address.
+//
+// tu_unaligned_read32/write32 are packed accesses, which compile to byte loads and stores
+// on cores without unaligned access (e.g. Xtensa): a word aligned buffer, the usual case
+// with CFG_TUSB_MEM_ALIGN, takes plain word accesses, four per loop.
+
+// Read len bytes from a FIFO port into a buffer
+TU_ATTR_ALWAYS_INLINE static inline void tu_hwfifo_read(volatile const uint32_t * rx_fifo, uint8_t * dst, uint16_t len)
+{
+  // Reading full available 32 bit words from fifo
+  uint16_t full_words = len >> 2;
+
+  if ( ((uintptr_t) dst & 0x03) == 0 )
+  {
+    uint32_t * dst32 = (uint32_t *) dst;
+
+    while(full_words >= 4)
+    {
+      dst32[0] = *rx_fifo;
+      dst32[1] = *rx_fifo;
+      dst32[2] = *rx_fifo;
+      dst32[3] = *rx_fifo;
+      dst32 += 4;
+      full_words -= 4;
+    }
+    while(full_words--) *dst32++ = *rx_fifo;
+
+    dst = (uint8_t *) dst32;
+  }
+  else
+  {
+    while(full_words--)
+    {
+      tu_unaligned_write32(dst, *rx_fifo);
+      dst += 4;
+    }
+  }
+
+  // Read the remaining 1-3 bytes from fifo
+  uint8_t const bytes_rem = len & 0x03;
+  if ( bytes_rem != 0 )
+  {
+    uint32_t const tmp = *rx_fifo;
+    dst[0] = tu_u32_byte0(tmp);
+    if ( bytes_rem > 1 ) dst[1] = tu_u32_byte1(tmp);
+    if ( bytes_rem > 2 ) dst[2] = tu_u32_byte2(tmp);
+  }
+}
+
+// Write len bytes from a buffer to a FIFO port
+TU_ATTR_ALWAYS_INLINE static inline void tu_hwfifo_write(volatile uint32_t * tx_fifo, uint8_t const * src, uint16_t len)
+{
+  // Pushing full available 32 bit words to fifo
+  uint16_t full_words = len >> 2;
+
+  if ( ((uintptr_t) src & 0x03) == 0 )
+  {
+    uint32_t const * src32 = (uint32_t const *) src;
+
+    while(full_words >= 4)
+    {
+      *tx_fifo = src32[0];
+      *tx_fifo = src32[1];
+      *tx_fifo = src32[2];
+      *tx_fifo = src32[3];
+      src32 += 4;
+      full_words -= 4;
+    }
+    while(full_words--) *tx_fifo = *src32++;
+
+    src = (uint8_t const *) src32;
+  }
+  else
+  {
+    while(full_words--)
+    {
+      *tx_fifo = tu_unaligned_read32(src);
+      src += 4;
+    }
+  }
+
+  // Write the remaining 1-3 bytes into fifo
+  uint8_t const bytes_rem = len & 0x03;
+  if ( bytes_rem )
+  {
+    uint32_t tmp_word = src[0];
+    if ( bytes_rem > 1 ) tmp_word |= (src[1] << 8);
+    if ( bytes_rem > 2 ) tmp_word |= (src[2] << 16);
+
+    *tx_fifo = tmp_word;
+  }
+}
+
+#ifdef __cplusplus
+ }
+#endif
+
+#endif /* _TUSB_HWFIFO_H_ */
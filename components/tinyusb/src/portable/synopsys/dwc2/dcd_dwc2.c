@@ -33,6 +33,7 @@
 
 #include "device/dcd.h"
 #include "dwc2_type.h"
+#include "common/tusb_hwfifo.h"
 
 // Following symbols must be defined by port header
 // - _dwc2_controller[]: array of controllers
@@ -79,6 +80,16 @@
 #define dcache_clean_invalidate(_addr, _size)
 #endif
 
+// Profiling scopes in the interrupt handler, e.g. to count CPU cycles; the application
+// can define them in tusb_config.h. _name is ISR (all of dcd_int_handler()), RX_PACKET
+// or TX_PACKET (a linear buffer packet out of or into the FIFO).
+#ifndef TU_DWC2_PROFILE_BEGIN
+  #define TU_DWC2_PROFILE_BEGIN(_name)
+#endif
+#ifndef TU_DWC2_PROFILE_END
+  #define TU_DWC2_PROFILE_END(_name)
+#endif
+
 static TU_ATTR_ALIGNED(4) uint32_t _setup_packet[2];
 
 typedef struct {
@@ -998,56 +1009,21 @@ void dcd_edpt_clear_stall (uint8_t rhport, uint8_t ep_addr)
 // Read a single data packet from receive FIFO
 static void read_fifo_packet(uint8_t rhport, uint8_t * dst, uint16_t len)
 {
-  (void) rhport;
-
   dwc2_regs_t * dwc2 = DWC2_REG(rhport);
-  volatile const uint32_t * rx_fifo = dwc2->fifo[0];
 
-  // Reading full available 32 bit words from fifo
-  uint16_t full_words = len >> 2;
-  while(full_words--)
-  {
-    tu_unaligned_write32(dst, *rx_fifo);
-    dst += 4;
-  }
-
-  // Read the remaining 1-3 bytes from fifo
-  uint8_t const bytes_rem = len & 0x03;
-  if ( bytes_rem != 0 )
-  {
-    uint32_t const tmp = *rx_fifo;
-    dst[0] = tu_u32_byte0(tmp);
-    if ( bytes_rem > 1 ) dst[1] = tu_u32_byte1(tmp);
-    if ( bytes_rem > 2 ) dst[2] = tu_u32_byte2(tmp);
-  }
+  TU_DWC2_PROFILE_BEGIN(RX_PACKET);
+  tu_hwfifo_read(dwc2->fifo[0], dst, len);
+  TU_DWC2_PROFILE_END(RX_PACKET);
 }
 
 // Write a single data packet to EPIN FIFO
 static void write_fifo_packet(uint8_t rhport, uint8_t fifo_num, uint8_t const * src, uint16_t len)
 {
-  (void) rhport;
-
   dwc2_regs_t * dwc2 = DWC2_REG(rhport);
-  volatile uint32_t * tx_fifo = dwc2->fifo[fifo_num];
-
-  // Pushing full available 32 bit words to fifo
-  uint16_t full_words = len >> 2;
-  while(full_words--)
-  {
-    *tx_fifo = tu_unaligned_read32(src);
-    src += 4;
-  }
 
-  // Write the remaining 1-3 bytes into fifo
-  uint8_t const bytes_rem = len & 0x03;
-  if ( bytes_rem )
-  {
-    uint32_t tmp_word = src[0];
-    if ( bytes_rem > 1 ) tmp_word |= (src[1] << 8);
-    if ( bytes_rem > 2 ) tmp_word |= (src[2] << 16);
-
-    *tx_fifo = tmp_word;
-  }
+  TU_DWC2_PROFILE_BEGIN(TX_PACKET);
+  tu_hwfifo_write(dwc2->fifo[fifo_num], src, len);
+  TU_DWC2_PROFILE_END(TX_PACKET);
 }
 
 static void handle_rxflvl_irq(uint8_t rhport)
@@ -1290,6 +1266,8 @@ static void handle_epin_irq (uint8_t rhport)
 
 void dcd_int_handler(uint8_t rhport)
 {
+  TU_DWC2_PROFILE_BEGIN(ISR);
+
   dwc2_regs_t *dwc2 = DWC2_REG(rhport);
 
   uint32_t const int_mask = dwc2->gintmsk;
@@ -1423,6 +1401,8 @@ void dcd_int_handler(uint8_t rhport)
   //    printf("      IISOIXFR!\r\n");
   ////    TU_LOG(DWC2_DEBUG, "      IISOIXFR!\r\n");
   //  }
+
+  TU_DWC2_PROFILE_END(ISR);
 }
 
 #endif
@@ -0,0 +1,226 @@
+/*
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2019 Ha Thach (tinyusb.org)
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ * This file is part of the TinyUSB stack.
+ */
+
+/*
+ * Throughput of tu_fifo_write_n() / tu_fifo_read_n() and their const address variants
+ * at the sizes of audio packets, for a byte FIFO as the audio class uses them:
+ *
+ *   aligned    FIFO position and app buffer word aligned, no wrap
+ *   unaligned  the app buffer one byte off a word
+ *   wrap       the copy wraps half way through, on a word boundary
+ *   wrap_odd   the copy wraps one byte past a word boundary
+ *
+ * The const address rows read (write) every word from (to) one address, as the DWC2
+ * and other drivers do with their hardware FIFOs. Each copy is checked against the
+ * data before it is timed. Not a unit test: it has no Unity runner.
+ *
+ *   bench_fifo [-q]      -q: fewer iterations, for ctest
+ *
+ * Time is ns per call and, on x86, TSC cycles per call; the best of a few runs.
+ */
+
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "osal/osal.h"
+#include "tusb_fifo.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#define HAVE_TSC 1
+static inline uint64_t cycles(void) { return __rdtsc(); }
+#else
+#define HAVE_TSC 0
+static inline uint64_t cycles(void) { return 0; }
+#endif
+
+#define FIFO_SIZE   1024
+#define MAX_LEN     384
+#define ROUNDS      10
+
+static uint64_t now_ns(void)
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t) ts.tv_sec * 1000000000u + (uint64_t) ts.tv_nsec;
+}
+
+static uint32_t ff_buf[FIFO_SIZE / 4];
+static tu_fifo_t ff;
+
+static uint32_t app_src[MAX_LEN / 4 + 2];
+static uint32_t app_dst[MAX_LEN / 4 + 2];
+static volatile uint32_t fifo_reg;
+
+typedef enum { CASE_ALIGNED, CASE_UNALIGNED, CASE_WRAP, CASE_WRAP_ODD, CASE_COUNT } bench_case_t;
+static const char * const case_names[CASE_COUNT] = { "aligned", "unaligned", "wrap", "wrap_odd" };
+
+// FIFO position and app buffer offset of a case
+static uint16_t case_pos(bench_case_t c, uint16_t len)
+{
+  switch (c)
+  {
+    case CASE_WRAP:     return (uint16_t) (FIFO_SIZE - (len / 2 & ~3u));
+    case CASE_WRAP_ODD: return (uint16_t) (FIFO_SIZE - (len / 2 & ~3u) - 1);
+    default:            return 256;
+  }
+}
+
+static unsigned case_ofs(bench_case_t c)
+{
+  return c == CASE_UNALIGNED ? 1 : 0;
+}
+
+static void set_idx(uint16_t wr, uint16_t rd)
+{
+  ff.wr_idx = wr;
+  ff.rd_idx = rd;
+}
+
+// One copy in and out, checked byte for byte
+static int check_case(bench_case_t c, uint16_t len)
+{
+  uint16_t const pos = case_pos(c, len);
+  uint8_t * src = (uint8_t *) app_src + case_ofs(c);
+  uint8_t * dst = (uint8_t *) app_dst + case_ofs(c);
+
+  for (uint16_t i = 0; i < len; i++) src[i] = (uint8_t) (i * 7 + len);
+  memset(app_dst, 0, sizeof(app_dst));
+
+  set_idx(pos, pos);
+  if (tu_fifo_write_n(&ff, src, len) != len) return 1;
+  if (tu_fifo_read_n(&ff, dst, len) != len) return 1;
+  if (memcmp(src, dst, len)) return 1;
+
+  // const address: the same word every time, the last one padded
+  if (c != CASE_UNALIGNED)
+  {
+    fifo_reg = 0x04030201;
+    set_idx(pos, pos);
+    tu_fifo_write_n_const_addr_full_words(&ff, (const void *) &fifo_reg, len);
+    tu_fifo_read_n(&ff, dst, len);
+    for (uint16_t i = 0; i < len; i++)
+    {
+      if (dst[i] != (uint8_t) (1 + (i & 3))) return 1;
+    }
+  }
+  return 0;
+}
+
+typedef enum { OP_WRITE, OP_READ, OP_WRITE_CONST, OP_READ_CONST, OP_COUNT } bench_op_t;
+static const char * const op_names[OP_COUNT] = { "write_n", "read_n", "write_n_const", "read_n_const" };
+
+static void time_op(bench_op_t op, bench_case_t c, uint16_t len, uint32_t iterations, double * ns, double * cyc)
+{
+  uint16_t const pos = case_pos(c, len);
+  uint16_t const end = (uint16_t) (pos + len);
+  uint8_t * src = (uint8_t *) app_src + case_ofs(c);
+  uint8_t * dst = (uint8_t *) app_dst + case_ofs(c);
+  uint32_t const n = iterations / ROUNDS;
+
+  *ns = *cyc = 1e30;
+  for (int r = 0; r < ROUNDS; r++)
+  {
+    uint64_t t0 = now_ns();
+    uint64_t c0 = cycles();
+    for (uint32_t it = 0; it < n; it++)
+    {
+      switch (op)
+      {
+        case OP_WRITE:       set_idx(pos, pos); tu_fifo_write_n(&ff, src, len); break;
+        case OP_READ:        set_idx(end, pos); tu_fifo_read_n(&ff, dst, len); break;
+        case OP_WRITE_CONST: set_idx(pos, pos); tu_fifo_write_n_const_addr_full_words(&ff, (const void *) &fifo_reg, len); break;
+        case OP_READ_CONST:  set_idx(end, pos); tu_fifo_read_n_const_addr_full_words(&ff, (void *) &fifo_reg, len); break;
+        default: break;
+      }
+      __asm__ volatile("" ::: "memory");
+    }
+    uint64_t c1 = cycles();
+    uint64_t t1 = now_ns();
+
+    if ((double) (t1 - t0) / n < *ns) *ns = (double) (t1 - t0) / n;
+    if ((double) (c1 - c0) / n < *cyc) *cyc = (double) (c1 - c0) / n;
+  }
+}
+
+int main(int argc, char ** argv)
+{
+  static const uint16_t lens[] = { 96, 192, 288, 384 };
+  uint32_t iterations = 1000000;
+  int opt;
+
+  while ((opt = getopt(argc, argv, "q")) != -1)
+  {
+    if (opt == 'q')
+    {
+      iterations = 10000;
+    }
+    else
+    {
+      fprintf(stderr, "usage: %s [-q]\n", argv[0]);
+      return 2;
+    }
+  }
+
+  tu_fifo_config(&ff, ff_buf, FIFO_SIZE, 1, false);
+
+  for (int c = 0; c < CASE_COUNT; c++)
+  {
+    for (unsigned l = 0; l < sizeof(lens) / sizeof(lens[0]); l++)
+    {
+      if (check_case((bench_case_t) c, lens[l]))
+      {
+        printf("FAIL: %s, %u bytes: read back differs\n", case_names[c], lens[l]);
+        return 1;
+      }
+    }
+  }
+  printf("tu_fifo: every case reads back what was written\n\n");
+
+  printf("%-14s %-10s %6s %9s %9s", "op", "case", "bytes", "ns", "MB/s");
+  if (HAVE_TSC) printf(" %9s", "cycles");
+  printf("\n");
+  for (int op = 0; op < OP_COUNT; op++)
+  {
+    for (int c = 0; c < CASE_COUNT; c++)
+    {
+      // a register has no alignment to be off
+      if (op >= OP_WRITE_CONST && c == CASE_UNALIGNED) continue;
+      for (unsigned l = 0; l < sizeof(lens) / sizeof(lens[0]); l++)
+      {
+        double ns, cyc;
+        time_op((bench_op_t) op, (bench_case_t) c, lens[l], iterations, &ns, &cyc);
+        printf("%-14s %-10s %6u %9.1f %9.0f", op_names[op], case_names[c], lens[l], ns, lens[l] * 1000.0 / ns);
+        if (HAVE_TSC) printf(" %9.1f", cyc);
+        printf("\n");
+      }
+    }
+  }
+  return 0;
+}
@@ -0,0 +1,162 @@
+/*
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2020 Ha Thach (tinyusb.org)
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ * This file is part of the TinyUSB stack.
+ */
+
+#include <string.h>
+#include "unity.h"
+
+// Files to test
+#include "class/audio/audio_interleave.h"
+
+//--------------------------------------------------------------------+
+// MACRO TYPEDEF CONSTANT ENUM DECLARATION
+//--------------------------------------------------------------------+
+
+// A 1 ms packet of 48 kHz stereo at 4 bytes, with room for the offsets and the guard bytes
+#define BUF_SIZE    512
+#define GUARD       0xA5
+
+// word aligned, so that an offset into them sets the alignment
+static uint32_t stream_buf[BUF_SIZE / 4];
+static uint32_t ff_buf[BUF_SIZE / 4];
+static uint8_t ref_buf[BUF_SIZE];
+
+void setUp(void)
+{
+  for(int i=0; i<BUF_SIZE; i++) ((uint8_t *) stream_buf)[i] = (uint8_t) (i * 7 + 3);
+  memset(ff_buf, GUARD, sizeof(ff_buf));
+  memset(ref_buf, GUARD, sizeof(ref_buf));
+}
+
+void tearDown(void)
+{
+}
+
+// The memcpy loops the helpers are an optimized version of
+static uint8_t * ref_decode(uint16_t n_bytes, uint8_t * dst, uint8_t * dst_end, uint8_t * src, uint8_t n_ff_used)
+{
+  while(dst < dst_end)
+  {
+    memcpy(dst, src, n_bytes);
+    dst += n_bytes;
+    src += n_bytes * n_ff_used;
+  }
+  return src;
+}
+
+static uint8_t * ref_encode(uint16_t n_bytes, uint8_t * src, uint8_t * src_end, uint8_t * dst, uint8_t n_ff_used)
+{
+  while(src < src_end)
+  {
+    memcpy(dst, src, n_bytes);
+    src += n_bytes;
+    dst += n_bytes * n_ff_used;
+  }
+  return dst;
+}
+
+// Every sample size and FIFO count, with the stream and the FIFO on each byte offset of a
+// word and packets of 0 up to 13 samples: odd counts leave a tail to the 2 x 16 bit path
+static void check_decode(uint8_t n_ff_used, uint16_t n_bytes, uint8_t ff_ofs, uint8_t stream_ofs, uint16_t n_samples)
+{
+  uint8_t * src = (uint8_t *) stream_buf + stream_ofs;
+  uint8_t * dst = (uint8_t *) ff_buf + ff_ofs;
+  uint16_t const len = n_samples * n_bytes;
+
+  setUp();
+  uint8_t * ref_end = ref_decode(n_bytes, ref_buf + ff_ofs, ref_buf + ff_ofs + len, src, n_ff_used);
+  uint8_t * end = audiod_interleaved_copy_bytes_fast_decode(n_bytes, dst, dst + len, src, n_ff_used);
+
+  TEST_ASSERT_EQUAL_PTR(ref_end, end);
+  TEST_ASSERT_EQUAL_MEMORY(ref_buf, ff_buf, BUF_SIZE);
+}
+
+static void check_encode(uint8_t n_ff_used, uint16_t n_bytes, uint8_t ff_ofs, uint8_t stream_ofs, uint16_t n_samples)
+{
+  uint8_t * src = (uint8_t *) stream_buf + ff_ofs;
+  uint8_t * dst = (uint8_t *) ff_buf + stream_ofs;
+  uint16_t const len = n_samples * n_bytes;
+
+  setUp();
+  uint8_t * ref_end = ref_encode(n_bytes, src, src + len, ref_buf + stream_ofs, n_ff_used);
+  uint8_t * end = audiod_interleaved_copy_bytes_fast_encode(n_bytes, src, src + len, dst, n_ff_used);
+
+  TEST_ASSERT_EQUAL_PTR(ref_end - ref_buf, end - (uint8_t *) ff_buf);
+  TEST_ASSERT_EQUAL_MEMORY(ref_buf, ff_buf, BUF_SIZE);
+}
+
+//--------------------------------------------------------------------+
+// Tests
+//--------------------------------------------------------------------+
+void test_decode_matches_reference(void)
+{
+  for(uint8_t n_ff = 1; n_ff <= 3; n_ff++)
+    for(uint16_t n_bytes = 1; n_bytes <= 4; n_bytes++)
+      for(uint8_t ff_ofs = 0; ff_ofs < 4; ff_ofs++)
+        for(uint8_t stream_ofs = 0; stream_ofs < 4; stream_ofs++)
+          for(uint16_t n = 0; n <= 13; n++)
+            check_decode(n_ff, n_bytes, ff_ofs, stream_ofs, n);
+}
+
+void test_encode_matches_reference(void)
+{
+  for(uint8_t n_ff = 1; n_ff <= 3; n_ff++)
+    for(uint16_t n_bytes = 1; n_bytes <= 4; n_bytes++)
+      for(uint8_t ff_ofs = 0; ff_ofs < 4; ff_ofs++)
+        for(uint8_t stream_ofs = 0; stream_ofs < 4; stream_ofs++)
+          for(uint16_t n = 0; n <= 13; n++)
+            check_encode(n_ff, n_bytes, ff_ofs, stream_ofs, n);
+}
+
+// A full packet of each fast path, aligned: 48 samples per channel
+void test_decode_stereo_packet(void)
+{
+  check_decode(2, 2, 0, 0, 48);
+  check_decode(2, 4, 0, 0, 48);
+
+  // the left channel of the 2 x 16 bit stream lands in the FIFO in order
+  uint16_t const * stream = (uint16_t const *) stream_buf;
+  uint16_t const * ff = (uint16_t const *) ff_buf;
+  setUp();
+  audiod_interleaved_copy_bytes_fast_decode(2, ff_buf, (uint8_t *) ff_buf + 96, (uint8_t *) stream_buf, 2);
+  for(int i=0; i<48; i++) TEST_ASSERT_EQUAL_HEX16(stream[2 * i], ff[i]);
+}
+
+void test_encode_stereo_packet(void)
+{
+  check_encode(2, 2, 0, 0, 48);
+  check_encode(2, 4, 0, 0, 48);
+
+  // the right channel is written into every other sample and leaves the left alone
+  uint16_t const * ff = (uint16_t const *) stream_buf;
+  uint16_t const * stream = (uint16_t const *) ff_buf;
+  setUp();
+  audiod_interleaved_copy_bytes_fast_encode(2, (uint8_t *) stream_buf, (uint8_t *) stream_buf + 96, (uint8_t *) ff_buf + 2, 2);
+  for(int i=0; i<48; i++)
+  {
+    TEST_ASSERT_EQUAL_HEX16(0xA5A5, stream[2 * i]);
+    TEST_ASSERT_EQUAL_HEX16(ff[i], stream[2 * i + 1]);
+  }
+}
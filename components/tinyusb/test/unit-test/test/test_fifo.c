@@ -31,9 +31,14 @@
 #include "tusb_fifo.h"
 
 #define FIFO_SIZE   64
-uint8_t tu_ff_buf[FIFO_SIZE * sizeof(uint8_t)];
+TU_ATTR_ALIGNED(4) uint8_t tu_ff_buf[FIFO_SIZE * sizeof(uint8_t)];
 tu_fifo_t tu_ff = TU_FIFO_INIT(tu_ff_buf, FIFO_SIZE, uint8_t, false);
 
+// The same a byte off a word, for the const address copies: positions that are word aligned
+// in tu_ff are not here, and position 3 is
+TU_ATTR_ALIGNED(4) uint8_t tu_ff_off_buf[FIFO_SIZE + 4];
+tu_fifo_t tu_ff_off = TU_FIFO_INIT(tu_ff_off_buf + 1, FIFO_SIZE, uint8_t, false);
+
 tu_fifo_t* ff = &tu_ff;
 tu_fifo_buffer_info_t info;
 
@@ -376,3 +381,67 @@ void test_rd_idx_wrap()
   TEST_ASSERT_EQUAL(n, 2);
   TEST_ASSERT_EQUAL(ff10.rd_idx, 6);
 }
+
+// FIFO positions word aligned, off a word and wrapping (on and off a word) in tu_ff
+static uint16_t const const_addr_pos[] = { 0, 1, 2, 3, FIFO_SIZE-8, FIFO_SIZE-5 };
+
+static void write_n_const_addr(tu_fifo_t* f)
+{
+  uint32_t reg = 0x44332211;
+
+  for(uint8_t p=0; p < TU_ARRAY_SIZE(const_addr_pos); p++)
+  {
+    f->wr_idx = f->rd_idx = const_addr_pos[p];
+    memset(rd_buf, 0, sizeof(rd_buf));
+
+    TEST_ASSERT_EQUAL(23, tu_fifo_write_n_const_addr_full_words(f, &reg, 23));
+    TEST_ASSERT_EQUAL(23, tu_fifo_read_n(f, rd_buf, 23));
+
+    for(uint8_t i=0; i < 23; i++) TEST_ASSERT_EQUAL_HEX8(0x11 * ((i & 3) + 1), rd_buf[i]);
+  }
+}
+
+static void read_n_const_addr(tu_fifo_t* f)
+{
+  uint32_t reg;
+
+  for(uint8_t p=0; p < TU_ARRAY_SIZE(const_addr_pos); p++)
+  {
+    f->wr_idx = f->rd_idx = const_addr_pos[p];
+
+    // 20 bytes: the last word written to the address is test_data[16..19]
+    TEST_ASSERT_EQUAL(20, tu_fifo_write_n(f, test_data, 20));
+    TEST_ASSERT_EQUAL(20, tu_fifo_read_n_const_addr_full_words(f, &reg, 20));
+    TEST_ASSERT_EQUAL_HEX32(tu_unaligned_read32(test_data + 16), reg);
+    TEST_ASSERT_TRUE(tu_fifo_empty(f));
+
+    // 22 bytes: the last two are padded to a word
+    TEST_ASSERT_EQUAL(22, tu_fifo_write_n(f, test_data, 22));
+    TEST_ASSERT_EQUAL(22, tu_fifo_read_n_const_addr_full_words(f, &reg, 22));
+    TEST_ASSERT_EQUAL_HEX32(tu_u32(0, 0, test_data[21], test_data[20]), reg);
+  }
+}
+
+void test_write_n_const_addr(void)
+{
+  TEST_ASSERT_EQUAL(0, (uintptr_t) tu_ff.buffer & 0x03);
+  write_n_const_addr(&tu_ff);
+}
+
+void test_write_n_const_addr_misaligned(void)
+{
+  TEST_ASSERT_EQUAL(1, (uintptr_t) tu_ff_off.buffer & 0x03);
+  write_n_const_addr(&tu_ff_off);
+}
+
+void test_read_n_const_addr(void)
+{
+  TEST_ASSERT_EQUAL(0, (uintptr_t) tu_ff.buffer & 0x03);
+  read_n_const_addr(&tu_ff);
+}
+
+void test_read_n_const_addr_misaligned(void)
+{
+  TEST_ASSERT_EQUAL(1, (uintptr_t) tu_ff_off.buffer & 0x03);
+  read_n_const_addr(&tu_ff_off);
+}
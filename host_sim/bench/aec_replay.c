@@ -0,0 +1,250 @@
+/*
+ * Echo canceller (aec.c) replayed on recordings: the far end (speaker) and the
+ * mic go through aec_process() a 1 ms block at a time, as the capture task
+ * hands them over, and the result is written out. Reports the ERLE of every
+ * window and the CPU time per 1 ms block.
+ *
+ *   aec_replay [-q] [-c] [-m mu] [-w prefix] [ref.wav mic.wav [out.wav]]
+ *
+ * ref.wav is what went to the speaker (mono, or stereo mixed to mono), mic.wav
+ * the recording of the mic (mono or stereo), both 16 or 24 bit PCM at the same
+ * rate. Without files it makes up a test: 6 s of noise at 16 kHz played into a
+ * room of 20 ms reverberation 2.5 ms away from the mic, with a faint near end,
+ * and fails below 20 dB of ERLE at the end; -w writes that test as
+ * prefix_ref.wav and prefix_mic.wav, and the result as prefix_out.wav.
+ * -c fails below 20 dB on files too; -q: shorter test, for ctest.
+ *
+ * Time is host time; the multiply-adds per 1 ms block are what carries over to
+ * the ESP32-S3 (2 * AEC_TAPS per frame and channel).
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <math.h>
+#include <unistd.h>
+#include "aec.h"
+#include "sim.h"
+
+#define SYNTH_RATE      16000
+#define SYNTH_ECHO_MS   20
+#define SYNTH_DELAY     40          // frames from the speaker to the first reflection
+#define MIN_ERLE_DB     20.0
+
+typedef struct {
+    uint32_t rate;
+    uint32_t n_frames;
+    int32_t *frames;                // stereo 32bit slots
+} pcm_t;
+
+static uint32_t s_rand = 12345;
+
+static float rnd_uniform(void)
+{
+    s_rand = s_rand * 1664525u + 1013904223u;
+    return (float)(s_rand >> 8) / 8388608.0f - 1.0f;
+}
+
+static uint32_t rd32(const uint8_t *p) { return p[0] | p[1] << 8 | p[2] << 16 | (uint32_t)p[3] << 24; }
+static uint16_t rd16(const uint8_t *p) { return p[0] | p[1] << 8; }
+
+// Reads a 16 or 24 bit PCM wav into stereo 32bit slots, a mono file into both channels
+static int wav_read(const char *path, pcm_t *pcm)
+{
+    FILE *f = fopen(path, "rb");
+    uint8_t hdr[12], chunk[8], fmt[16] = { 0 };
+    uint16_t n_channels = 0, bits = 0;
+
+    if (!f) {
+        perror(path);
+        return 1;
+    }
+    if (fread(hdr, 1, 12, f) != 12 || memcmp(hdr, "RIFF", 4) || memcmp(hdr + 8, "WAVE", 4)) goto bad;
+    while (fread(chunk, 1, 8, f) == 8) {
+        uint32_t size = rd32(chunk + 4);
+        if (!memcmp(chunk, "fmt ", 4)) {
+            if (size < 16 || fread(fmt, 1, 16, f) != 16) goto bad;
+            fseek(f, size - 16 + (size & 1), SEEK_CUR);
+            n_channels = rd16(fmt + 2);
+            pcm->rate = rd32(fmt + 4);
+            bits = rd16(fmt + 14);
+        }
+        else if (!memcmp(chunk, "data", 4)) {
+            if (rd16(fmt) != 1 || (bits != 16 && bits != 24) || n_channels < 1 || n_channels > 2) goto bad;
+            uint32_t frame_bytes = n_channels * bits / 8;
+            uint8_t *data = malloc(size);
+            pcm->n_frames = (uint32_t)fread(data, 1, size, f) / frame_bytes;
+            pcm->frames = malloc(pcm->n_frames * 8 + 8);
+            for (uint32_t i = 0; i < pcm->n_frames; i++) {
+                for (int c = 0; c < 2; c++) {
+                    const uint8_t *p = data + i * frame_bytes + (c % n_channels) * bits / 8;
+                    pcm->frames[2 * i + c] = bits == 16 ? (int32_t)((uint32_t)rd16(p) << 16)
+                                                        : (int32_t)((uint32_t)(p[0] | p[1] << 8 | p[2] << 16) << 8);
+                }
+            }
+            free(data);
+            fclose(f);
+            return 0;
+        }
+        else {
+            fseek(f, size + (size & 1), SEEK_CUR);
+        }
+    }
+bad:
+    fprintf(stderr, "%s: not a 16 or 24 bit PCM wav file with 1 or 2 channels\n", path);
+    fclose(f);
+    return 1;
+}
+
+// Writes stereo slots as a 16 bit stereo wav
+static int wav_write(const char *path, const pcm_t *pcm)
+{
+    FILE *f = fopen(path, "wb");
+    if (!f) {
+        perror(path);
+        return 1;
+    }
+    uint32_t const data = pcm->n_frames * 4, riff = data + 36, byte_rate = pcm->rate * 4;
+    uint8_t header[44] = "RIFF\0\0\0\0WAVEfmt \x10\0\0\0\x01\0\x02\0";
+    memcpy(header + 4, &riff, 4);
+    memcpy(header + 24, &pcm->rate, 4);
+    memcpy(header + 28, &byte_rate, 4);
+    memcpy(header + 32, "\x04\0\x10\0data", 8);
+    memcpy(header + 40, &data, 4);
+    fwrite(header, sizeof(header), 1, f);
+    for (uint32_t i = 0; i < 2 * pcm->n_frames; i++) {
+        int16_t v = (int16_t)(pcm->frames[i] >> 16);
+        fwrite(&v, 2, 1, f);
+    }
+    fclose(f);
+    return 0;
+}
+
+static int32_t to_slot(float v)
+{
+    if (v > 0.99f) v = 0.99f;
+    if (v < -0.99f) v = -0.99f;
+    return (int32_t)lrintf(v * 2147483648.0f) & ~0xff;
+}
+
+// Noise at -12 dBFS through a room: a reflection every few frames from SYNTH_DELAY on,
+// decaying by 60 dB over SYNTH_ECHO_MS, plus the near end, noise at -60 dBFS
+static void synthesize(pcm_t *ref, pcm_t *mic, uint32_t seconds)
+{
+    uint32_t const n = SYNTH_RATE * seconds;
+    uint32_t const n_ir = SYNTH_DELAY + SYNTH_RATE * SYNTH_ECHO_MS / 1000;
+    float *h = calloc(n_ir, sizeof(float));
+    float *x = calloc(n, sizeof(float));
+
+    for (uint32_t k = SYNTH_DELAY; k < n_ir; k += 1 + (s_rand >> 29)) {
+        float t = (float)(k - SYNTH_DELAY) / (n_ir - SYNTH_DELAY);
+        h[k] = 0.5f * rnd_uniform() * powf(10.0f, -3.0f * t);
+    }
+    ref->rate = mic->rate = SYNTH_RATE;
+    ref->n_frames = mic->n_frames = n;
+    ref->frames = malloc(n * 8);
+    mic->frames = malloc(n * 8);
+    for (uint32_t i = 0; i < n; i++) {
+        x[i] = 0.25f * rnd_uniform() * 1.732f;
+        ref->frames[2 * i] = ref->frames[2 * i + 1] = to_slot(x[i]);
+    }
+    for (uint32_t i = 0; i < n; i++) {
+        float y = 0.0f;
+        for (uint32_t k = SYNTH_DELAY; k < n_ir && k <= i; k++) y += h[k] * x[i - k];
+        mic->frames[2 * i]     = to_slot(y + 0.001f * rnd_uniform());
+        mic->frames[2 * i + 1] = to_slot(0.5f * y + 0.001f * rnd_uniform());
+    }
+    free(h);
+    free(x);
+}
+
+int main(int argc, char **argv)
+{
+    float mu = AEC_MU;
+    bool quick = false;
+    bool check = false;
+    const char *prefix = NULL;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "qcm:w:")) != -1) {
+        switch (opt) {
+        case 'q': quick = true; break;
+        case 'c': check = true; break;
+        case 'm': mu = strtof(optarg, NULL); break;
+        case 'w': prefix = optarg; break;
+        default:
+            fprintf(stderr, "usage: %s [-q] [-c] [-m mu] [-w prefix] [ref.wav mic.wav [out.wav]]\n", argv[0]);
+            return 2;
+        }
+    }
+
+    pcm_t ref, mic;
+    bool const synthetic = optind >= argc;
+    if (synthetic) {
+        synthesize(&ref, &mic, quick ? 3 : 6);
+    }
+    else {
+        if (argc - optind < 2) {
+            fprintf(stderr, "%s: the reference and the mic recording\n", argv[0]);
+            return 2;
+        }
+        if (wav_read(argv[optind], &ref) || wav_read(argv[optind + 1], &mic)) return 2;
+        if (ref.rate != mic.rate) {
+            fprintf(stderr, "%s is %u Hz, %s %u Hz\n", argv[optind], ref.rate, argv[optind + 1], mic.rate);
+            return 2;
+        }
+    }
+    if (synthetic && prefix) {
+        char path[512];
+        snprintf(path, sizeof(path), "%s_ref.wav", prefix);
+        wav_write(path, &ref);
+        snprintf(path, sizeof(path), "%s_mic.wav", prefix);
+        wav_write(path, &mic);
+    }
+
+    static aec_t aec;
+    uint32_t const rate = mic.rate;
+    uint32_t const block = rate / 1000 < AEC_BLOCK_MAX ? rate / 1000 : AEC_BLOCK_MAX;
+    uint32_t const n_frames = mic.n_frames < ref.n_frames ? mic.n_frames : ref.n_frames;
+    float ref_mono[AEC_BLOCK_MAX];
+    uint64_t total_ns = 0, max_ns = 0, n_blocks = 0;
+    uint32_t windows = 0;
+
+    aec_init(&aec, rate, mu);
+    printf("%u Hz, %u taps (%.1f ms), mu %.2f, %u frames per block, %.0f multiply-adds per block\n",
+           rate, AEC_TAPS, AEC_TAPS * 1e3 / rate, mu, block, 2.0 * 2 * AEC_TAPS * block);
+    for (uint32_t i = 0; i + block <= n_frames; i += block) {
+        for (uint32_t j = 0; j < block; j++)
+            ref_mono[j] = ((ref.frames[2 * (i + j)] >> 1) + (ref.frames[2 * (i + j) + 1] >> 1)) / 2147483648.0f;
+        uint64_t t0 = sim_cpu_ns();
+        aec_process(&aec, ref_mono, mic.frames + 2 * i, block);
+        uint64_t ns = sim_cpu_ns() - t0;
+        total_ns += ns;
+        if (ns > max_ns) max_ns = ns;
+        n_blocks++;
+        if (aec.n_windows != windows) {
+            windows = aec.n_windows;
+            printf("  %6.2f s  ERLE %6.1f dB\n", (double)(i + block) / rate, aec.erle_db);
+        }
+    }
+    double const avg_ns = n_blocks ? (double)total_ns / n_blocks : 0.0;
+    printf("ERLE %.1f dB; %.0f ns per 1 ms block (max %llu), %.1f %% of the block on this host\n",
+           aec.erle_db, avg_ns, (unsigned long long)max_ns, avg_ns / 1e4);
+
+    const char *out_path = NULL;
+    char path[512];
+    if (!synthetic && argc - optind >= 3) out_path = argv[optind + 2];
+    if (synthetic && prefix) {
+        snprintf(path, sizeof(path), "%s_out.wav", prefix);
+        out_path = path;
+    }
+    if (out_path) {
+        mic.n_frames = (uint32_t)(n_blocks * block);
+        if (wav_write(out_path, &mic)) return 2;
+    }
+    if ((synthetic || check) && aec.erle_db < MIN_ERLE_DB) {
+        printf("FAIL: ERLE %.1f dB, expected at least %.1f\n", aec.erle_db, MIN_ERLE_DB);
+        return 1;
+    }
+    return 0;
+}
@@ -0,0 +1,27 @@
+/*
+ * Shared by the benchmarks: the TSC where there is one, for cycle counts next to the
+ * ns of sim_cpu_ns(), and a repeatable pseudo random sequence for their test data.
+ */
+#ifndef BENCH_COMMON_H
+#define BENCH_COMMON_H
+
+#include <stdint.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#define HAVE_TSC 1
+static inline uint64_t cycles(void) { return __rdtsc(); }
+#else
+#define HAVE_TSC 0
+static inline uint64_t cycles(void) { return 0; }
+#endif
+
+static uint32_t s_rand = 12345;
+
+static inline uint32_t rnd(void)
+{
+    s_rand = s_rand * 1664525u + 1013904223u;
+    return s_rand;
+}
+
+#endif
@@ -0,0 +1,267 @@
+/*
+ * Interleaved against per-channel (planar) processing of the audio path.
+ *
+ * tinyusb can split the streams into one support FIFO per channel
+ * (CFG_TUD_AUDIO_ENABLE_ENCODING/DECODING): audiod_decode_type_I_pcm()
+ * deinterleaves every OUT packet and audiod_encode_type_I_pcm() interleaves
+ * every IN packet, so the DSP stages could run on contiguous blocks of one
+ * channel. This times both ways for one 1 ms block at each sample rate:
+ *
+ *   mic  interleaved: dc_block_process() and mic_convert_gain() on the stereo
+ *        slots, as the capture task runs them;
+ *        planar: the slots split per channel, the same DC blocker and gain on
+ *        each contiguous channel, the 16 bit samples interleaved into the
+ *        packet the way the encoder does it.
+ *   spk  interleaved: spk_convert_gain() on the 16 bit stereo samples;
+ *        planar: split as the decoder does it, a per-channel gain, interleaved
+ *        again into the I2S slots.
+ *
+ * The planar kernels are the arithmetic of audio_dsp.c with a stride of one;
+ * both ways are checked bit for bit against each other first. The split and
+ * merge loops are the cheapest form of what the encoder and decoder do (they
+ * copy through tu_fifo, a sample at a time), so the planar times are a lower
+ * bound.
+ *
+ *   bench_deinterleave [-q]      -q: fewer iterations, for ctest
+ *
+ * Time is reported in ns per block and, on x86, in TSC cycles per block.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include "audio_dsp.h"
+#include "sim.h"
+#include "bench_common.h"
+
+#define MAX_FRAMES  48
+#define Q31_ONE     (1LL << 31)
+#define MAX_24      8388607
+#define MIN_24      -8388608
+
+// The DC blocker of audio_dsp.c on one contiguous channel
+static void dc_block_planar(dc_block_t *f, int ch, int32_t *p, uint32_t n_frames)
+{
+    const int64_t a = f->a;
+    int32_t x1 = f->x1[ch];
+    int32_t y1 = f->y1[ch];
+    int64_t err = f->err[ch];
+
+    for (uint32_t i = 0; i < n_frames; i++) {
+        int32_t x = p[i] >> 8;
+        int64_t acc = (int64_t)(x - x1) * Q31_ONE + a * y1 + err;
+        int32_t y;
+        if (acc >= ((int64_t)MAX_24 + 1) * Q31_ONE) {
+            y = MAX_24;
+            err = 0;
+        }
+        else if (acc < (int64_t)MIN_24 * Q31_ONE) {
+            y = MIN_24;
+            err = 0;
+        }
+        else {
+            y = (int32_t)(acc >> 31);
+            err = acc - (int64_t)y * Q31_ONE;
+        }
+        p[i] = (int32_t)((uint32_t)y << 8);
+        x1 = x;
+        y1 = y;
+    }
+    f->x1[ch]  = x1;
+    f->y1[ch]  = y1;
+    f->err[ch] = err;
+}
+
+// mic_convert_gain() on one contiguous channel
+static void mic_gain_planar(const int32_t *src, int16_t *dst, uint32_t n, int32_t gain)
+{
+    for (uint32_t i = 0; i < n; i++) {
+        int64_t t = ((int64_t)(src[i] & (int32_t)0xffffff00) * gain) >> 40;
+        dst[i] = t > 32767 ? 32767 : t < -32768 ? -32768 : (int16_t)t;
+    }
+}
+
+static void spk_gain_planar(const int16_t *src, int32_t *dst, uint32_t n, int32_t gain)
+{
+    for (uint32_t i = 0; i < n; i++) {
+        int64_t t = ((int64_t)src[i] * gain) >> 8;
+        dst[i] = t > INT32_MAX ? INT32_MAX : t < INT32_MIN ? INT32_MIN : (int32_t)t;
+    }
+}
+
+typedef struct {
+    dc_block_t dc;
+    int32_t    gain[2];
+    int32_t    slots[2 * MAX_FRAMES];       // I2S, interleaved
+    int32_t    ch32[2][MAX_FRAMES];         // per channel
+    int16_t    ch16[2][MAX_FRAMES];
+    int16_t    pcm16[2 * MAX_FRAMES];       // USB, interleaved
+    int32_t    out32[2 * MAX_FRAMES];
+} block_t;
+
+static void mic_interleaved(block_t *b, uint32_t n)
+{
+    dc_block_process(&b->dc, b->slots, n);
+    mic_convert_gain(b->slots, b->pcm16, n, b->gain);
+}
+
+static void mic_planar(block_t *b, uint32_t n)
+{
+    for (uint32_t i = 0; i < n; i++) {
+        b->ch32[0][i] = b->slots[2 * i];
+        b->ch32[1][i] = b->slots[2 * i + 1];
+    }
+    if (!b->dc.primed) {
+        b->dc.x1[0] = b->ch32[0][0] >> 8;
+        b->dc.x1[1] = b->ch32[1][0] >> 8;
+        b->dc.primed = true;
+    }
+    for (int c = 0; c < 2; c++) {
+        dc_block_planar(&b->dc, c, b->ch32[c], n);
+        mic_gain_planar(b->ch32[c], b->ch16[c], n, b->gain[c]);
+    }
+    for (uint32_t i = 0; i < n; i++) {
+        b->pcm16[2 * i]     = b->ch16[0][i];
+        b->pcm16[2 * i + 1] = b->ch16[1][i];
+    }
+}
+
+static void spk_interleaved(block_t *b, uint32_t n)
+{
+    spk_convert_gain(b->pcm16, b->out32, n, b->gain);
+}
+
+static void spk_planar(block_t *b, uint32_t n)
+{
+    for (uint32_t i = 0; i < n; i++) {
+        b->ch16[0][i] = b->pcm16[2 * i];
+        b->ch16[1][i] = b->pcm16[2 * i + 1];
+    }
+    for (int c = 0; c < 2; c++)
+        spk_gain_planar(b->ch16[c], b->ch32[c], n, b->gain[c]);
+    for (uint32_t i = 0; i < n; i++) {
+        b->out32[2 * i]     = b->ch32[0][i];
+        b->out32[2 * i + 1] = b->ch32[1][i];
+    }
+}
+
+static void block_init(block_t *b, uint32_t rate, const int32_t gain[2])
+{
+    memset(b, 0, sizeof(*b));
+    dc_block_init(&b->dc, 10, rate);
+    b->gain[0] = gain[0];
+    b->gain[1] = gain[1];
+}
+
+// Both ways over a run of random blocks, gains into saturation, must give the same samples
+static int check_exact(uint32_t n_blocks)
+{
+    static const int32_t gains[][2] = {
+        { 1 << 24, 1 << 24 }, { 3 << 22, 5 << 23 }, { 0, 0x7fffffff }, { 1677721600, 167772 },
+    };
+    static block_t a, b;
+
+    for (unsigned g = 0; g < sizeof(gains) / sizeof(gains[0]); g++) {
+        block_init(&a, 48000, gains[g]);
+        block_init(&b, 48000, gains[g]);
+        for (uint32_t k = 0; k < n_blocks; k++) {
+            uint32_t n = 1 + rnd() % MAX_FRAMES;
+            for (uint32_t i = 0; i < 2 * n; i++) {
+                a.slots[i] = b.slots[i] = (int32_t)rnd();
+            }
+            mic_interleaved(&a, n);
+            mic_planar(&b, n);
+            if (memcmp(a.pcm16, b.pcm16, 4 * n)) {
+                printf("mic: planar differs from interleaved, gains %d/%d, block %u\n", gains[g][0], gains[g][1], k);
+                return 1;
+            }
+            spk_interleaved(&a, n);
+            spk_planar(&b, n);
+            if (memcmp(a.out32, b.out32, 8 * n)) {
+                printf("spk: planar differs from interleaved, gains %d/%d, block %u\n", gains[g][0], gains[g][1], k);
+                return 1;
+            }
+        }
+    }
+    return 0;
+}
+
+typedef void (*path_fn)(block_t *, uint32_t);
+
+static void time_path(path_fn fn, uint32_t rate, uint32_t iterations, double *ns_per_block, double *cycles_per_block)
+{
+    static block_t b;
+    static volatile int32_t sink;
+    const int32_t gain[2] = { 1 << 24, 3 << 23 };
+    uint32_t const n = rate / 1000;
+
+    block_init(&b, rate, gain);
+    for (unsigned i = 0; i < 2 * MAX_FRAMES; i++) {
+        b.slots[i] = (int32_t)(rnd() & 0xffffff00);
+        b.pcm16[i] = (int16_t)rnd();
+    }
+
+    uint64_t t0 = sim_cpu_ns();
+    uint64_t c0 = cycles();
+    for (uint32_t it = 0; it < iterations; it++) {
+        fn(&b, n);
+        sink = b.out32[it % (2 * n)] + b.pcm16[it % (2 * n)];
+        __asm__ volatile("" ::: "memory");
+    }
+    uint64_t c1 = cycles();
+    uint64_t t1 = sim_cpu_ns();
+    (void) sink;
+
+    *ns_per_block = (double)(t1 - t0) / iterations;
+    *cycles_per_block = (double)(c1 - c0) / iterations;
+}
+
+int main(int argc, char **argv)
+{
+    uint32_t iterations = 1000000;
+    uint32_t n_check = 20000;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "q")) != -1) {
+        if (opt == 'q') {
+            iterations = 20000;
+            n_check = 2000;
+        }
+        else {
+            fprintf(stderr, "usage: %s [-q]\n", argv[0]);
+            return 2;
+        }
+    }
+
+    if (check_exact(n_check)) {
+        printf("FAIL: the planar path is not bit exact\n");
+        return 1;
+    }
+    printf("planar mic and speaker paths: bit exact against the interleaved kernels\n\n");
+
+    static const uint32_t rates[] = { 16000, 24000, 32000, 48000 };
+    static const struct {
+        const char *name;
+        path_fn interleaved, planar;
+    } paths[] = {
+        { "mic", mic_interleaved, mic_planar },
+        { "spk", spk_interleaved, spk_planar },
+    };
+
+    printf("%-5s %-8s %-7s %14s %14s", "path", "rate", "frames", "interleaved ns", "planar ns");
+    if (HAVE_TSC) printf(" %15s %15s", "interleaved cyc", "planar cyc");
+    printf(" %8s\n", "planar");
+    for (unsigned p = 0; p < sizeof(paths) / sizeof(paths[0]); p++) {
+        for (unsigned r = 0; r < sizeof(rates) / sizeof(rates[0]); r++) {
+            double ns_i, cyc_i, ns_p, cyc_p;
+            time_path(paths[p].interleaved, rates[r], iterations, &ns_i, &cyc_i);
+            time_path(paths[p].planar, rates[r], iterations, &ns_p, &cyc_p);
+
+            printf("%-5s %-8u %-7u %14.1f %14.1f", paths[p].name, rates[r], rates[r] / 1000, ns_i, ns_p);
+            if (HAVE_TSC) printf(" %15.1f %15.1f", cyc_i, cyc_p);
+            printf(" %7.2fx\n", ns_p / ns_i);
+        }
+    }
+    return 0;
+}
@@ -0,0 +1,243 @@
+/*
+ * The DWC2 packet copies (common/tusb_hwfifo.h) against the word at a time
+ * loops they replaced, per packet, in the interrupt handler's share of a packet.
+ *
+ * On the ESP32-S3 the audio class hands the driver linear buffers, so every 1 ms OUT packet
+ * is read out of the RX FIFO by read_fifo_packet() and every IN packet written into its TX
+ * FIFO by write_fifo_packet(), both in dcd_int_handler(). The register block here is a
+ * dwc2_regs_t in RAM: the FIFO port is one volatile word that every access of a packet goes
+ * to, as on the controller. A packet's ISR work is the register reads around the copy in
+ * handle_rxflvl_irq() (GRXSTSP, DOEPTSIZ) and handle_epin_irq() (DIEPTSIZ, DTXFSTS) plus
+ * the copy, for 1 ms packets of 44.1 and 48 kHz stereo at 2 and 4 bytes per sample, into a
+ * word aligned buffer (the fast path, as CFG_TUSB_MEM_ALIGN gives the audio buffers) and
+ * one a byte off (the loop the helpers fall back to). Every length up to 400 bytes and
+ * every offset is first checked against the old loops: the reads byte for byte, guard
+ * bytes included, the writes by the word they leave last on the port.
+ *
+ *   bench_dwc2_fifo [-q]      -q: fewer iterations, for ctest
+ *
+ * Time is reported in ns per packet and, on x86, in TSC cycles per packet, the best of a
+ * few runs. The host has unaligned loads and stores, so here the old loop only loses the
+ * unrolling; on the Xtensa each of its packed accesses is four byte accesses and a word
+ * takes about four times as many instructions. RAM is also faster than the FIFO port,
+ * which the copies wait on over the peripheral bus on the target.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+#include <unistd.h>
+#include "common/tusb_common.h"
+#include "portable/synopsys/dwc2/dwc2_type.h"
+#include "common/tusb_hwfifo.h"
+#include "sim.h"
+#include "bench_common.h"
+
+#define MAX_LEN     400
+
+static dwc2_regs_t s_regs;
+
+// The copies as they were: a packed access per word
+static __attribute__((noinline)) void old_read_packet(volatile const uint32_t *rx_fifo, uint8_t *dst, uint16_t len)
+{
+    uint16_t full_words = len >> 2;
+    while (full_words--) {
+        tu_unaligned_write32(dst, *rx_fifo);
+        dst += 4;
+    }
+
+    uint8_t const bytes_rem = len & 0x03;
+    if (bytes_rem != 0) {
+        uint32_t const tmp = *rx_fifo;
+        dst[0] = tu_u32_byte0(tmp);
+        if (bytes_rem > 1) dst[1] = tu_u32_byte1(tmp);
+        if (bytes_rem > 2) dst[2] = tu_u32_byte2(tmp);
+    }
+}
+
+static __attribute__((noinline)) void old_write_packet(volatile uint32_t *tx_fifo, uint8_t const *src, uint16_t len)
+{
+    uint16_t full_words = len >> 2;
+    while (full_words--) {
+        *tx_fifo = tu_unaligned_read32(src);
+        src += 4;
+    }
+
+    uint8_t const bytes_rem = len & 0x03;
+    if (bytes_rem) {
+        uint32_t tmp_word = src[0];
+        if (bytes_rem > 1) tmp_word |= (src[1] << 8);
+        if (bytes_rem > 2) tmp_word |= (src[2] << 16);
+        *tx_fifo = tmp_word;
+    }
+}
+
+static __attribute__((noinline)) void new_read_packet(volatile const uint32_t *rx_fifo, uint8_t *dst, uint16_t len)
+{
+    tu_hwfifo_read(rx_fifo, dst, len);
+}
+
+static __attribute__((noinline)) void new_write_packet(volatile uint32_t *tx_fifo, uint8_t const *src, uint16_t len)
+{
+    tu_hwfifo_write(tx_fifo, src, len);
+}
+
+typedef void (*read_fn)(volatile const uint32_t *, uint8_t *, uint16_t);
+typedef void (*write_fn)(volatile uint32_t *, uint8_t const *, uint16_t);
+
+typedef struct {
+    const char *name;
+    read_fn read;
+    write_fn write;
+} impl_t;
+
+static const impl_t impl_old = { "word loop", old_read_packet, old_write_packet };
+static const impl_t impl_new = { "fast", new_read_packet, new_write_packet };
+
+// An OUT packet as handle_rxflvl_irq() takes it: pop the status, read the packet, check
+// for a short one
+static inline void isr_rx_packet(const impl_t *impl, uint8_t *dst)
+{
+    dwc2_regs_t *dwc2 = &s_regs;
+    uint32_t const ctl_word = dwc2->grxstsp;
+    uint16_t const bcnt = (ctl_word & GRXSTSP_BCNT_Msk) >> GRXSTSP_BCNT_Pos;
+
+    impl->read(dwc2->fifo[0], dst, bcnt);
+    if (bcnt < MAX_LEN) (void) dwc2->epout[1].doeptsiz;
+}
+
+// An IN packet as handle_epin_irq() writes it: the size left, the room in the TX FIFO, the
+// packet
+static inline void isr_tx_packet(const impl_t *impl, uint8_t const *src, uint16_t len)
+{
+    dwc2_regs_t *dwc2 = &s_regs;
+    uint16_t const remaining = (dwc2->epin[1].dieptsiz & DIEPTSIZ_XFRSIZ_Msk) >> DIEPTSIZ_XFRSIZ_Pos;
+    uint16_t const packet_size = tu_min16(remaining, len);
+
+    if (packet_size > ((dwc2->epin[1].dtxfsts & DTXFSTS_INEPTFSAV_Msk) << 2)) return;
+    impl->write(dwc2->fifo[1], src, packet_size);
+}
+
+static void set_rx_len(uint16_t len)
+{
+    s_regs.grxstsp = (uint32_t)len << GRXSTSP_BCNT_Pos;
+}
+
+static void set_tx_len(uint16_t len)
+{
+    s_regs.epin[1].dieptsiz = (uint32_t)len << DIEPTSIZ_XFRSIZ_Pos;
+    s_regs.epin[1].dtxfsts = DTXFSTS_INEPTFSAV_Msk;
+}
+
+// Every length and buffer offset: the same bytes read, guard bytes untouched, the same last
+// word written to the port
+static int check_exact(void)
+{
+    static uint32_t a[MAX_LEN / 4 + 2], b[MAX_LEN / 4 + 2], src32[MAX_LEN / 4 + 2];
+    uint8_t *src = (uint8_t *)src32;
+
+    for (unsigned i = 0; i < sizeof(src32); i++) src[i] = (uint8_t)(i * 7 + 3);
+
+    for (uint16_t len = 0; len <= MAX_LEN; len++) {
+        for (unsigned ofs = 0; ofs < 4; ofs++) {
+            s_regs.fifo[0][0] = 0x44332211u ^ len;
+            memset(a, 0xa5, sizeof(a));
+            memset(b, 0xa5, sizeof(b));
+            old_read_packet(s_regs.fifo[0], (uint8_t *)a + ofs, len);
+            new_read_packet(s_regs.fifo[0], (uint8_t *)b + ofs, len);
+            if (memcmp(a, b, sizeof(a))) {
+                printf("read: %u bytes at offset %u differ\n", len, ofs);
+                return 1;
+            }
+
+            s_regs.fifo[1][0] = 0;
+            old_write_packet(s_regs.fifo[1], src + ofs, len);
+            uint32_t const last_old = s_regs.fifo[1][0];
+            s_regs.fifo[1][0] = 0;
+            new_write_packet(s_regs.fifo[1], src + ofs, len);
+            if (s_regs.fifo[1][0] != last_old) {
+                printf("write: %u bytes at offset %u, last word %08x instead of %08x\n", len, ofs,
+                       (unsigned)s_regs.fifo[1][0], (unsigned)last_old);
+                return 1;
+            }
+        }
+    }
+    return 0;
+}
+
+// Best of ROUNDS runs of iterations / ROUNDS packets
+#define ROUNDS      25
+
+static void time_packet(const impl_t *impl, int tx, uint16_t len, unsigned ofs, uint32_t iterations,
+                        double *ns, double *cyc)
+{
+    static uint32_t buf[MAX_LEN / 4 + 2];
+    uint8_t *p = (uint8_t *)buf + ofs;
+    uint32_t const n = iterations / ROUNDS;
+
+    if (tx) set_tx_len(len);
+    else set_rx_len(len);
+
+    *ns = *cyc = 1e30;
+    for (int r = 0; r < ROUNDS; r++) {
+        uint64_t t0 = sim_cpu_ns();
+        uint64_t c0 = cycles();
+        for (uint32_t it = 0; it < n; it++) {
+            if (tx)
+                isr_tx_packet(impl, p, len);
+            else
+                isr_rx_packet(impl, p);
+            __asm__ volatile("" ::: "memory");
+        }
+        uint64_t c1 = cycles();
+        uint64_t t1 = sim_cpu_ns();
+
+        if ((double)(t1 - t0) / n < *ns) *ns = (double)(t1 - t0) / n;
+        if ((double)(c1 - c0) / n < *cyc) *cyc = (double)(c1 - c0) / n;
+    }
+}
+
+int main(int argc, char **argv)
+{
+    // 1 ms at 44.1 kHz (the longer packet) and 48 kHz, stereo, 2 and 4 bytes per sample
+    static const uint16_t lens[] = { 180, 192, 360, 384 };
+    uint32_t iterations = 2000000;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "q")) != -1) {
+        if (opt == 'q') {
+            iterations = 20000;
+        }
+        else {
+            fprintf(stderr, "usage: %s [-q]\n", argv[0]);
+            return 2;
+        }
+    }
+
+    if (check_exact()) {
+        printf("FAIL: the DWC2 packet copies differ from the word loops\n");
+        return 1;
+    }
+    printf("DWC2 packet copies: byte exact against the word loops\n\n");
+
+    static const char *dirs[] = { "rx", "tx" };
+
+    printf("%-4s %-6s %-10s %11s %11s", "dir", "bytes", "buffer", "loop ns", "fast ns");
+    if (HAVE_TSC) printf(" %11s %11s", "loop cyc", "fast cyc");
+    printf(" %8s\n", "speedup");
+    for (int d = 0; d < 2; d++) {
+        for (unsigned l = 0; l < sizeof(lens) / sizeof(lens[0]); l++) {
+            for (unsigned ofs = 0; ofs < 2; ofs++) {
+                double ns_o, cyc_o, ns_n, cyc_n;
+                time_packet(&impl_old, d, lens[l], ofs, iterations, &ns_o, &cyc_o);
+                time_packet(&impl_new, d, lens[l], ofs, iterations, &ns_n, &cyc_n);
+
+                printf("%-4s %-6u %-10s %11.1f %11.1f", dirs[d], lens[l], ofs ? "unaligned" : "aligned", ns_o, ns_n);
+                if (HAVE_TSC) printf(" %11.1f %11.1f", cyc_o, cyc_n);
+                printf(" %7.2fx\n", ns_o / ns_n);
+            }
+        }
+    }
+    return 0;
+}
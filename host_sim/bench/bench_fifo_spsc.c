@@ -0,0 +1,99 @@
+/*
+ * tu_fifo with its mutexes taken against the single producer, single consumer mode
+ * (tu_fifo_config_spsc()), built with the pthread OSAL of include/tusb_os_custom.h as
+ * tu_fifo is built on the FreeRTOS target.
+ *
+ * Two measurements per packet size, for the 1 ms packets of 48 kHz stereo at 2 and 4
+ * bytes per sample and a small one where the call overhead dominates:
+ *
+ *   alone      one thread writes a packet and reads it back: the cost of the calls
+ *              without contention, what the USB task pays for the EP IN FIFO; ns per
+ *              write and read pair
+ *   contended  a writer and a reader thread on two cores stream packets through the
+ *              FIFO flat out, as the USB task and the playback task share the EP OUT
+ *              FIFO; ns per packet through the FIFO
+ *
+ *   bench_fifo_spsc [-q]      -q: fewer iterations, for ctest
+ *
+ * Each is the best of a few runs. A pthread mutex costs about what a FreeRTOS one
+ * does uncontended; under contention the host mutex sleeps in the kernel where the
+ * FreeRTOS one would let the other task run, so the contended rows only show the
+ * direction. A side that finds the FIFO full (empty) yields, so that the rows mean
+ * something on a single core too.
+ */
+#include <stdio.h>
+#include <stdint.h>
+#include <unistd.h>
+#include "fifo_stream.h"
+
+#define MAX_LEN     384
+#define ROUNDS      5
+
+// A packet in and out on one thread; ns per write and read pair
+static double time_alone(bool spsc, uint16_t len, uint32_t iterations)
+{
+    static uint8_t src[MAX_LEN], dst[MAX_LEN];
+    uint32_t const n = iterations / ROUNDS;
+    double best = 1e30;
+
+    fifo_stream_setup(spsc);
+    for (int r = 0; r < ROUNDS; r++) {
+        uint64_t t0 = fifo_stream_now_ns();
+        for (uint32_t it = 0; it < n; it++) {
+            tu_fifo_write_n(&fifo_stream_ff, src, len);
+            tu_fifo_read_n(&fifo_stream_ff, dst, len);
+            __asm__ volatile("" ::: "memory");
+        }
+        uint64_t t1 = fifo_stream_now_ns();
+        if ((double)(t1 - t0) / n < best) best = (double)(t1 - t0) / n;
+    }
+    return best;
+}
+
+// Packets streamed between two threads; ns per packet, or -1 if the data came out wrong
+static double time_contended(bool spsc, uint16_t len, uint32_t iterations)
+{
+    double best = 1e30;
+
+    for (int r = 0; r < ROUNDS; r++) {
+        fifo_stream_t s = { .len = len, .n_bytes = iterations / ROUNDS * len };
+
+        fifo_stream_setup(spsc);
+        uint64_t ns = fifo_stream_run(&s);
+
+        if (s.n_bad) return -1;
+        if ((double)ns / (iterations / ROUNDS) < best) best = (double)ns / (iterations / ROUNDS);
+    }
+    return best;
+}
+
+int main(int argc, char **argv)
+{
+    static const uint16_t lens[] = { 16, 192, 384 };
+    uint32_t iterations = 2000000;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "q")) != -1) {
+        if (opt == 'q') {
+            iterations = 20000;
+        }
+        else {
+            fprintf(stderr, "usage: %s [-q]\n", argv[0]);
+            return 2;
+        }
+    }
+
+    printf("%-6s %-6s %14s %14s\n", "mode", "bytes", "alone ns", "contended ns");
+    for (unsigned l = 0; l < sizeof(lens) / sizeof(lens[0]); l++) {
+        for (int spsc = 0; spsc <= 1; spsc++) {
+            double ns_alone = time_alone(spsc, lens[l], iterations);
+            double ns_pkt = time_contended(spsc, lens[l], iterations);
+            if (ns_pkt < 0) {
+                printf("FAIL: %s, %u bytes: the reader got the stream out of order\n", spsc ? "spsc" : "mutex", lens[l]);
+                return 1;
+            }
+            printf("%-6s %-6u %14.1f %14.1f\n", spsc ? "spsc" : "mutex", lens[l], ns_alone, ns_pkt);
+        }
+    }
+    return 0;
+}
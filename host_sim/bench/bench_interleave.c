@@ -0,0 +1,232 @@
+/*
+ * The interleaved copies of tinyusb's support FIFOs (class/audio/audio_interleave.h)
+ * against the byte generic loops they replaced, per packet.
+ *
+ * With CFG_TUD_AUDIO_ENABLE_ENCODING/DECODING every IN packet is put together from one
+ * FIFO per channel by audiod_interleaved_copy_bytes_fast_encode() and every OUT packet
+ * split by audiod_interleaved_copy_bytes_fast_decode(). This times both for a 1 ms
+ * packet of 48 kHz stereo at 2 and 4 bytes per sample, with the buffers aligned (the
+ * fast paths) and with the FIFO one byte off (the generic loops the helpers fall back
+ * to), against a copy of the helpers before the fast paths. Every case is first checked
+ * byte for byte against the old loops.
+ *
+ *   bench_interleave [-q]      -q: fewer iterations, for ctest
+ *
+ * Time is reported in ns per packet and, on x86, in TSC cycles per packet, the best of a
+ * few runs. The host has unaligned loads, so the old loops cost less here than on the
+ * Xtensa, where each packed access is a byte access; the host compiler also vectorizes the
+ * generic loops once the fast paths pin n_ff_used to 2, which moves the unaligned rows
+ * either way by more than the copies themselves.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include "class/audio/audio_interleave.h"
+#include "sim.h"
+#include "bench_common.h"
+
+#define N_FF        2
+#define FRAMES      48
+#define MAX_BYTES   (N_FF * FRAMES * 4)
+
+// The helpers as they were: a packed access per sample
+static __attribute__((noinline)) uint8_t * old_decode(uint16_t const nBytesToCopy, void * dst, uint8_t * dst_end, uint8_t * src, uint8_t const n_ff_used)
+{
+    switch (nBytesToCopy) {
+    case 2:
+        while ((uint8_t *)dst < dst_end) {
+            *(audiod_unaligned_uint16_t *)dst = *(audiod_unaligned_uint16_t *)src;
+            dst += 2;
+            src += 2 * n_ff_used;
+        }
+        break;
+    case 4:
+        while ((uint8_t *)dst < dst_end) {
+            *(audiod_unaligned_uint32_t *)dst = *(audiod_unaligned_uint32_t *)src;
+            dst += 4;
+            src += 4 * n_ff_used;
+        }
+        break;
+    }
+    return src;
+}
+
+static __attribute__((noinline)) uint8_t * old_encode(uint16_t const nBytesToCopy, uint8_t * src, uint8_t * src_end, uint8_t * dst, uint8_t const n_ff_used)
+{
+    switch (nBytesToCopy) {
+    case 2:
+        while (src < src_end) {
+            *(audiod_unaligned_uint16_t *)dst = *(audiod_unaligned_uint16_t *)src;
+            src += 2;
+            dst += 2 * n_ff_used;
+        }
+        break;
+    case 4:
+        while (src < src_end) {
+            *(audiod_unaligned_uint32_t *)dst = *(audiod_unaligned_uint32_t *)src;
+            src += 4;
+            dst += 4 * n_ff_used;
+        }
+        break;
+    }
+    return dst;
+}
+
+static __attribute__((noinline)) uint8_t * new_decode(uint16_t const nBytesToCopy, void * dst, uint8_t * dst_end, uint8_t * src, uint8_t const n_ff_used)
+{
+    return audiod_interleaved_copy_bytes_fast_decode(nBytesToCopy, dst, dst_end, src, n_ff_used);
+}
+
+static __attribute__((noinline)) uint8_t * new_encode(uint16_t const nBytesToCopy, uint8_t * src, uint8_t * src_end, uint8_t * dst, uint8_t const n_ff_used)
+{
+    return audiod_interleaved_copy_bytes_fast_encode(nBytesToCopy, src, src_end, dst, n_ff_used);
+}
+
+typedef uint8_t * (*decode_fn)(uint16_t, void *, uint8_t *, uint8_t *, uint8_t);
+typedef uint8_t * (*encode_fn)(uint16_t, uint8_t *, uint8_t *, uint8_t *, uint8_t);
+
+// One packet; the FIFOs are ff_ofs bytes into their buffers
+typedef struct {
+    uint32_t stream[MAX_BYTES / 4];
+    uint32_t ff[N_FF][MAX_BYTES / 4 / N_FF + 1];
+} packet_t;
+
+static void decode_packet(decode_fn fn, packet_t *p, uint16_t n_bytes, unsigned ff_ofs)
+{
+    uint8_t *src = (uint8_t *)p->stream;
+    uint16_t const len = FRAMES * n_bytes;
+
+    for (int f = 0; f < N_FF; f++) {
+        uint8_t *dst = (uint8_t *)p->ff[f] + ff_ofs;
+        fn(n_bytes, dst, dst + len, src, N_FF);
+        src += n_bytes;
+    }
+}
+
+static void encode_packet(encode_fn fn, packet_t *p, uint16_t n_bytes, unsigned ff_ofs)
+{
+    uint8_t *dst = (uint8_t *)p->stream;
+    uint16_t const len = FRAMES * n_bytes;
+
+    for (int f = 0; f < N_FF; f++) {
+        uint8_t *src = (uint8_t *)p->ff[f] + ff_ofs;
+        fn(n_bytes, src, src + len, dst, N_FF);
+        dst += n_bytes;
+    }
+}
+
+static void packet_fill(packet_t *p)
+{
+    uint8_t *b = (uint8_t *)p;
+    for (size_t i = 0; i < sizeof(*p); i++) b[i] = (uint8_t)(i * 13 + 5);
+}
+
+static int check_exact(void)
+{
+    static packet_t a, b;
+
+    for (uint16_t n_bytes = 2; n_bytes <= 4; n_bytes += 2) {
+        for (unsigned ofs = 0; ofs < 4; ofs++) {
+            packet_fill(&a);
+            packet_fill(&b);
+            decode_packet(old_decode, &a, n_bytes, ofs);
+            decode_packet(new_decode, &b, n_bytes, ofs);
+            if (memcmp(&a, &b, sizeof(a))) {
+                printf("decode: %u bytes, FIFO offset %u differs\n", n_bytes, ofs);
+                return 1;
+            }
+            encode_packet(old_encode, &a, n_bytes, ofs);
+            encode_packet(new_encode, &b, n_bytes, ofs);
+            if (memcmp(&a, &b, sizeof(a))) {
+                printf("encode: %u bytes, FIFO offset %u differs\n", n_bytes, ofs);
+                return 1;
+            }
+        }
+    }
+    return 0;
+}
+
+typedef struct {
+    const char *name;
+    decode_fn decode;
+    encode_fn encode;
+} impl_t;
+
+// Best of ROUNDS runs of iterations / ROUNDS packets: a packet is short enough for a
+// preemption or a frequency step to show in one run
+#define ROUNDS      25
+
+static void time_packet(const impl_t *impl, int encode, uint16_t n_bytes, unsigned ofs, uint32_t iterations,
+                        double *ns, double *cyc)
+{
+    static packet_t p;
+    static volatile uint32_t sink;
+    uint32_t const n = iterations / ROUNDS;
+
+    packet_fill(&p);
+    *ns = *cyc = 1e30;
+    for (int r = 0; r < ROUNDS; r++) {
+        uint64_t t0 = sim_cpu_ns();
+        uint64_t c0 = cycles();
+        for (uint32_t it = 0; it < n; it++) {
+            if (encode)
+                encode_packet(impl->encode, &p, n_bytes, ofs);
+            else
+                decode_packet(impl->decode, &p, n_bytes, ofs);
+            sink = p.stream[it % (MAX_BYTES / 4)] + p.ff[1][it % 8];
+            __asm__ volatile("" ::: "memory");
+        }
+        uint64_t c1 = cycles();
+        uint64_t t1 = sim_cpu_ns();
+
+        if ((double)(t1 - t0) / n < *ns) *ns = (double)(t1 - t0) / n;
+        if ((double)(c1 - c0) / n < *cyc) *cyc = (double)(c1 - c0) / n;
+    }
+    (void) sink;
+}
+
+int main(int argc, char **argv)
+{
+    uint32_t iterations = 2000000;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "q")) != -1) {
+        if (opt == 'q') {
+            iterations = 20000;
+        }
+        else {
+            fprintf(stderr, "usage: %s [-q]\n", argv[0]);
+            return 2;
+        }
+    }
+
+    if (check_exact()) {
+        printf("FAIL: the interleave helpers differ from the generic loops\n");
+        return 1;
+    }
+    printf("interleave helpers: byte exact against the generic loops\n\n");
+
+    static const impl_t impl_old = { "generic", old_decode, old_encode };
+    static const impl_t impl_new = { "fast", new_decode, new_encode };
+    static const char *dirs[] = { "decode", "encode" };
+
+    printf("%-7s %-6s %-10s %11s %11s", "dir", "bytes", "FIFO", "generic ns", "fast ns");
+    if (HAVE_TSC) printf(" %11s %11s", "generic cyc", "fast cyc");
+    printf(" %8s\n", "speedup");
+    for (int d = 0; d < 2; d++) {
+        for (uint16_t n_bytes = 2; n_bytes <= 4; n_bytes += 2) {
+            for (unsigned ofs = 0; ofs < 2; ofs++) {
+                double ns_o, cyc_o, ns_n, cyc_n;
+                time_packet(&impl_old, d, n_bytes, ofs, iterations, &ns_o, &cyc_o);
+                time_packet(&impl_new, d, n_bytes, ofs, iterations, &ns_n, &cyc_n);
+
+                printf("%-7s %-6u %-10s %11.1f %11.1f", dirs[d], n_bytes, ofs ? "unaligned" : "aligned", ns_o, ns_n);
+                if (HAVE_TSC) printf(" %11.1f %11.1f", cyc_o, cyc_n);
+                printf(" %7.2fx\n", ns_o / ns_n);
+            }
+        }
+    }
+    return 0;
+}
@@ -0,0 +1,257 @@
+/*
+ * Mic path convert-and-gain kernel: bit exactness and speed.
+ *
+ * Checks mic_convert_gain() against mic_convert_gain_ref() and against the
+ * per-sample mul_1p31x8p24() the firmware used before, on random slots,
+ * full-scale slots and gains that saturate, then times one 1 ms block of
+ * stereo frames at each sample rate for both versions.
+ *
+ * The 24 bit path's pcm24_gain() is checked the same way: at unity gain the slots
+ * come out as they went in, and its upper 16 bits are mic_convert_gain()'s output.
+ * It is timed against the 16 bit kernel, which is the comparison between the two
+ * alternate settings: the 24 bit one moves twice the bytes over USB (8 instead of
+ * 4 per stereo frame) but skips the conversion.
+ *
+ *   bench_mic_convert [-q]      -q: fewer iterations, for ctest
+ *
+ * Time is reported in ns per block and, on x86, in TSC cycles per block.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include "audio_dsp.h"
+#include "utilities.h"
+#include "sim.h"
+#include "bench_common.h"
+
+#define MAX_FRAMES 48
+
+// INMP441 slot: 24 valid bits, low byte zero
+static int32_t rnd_slot(void)
+{
+    return (int32_t)(rnd() & 0xffffff00);
+}
+
+// the per-sample loop the kernel replaces
+static void convert_per_sample(const int32_t *src, int16_t *dst, uint32_t n_frames, const int32_t gain[2])
+{
+    for (uint32_t i = 0; i < n_frames; i++) {
+        dst[2 * i]     = mul_1p31x8p24(src[2 * i] & ~0xff, gain[0]);
+        dst[2 * i + 1] = mul_1p31x8p24(src[2 * i + 1] & ~0xff, gain[1]);
+    }
+}
+
+static int check_block(const int32_t *src, uint32_t n_frames, const int32_t gain[2])
+{
+    int16_t out[2 * MAX_FRAMES], ref[2 * MAX_FRAMES], old[2 * MAX_FRAMES];
+
+    mic_convert_gain(src, out, n_frames, gain);
+    mic_convert_gain_ref(src, ref, n_frames, gain);
+    convert_per_sample(src, old, n_frames, gain);
+
+    for (uint32_t i = 0; i < 2 * n_frames; i++) {
+        if (out[i] != ref[i] || ref[i] != old[i]) {
+            printf("mismatch: slot 0x%08x gain %d: kernel %d ref %d mul_1p31x8p24 %d\n",
+                   (unsigned)src[i], gain[i & 1], out[i], ref[i], old[i]);
+            return 1;
+        }
+    }
+    return 0;
+}
+
+static int check_exact(uint32_t n_blocks)
+{
+    static const int32_t edge_slots[] = {
+        0, 0x100, -0x100, 0x7fffff00, (int32_t)0x80000000, 0x40000000, (int32_t)0xc0000000,
+        0x00800000, (int32_t)0xff800000, 0x000ff000, (int32_t)0xfff01000,
+    };
+    static const int32_t edge_gains[] = {
+        0, 1, 167772, 1 << 24, 0x7fffffff, (int32_t)0x80000000, -(1 << 24),
+        1677721600 /* +40 dB */, 33554432, 0x00ffffff,
+    };
+    int32_t src[2 * MAX_FRAMES];
+    int32_t gain[2];
+    int fail = 0;
+
+    // every edge slot against every edge gain, odd and even frame counts
+    for (unsigned g = 0; g < sizeof(edge_gains) / sizeof(edge_gains[0]); g++) {
+        for (unsigned i = 0; i < 2 * MAX_FRAMES; i++) {
+            src[i] = edge_slots[i % (sizeof(edge_slots) / sizeof(edge_slots[0]))];
+        }
+        gain[0] = edge_gains[g];
+        gain[1] = edge_gains[(g + 3) % (sizeof(edge_gains) / sizeof(edge_gains[0]))];
+        fail |= check_block(src, MAX_FRAMES, gain);
+        fail |= check_block(src, MAX_FRAMES - 1, gain);
+    }
+
+    // random slots; gains from the volume range, some well into saturation
+    for (uint32_t b = 0; b < n_blocks && !fail; b++) {
+        for (unsigned i = 0; i < 2 * MAX_FRAMES; i++) src[i] = rnd_slot();
+        gain[0] = (int32_t)(rnd() % 1677721600u);
+        gain[1] = (b & 1) ? (int32_t)(rnd() >> 7) : (1 << 24);
+        fail |= check_block(src, 1 + rnd() % MAX_FRAMES, gain);
+    }
+    return fail;
+}
+
+static int check_pcm24_block(const int32_t *src, uint32_t n_frames, const int32_t gain[2])
+{
+    int32_t out[2 * MAX_FRAMES];
+    int16_t ref[2 * MAX_FRAMES];
+
+    memcpy(out, src, 2 * n_frames * sizeof(out[0]));
+    pcm24_gain(out, n_frames, gain);
+    mic_convert_gain(src, ref, n_frames, gain);
+
+    for (uint32_t i = 0; i < 2 * n_frames; i++) {
+        bool unity = gain[i & 1] == (1 << 24);
+        if ((out[i] & 0xff) || (out[i] >> 16) != ref[i] || (unity && out[i] != (src[i] & ~0xff))) {
+            printf("mismatch: slot 0x%08x gain %d: pcm24_gain 0x%08x mic_convert_gain %d\n",
+                   (unsigned)src[i], gain[i & 1], (unsigned)out[i], ref[i]);
+            return 1;
+        }
+    }
+    return 0;
+}
+
+static int check_pcm24(uint32_t n_blocks)
+{
+    static const int32_t gains[][2] = {
+        { 1 << 24, 1 << 24 }, { 1 << 24, 3 << 23 }, { 0, 1 }, { 0x7fffffff, (int32_t)0x80000000 },
+        { 1677721600, -(1 << 24) },
+    };
+    int32_t src[2 * MAX_FRAMES];
+    int fail = 0;
+
+    // full scale, the smallest steps and the low byte set, as the slots of an I2S codec can have it
+    for (unsigned g = 0; g < sizeof(gains) / sizeof(gains[0]); g++) {
+        for (unsigned i = 0; i < 2 * MAX_FRAMES; i++) {
+            static const int32_t edge[] = { 0, 0x1ff, -0x100, 0x7fffffff, (int32_t)0x80000000, 0x7fffff00, -0x7fffff00 };
+            src[i] = edge[i % (sizeof(edge) / sizeof(edge[0]))];
+        }
+        fail |= check_pcm24_block(src, MAX_FRAMES, gains[g]);
+    }
+    for (uint32_t b = 0; b < n_blocks && !fail; b++) {
+        int32_t gain[2] = { (b & 1) ? (1 << 24) : (int32_t)(rnd() % 1677721600u), (int32_t)(rnd() >> 6) };
+        if (b % 3 == 0) gain[1] = 1 << 24;
+        for (unsigned i = 0; i < 2 * MAX_FRAMES; i++) src[i] = (int32_t)rnd();
+        fail |= check_pcm24_block(src, 1 + rnd() % MAX_FRAMES, gain);
+    }
+    return fail;
+}
+
+typedef void (*convert_fn)(const int32_t *, int16_t *, uint32_t, const int32_t *);
+
+static void time_block(convert_fn fn, uint32_t n_frames, uint32_t iterations,
+                       double *ns_per_block, double *cycles_per_block)
+{
+    static int32_t src[2 * MAX_FRAMES];
+    static int16_t dst[2 * MAX_FRAMES];
+    static volatile int16_t sink;
+    const int32_t gain[2] = { 1 << 24, 3 << 23 };
+
+    for (unsigned i = 0; i < 2 * MAX_FRAMES; i++) src[i] = rnd_slot();
+
+    uint64_t t0 = sim_cpu_ns();
+    uint64_t c0 = cycles();
+    for (uint32_t it = 0; it < iterations; it++) {
+        fn(src, dst, n_frames, gain);
+        sink = dst[it % (2 * n_frames)];
+        __asm__ volatile("" ::: "memory");
+    }
+    uint64_t c1 = cycles();
+    uint64_t t1 = sim_cpu_ns();
+    (void) sink;
+
+    *ns_per_block = (double)(t1 - t0) / iterations;
+    *cycles_per_block = (double)(c1 - c0) / iterations;
+}
+
+// pcm24_gain() works in place; a gain below unity keeps the block from saturating
+// however many times it runs over it
+static void time_pcm24(int32_t g, uint32_t n_frames, uint32_t iterations,
+                       double *ns_per_block, double *cycles_per_block)
+{
+    static int32_t buf[2 * MAX_FRAMES];
+    static volatile int32_t sink;
+    const int32_t gain[2] = { g, g };
+
+    for (unsigned i = 0; i < 2 * MAX_FRAMES; i++) buf[i] = rnd_slot();
+
+    uint64_t t0 = sim_cpu_ns();
+    uint64_t c0 = cycles();
+    for (uint32_t it = 0; it < iterations; it++) {
+        pcm24_gain(buf, n_frames, gain);
+        sink = buf[it % (2 * n_frames)];
+        __asm__ volatile("" ::: "memory");
+    }
+    uint64_t c1 = cycles();
+    uint64_t t1 = sim_cpu_ns();
+    (void) sink;
+
+    *ns_per_block = (double)(t1 - t0) / iterations;
+    *cycles_per_block = (double)(c1 - c0) / iterations;
+}
+
+int main(int argc, char **argv)
+{
+    uint32_t iterations = 1000000;
+    uint32_t n_check = 100000;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "q")) != -1) {
+        if (opt == 'q') {
+            iterations = 20000;
+            n_check = 10000;
+        }
+        else {
+            fprintf(stderr, "usage: %s [-q]\n", argv[0]);
+            return 2;
+        }
+    }
+
+    if (check_exact(n_check)) {
+        printf("FAIL: mic_convert_gain is not bit exact\n");
+        return 1;
+    }
+    printf("mic_convert_gain: bit exact against mic_convert_gain_ref and mul_1p31x8p24\n\n");
+
+    static const uint32_t rates[] = { 16000, 24000, 32000, 48000 };
+    printf("%-8s %-7s %14s %14s", "rate", "frames", "per-sample ns", "kernel ns");
+    if (HAVE_TSC) printf(" %14s %14s", "per-sample cyc", "kernel cyc");
+    printf(" %8s\n", "speedup");
+
+    for (unsigned r = 0; r < sizeof(rates) / sizeof(rates[0]); r++) {
+        uint32_t n_frames = rates[r] / 1000;
+        double ns_old, cyc_old, ns_new, cyc_new;
+        time_block(convert_per_sample, n_frames, iterations, &ns_old, &cyc_old);
+        time_block(mic_convert_gain, n_frames, iterations, &ns_new, &cyc_new);
+
+        printf("%-8u %-7u %14.1f %14.1f", rates[r], n_frames, ns_old, ns_new);
+        if (HAVE_TSC) printf(" %14.1f %14.1f", cyc_old, cyc_new);
+        printf(" %7.2fx\n", ns_old / ns_new);
+    }
+
+    if (check_pcm24(n_check)) {
+        printf("FAIL: pcm24_gain does not match mic_convert_gain\n");
+        return 1;
+    }
+    printf("\npcm24_gain: unity gain passes the 24 bits through, upper 16 bits match mic_convert_gain\n\n");
+
+    printf("%-8s %-7s %10s %10s %14s %14s\n", "rate", "frames", "16bit B/ms", "24bit B/ms",
+           "16bit conv ns", "24bit ns");
+    printf("%-8s %-7s %10s %10s %14s %14s\n", "", "", "", "", "", "(unity/gain)");
+    for (unsigned r = 0; r < sizeof(rates) / sizeof(rates[0]); r++) {
+        uint32_t n_frames = rates[r] / 1000;
+        double ns16, cyc16, ns_unity, cyc_unity, ns24, cyc24;
+        time_block(mic_convert_gain, n_frames, iterations, &ns16, &cyc16);
+        time_pcm24(1 << 24, n_frames, iterations, &ns_unity, &cyc_unity);
+        time_pcm24(3 << 22, n_frames, iterations, &ns24, &cyc24);
+
+        printf("%-8u %-7u %10u %10u %14.1f %6.1f/%-7.1f\n", rates[r], n_frames, n_frames * 4, n_frames * 8,
+               ns16, ns_unity, ns24);
+    }
+    return 0;
+}
@@ -0,0 +1,6 @@
+#pragma once
+
+// Code placement attributes have no meaning on the host
+#define IRAM_ATTR
+#define DRAM_ATTR
+#define FORCE_INLINE_ATTR static inline __attribute__((always_inline))
@@ -0,0 +1,10 @@
+#pragma once
+
+#include <stdint.h>
+
+typedef uint32_t esp_cpu_cycle_count_t;
+
+// The cycle counter counts ns of the host clock (CONFIG_ESP_DEFAULT_CPU_FREQ_MHZ is 1000);
+// the core is the one sim_set_core() last set, that of the task the sim is running
+esp_cpu_cycle_count_t esp_cpu_get_cycle_count(void);
+int esp_cpu_get_core_id(void);
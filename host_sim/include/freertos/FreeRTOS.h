@@ -0,0 +1,28 @@
+/* Minimal FreeRTOS stand-in for the host simulation build.
+ * The simulation is single threaded: tasks are stepped by the driver in
+ * sim_main.c, so only the types and the few calls used by main/ exist here.
+ */
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <inttypes.h>
+#include <assert.h>
+
+typedef int           BaseType_t;
+typedef unsigned int  UBaseType_t;
+typedef uint32_t      TickType_t;
+
+#define pdFALSE             ((BaseType_t) 0)
+#define pdTRUE              ((BaseType_t) 1)
+#define pdPASS              (pdTRUE)
+#define pdFAIL              (pdFALSE)
+#define portMAX_DELAY       ((TickType_t) 0xffffffffUL)
+#define portTICK_PERIOD_MS  ((TickType_t) 1)
+#define pdMS_TO_TICKS(ms)   ((TickType_t) (ms))
+
+#define configASSERT(x)     assert(x)
+
+// On the target the tinyusb FreeRTOS OSAL pulls in task.h for every user of tusb.h
+#include "freertos/task.h"
@@ -0,0 +1,21 @@
+/* sdkconfig.h stand-in for the host simulation build.
+ * Only the options referenced by main/ are defined here.
+ */
+#pragma once
+
+#define CONFIG_IDF_TARGET               "esp32s3"
+#define CONFIG_IDF_TARGET_ESP32S3       1
+#define CONFIG_TINYUSB_DEBUG_LEVEL      0
+#define CONFIG_MIC_DC_BLOCK             1
+#define CONFIG_MIC_DC_BLOCK_CORNER_HZ   20
+#define CONFIG_MIC_AEC                  1
+#define CONFIG_MIC_AEC_TAPS             512
+#define CONFIG_MIC_AEC_MAX_RATE         16000
+#define CONFIG_GAIN_RAMP_MS             5
+#define CONFIG_SPK_JITTER_BALANCED      1
+#define CONFIG_AUDIO_TRACE              1
+#define CONFIG_AUDIO_TRACE_LEN          1024
+#define CONFIG_AUDIO_PROFILER           1
+#define CONFIG_ESP_DEFAULT_CPU_FREQ_MHZ 1000    // the cycle counter of the host build counts ns
+#define CONFIG_FREERTOS_HZ              1000
+#define CONFIG_BLINK_GPIO               48
@@ -0,0 +1,30 @@
+/* tinyusb OSAL on pthreads for the host builds with CFG_TUSB_OS=OPT_OS_CUSTOM.
+ * Only the mutex API is here: it is what tu_fifo needs, and the two threaded
+ * tu_fifo test and bench are the only users. With a real mutex, OSAL_MUTEX_REQUIRED
+ * is 1 and tu_fifo is built as on the FreeRTOS target.
+ */
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <pthread.h>
+
+typedef pthread_mutex_t  osal_mutex_def_t;
+typedef pthread_mutex_t *osal_mutex_t;
+
+static inline osal_mutex_t osal_mutex_create(osal_mutex_def_t *mdef)
+{
+    pthread_mutex_init(mdef, NULL);
+    return mdef;
+}
+
+static inline bool osal_mutex_lock(osal_mutex_t mutex_hdl, uint32_t msec)
+{
+    (void) msec;
+    return pthread_mutex_lock(mutex_hdl) == 0;
+}
+
+static inline bool osal_mutex_unlock(osal_mutex_t mutex_hdl)
+{
+    return pthread_mutex_unlock(mutex_hdl) == 0;
+}
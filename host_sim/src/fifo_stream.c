@@ -0,0 +1,147 @@
+/*
+ * The writer and reader threads of fifo_stream.h. A side that finds the FIFO full
+ * (empty) yields, so that a stream also gets through on a single core.
+ */
+#include <pthread.h>
+#include <sched.h>
+#include <time.h>
+#include "fifo_stream.h"
+
+tu_fifo_t fifo_stream_ff;
+osal_mutex_def_t fifo_stream_mutex_wr, fifo_stream_mutex_rd;
+
+static uint8_t s_ff_buf[FIFO_STREAM_SIZE];
+
+// Byte n of the stream; repeats only every 16 MB
+static inline uint8_t seq_byte(uint32_t n)
+{
+    return (uint8_t)(n ^ (n >> 8) ^ (n >> 16));
+}
+
+static inline uint32_t xorshift(uint32_t *s)
+{
+    *s ^= *s << 13;
+    *s ^= *s >> 17;
+    *s ^= *s << 5;
+    return *s;
+}
+
+// Size of the next call and, in the top bit, whether it copies (set) or works in place
+static inline uint32_t next_call(const fifo_stream_t *s, uint32_t *rng, uint16_t *n)
+{
+    if (!s->random) {
+        *n = s->len;
+        return 0x80000000u;
+    }
+    uint32_t r = xorshift(rng);
+    *n = (uint16_t)(1 + r % s->len);
+    return r;
+}
+
+void fifo_stream_setup(bool spsc)
+{
+    tu_fifo_config(&fifo_stream_ff, s_ff_buf, FIFO_STREAM_SIZE, 1, false);
+    tu_fifo_config_mutex(&fifo_stream_ff, osal_mutex_create(&fifo_stream_mutex_wr),
+                         osal_mutex_create(&fifo_stream_mutex_rd));
+    tu_fifo_config_spsc(&fifo_stream_ff, spsc);
+}
+
+static void *writer_thread(void *arg)
+{
+    fifo_stream_t *s = arg;
+    uint8_t chunk[FIFO_STREAM_MAX_LEN];
+    uint32_t rng = 0x12345678;
+    uint32_t pos = 0;
+
+    while (pos < s->n_bytes) {
+        uint16_t n;
+        uint32_t r = next_call(s, &rng, &n);
+        if (n > s->n_bytes - pos) n = (uint16_t)(s->n_bytes - pos);
+
+        if (r & 0x80000000u) {
+            for (uint16_t i = 0; i < n; i++) chunk[i] = seq_byte(pos + i);
+            n = tu_fifo_write_n(&fifo_stream_ff, chunk, n);
+        }
+        else {
+            // in place, the linear part first and then the wrapped one
+            tu_fifo_buffer_info_t info;
+            tu_fifo_get_write_info(&fifo_stream_ff, &info);
+            uint16_t n_lin = TU_MIN(n, info.len_lin);
+            uint16_t n_wrap = TU_MIN((uint16_t)(n - n_lin), info.len_wrap);
+            for (uint16_t i = 0; i < n_lin; i++) ((uint8_t *)info.ptr_lin)[i] = seq_byte(pos + i);
+            for (uint16_t i = 0; i < n_wrap; i++) ((uint8_t *)info.ptr_wrap)[i] = seq_byte(pos + n_lin + i);
+            tu_fifo_advance_write_pointer(&fifo_stream_ff, n_lin + n_wrap);
+            n = n_lin + n_wrap;
+        }
+        pos += n;
+        // full: let the reader run if it shares the core
+        if (n == 0) sched_yield();
+    }
+    return NULL;
+}
+
+static inline void check_bytes(fifo_stream_t *s, const uint8_t *p, uint16_t n, uint32_t pos)
+{
+    for (uint16_t i = 0; i < n; i++) {
+        if (p[i] != seq_byte(pos + i)) {
+            if (s->n_bad++ == 0) s->first_bad = pos + i;
+        }
+    }
+}
+
+static void *reader_thread(void *arg)
+{
+    fifo_stream_t *s = arg;
+    uint8_t chunk[FIFO_STREAM_MAX_LEN];
+    uint32_t rng = 0x9e3779b9;
+    uint32_t pos = 0;
+
+    while (pos < s->n_bytes) {
+        uint16_t n, got;
+        uint32_t r = next_call(s, &rng, &n);
+
+        if (r & 0x80000000u) {
+            got = tu_fifo_read_n(&fifo_stream_ff, chunk, n);
+            check_bytes(s, chunk, got, pos);
+        }
+        else {
+            tu_fifo_buffer_info_t info;
+            tu_fifo_get_read_info(&fifo_stream_ff, &info);
+            uint16_t n_lin = TU_MIN(n, info.len_lin);
+            uint16_t n_wrap = TU_MIN((uint16_t)(n - n_lin), info.len_wrap);
+            check_bytes(s, info.ptr_lin, n_lin, pos);
+            check_bytes(s, info.ptr_wrap, n_wrap, pos + n_lin);
+            tu_fifo_advance_read_pointer(&fifo_stream_ff, n_lin + n_wrap);
+            got = n_lin + n_wrap;
+        }
+        if (got == 0) {
+            s->n_empty++;
+            sched_yield();
+        }
+        pos += got;
+    }
+    return NULL;
+}
+
+uint64_t fifo_stream_run(fifo_stream_t *s)
+{
+    pthread_t writer, reader;
+
+    s->n_bad = 0;
+    s->first_bad = 0;
+    s->n_empty = 0;
+
+    uint64_t t0 = fifo_stream_now_ns();
+    pthread_create(&reader, NULL, reader_thread, s);
+    pthread_create(&writer, NULL, writer_thread, s);
+    pthread_join(writer, NULL);
+    pthread_join(reader, NULL);
+    return fifo_stream_now_ns() - t0;
+}
+
+uint64_t fifo_stream_now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000u + (uint64_t)ts.tv_nsec;
+}
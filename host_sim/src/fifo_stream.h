@@ -0,0 +1,39 @@
+/*
+ * A byte stream through a tu_fifo between a writer and a reader thread, shared by
+ * test_fifo_spsc and bench_fifo_spsc. The FIFO is the size of the audio EP FIFOs and
+ * has its mutexes from the pthread OSAL of include/tusb_os_custom.h, as on the target.
+ */
+#ifndef _FIFO_STREAM_H_
+#define _FIFO_STREAM_H_
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "tusb_fifo.h"
+
+#define FIFO_STREAM_SIZE      1024
+#define FIFO_STREAM_MAX_LEN   400
+
+extern tu_fifo_t fifo_stream_ff;
+extern osal_mutex_def_t fifo_stream_mutex_wr, fifo_stream_mutex_rd;
+
+typedef struct {
+    uint16_t len;           // bytes per call, at most FIFO_STREAM_MAX_LEN
+    bool random;            // 1..len bytes per call at random, copying and in place calls mixed
+    uint32_t n_bytes;       // length of the stream
+
+    uint32_t n_bad;         // bytes that differ from the stream
+    uint32_t first_bad;
+    uint32_t n_empty;       // reads that found the FIFO empty
+} fifo_stream_t;
+
+// (Re)configures fifo_stream_ff empty, with or without tu_fifo_config_spsc()
+void fifo_stream_setup(bool spsc);
+
+// Runs the whole stream through fifo_stream_ff, both threads flat out; returns the
+// wall time it took in ns. The reader checks every byte.
+uint64_t fifo_stream_run(fifo_stream_t *s);
+
+// Host monotonic clock in ns
+uint64_t fifo_stream_now_ns(void);
+
+#endif
@@ -0,0 +1,163 @@
+/*
+ * Host simulation of the USB audio dongle.
+ *
+ * The firmware sources in main/src are compiled unchanged for the host and
+ * linked against the real tinyusb audio class driver (audio_device.c) and
+ * tu_fifo. The hardware below them -- the DWC2 controller, the USB host and
+ * the I2S peripheral -- is replaced by the models declared here. Everything
+ * runs on one thread against a simulated clock, so a second of audio takes
+ * as long as the code under test needs and no longer.
+ */
+#ifndef _SIM_H_
+#define _SIM_H_
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdio.h>
+
+//--------------------------------------------------------------------+
+// Simulated time
+//--------------------------------------------------------------------+
+uint64_t sim_now_ns(void);
+void     sim_advance_ns(uint64_t ns);
+void     sim_reset_time(void);
+
+// Host monotonic clock in ns, used to measure CPU time spent in firmware code
+uint64_t sim_cpu_ns(void);
+
+// Task whose notifications ulTaskNotifyTake() takes (the sim has no scheduler)
+void     sim_set_current_task(void *task);
+uint32_t sim_task_notify_count(void *task);
+
+// Core the code run next is on, for esp_cpu_get_core_id(): 0 for the tinyusb task, 1 for
+// the capture and playback tasks
+void     sim_set_core(int core);
+
+//--------------------------------------------------------------------+
+// Per call timing statistics
+//--------------------------------------------------------------------+
+typedef struct {
+    uint64_t calls;
+    uint64_t total_ns;
+    uint64_t min_ns;
+    uint64_t max_ns;
+} sim_timing_t;
+
+void sim_timing_reset(sim_timing_t *t);
+void sim_timing_add(sim_timing_t *t, uint64_t ns);
+
+//--------------------------------------------------------------------+
+// I2S model
+//--------------------------------------------------------------------+
+typedef struct {
+    uint64_t rx_frames_read;       // frames handed to i2s_channel_read() callers
+    uint64_t rx_overrun_frames;    // frames lost because the RX DMA ring wrapped before being read
+    uint64_t rx_overrun_buffers;   // the same in DMA buffers, each reported to on_recv_q_ovf
+    uint64_t rx_short_reads;       // reads that returned less than requested
+    uint64_t tx_frames_written;    // frames accepted by i2s_channel_write()
+    uint64_t tx_underrun_frames;   // frames the TX DMA had to fill with silence
+    uint64_t tx_underrun_buffers;  // the same in DMA buffers, each reported to on_send_q_ovf
+    uint64_t tx_short_writes;      // writes that could not be accepted completely
+    int32_t  tx_peak;              // largest |slot| written, 32 bit MSB aligned
+    uint64_t tx_low_bits_set;      // slots with bits below the 16 bit sample set (only below unity gain)
+    uint64_t tx_pad_bits_set;      // slots with bits below the 24 bit sample set (never)
+} sim_i2s_stats_t;
+
+void sim_i2s_get_stats(sim_i2s_stats_t *stats);
+void sim_i2s_reset_stats(void);
+
+// Frames written to the TX channel that the DMA has not played yet
+uint32_t sim_i2s_tx_queued_frames(void);
+
+// Frames the RX DMA has completed that have not been read yet
+uint32_t sim_i2s_rx_queued_frames(void);
+
+// DIN wired to DOUT: the RX channel receives what the TX channel sends instead of the mic tones
+void sim_i2s_set_loopback(bool on);
+
+// The RX channel receives the echo of a small room (a handful of reflections 1.5 to 15 ms at
+// 16 kHz after the sound left DOUT) instead of the mic tones
+void sim_i2s_set_echo(bool on);
+
+// Error of the I2S clock (both channels) for channels enabled from now on
+void sim_i2s_set_clock_ppm(double ppm);
+
+// Advances simulated time to t_ns, calling the DMA completion callbacks on the way
+void sim_i2s_run_until(uint64_t t_ns);
+
+//--------------------------------------------------------------------+
+// USB bus model (device controller + host)
+//--------------------------------------------------------------------+
+typedef struct {
+    uint64_t in_packets;           // isochronous IN packets collected by the host
+    uint64_t in_bytes;
+    uint64_t in_nominal_bytes;     // the same number of packets at the nominal rate
+    uint64_t in_short_packets;     // IN packets smaller than the nominal size of that frame
+    uint64_t in_long_packets;      // IN packets larger than the nominal size of that frame
+    uint64_t in_zlp;               // zero length IN packets
+    uint64_t out_packets;          // isochronous OUT packets sent by the host
+    uint64_t out_bytes;
+    uint64_t out_overrun_bytes;    // OUT bytes that did not fit into the EP OUT FIFO
+    int32_t  out_peak;             // largest |sample| sent, at the resolution of the stream
+    uint64_t in_fine_samples;      // 24 bit IN samples with bits below the top 16 set
+    uint64_t in_pad_bits_set;      // 24 bit IN samples with bits of the pad byte set
+    uint64_t fb_reads;             // values read from the speaker feedback EP
+    uint64_t xfer_errors;          // audiod_xfer_cb() returned false
+    sim_timing_t out_xfer_cb;      // CPU time of the EP OUT transfer complete handling
+    uint64_t markers_out;          // latency markers sent (sim_usb_set_markers())
+    uint64_t markers_in;           // of those, found again in the IN stream
+    uint32_t rt_min_frames;        // host round trip of a marker, OUT frame to IN frame
+    uint32_t rt_max_frames;
+    uint64_t rt_sum_frames;
+    uint64_t lb_frames;            // loopback check (sim_usb_set_loopback_check()): IN frames equal to the OUT frame they line up with
+    uint64_t lb_mismatches;        // IN frames different from it, or from any recent OUT frame
+    uint64_t lb_silent;            // silent IN frames after the first alignment
+    uint64_t lb_skipped;           // IN frames before the first alignment
+    uint64_t lb_alignments;        // times the IN stream was lined up with the OUT stream
+    uint32_t lb_offset_frames;     // OUT frames sent after the one the last alignment found: the round trip
+} sim_usb_stats_t;
+
+void sim_usb_enumerate(void);
+bool sim_usb_set_sample_rate(uint32_t sample_rate);
+bool sim_usb_set_interface(uint8_t itf, uint8_t alt);
+
+// Bytes per audio frame of a streaming interface alternate setting (0: closed)
+uint16_t sim_usb_frame_bytes(uint8_t alt);
+
+// Runs one full speed frame: SOF, then the host reads the feedback EP, collects
+// the pending IN packet and sends one OUT packet on every streaming interface
+// that is open
+void sim_usb_frame(void);
+
+// With use == false the host ignores the feedback EP and always sends the nominal
+// packet size, like a host treating the speaker as adaptive
+void sim_usb_use_feedback(bool use);
+
+// Last feedback value the host read, frames per frame in 16.16 (0: none yet)
+uint32_t sim_usb_feedback(void);
+
+// Latency mode: instead of the tone the host sends a chirp of SIM_MARKER_MS every period_ms,
+// silence in between, and finds the chirps again in the IN stream (0: back to the tone)
+#define SIM_MARKER_MS 5
+void sim_usb_set_markers(uint32_t period_ms);
+
+// Loopback check, for the firmware's digital loopback: the host sends a pseudo random
+// sequence, lines the IN stream up with it at the first frame that is not silent and then
+// compares each IN frame with the OUT frame it lines up with, at the resolution of the
+// coarser of the two streams. A silent frame or a mismatch ends the alignment; the next
+// frame that is not silent is lined up again.
+#define SIM_LB_SEARCH_FRAMES 4096
+void sim_usb_set_loopback_check(bool on);
+
+// The host writes the OUT stream it sends and the IN stream it receives to the files, as 16 bit
+// stereo PCM (the top 16 bits of 24 bit samples); NULL: not recorded
+void sim_usb_record(FILE *out, FILE *in);
+
+// The host sends no OUT packets for the next n_frames frames
+void sim_usb_skip_out(uint32_t n_frames);
+
+void sim_usb_get_stats(sim_usb_stats_t *stats);
+void sim_usb_reset_stats(void);
+
+#endif
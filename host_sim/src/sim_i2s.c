@@ -0,0 +1,429 @@
+/*
+ * Clocked model of the ESP32-S3 I2S peripheral in standard (Philips) mode.
+ *
+ * Each channel owns a ring of dma_desc_num buffers of dma_frame_num frames,
+ * like the GDMA descriptor list in the real driver. The wire runs off the
+ * simulated clock: frames become readable (RX) or are consumed (TX) as
+ * sim_now_ns() advances, a whole DMA buffer at a time. Reads never block --
+ * there is nobody else to advance the clock -- so a read that cannot be
+ * satisfied completely returns what is there with ESP_ERR_TIMEOUT, which is
+ * what a zero-timeout read on the target does. Writes take what the DMA
+ * would free within their timeout, see i2s_channel_write().
+ *
+ * RX: the microphone is an INMP441-like source producing 24 bit samples left
+ *     aligned in 32 bit slots: a 1 kHz tone on the left channel and a 440 Hz
+ *     tone on the right, both at -6 dBFS. With sim_i2s_set_loopback() DIN is
+ *     wired to DOUT instead: the RX channel receives the slots the TX channel
+ *     sends, in the same frame of the shared word clock. With sim_i2s_set_echo()
+ *     it receives an echo of them instead: the speaker mixed to mono through a
+ *     few reflections, as a room returns it to the mic, with no near end.
+ * TX: when the DMA reaches a buffer that was not written it plays silence
+ *     (auto_clear) and the missing frames are counted as an underrun. The
+ *     written slots are only inspected for their peak and low bits.
+ *
+ * The I2S clock can be set off its nominal rate by a number of ppm, as a real
+ * crystal is, to run it against the USB frame clock. The DMA completion
+ * callbacks (on_sent / on_recv) are called at the exact simulated time each
+ * buffer finishes, from sim_i2s_run_until(). The queue overflow callbacks
+ * (on_recv_q_ovf / on_send_q_ovf) are called once for every DMA buffer of an
+ * overrun or underrun, late: when the read or write that finds it is made.
+ */
+#include <math.h>
+#include <string.h>
+#include "driver/i2s_std.h"
+#include "sim.h"
+
+#define SIM_I2S_MAX_CHANNELS   4
+#define SIM_WIRE_FRAMES        8192     // TX frames kept for the loopback, a power of 2
+
+struct i2s_channel_obj_t {
+    bool     in_use;
+    bool     is_tx;
+    bool     enabled;
+    uint32_t dma_desc_num;
+    uint32_t dma_frame_num;
+    uint32_t sample_rate;
+    uint32_t n_slots;
+    uint32_t slot_bytes;
+    uint64_t enable_ns;     // sim time at which the channel was enabled
+    uint64_t rate_nhz;      // actual frame rate, including the clock error, in nHz
+    i2s_event_callbacks_t cbs;
+    void    *cb_ctx;
+    uint64_t cb_buffers;    // DMA buffers reported to the callbacks since the channel was enabled
+    uint64_t pos;           // RX: frames handed to the reader, TX: frames written
+    bool     tx_started;    // TX: first write seen, underruns are counted from here
+    uint64_t tx_first;      // TX: frame of the first write
+};
+
+static struct i2s_channel_obj_t s_channels[SIM_I2S_MAX_CHANNELS];
+static sim_i2s_stats_t s_stats;
+static double s_clock_ppm;
+static bool s_loopback;
+static bool s_echo;
+static int32_t s_wire[SIM_WIRE_FRAMES][2];      // TX frame n in s_wire[n % SIM_WIRE_FRAMES]
+
+// The room of sim_i2s_set_echo(): delay in frames and gain of each reflection
+static const struct { uint32_t delay; double gain; } s_room[] = {
+    { 24, 0.30 }, { 37, -0.20 }, { 61, 0.12 }, { 95, -0.07 }, { 150, 0.04 }, { 230, -0.02 },
+};
+
+void sim_i2s_set_loopback(bool on)
+{
+    s_loopback = on;
+}
+
+void sim_i2s_set_echo(bool on)
+{
+    s_echo = on;
+}
+
+void sim_i2s_set_clock_ppm(double ppm)
+{
+    s_clock_ppm = ppm;
+}
+
+void sim_i2s_get_stats(sim_i2s_stats_t *stats)
+{
+    *stats = s_stats;
+}
+
+void sim_i2s_reset_stats(void)
+{
+    memset(&s_stats, 0, sizeof(s_stats));
+}
+
+// Frames clocked over the wire since the channel was enabled, rounded down
+// to whole DMA buffers since the driver only sees completed descriptors
+static uint64_t clocked_frames(const struct i2s_channel_obj_t *ch)
+{
+    uint64_t frames = (uint64_t)((unsigned __int128)(sim_now_ns() - ch->enable_ns) * ch->rate_nhz / 1000000000000000000ull);
+    return frames - frames % ch->dma_frame_num;
+}
+
+// Sim time at which DMA buffer n (counting from 1) is complete
+static uint64_t buffer_done_ns(const struct i2s_channel_obj_t *ch, uint64_t n)
+{
+    unsigned __int128 frames_e18 = (unsigned __int128)(n * ch->dma_frame_num) * 1000000000000000000ull;
+    return ch->enable_ns + (uint64_t)((frames_e18 + ch->rate_nhz - 1) / ch->rate_nhz);
+}
+
+static uint64_t ring_frames(const struct i2s_channel_obj_t *ch)
+{
+    return (uint64_t)ch->dma_desc_num * ch->dma_frame_num;
+}
+
+// Reports n_frames lost or played as silence to the queue overflow callback, a DMA buffer at a time
+static uint64_t report_q_ovf(struct i2s_channel_obj_t *ch, uint64_t n_frames)
+{
+    i2s_isr_callback_t cb = ch->is_tx ? ch->cbs.on_send_q_ovf : ch->cbs.on_recv_q_ovf;
+    uint64_t n_buffers = (n_frames + ch->dma_frame_num - 1) / ch->dma_frame_num;
+    i2s_event_data_t event = { .data = NULL, .size = ch->dma_frame_num * ch->n_slots * ch->slot_bytes };
+
+    for (uint64_t i = 0; cb && i < n_buffers; i++) cb(ch, &event, ch->cb_ctx);
+    return n_buffers;
+}
+
+static struct i2s_channel_obj_t *alloc_channel(const i2s_chan_config_t *chan_cfg, bool is_tx)
+{
+    for (int i = 0; i < SIM_I2S_MAX_CHANNELS; i++) {
+        struct i2s_channel_obj_t *ch = &s_channels[i];
+        if (!ch->in_use) {
+            memset(ch, 0, sizeof(*ch));
+            ch->in_use = true;
+            ch->is_tx = is_tx;
+            ch->dma_desc_num = chan_cfg->dma_desc_num;
+            ch->dma_frame_num = chan_cfg->dma_frame_num;
+            return ch;
+        }
+    }
+    return NULL;
+}
+
+esp_err_t i2s_new_channel(const i2s_chan_config_t *chan_cfg, i2s_chan_handle_t *ret_tx_handle, i2s_chan_handle_t *ret_rx_handle)
+{
+    if (chan_cfg == NULL || chan_cfg->dma_desc_num < 2 || chan_cfg->dma_frame_num == 0) return ESP_ERR_INVALID_ARG;
+
+    if (ret_tx_handle) {
+        *ret_tx_handle = alloc_channel(chan_cfg, true);
+        if (*ret_tx_handle == NULL) return ESP_ERR_NOT_FOUND;
+    }
+    if (ret_rx_handle) {
+        *ret_rx_handle = alloc_channel(chan_cfg, false);
+        if (*ret_rx_handle == NULL) return ESP_ERR_NOT_FOUND;
+    }
+    return ESP_OK;
+}
+
+esp_err_t i2s_del_channel(i2s_chan_handle_t handle)
+{
+    if (handle == NULL || !handle->in_use) return ESP_ERR_INVALID_ARG;
+    if (handle->enabled) return ESP_ERR_INVALID_STATE;
+    handle->in_use = false;
+    return ESP_OK;
+}
+
+esp_err_t i2s_channel_init_std_mode(i2s_chan_handle_t handle, const i2s_std_config_t *std_cfg)
+{
+    if (handle == NULL || std_cfg == NULL) return ESP_ERR_INVALID_ARG;
+    handle->sample_rate = std_cfg->clk_cfg.sample_rate_hz;
+    handle->n_slots = std_cfg->slot_cfg.slot_mode;
+    handle->slot_bytes = std_cfg->slot_cfg.data_bit_width / 8;
+    return ESP_OK;
+}
+
+esp_err_t i2s_channel_reconfig_std_clock(i2s_chan_handle_t handle, const i2s_std_clk_config_t *clk_cfg)
+{
+    if (handle == NULL || clk_cfg == NULL) return ESP_ERR_INVALID_ARG;
+    if (handle->enabled) return ESP_ERR_INVALID_STATE;
+    handle->sample_rate = clk_cfg->sample_rate_hz;
+    return ESP_OK;
+}
+
+esp_err_t i2s_channel_enable(i2s_chan_handle_t handle)
+{
+    if (handle == NULL || handle->sample_rate == 0) return ESP_ERR_INVALID_STATE;
+    if (handle->enabled) return ESP_ERR_INVALID_STATE;
+    handle->enabled = true;
+    handle->enable_ns = sim_now_ns();
+    handle->rate_nhz = (uint64_t)llround(handle->sample_rate * (1e9 + s_clock_ppm * 1e3));
+    handle->cb_buffers = 0;
+    handle->pos = 0;
+    handle->tx_started = false;
+    return ESP_OK;
+}
+
+esp_err_t i2s_channel_disable(i2s_chan_handle_t handle)
+{
+    if (handle == NULL || !handle->enabled) return ESP_ERR_INVALID_STATE;
+    handle->enabled = false;
+    return ESP_OK;
+}
+
+esp_err_t i2s_channel_register_event_callback(i2s_chan_handle_t handle, const i2s_event_callbacks_t *callbacks, void *user_data)
+{
+    if (handle == NULL || callbacks == NULL) return ESP_ERR_INVALID_ARG;
+    if (handle->enabled) return ESP_ERR_INVALID_STATE;
+    handle->cbs = *callbacks;
+    handle->cb_ctx = user_data;
+    return ESP_OK;
+}
+
+void sim_i2s_run_until(uint64_t t_ns)
+{
+    for (;;) {
+        struct i2s_channel_obj_t *next = NULL;
+        uint64_t next_ns = t_ns;
+        for (int i = 0; i < SIM_I2S_MAX_CHANNELS; i++) {
+            struct i2s_channel_obj_t *ch = &s_channels[i];
+            if (!ch->in_use || !ch->enabled) continue;
+            if (!(ch->is_tx ? ch->cbs.on_sent : ch->cbs.on_recv)) continue;
+            uint64_t done = buffer_done_ns(ch, ch->cb_buffers + 1);
+            if (done <= next_ns) {
+                next = ch;
+                next_ns = done;
+            }
+        }
+        if (next == NULL) break;
+
+        if (next_ns > sim_now_ns()) sim_advance_ns(next_ns - sim_now_ns());
+        next->cb_buffers++;
+        i2s_event_data_t event = { .data = NULL, .size = next->dma_frame_num * next->n_slots * next->slot_bytes };
+        if (next->is_tx) next->cbs.on_sent(next, &event, next->cb_ctx);
+        else             next->cbs.on_recv(next, &event, next->cb_ctx);
+    }
+    if (t_ns > sim_now_ns()) sim_advance_ns(t_ns - sim_now_ns());
+}
+
+// Test signal of the simulated microphone for frame number n. The sine comes
+// from a table so that the model does not dominate the capture timings.
+#define SINE_TABLE_BITS 12
+static int32_t s_sine[1 << SINE_TABLE_BITS];
+
+static int32_t sine_at(uint64_t n, uint32_t freq, uint32_t rate)
+{
+    if (s_sine[1 << (SINE_TABLE_BITS - 2)] == 0) {
+        for (int i = 0; i < (1 << SINE_TABLE_BITS); i++) {
+            s_sine[i] = (int32_t)(0.5 * 2147483647.0 * sin(2.0 * M_PI * i / (1 << SINE_TABLE_BITS)));
+        }
+    }
+    uint64_t phase = (n * freq % rate) * (1u << SINE_TABLE_BITS) / rate;
+    return s_sine[phase];
+}
+
+static void mic_frame(const struct i2s_channel_obj_t *ch, uint64_t n, int32_t *slots)
+{
+    // INMP441: 24 valid bits, the low byte of the slot is always zero
+    slots[0] = sine_at(n, 1000, ch->sample_rate) & ~0xff;
+    slots[1] = sine_at(n,  440, ch->sample_rate) & ~0xff;
+}
+
+static const struct i2s_channel_obj_t *tx_channel(void)
+{
+    for (int i = 0; i < SIM_I2S_MAX_CHANNELS; i++) {
+        const struct i2s_channel_obj_t *ch = &s_channels[i];
+        if (ch->in_use && ch->is_tx && ch->enabled) return ch;
+    }
+    return NULL;
+}
+
+// Loopback: what DOUT carried delay frames before RX frame n. The TX frame of the same instant
+// is counted from when the TX channel was enabled. Frames before the first write, and those
+// the TX DMA reached before they were written, are the silence of auto_clear.
+static void wire_frame(const struct i2s_channel_obj_t *rx, uint64_t n, uint32_t delay, int32_t *slots)
+{
+    const struct i2s_channel_obj_t *tx = tx_channel();
+    slots[0] = slots[1] = 0;
+    if (tx == NULL || !tx->tx_started) return;
+
+    int64_t offset = (int64_t)((int64_t)(rx->enable_ns - tx->enable_ns) * (double)tx->rate_nhz / 1e18 + 0.5);
+    int64_t m = (int64_t)n + offset - delay;
+    if (m < (int64_t)tx->tx_first || (uint64_t)m >= tx->pos || tx->pos - (uint64_t)m > SIM_WIRE_FRAMES) return;
+    slots[0] = s_wire[m % SIM_WIRE_FRAMES][0];
+    slots[1] = s_wire[m % SIM_WIRE_FRAMES][1];
+}
+
+// Echo: the reflections of the speaker's mono mix, the right channel 6 dB below the left
+static void echo_frame(const struct i2s_channel_obj_t *rx, uint64_t n, int32_t *slots)
+{
+    double v = 0.0;
+    for (size_t i = 0; i < sizeof(s_room) / sizeof(s_room[0]); i++) {
+        int32_t w[2];
+        wire_frame(rx, n, s_room[i].delay, w);
+        v += s_room[i].gain * ((double)w[0] + w[1]) / 2;
+    }
+    slots[0] = (int32_t)v & ~0xff;
+    slots[1] = (int32_t)(v / 2) & ~0xff;
+}
+
+esp_err_t i2s_channel_read(i2s_chan_handle_t handle, void *dest, size_t size, size_t *bytes_read, uint32_t timeout_ms)
+{
+    (void) timeout_ms;
+    if (handle == NULL || handle->is_tx) return ESP_ERR_INVALID_ARG;
+    if (!handle->enabled) return ESP_ERR_INVALID_STATE;
+
+    size_t frame_bytes = handle->n_slots * handle->slot_bytes;
+    uint64_t clocked = clocked_frames(handle);
+
+    // DMA overwrote buffers that were never read
+    if (clocked - handle->pos > ring_frames(handle)) {
+        uint64_t lost = clocked - handle->pos - ring_frames(handle);
+        s_stats.rx_overrun_frames += lost;
+        s_stats.rx_overrun_buffers += report_q_ovf(handle, lost);
+        handle->pos += lost;
+    }
+
+    uint64_t want = size / frame_bytes;
+    uint64_t n = clocked - handle->pos;
+    if (n > want) n = want;
+
+    uint8_t *p = dest;
+    for (uint64_t i = 0; i < n; i++) {
+        int32_t slots[2];
+        if (s_echo)          echo_frame(handle, handle->pos + i, slots);
+        else if (s_loopback) wire_frame(handle, handle->pos + i, 0, slots);
+        else                 mic_frame(handle, handle->pos + i, slots);
+        if (handle->slot_bytes == 4) {
+            memcpy(p, slots, handle->n_slots * 4);
+        } else {
+            for (uint32_t s = 0; s < handle->n_slots; s++) {
+                int16_t v = (int16_t)(slots[s] >> 16);
+                memcpy(p + 2 * s, &v, 2);
+            }
+        }
+        p += frame_bytes;
+    }
+    handle->pos += n;
+    s_stats.rx_frames_read += n;
+
+    if (bytes_read) *bytes_read = n * frame_bytes;
+    if (n < want) {
+        s_stats.rx_short_reads++;
+        return ESP_ERR_TIMEOUT;
+    }
+    return ESP_OK;
+}
+
+uint32_t sim_i2s_tx_queued_frames(void)
+{
+    for (int i = 0; i < SIM_I2S_MAX_CHANNELS; i++) {
+        struct i2s_channel_obj_t *ch = &s_channels[i];
+        if (ch->in_use && ch->is_tx && ch->enabled && ch->tx_started) {
+            uint64_t played = clocked_frames(ch);
+            return ch->pos > played ? (uint32_t)(ch->pos - played) : 0;
+        }
+    }
+    return 0;
+}
+
+uint32_t sim_i2s_rx_queued_frames(void)
+{
+    for (int i = 0; i < SIM_I2S_MAX_CHANNELS; i++) {
+        struct i2s_channel_obj_t *ch = &s_channels[i];
+        if (ch->in_use && !ch->is_tx && ch->enabled) {
+            uint64_t clocked = clocked_frames(ch);
+            return clocked > ch->pos ? (uint32_t)(clocked - ch->pos) : 0;
+        }
+    }
+    return 0;
+}
+
+static void inspect_tx_slots(const int32_t *slots, size_t n_slots)
+{
+    for (size_t i = 0; i < n_slots; i++) {
+        int32_t v = slots[i];
+        int32_t mag = v == INT32_MIN ? INT32_MAX : (v < 0 ? -v : v);
+        if (mag > s_stats.tx_peak) s_stats.tx_peak = mag;
+        if (v & 0xffff) s_stats.tx_low_bits_set++;
+        if (v & 0xff) s_stats.tx_pad_bits_set++;
+    }
+}
+
+esp_err_t i2s_channel_write(i2s_chan_handle_t handle, const void *src, size_t size, size_t *bytes_written, uint32_t timeout_ms)
+{
+    if (handle == NULL || !handle->is_tx) return ESP_ERR_INVALID_ARG;
+    if (!handle->enabled) return ESP_ERR_INVALID_STATE;
+
+    size_t frame_bytes = handle->n_slots * handle->slot_bytes;
+    uint64_t played = clocked_frames(handle);
+
+    if (!handle->tx_started) {
+        // Start playing from the next DMA buffer
+        handle->pos = played;
+        handle->tx_first = played;
+        handle->tx_started = true;
+    }
+    else if (played > handle->pos) {
+        // DMA ran dry and sent silence
+        s_stats.tx_underrun_frames += played - handle->pos;
+        s_stats.tx_underrun_buffers += report_q_ovf(handle, played - handle->pos);
+        uint64_t m0 = played - handle->pos > SIM_WIRE_FRAMES ? played - SIM_WIRE_FRAMES : handle->pos;
+        for (uint64_t m = m0; m < played; m++) {
+            s_wire[m % SIM_WIRE_FRAMES][0] = s_wire[m % SIM_WIRE_FRAMES][1] = 0;
+        }
+        handle->pos = played;
+    }
+
+    // On the target a write that does not fit blocks until the DMA has freed the room, for
+    // up to timeout_ms. Nothing here can advance the clock while the caller waits, so the
+    // frames the DMA frees in that time are accepted at once.
+    uint64_t space = ring_frames(handle) - (handle->pos - played);
+    space += (uint64_t)timeout_ms * handle->sample_rate / 1000 / handle->dma_frame_num * handle->dma_frame_num;
+    uint64_t want = size / frame_bytes;
+    uint64_t n = want < space ? want : space;
+
+    if (handle->slot_bytes == 4) {
+        inspect_tx_slots(src, n * handle->n_slots);
+        if (handle->n_slots == 2) {
+            for (uint64_t i = 0; i < n; i++) memcpy(s_wire[(handle->pos + i) % SIM_WIRE_FRAMES], (const int32_t *)src + 2 * i, 8);
+        }
+    }
+    handle->pos += n;
+    s_stats.tx_frames_written += n;
+
+    if (bytes_written) *bytes_written = n * frame_bytes;
+    if (n < want) {
+        s_stats.tx_short_writes++;
+        return ESP_ERR_TIMEOUT;
+    }
+    return ESP_OK;
+}
@@ -0,0 +1,602 @@
+/*
+ * uad_sim: runs the dongle firmware against the simulated USB host and I2S
+ * codec for each supported sample rate and reports throughput, the CPU time
+ * spent in the audio callbacks and in each stage of the pipeline (profiler.h)
+ * and any under/overruns.
+ *
+ * The 1 ms frame clock is accelerated: simulated time only advances between
+ * frames, so the run takes as long as the firmware code needs. The CPU time
+ * figures are host figures; they are useful for comparing implementations,
+ * not as an absolute ESP32-S3 budget.
+ *
+ * usage: uad_sim [-s seconds_per_rate] [-r sample_rate] [-b bits] [-g gap_ms] [-d ppm] [-F] [-t file] [-j file]
+ *                [-l period_ms] [-L] [-e] [-J profile] [-w prefix] [-v]
+ *
+ *   -b  16 (default) or 24: the host opens both streaming interfaces with the
+ *       alternate setting of that resolution
+ *   -g  the host stops sending speaker data for gap_ms in the middle of every
+ *       second, to exercise the stall/silence/re-prime path of the playback task;
+ *       the jitter buffer must have grown to cover the gap by the last one
+ *   -d  the I2S clock runs ppm (may be fractional or negative) off the USB frame
+ *       clock; the speaker feedback must keep the host in step with it and the mic
+ *       IN packets must carry the extra (or missing) frames
+ *   -F  the host ignores the feedback EP and sends nominal packets
+ *   -t  writes the trace rings (trace.h) to file at the end of each sample rate,
+ *       for scripts/trace_decode.py
+ *   -j  writes the firmware's statistics (audio_stats.h) to file at the end of
+ *       each sample rate, one line of JSON per rate, as the console command
+ *       "stats json" prints them
+ *   -l  latency mode: the I2S output is looped back to the input, the host sends a
+ *       chirp every period_ms instead of the tone, and the firmware measures the
+ *       round trip of each through I2S (latency.h) while the host measures it from
+ *       USB OUT to USB IN
+ *   -L  digital loopback (audio_loopback_enable()): the firmware feeds the speaker
+ *       stream back into the mic ring instead of I2S; the host sends a pseudo random
+ *       sequence and checks that it comes back bit exact (not with -l)
+ *   -e  echo: the mic hears the speaker through a simulated room (sim_i2s_set_echo())
+ *       and the firmware's echo canceller (aec.h) runs on it; it must take at least
+ *       20 dB off the echo at the sample rates it runs at
+ *   -J  profile of the speaker's jitter buffer (jitter_buf.h): low_latency, balanced
+ *       (the default) or robust
+ *   -w  writes the host's OUT and IN streams to prefix_<rate>_out.wav and
+ *       prefix_<rate>_in.wav, for scripts/latency.py
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <unistd.h>
+#include "tusb.h"
+#include "tusb_config.h"
+#include "esp_log.h"
+#include "i2s_functions.h"
+#include "uad_callbacks.h"
+#include "usb_descriptors.h"
+#include "data_buffers.h"
+#include "trace.h"
+#include "audio_stats.h"
+#include "profiler.h"
+#include "latency.h"
+#include "jitter_buf.h"
+#include "sim.h"
+
+extern uint32_t sampFreq;
+extern uint8_t clkValid;
+extern const uint32_t sampleRatesList[5];
+
+//--------------------------------------------------------------------+
+// Callback timing (linked with -Wl,--wrap=<callback>)
+//--------------------------------------------------------------------+
+static sim_timing_t t_pre_load, t_post_load, t_playback, t_capture;
+static uint32_t s_gap_ms;
+static double s_drift_ppm;
+static uint8_t s_alt = 1;       // alternate setting of both streaming interfaces
+static FILE *s_trace_file;
+static FILE *s_stats_file;
+static uint32_t s_marker_ms;
+static bool s_loopback;
+static bool s_echo;
+static const char *s_wav_prefix;
+
+bool __real_tud_audio_tx_done_pre_load_cb(uint8_t rhport, uint8_t itf, uint8_t ep_in, uint8_t cur_alt_setting);
+bool __real_tud_audio_tx_done_post_load_cb(uint8_t rhport, uint16_t n_bytes_copied, uint8_t itf, uint8_t ep_in, uint8_t cur_alt_setting);
+
+bool __wrap_tud_audio_tx_done_pre_load_cb(uint8_t rhport, uint8_t itf, uint8_t ep_in, uint8_t cur_alt_setting)
+{
+    uint64_t t0 = sim_cpu_ns();
+    bool ret = __real_tud_audio_tx_done_pre_load_cb(rhport, itf, ep_in, cur_alt_setting);
+    sim_timing_add(&t_pre_load, sim_cpu_ns() - t0);
+    return ret;
+}
+
+bool __wrap_tud_audio_tx_done_post_load_cb(uint8_t rhport, uint16_t n_bytes_copied, uint8_t itf, uint8_t ep_in, uint8_t cur_alt_setting)
+{
+    uint64_t t0 = sim_cpu_ns();
+    bool ret = __real_tud_audio_tx_done_post_load_cb(rhport, n_bytes_copied, itf, ep_in, cur_alt_setting);
+    sim_timing_add(&t_post_load, sim_cpu_ns() - t0);
+    return ret;
+}
+
+//--------------------------------------------------------------------+
+// Report
+//--------------------------------------------------------------------+
+static void print_timing(const char *name, const sim_timing_t *t)
+{
+    if (t->calls == 0) {
+        printf("  %-22s       -\n", name);
+        return;
+    }
+    printf("  %-22s %8llu calls  min %6llu  avg %6llu  max %7llu ns\n", name,
+           (unsigned long long)t->calls, (unsigned long long)t->min_ns,
+           (unsigned long long)(t->total_ns / t->calls), (unsigned long long)t->max_ns);
+}
+
+static void print_load(const char *name, const sim_timing_t *t, uint32_t n_frames)
+{
+    printf("  %-22s %5.2f %% of the 1 ms frame\n", name, t->total_ns / (n_frames * 1e6) * 100.0);
+}
+
+// 16 bit stereo WAV at the sample rate; wav_close() fills in the sizes
+static FILE *wav_open(const char *prefix, uint32_t rate, const char *stream)
+{
+    char path[512];
+    snprintf(path, sizeof(path), "%s_%lu_%s.wav", prefix, (unsigned long)rate, stream);
+    FILE *f = fopen(path, "wb");
+    if (!f) {
+        perror(path);
+        exit(2);
+    }
+    uint8_t header[44] = "RIFF\0\0\0\0WAVEfmt \x10\0\0\0\x01\0\x02\0";
+    uint32_t const byte_rate = rate * 4;
+    memcpy(header + 24, &rate, 4);
+    memcpy(header + 28, &byte_rate, 4);
+    memcpy(header + 32, "\x04\0\x10\0data", 8);
+    fwrite(header, sizeof(header), 1, f);
+    return f;
+}
+
+static void wav_close(FILE *f)
+{
+    uint32_t const size = (uint32_t)ftell(f);
+    uint32_t const riff = size - 8, data = size - 44;
+    fseek(f, 4, SEEK_SET);
+    fwrite(&riff, 4, 1, f);
+    fseek(f, 40, SEEK_SET);
+    fwrite(&data, 4, 1, f);
+    fclose(f);
+}
+
+// Returns the number of problems found
+static int run_rate(uint32_t rate, uint32_t seconds)
+{
+    int problems = 0;
+
+    if (!sim_usb_set_sample_rate(rate)) {
+        printf("%6lu Hz: SET_CUR sample frequency rejected\n", (unsigned long)rate);
+        return 1;
+    }
+    if (!sim_usb_set_interface(ITF_NUM_AUDIO_STREAMING_SPK, s_alt) ||
+        !sim_usb_set_interface(ITF_NUM_AUDIO_STREAMING_MIC, s_alt)) {
+        printf("%6lu Hz: SET_INTERFACE failed\n", (unsigned long)rate);
+        return 1;
+    }
+    trace_reset();
+    audio_stats_reset();
+    prof_reset();
+    latency_reset();
+
+    sim_timing_reset(&t_pre_load);
+    sim_timing_reset(&t_post_load);
+    sim_timing_reset(&t_playback);
+    sim_timing_reset(&t_capture);
+    sim_usb_reset_stats();
+    sim_i2s_reset_stats();
+
+    uint32_t const n_frames = seconds * 1000;
+    uint32_t const frames_per_ms = rate / 1000;
+    uint32_t const frame_bytes = sim_usb_frame_bytes(s_alt);
+    uint64_t const wall_start = sim_cpu_ns();
+    FILE *wav_out = s_wav_prefix ? wav_open(s_wav_prefix, rate, "out") : NULL;
+    FILE *wav_in = s_wav_prefix ? wav_open(s_wav_prefix, rate, "in") : NULL;
+    sim_usb_record(wav_out, wav_in);
+
+    // speaker latency: frames in the EP OUT FIFO, the jitter buffer and the I2S DMA,
+    // sampled after every playback pass once the stream has settled and before any gap
+    uint32_t lat_min = UINT32_MAX, lat_max = 0, lat_last = 0;
+    uint64_t lat_sum = 0, lat_n = 0;
+    uint32_t idle_ms = 0;
+    uint32_t n_gaps = 0;
+    uint32_t stalls_before_gap = 0, stalls_last_gap = 0;
+    uint32_t lat_steady = 0;            // the latency last seen before a gap, and the target then
+    uint32_t lat_steady_target = 0;
+    uint32_t target_ms = 0, target_frame = 0;
+
+    // speaker fill (the same measure) over the whole run once the feedback has settled,
+    // leaving out the gaps and the re-priming after them
+    uint32_t const settle_frames = 1000;
+    int32_t fill_min = INT32_MAX, fill_max = INT32_MIN;
+
+    for (uint32_t frame = 0; frame < n_frames; frame++) {
+        sim_i2s_run_until(sim_now_ns() + 1000000);
+
+        // Capture task (core 1): runs whenever a DMA buffer is complete; here
+        // once for every buffer completed during the last frame
+        uint64_t t0;
+        sim_set_core(1);
+        while (sim_i2s_rx_queued_frames() >= frames_per_ms) {
+            t0 = sim_cpu_ns();
+            i2s_capture();
+            sim_timing_add(&t_capture, sim_cpu_ns() - t0);
+        }
+        sim_set_core(0);
+
+        if (s_gap_ms && frame % 1000 == 500) {
+            sim_usb_skip_out(s_gap_ms);
+            n_gaps++;
+            stalls_before_gap = spk_stats.stall_count;
+        }
+        sim_usb_frame();
+
+        // Playback task (core 1): runs when tud_audio_rx_done_post_read_cb() has
+        // notified it, or when its wait of SPK_WAIT_MS times out
+        idle_ms++;
+        if (sim_task_notify_count(spk_task_handle) || idle_ms >= SPK_WAIT_MS) {
+            idle_ms = 0;
+            sim_set_core(1);
+            t0 = sim_cpu_ns();
+            i2s_transmit(SPK_WAIT_MS);
+            sim_timing_add(&t_playback, sim_cpu_ns() - t0);
+            sim_set_core(0);
+        }
+
+        if (s_gap_ms && frame % 1000 == 999) stalls_last_gap = spk_stats.stall_count - stalls_before_gap;
+
+        // the fill against the target of the jitter buffer, which may move; the loopback has none
+        uint32_t fill = (tud_audio_available() + audio_ring_count(&spk_jb_ring)) / frame_bytes + sim_i2s_tx_queued_frames();
+        uint32_t lat = fill * 1000 / frames_per_ms;
+        int32_t fill_off = (int32_t)fill - (s_loopback ? 0 : (int32_t)jb_target_frames(&spk_jb));
+        lat_last = lat;
+        if (frame >= 10 && frame < 500) {
+            if (lat < lat_min) lat_min = lat;
+            if (lat > lat_max) lat_max = lat;
+            lat_sum += lat;
+            lat_n++;
+        }
+        if (!s_gap_ms || frame % 1000 < 500) {
+            lat_steady = lat;
+            lat_steady_target = spk_jb.target_ms * 1000;
+        }
+        // a new target takes the steering a while, JB_WARP_FRAMES for each frame
+        if (spk_jb.target_ms != target_ms) {
+            target_ms = spk_jb.target_ms;
+            target_frame = frame;
+        }
+        if (frame >= settle_frames && frame >= target_frame + 500 && (!s_gap_ms || frame % 1000 < 500)) {
+            if (fill_off < fill_min) fill_min = fill_off;
+            if (fill_off > fill_max) fill_max = fill_off;
+        }
+    }
+    uint32_t const feedback = sim_usb_feedback();
+    if (s_trace_file) trace_dump(s_trace_file);
+    if (s_stats_file) audio_stats_print_json(s_stats_file);
+
+    uint64_t const wall_ns = sim_cpu_ns() - wall_start;
+    sim_usb_record(NULL, NULL);
+    if (wav_out) wav_close(wav_out);
+    if (wav_in) wav_close(wav_in);
+    uint32_t const spk_fifo_left = tud_audio_available() + audio_ring_count(&spk_jb_ring);
+    jitter_buf_t const jb = spk_jb;
+
+    sim_usb_set_interface(ITF_NUM_AUDIO_STREAMING_MIC, 0);
+    sim_usb_set_interface(ITF_NUM_AUDIO_STREAMING_SPK, 0);
+
+    sim_usb_stats_t usb;
+    sim_i2s_stats_t i2s;
+    sim_usb_get_stats(&usb);
+    sim_i2s_get_stats(&i2s);
+
+    double const sim_s = n_frames / 1000.0;
+    double const nominal = (double)rate * frame_bytes;
+    unsigned const bits = s_alt == 2 ? 24 : 16;
+
+    printf("%6lu Hz %2u bit: %u ms simulated in %.1f ms (%.0fx real time, %.0f frames/s)\n",
+           (unsigned long)rate, bits, n_frames, wall_ns / 1e6, sim_s * 1e9 / wall_ns, n_frames * 1e9 / wall_ns);
+    printf("  mic  IN  %9.0f B/s (nominal %.0f)  packets %llu  short %llu  long %llu  zlp %llu\n",
+           usb.in_bytes / sim_s, nominal, (unsigned long long)usb.in_packets,
+           (unsigned long long)usb.in_short_packets, (unsigned long long)usb.in_long_packets,
+           (unsigned long long)usb.in_zlp);
+    printf("  mic  sizing  N+1 %lu  N-1 %lu  last second +%u/-%u  most in a second %u\n",
+           (unsigned long)mic_pkt_sched.long_packets, (unsigned long)mic_pkt_sched.short_packets,
+           mic_pkt_sched.last_long, mic_pkt_sched.last_short, mic_pkt_sched.max_per_sec);
+    printf("  spk  OUT %9.0f B/s (nominal %.0f)  packets %llu  fifo overrun %llu B\n",
+           usb.out_bytes / sim_s, nominal, (unsigned long long)usb.out_packets,
+           (unsigned long long)usb.out_overrun_bytes);
+    printf("  spk  play %8.0f B/s  dropped %lu B  stalls %lu  latency %lu..%lu us (avg %.0f, last %lu)  peak 0x%08lx\n",
+           spk_stats.played_bytes / sim_s, (unsigned long)spk_stats.dropped_bytes, (unsigned long)spk_stats.stall_count,
+           (unsigned long)(lat_n ? lat_min : 0), (unsigned long)lat_max, lat_n ? (double)lat_sum / lat_n : 0.0,
+           (unsigned long)lat_last, (unsigned long)i2s.tx_peak);
+    printf("  i2s  rx overrun %llu frames  short reads %llu  tx underrun %llu frames  short writes %llu\n",
+           (unsigned long long)i2s.rx_overrun_frames, (unsigned long long)i2s.rx_short_reads,
+           (unsigned long long)i2s.tx_underrun_frames, (unsigned long long)i2s.tx_short_writes);
+    printf("  mic_ring fill %lu..%lu B  underruns %lu (%lu B)  overrun %lu B\n",
+           (unsigned long)mic_ring.fill_min, (unsigned long)mic_ring.fill_max, (unsigned long)mic_ring.underrun_count,
+           (unsigned long)mic_ring.underrun_bytes, (unsigned long)mic_ring.overrun_bytes);
+    if (!s_loopback) {
+        printf("  spk  ");
+        jb_print(&jb, stdout);
+    }
+    if (fill_max >= fill_min) {
+        printf("  spk  fill %+ld..%+ld frames off the target after %lu ms  last feedback %.4f frames/ms (I2S clock %.3f Hz, %+.2f ppm)\n",
+               (long)fill_min, (long)fill_max, (unsigned long)settle_frames,
+               feedback / 65536.0, feedback / 65.536, (feedback / 65.536 / rate - 1.0) * 1e6);
+    }
+    print_timing("i2s capture", &t_capture);
+    print_timing("tx_done_pre_load_cb", &t_pre_load);
+    print_timing("tx_done_post_load_cb", &t_post_load);
+    print_timing("ep out xfer_cb", &usb.out_xfer_cb);
+    print_timing("i2s playback", &t_playback);
+    print_load("i2s playback", &t_playback, n_frames);
+    prof_print(stdout);
+    if (s_marker_ms) {
+        printf("  ");
+        latency_print(stdout);
+        if (usb.markers_in) {
+            printf("  host round trip %.3f..%.3f ms (avg %.3f), markers %llu sent, %llu back\n",
+                   usb.rt_min_frames * 1e3 / rate, usb.rt_max_frames * 1e3 / rate,
+                   (double)usb.rt_sum_frames / usb.markers_in * 1e3 / rate,
+                   (unsigned long long)usb.markers_out, (unsigned long long)usb.markers_in);
+        }
+    }
+    if (s_echo) {
+        printf("  ");
+        mic_aec_print(stdout);
+    }
+    if (s_loopback) {
+        printf("  loopback %llu frames bit exact, %llu mismatched, %llu silent, %llu before the first;"
+               " %llu alignments, round trip %.3f ms\n",
+               (unsigned long long)usb.lb_frames, (unsigned long long)usb.lb_mismatches,
+               (unsigned long long)usb.lb_silent, (unsigned long long)usb.lb_skipped,
+               (unsigned long long)usb.lb_alignments, usb.lb_offset_frames * 1e3 / rate);
+    }
+
+    if (usb.xfer_errors) {
+        printf("  FAIL: %llu transfer errors\n", (unsigned long long)usb.xfer_errors);
+        problems++;
+    }
+    // the IN packet sizing keeps the ring where it settled whatever the clock error. In the
+    // loopback the gaps of the OUT stream are gaps of the mic source: the ring runs dry and
+    // the sizing is thrown off each time.
+    bool const mic_gaps = s_loopback && s_gap_ms;
+    if ((!mic_gaps && mic_ring.underrun_count) || mic_ring.overrun_bytes || i2s.rx_overrun_frames) {
+        printf("  FAIL: mic data lost: mic_ring under/overrun, I2S rx overrun\n");
+        problems++;
+    }
+    // IN packets are the nominal size of their frame or one frame off it, and without a
+    // clock error exactly the nominal size: n packets carry n * rate / 1000 frames
+    int64_t const in_off = (int64_t)usb.in_bytes - (int64_t)usb.in_nominal_bytes;
+    if (in_off != frame_bytes * ((int64_t)usb.in_long_packets - (int64_t)usb.in_short_packets) ||
+        (s_drift_ppm == 0 && !mic_gaps && in_off != 0)) {
+        printf("  FAIL: IN packets carried %lld B more than the nominal rate (%llu long, %llu short)\n",
+               (long long)in_off, (unsigned long long)usb.in_long_packets, (unsigned long long)usb.in_short_packets);
+        problems++;
+    }
+    // one frame more (or less) per frame of clock error, and no hunting back and forth. The
+    // ring takes whole DMA buffers, so up to one buffer of the error can still be in it.
+    double const drift_frames = rate * s_drift_ppm * 1e-6 * sim_s;
+    double const net = (double)mic_pkt_sched.long_packets - (double)mic_pkt_sched.short_packets;
+    double const slack = frames_per_ms + 2;
+    if (!mic_gaps && (fabs(net - drift_frames) > slack ||
+        mic_pkt_sched.long_packets + mic_pkt_sched.short_packets > fabs(drift_frames) + slack)) {
+        printf("  FAIL: %lu long and %lu short IN packets for %.1f frames of clock error\n",
+               (unsigned long)mic_pkt_sched.long_packets, (unsigned long)mic_pkt_sched.short_packets, drift_frames);
+        problems++;
+    }
+    if (usb.in_packets < n_frames - 1) {
+        printf("  FAIL: host collected %llu IN packets in %u frames\n", (unsigned long long)usb.in_packets, n_frames);
+        problems++;
+    }
+    // everything the host sent is played, but for the frames the jitter buffer put in or took
+    // out, or still waiting in the FIFO and the jitter buffer
+    int64_t const stretched = ((int64_t)jb.inserted - (int64_t)jb.deleted) * frame_bytes;
+    if (spk_stats.dropped_bytes || i2s.tx_short_writes ||
+        spk_stats.played_bytes - stretched + spk_fifo_left != usb.out_bytes) {
+        printf("  FAIL: speaker data lost: sent %llu B, played %lu B (%+lld B stretched), left in FIFO and jitter buffer %lu B\n",
+               (unsigned long long)usb.out_bytes, (unsigned long)spk_stats.played_bytes, (long long)stretched,
+               (unsigned long)spk_fifo_left);
+        problems++;
+    }
+    // unity gain: the samples come out MSB aligned and unchanged, the 24 bit ones with
+    // all their bits and nothing in the pad byte
+    bool const spk_exact = s_alt == 2 ? i2s.tx_low_bits_set != 0 && i2s.tx_pad_bits_set == 0
+                                      : i2s.tx_low_bits_set == 0;
+    if (!s_loopback && (!spk_exact || (i2s.tx_peak >> (32 - bits)) != usb.out_peak)) {
+        printf("  FAIL: speaker samples not MSB aligned at unity gain (peak 0x%08lx, %llu slots with bits below 16, %llu below 24)\n",
+               (unsigned long)i2s.tx_peak, (unsigned long long)i2s.tx_low_bits_set, (unsigned long long)i2s.tx_pad_bits_set);
+        problems++;
+    }
+    // the 24 bit mic samples keep the bits the 16 bit format drops
+    if (s_alt == 2 && (usb.in_fine_samples == 0 || usb.in_pad_bits_set)) {
+        printf("  FAIL: 24 bit mic samples: %llu with bits below 16, %llu with the pad byte set\n",
+               (unsigned long long)usb.in_fine_samples, (unsigned long long)usb.in_pad_bits_set);
+        problems++;
+    }
+    // the firmware's own counters agree with what the host and the I2S model saw; the host
+    // may not have collected the last IN packet yet
+    const audio_stats_t *st = &audio_stats;
+    uint32_t const overruns = st->mic.i2s_overruns - st->mic.i2s_overruns_base;
+    uint32_t const underruns = st->spk.i2s_underruns - st->spk.i2s_underruns_base;
+    if (st->spk.packets != usb.out_packets || st->spk.short_packets ||
+        st->mic.packets < usb.in_packets || st->mic.packets > usb.in_packets + 1 ||
+        st->mic.i2s_read_errors != i2s.rx_short_reads || overruns != i2s.rx_overrun_buffers ||
+        underruns != (s_loopback ? 0 : i2s.tx_underrun_buffers) ||
+        st->timing[STATS_RX_DONE].n != st->spk.packets || st->timing[STATS_CAPTURE].n != st->mic.i2s_reads) {
+        printf("  FAIL: audio_stats: OUT %lu (short %lu) IN %lu, I2S read errors %lu overruns %lu underruns %lu;"
+               " host OUT %llu IN %llu, I2S short reads %llu overruns %llu underruns %llu buffers\n",
+               (unsigned long)st->spk.packets, (unsigned long)st->spk.short_packets, (unsigned long)st->mic.packets,
+               (unsigned long)st->mic.i2s_read_errors, (unsigned long)overruns,
+               (unsigned long)underruns, (unsigned long long)usb.out_packets,
+               (unsigned long long)usb.in_packets, (unsigned long long)i2s.rx_short_reads,
+               (unsigned long long)i2s.rx_overrun_buffers, (unsigned long long)i2s.tx_underrun_buffers);
+        problems++;
+    }
+    // silence only around the gaps: at most the gap plus the time to prime the jitter buffer
+    // again each time. The loopback leaves the TX DMA to play silence all the time.
+    uint32_t const gap_silence = s_gap_ms ? n_gaps * (s_gap_ms + jb_profiles[jb.profile].max_ms) * frames_per_ms : 0;
+    if (!s_loopback && i2s.tx_underrun_frames > gap_silence) {
+        printf("  FAIL: %llu frames of speaker underrun (allowed %lu)\n",
+               (unsigned long long)i2s.tx_underrun_frames, (unsigned long)gap_silence);
+        problems++;
+    }
+    // the loopback stalls at every gap it does not have SPK_START_MS for. The jitter buffer
+    // runs dry at a gap deeper than it is and grows; given a few gaps to grow by it has
+    // stopped running dry by the last one, unless it is as deep as its profile lets it be.
+    // Without gaps it never does.
+    if (s_loopback) {
+        uint32_t const expected_stalls = s_gap_ms >= SPK_WAIT_MS ? n_gaps : 0;
+        if (spk_stats.stall_count != expected_stalls) {
+            printf("  FAIL: %lu speaker stalls, expected %lu\n", (unsigned long)spk_stats.stall_count,
+                   (unsigned long)expected_stalls);
+            problems++;
+        }
+    }
+    else if (spk_stats.stall_count != jb.underruns || (!s_gap_ms && jb.underruns) ||
+             (n_gaps >= 4 && stalls_last_gap && jb.target_ms < jb_profiles[jb.profile].max_ms)) {
+        printf("  FAIL: %lu speaker stalls, %lu jitter buffer underruns, %lu at the last gap (target %lu ms)\n",
+               (unsigned long)spk_stats.stall_count, (unsigned long)jb.underruns, (unsigned long)stalls_last_gap,
+               (unsigned long)jb.target_ms);
+        problems++;
+    }
+    // with the feedback the host follows the I2S clock and the jitter buffer keeps the depth
+    // on its target, within a packet either way, for as long as the stream runs; the
+    // latency before the last gap, or at the end, is the target. With a clock error the DMA
+    // buffers slide past the USB frames and the measure moves by up to one buffer more. A gap
+    // the jitter buffer covers leaves it short by the gap, which the steering takes back a
+    // frame in JB_WARP_FRAMES, most of the time till the next gap.
+    int32_t const fill_slack = (int32_t)frames_per_ms * (s_drift_ppm != 0 ? 2 : 1);
+    if (!s_loopback && !s_gap_ms && fill_max >= fill_min && (fill_min < -fill_slack || fill_max > fill_slack)) {
+        printf("  FAIL: speaker fill %+ld..%+ld frames off the target (allowed %ld)\n",
+               (long)fill_min, (long)fill_max, (long)fill_slack);
+        problems++;
+    }
+    // the loopback's fill stays where it started, within one packet
+    if (s_loopback && fill_max >= fill_min && fill_max - fill_min > 2 * (int32_t)frames_per_ms) {
+        printf("  FAIL: speaker fill moved over %ld frames (allowed %lu)\n",
+               (long)(fill_max - fill_min), (unsigned long)(2 * frames_per_ms));
+        problems++;
+    }
+    uint32_t const lat_target = lat_steady_target;
+    uint32_t const lat_slack = s_drift_ppm != 0 ? 2000 : 1000;
+    if (!s_loopback && (lat_steady + lat_slack < lat_target || lat_steady > lat_target + lat_slack)) {
+        printf("  FAIL: speaker latency %lu us at the end, jitter buffer target %lu us\n",
+               (unsigned long)lat_steady, (unsigned long)lat_target);
+        problems++;
+    }
+    // latency mode: every marker comes back, the last one may still be on its way, and each
+    // one takes the same time through I2S give or take the granularity of the tags: each is
+    // taken when its task gets to the block, up to a DMA buffer after the block moved
+    const latency_stats_t *ls = &latency_stats;
+    if (s_marker_ms && (ls->n == 0 || ls->n + 1 < usb.markers_out || ls->lost || ls->unmatched ||
+                        usb.markers_in + 1 < usb.markers_out ||
+                        ls->max_us - ls->min_us > 2 * I2S_DMA_BUF_US)) {
+        printf("  FAIL: latency: %lu of %llu markers back through I2S (%lu lost, %lu unmatched), %lu..%lu us;"
+               " %llu back to the host\n",
+               (unsigned long)ls->n, (unsigned long long)usb.markers_out, (unsigned long)ls->lost,
+               (unsigned long)ls->unmatched, (unsigned long)ls->min_us, (unsigned long)ls->max_us,
+               (unsigned long long)usb.markers_in);
+        problems++;
+    }
+    // loopback: every IN frame from the first one that is not silent is the OUT frame it lines
+    // up with, and it stays lined up; a gap in the OUT stream empties the ring and the stream
+    // is lined up again after it
+    uint64_t const in_frames = usb.in_bytes / frame_bytes;
+    if (s_loopback && (usb.lb_mismatches || usb.lb_alignments == 0 || usb.lb_alignments > n_gaps + 1 ||
+                       (!s_gap_ms && usb.lb_silent) ||
+                       usb.lb_frames + usb.lb_silent + usb.lb_skipped != in_frames)) {
+        printf("  FAIL: loopback: %llu of %llu IN frames bit exact, %llu mismatched, %llu silent, %llu alignments\n",
+               (unsigned long long)usb.lb_frames, (unsigned long long)in_frames, (unsigned long long)usb.lb_mismatches,
+               (unsigned long long)usb.lb_silent, (unsigned long long)usb.lb_alignments);
+        problems++;
+    }
+    // echo: the canceller has converged by the end of the run where it runs, and the
+    // reference kept up with the mic
+    if (s_echo && rate <= CONFIG_MIC_AEC_MAX_RATE &&
+        (mic_aec.n_windows == 0 || mic_aec.erle_db < 20.0f || mic_aec_stats.ref_dropped)) {
+        printf("  FAIL: echo canceller: ERLE %.1f dB after %lu windows, %lu reference frames dropped\n",
+               mic_aec.erle_db, (unsigned long)mic_aec.n_windows, (unsigned long)mic_aec_stats.ref_dropped);
+        problems++;
+    }
+    return problems;
+}
+
+int main(int argc, char **argv)
+{
+    uint32_t seconds = 2;
+    uint32_t only_rate = 0;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "s:r:b:g:d:Ft:j:l:LeJ:w:v")) != -1) {
+        switch (opt) {
+        case 's': seconds = strtoul(optarg, NULL, 0); break;
+        case 'r': only_rate = strtoul(optarg, NULL, 0); break;
+        case 'b': s_alt = strtoul(optarg, NULL, 0) == 24 ? 2 : 1; break;
+        case 'g': s_gap_ms = strtoul(optarg, NULL, 0); break;
+        case 'd': s_drift_ppm = strtod(optarg, NULL); break;
+        case 'F': sim_usb_use_feedback(false); break;
+        case 't':
+            s_trace_file = fopen(optarg, "w");
+            if (!s_trace_file) {
+                perror(optarg);
+                return 2;
+            }
+            break;
+        case 'j':
+            s_stats_file = fopen(optarg, "w");
+            if (!s_stats_file) {
+                perror(optarg);
+                return 2;
+            }
+            break;
+        case 'l': s_marker_ms = strtoul(optarg, NULL, 0); break;
+        case 'L': s_loopback = true; break;
+        case 'e': s_echo = true; break;
+        case 'J': {
+            int p = 0;
+            while (p < JB_N_PROFILES && strcmp(optarg, jb_profiles[p].name) != 0) p++;
+            if (p == JB_N_PROFILES) {
+                fprintf(stderr, "-J: low_latency, balanced or robust\n");
+                return 2;
+            }
+            spk_jb_profile = (jb_profile_t)p;
+            break;
+        }
+        case 'w': s_wav_prefix = optarg; break;
+        case 'v': sim_log_level = ESP_LOG_INFO; break;
+        default:
+            fprintf(stderr, "usage: %s [-s seconds_per_rate] [-r sample_rate] [-b bits] [-g gap_ms] [-d ppm] [-F] [-t file] [-j file] [-l period_ms] [-L] [-e] [-J profile] [-w prefix] [-v]\n", argv[0]);
+            return 2;
+        }
+    }
+    sim_i2s_set_clock_ppm(s_drift_ppm);
+    if (s_marker_ms) {
+        sim_i2s_set_loopback(true);
+        sim_usb_set_markers(s_marker_ms);
+        latency_enable(true);
+    }
+    if (s_loopback && s_marker_ms) {
+        fprintf(stderr, "-L and -l: the digital loopback bypasses the I2S the latency is measured through\n");
+        return 2;
+    }
+    if (s_echo && (s_loopback || s_marker_ms)) {
+        fprintf(stderr, "-e: not with -l or -L, which take over the I2S input or bypass it\n");
+        return 2;
+    }
+    if (s_echo) {
+        sim_i2s_set_echo(true);
+        mic_aec_enable(true);
+    }
+    if (s_loopback) {
+        audio_loopback_enable(true);
+        sim_usb_set_loopback_check(true);
+    }
+
+    // Same bring-up as app_main()
+    sampFreq = sampleRatesList[0];
+    clkValid = 1;
+    ESP_ERROR_CHECK(bsp_i2s_init(I2S_NUM_1, sampFreq));
+    usb_headset_init();
+    xTaskCreatePinnedToCore(i2s_playback_task, "i2s_playback_task", 3 * 1024, NULL, 4, &spk_task_handle, 1);
+    sim_set_current_task(spk_task_handle);
+    usb_get_data = &mic_ring_get_data;
+
+    sim_usb_enumerate();
+
+    int problems = 0;
+    for (size_t i = 0; i < TU_ARRAY_SIZE(sampleRatesList); i++) {
+        if (only_rate && sampleRatesList[i] != only_rate) continue;
+        problems += run_rate(sampleRatesList[i], seconds);
+    }
+    if (s_trace_file) fclose(s_trace_file);
+    if (s_stats_file) fclose(s_stats_file);
+
+    return problems ? 1 : 0;
+}
@@ -0,0 +1,215 @@
+/*
+ * Host stand-ins for the ESP-IDF / FreeRTOS services used by main/src:
+ * logging, task creation, the USB PHY, esp_timer, the micros() time base
+ * from blink_led.c and the cycle counter and core id of esp_cpu.h.
+ */
+#include <stdio.h>
+#include <stdarg.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/semphr.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "esp_cpu.h"
+#include "esp_private/usb_phy.h"
+#include "sim.h"
+
+//--------------------------------------------------------------------+
+// Time
+//--------------------------------------------------------------------+
+static uint64_t s_sim_ns = 0;
+
+uint64_t sim_now_ns(void)
+{
+    return s_sim_ns;
+}
+
+void sim_advance_ns(uint64_t ns)
+{
+    s_sim_ns += ns;
+}
+
+void sim_reset_time(void)
+{
+    s_sim_ns = 0;
+}
+
+uint64_t sim_cpu_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+}
+
+void sim_timing_reset(sim_timing_t *t)
+{
+    t->calls = 0;
+    t->total_ns = 0;
+    t->min_ns = UINT64_MAX;
+    t->max_ns = 0;
+}
+
+void sim_timing_add(sim_timing_t *t, uint64_t ns)
+{
+    t->calls++;
+    t->total_ns += ns;
+    if(ns < t->min_ns) t->min_ns = ns;
+    if(ns > t->max_ns) t->max_ns = ns;
+}
+
+// defined in blink_led.c on the target
+uint32_t micros()
+{
+    return (uint32_t)(s_sim_ns / 1000);
+}
+
+int64_t esp_timer_get_time(void)
+{
+    return (int64_t)(s_sim_ns / 1000);
+}
+
+uint32_t millis()
+{
+    return micros()/1000;
+}
+
+static int s_core_id;
+
+void sim_set_core(int core)
+{
+    s_core_id = core;
+}
+
+int esp_cpu_get_core_id(void)
+{
+    return s_core_id;
+}
+
+esp_cpu_cycle_count_t esp_cpu_get_cycle_count(void)
+{
+    return (esp_cpu_cycle_count_t)sim_cpu_ns();
+}
+
+uint32_t blink_state;
+
+//--------------------------------------------------------------------+
+// Logging
+//--------------------------------------------------------------------+
+esp_log_level_t sim_log_level = ESP_LOG_WARN;
+
+void sim_log_write(esp_log_level_t level, const char *tag, const char *format, ...)
+{
+    static const char letter[] = "NEWIDV";
+    if(level > sim_log_level) return;
+
+    va_list args;
+    va_start(args, format);
+    fprintf(stderr, "%c (%llu) %s: ", letter[level], (unsigned long long)(s_sim_ns / 1000000), tag);
+    vfprintf(stderr, format, args);
+    fputc('\n', stderr);
+    va_end(args);
+}
+
+//--------------------------------------------------------------------+
+// FreeRTOS
+//--------------------------------------------------------------------+
+struct sim_task {
+    uint32_t notify_count;
+};
+
+static struct sim_task *s_current_task;
+
+BaseType_t xTaskCreatePinnedToCore(TaskFunction_t pvTaskCode, const char *pcName, uint32_t usStackDepth,
+                                   void *pvParameters, UBaseType_t uxPriority, TaskHandle_t *pvCreatedTask,
+                                   BaseType_t xCoreID)
+{
+    // Tasks are not run by the simulation; the driver steps the audio path itself.
+    // The handle only carries the notification count.
+    (void) pvTaskCode; (void) pcName; (void) usStackDepth; (void) pvParameters;
+    (void) uxPriority; (void) xCoreID;
+    struct sim_task *task = calloc(1, sizeof(struct sim_task));
+    if(task == NULL) return pdFAIL;
+    if(pvCreatedTask) *pvCreatedTask = task;
+    return pdPASS;
+}
+
+void sim_set_current_task(TaskHandle_t task)
+{
+    s_current_task = task;
+}
+
+uint32_t sim_task_notify_count(TaskHandle_t task)
+{
+    return ((struct sim_task *)task)->notify_count;
+}
+
+BaseType_t xTaskNotifyGive(TaskHandle_t xTaskToNotify)
+{
+    ((struct sim_task *)xTaskToNotify)->notify_count++;
+    return pdPASS;
+}
+
+void vTaskNotifyGiveFromISR(TaskHandle_t xTaskToNotify, BaseType_t *pxHigherPriorityTaskWoken)
+{
+    ((struct sim_task *)xTaskToNotify)->notify_count++;
+    if(pxHigherPriorityTaskWoken) *pxHigherPriorityTaskWoken = pdTRUE;
+}
+
+uint32_t ulTaskNotifyTake(BaseType_t xClearCountOnExit, TickType_t xTicksToWait)
+{
+    (void) xTicksToWait;
+    configASSERT(s_current_task != NULL);
+    uint32_t count = s_current_task->notify_count;
+    if(count) s_current_task->notify_count = xClearCountOnExit ? 0 : count - 1;
+    return count;
+}
+
+void vTaskDelay(TickType_t xTicksToDelay)
+{
+    sim_advance_ns((uint64_t)xTicksToDelay * 1000000ull);
+}
+
+void vTaskDelete(TaskHandle_t xTaskToDelete)
+{
+    (void) xTaskToDelete;
+}
+
+struct sim_semaphore {
+    int count;
+};
+
+SemaphoreHandle_t xSemaphoreCreateMutex(void)
+{
+    struct sim_semaphore *sem = calloc(1, sizeof(struct sim_semaphore));
+    if(sem) sem->count = 1;
+    return sem;
+}
+
+BaseType_t xSemaphoreTake(SemaphoreHandle_t sem, TickType_t xTicksToWait)
+{
+    (void) xTicksToWait;
+    // nobody else could ever give it back
+    configASSERT(sem->count > 0);
+    sem->count--;
+    return pdTRUE;
+}
+
+BaseType_t xSemaphoreGive(SemaphoreHandle_t sem)
+{
+    configASSERT(sem->count == 0);
+    sem->count++;
+    return pdTRUE;
+}
+
+//--------------------------------------------------------------------+
+// USB PHY
+//--------------------------------------------------------------------+
+esp_err_t usb_new_phy(const usb_phy_config_t *config, usb_phy_handle_t *handle_ret)
+{
+    (void) config;
+    *handle_ret = NULL;
+    return ESP_OK;
+}
@@ -0,0 +1,578 @@
+/*
+ * USB bus model for the host simulation: a minimal usbd core (the endpoint
+ * and control transfer calls the audio class driver makes) plus a host that
+ * enumerates the device, issues the audio class requests and runs the
+ * isochronous schedule one full speed frame at a time.
+ *
+ * Transfers complete synchronously. A packet the class driver queued on
+ * EP IN is collected at the next sim_usb_frame(); an OUT packet is written
+ * straight into the buffer the driver queued on EP OUT, followed by the
+ * transfer complete callback, just as dcd_esp32sx does from its ISR.
+ *
+ * Every frame starts with the SOF interrupt, if the class driver enabled it.
+ * The host reads the speaker feedback EP and sizes its OUT packets from the
+ * last value like a UAC2 host driver does: the 16.16 frames per frame value
+ * is accumulated and each packet carries the whole frames of the sum.
+ *
+ * The host plays a 1 kHz tone, in latency mode a train of chirps, or for the
+ * loopback check a pseudo random sequence, and can record both streams. A
+ * chirp is taken as sent, or received, at the first frame of its left channel
+ * at -30 dBFS or more after 50 ms below that, the rule the firmware's latency
+ * mode (latency.h) uses on the I2S side.
+ */
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include "tusb.h"
+#include "device/usbd_pvt.h"
+#include "class/audio/audio_device.h"
+#include "usb_descriptors.h"
+#include "sim.h"
+
+#define SIM_RHPORT      0
+#define SIM_N_EP        16
+
+typedef struct {
+    bool     busy;
+    uint8_t *buffer;
+    uint16_t len;
+} sim_edpt_t;
+
+static sim_edpt_t s_ep[SIM_N_EP][2];
+
+// Data stage of the control transfer currently being emulated
+static uint8_t const *s_ctrl_data;
+static uint16_t       s_ctrl_len;
+
+static sim_usb_stats_t s_stats;
+static uint32_t s_sample_rate;
+static uint8_t  s_alt[ITF_NUM_TOTAL];
+static uint32_t s_out_phase;
+static uint32_t s_out_skip;     // frames for which the host sends no OUT packet
+static bool     s_sof_enabled;
+static uint32_t s_frame_count;
+static bool     s_use_feedback = true;
+static uint32_t s_feedback;     // last value read from the feedback EP, 0 before the first one
+static uint32_t s_out_acc;      // fraction of a frame carried to the next OUT packet, 16.16
+static uint32_t s_out_rem;      // the same for nominal packets, frames * 1000
+static uint32_t s_in_rem;       // frames * 1000 the IN stream owes at the nominal rate
+static uint32_t s_marker_period_ms;
+static bool     s_lb_check;
+static bool     s_lb_aligned;
+static uint32_t s_lb_next;      // OUT frame the next IN frame should equal
+static FILE    *s_rec_out;
+static FILE    *s_rec_in;
+
+// Marker detection on one stream of the host, counted in frames of that stream
+#define SIM_MARKER_THRESHOLD  (INT32_MAX / 32)
+#define SIM_MARKER_QUIET_MS   50
+#define SIM_MARKER_QUEUE      8
+typedef struct {
+    uint64_t frames;
+    uint64_t quiet_frames;
+} marker_detector_t;
+
+static marker_detector_t s_out_detector;
+static marker_detector_t s_in_detector;
+static uint64_t s_marker_sent[SIM_MARKER_QUEUE];    // OUT frames of the markers on their way
+static uint32_t s_marker_head, s_marker_tail;
+
+// Endpoint addresses from the configuration descriptor in usb_descriptors.c
+#define SIM_EP_AUDIO_OUT  0x01
+#define SIM_EP_AUDIO_IN   0x81
+#define SIM_EP_AUDIO_FB   0x82
+
+static sim_edpt_t *edpt(uint8_t ep_addr)
+{
+    return &s_ep[tu_edpt_number(ep_addr)][tu_edpt_dir(ep_addr)];
+}
+
+//--------------------------------------------------------------------+
+// usbd core stand-in
+//--------------------------------------------------------------------+
+// usb_device_task() is never started in the simulation, the bus model
+// drives the class driver directly
+bool tusb_init(void)
+{
+    return true;
+}
+
+void tud_task_ext(uint32_t timeout_ms, bool in_isr)
+{
+    (void) timeout_ms;
+    (void) in_isr;
+}
+
+tusb_speed_t tud_speed_get(void)
+{
+    return TUSB_SPEED_FULL;
+}
+
+bool usbd_edpt_open(uint8_t rhport, tusb_desc_endpoint_t const * desc_ep)
+{
+    (void) rhport;
+    sim_edpt_t *ep = edpt(desc_ep->bEndpointAddress);
+    memset(ep, 0, sizeof(*ep));
+    return true;
+}
+
+void usbd_edpt_close(uint8_t rhport, uint8_t ep_addr)
+{
+    (void) rhport;
+    sim_edpt_t *ep = edpt(ep_addr);
+    memset(ep, 0, sizeof(*ep));
+}
+
+bool usbd_edpt_xfer(uint8_t rhport, uint8_t ep_addr, uint8_t * buffer, uint16_t total_bytes)
+{
+    (void) rhport;
+    sim_edpt_t *ep = edpt(ep_addr);
+    ep->busy = true;
+    ep->buffer = buffer;
+    ep->len = total_bytes;
+    return true;
+}
+
+bool usbd_edpt_busy(uint8_t rhport, uint8_t ep_addr)
+{
+    (void) rhport;
+    return edpt(ep_addr)->busy;
+}
+
+void usbd_sof_enable(uint8_t rhport, bool en)
+{
+    (void) rhport;
+    s_sof_enabled = en;
+}
+
+void usbd_edpt_clear_stall(uint8_t rhport, uint8_t ep_addr)
+{
+    (void) rhport;
+    edpt(ep_addr)->busy = false;
+}
+
+bool tud_control_xfer(uint8_t rhport, tusb_control_request_t const * request, void* buffer, uint16_t len)
+{
+    (void) rhport;
+    // OUT data stage: hand the host's data to the driver
+    if (request->bmRequestType_bit.direction == TUSB_DIR_OUT && s_ctrl_data != NULL) {
+        TU_VERIFY(s_ctrl_len <= len);
+        memcpy(buffer, s_ctrl_data, s_ctrl_len);
+    }
+    return true;
+}
+
+bool tud_control_status(uint8_t rhport, tusb_control_request_t const * request)
+{
+    (void) rhport;
+    (void) request;
+    return true;
+}
+
+//--------------------------------------------------------------------+
+// Host side
+//--------------------------------------------------------------------+
+static bool control_request(tusb_control_request_t const *request, void const *data)
+{
+    s_ctrl_data = data;
+    s_ctrl_len = request->wLength;
+
+    bool ok = audiod_control_xfer_cb(SIM_RHPORT, CONTROL_STAGE_SETUP, request);
+    if (ok && request->bmRequestType_bit.type != TUSB_REQ_TYPE_STANDARD && request->wLength != 0) {
+        ok = audiod_control_xfer_cb(SIM_RHPORT, CONTROL_STAGE_DATA, request);
+    }
+
+    s_ctrl_data = NULL;
+    s_ctrl_len = 0;
+    return ok;
+}
+
+void sim_usb_enumerate(void)
+{
+    uint8_t const *p_config = tud_descriptor_configuration_cb(0);
+    uint16_t total_len = tu_le16toh(((tusb_desc_configuration_t const *) p_config)->wTotalLength);
+
+    // usbd hands the class driver its interfaces starting after the IAD
+    tusb_desc_interface_t const *itf = (tusb_desc_interface_t const *)
+            (p_config + TUD_CONFIG_DESC_LEN + TUD_AUDIO_DESC_IAD_LEN);
+
+    memset(s_ep, 0, sizeof(s_ep));
+    memset(s_alt, 0, sizeof(s_alt));
+
+    audiod_init();
+    audiod_reset(SIM_RHPORT);
+    uint16_t len = audiod_open(SIM_RHPORT, itf, total_len - TUD_CONFIG_DESC_LEN - TUD_AUDIO_DESC_IAD_LEN);
+    TU_ASSERT(len != 0,);
+
+    if (tud_mount_cb) tud_mount_cb();
+}
+
+bool sim_usb_set_sample_rate(uint32_t sample_rate)
+{
+    tusb_control_request_t const request = {
+        .bmRequestType_bit = {
+            .recipient = TUSB_REQ_RCPT_INTERFACE,
+            .type      = TUSB_REQ_TYPE_CLASS,
+            .direction = TUSB_DIR_OUT
+        },
+        .bRequest = AUDIO_CS_REQ_CUR,
+        .wValue   = tu_htole16(AUDIO_CS_CTRL_SAM_FREQ << 8),
+        .wIndex   = tu_htole16((UAC2_ENTITY_CLOCK << 8) | ITF_NUM_AUDIO_CONTROL),
+        .wLength  = sizeof(audio_control_cur_4_t)
+    };
+    audio_control_cur_4_t cur = { .bCur = tu_htole32(sample_rate) };
+
+    TU_VERIFY(control_request(&request, &cur));
+    s_sample_rate = sample_rate;
+    return true;
+}
+
+bool sim_usb_set_interface(uint8_t itf, uint8_t alt)
+{
+    tusb_control_request_t const request = {
+        .bmRequestType_bit = {
+            .recipient = TUSB_REQ_RCPT_INTERFACE,
+            .type      = TUSB_REQ_TYPE_STANDARD,
+            .direction = TUSB_DIR_OUT
+        },
+        .bRequest = TUSB_REQ_SET_INTERFACE,
+        .wValue   = tu_htole16(alt),
+        .wIndex   = tu_htole16(itf),
+        .wLength  = 0
+    };
+
+    TU_VERIFY(control_request(&request, NULL));
+    s_alt[itf] = alt;
+    if (itf == ITF_NUM_AUDIO_STREAMING_SPK) {
+        s_feedback = 0;
+        s_out_acc = 0;
+        s_out_phase = 0;
+        s_out_rem = 0;
+        s_lb_aligned = false;
+    }
+    if (itf == ITF_NUM_AUDIO_STREAMING_MIC) {
+        s_in_rem = 0;
+    }
+    return true;
+}
+
+// Bytes per audio frame (all channels) of a streaming interface alternate setting:
+// alternate 1 carries 16 bit samples, alternate 2 24 bit samples in 4 byte subslots
+uint16_t sim_usb_frame_bytes(uint8_t alt)
+{
+    switch (alt) {
+    case 1:  return CFG_TUD_AUDIO_FUNC_1_FORMAT_1_N_BYTES_PER_SAMPLE_TX * CFG_TUD_AUDIO_FUNC_1_N_CHANNELS_TX;
+    case 2:  return CFG_TUD_AUDIO_FUNC_1_FORMAT_2_N_BYTES_PER_SAMPLE_TX * CFG_TUD_AUDIO_FUNC_1_N_CHANNELS_TX;
+    default: return 0;
+    }
+}
+
+// Feeds one frame's left sample, MSB aligned in 32 bits; true at the first frame of a marker
+static bool marker_frame(marker_detector_t *d, int32_t v)
+{
+    bool onset = false;
+    d->frames++;
+    if (v < SIM_MARKER_THRESHOLD && v > -SIM_MARKER_THRESHOLD) {
+        d->quiet_frames++;
+        return false;
+    }
+    onset = d->quiet_frames >= (uint64_t)SIM_MARKER_QUIET_MS * (s_sample_rate / 1000);
+    d->quiet_frames = 0;
+    return onset;
+}
+
+static void marker_sent(void)
+{
+    s_stats.markers_out++;
+    if (s_marker_head - s_marker_tail < SIM_MARKER_QUEUE)
+        s_marker_sent[s_marker_head++ % SIM_MARKER_QUEUE] = s_out_detector.frames - 1;
+}
+
+static void marker_received(void)
+{
+    if (s_marker_head == s_marker_tail) return;
+    uint32_t rt = (uint32_t)(s_in_detector.frames - 1 - s_marker_sent[s_marker_tail++ % SIM_MARKER_QUEUE]);
+    if (s_stats.markers_in == 0 || rt < s_stats.rt_min_frames) s_stats.rt_min_frames = rt;
+    if (rt > s_stats.rt_max_frames) s_stats.rt_max_frames = rt;
+    s_stats.rt_sum_frames += rt;
+    s_stats.markers_in++;
+}
+
+// Writes n_frames stereo frames of a stream to its recording, 16 bits per sample
+static void record(FILE *f, const void *frames, uint16_t n_frames, bool is_24bit)
+{
+    for (uint16_t i = 0; f && i < n_frames; i++) {
+        int16_t pcm[2];
+        for (int c = 0; c < 2; c++)
+            pcm[c] = is_24bit ? (int16_t)(((const int32_t *)frames)[2 * i + c] >> 16) : ((const int16_t *)frames)[2 * i + c];
+        fwrite(pcm, sizeof(pcm), 1, f);
+    }
+}
+
+// Sample of the loopback check sequence for OUT frame and channel, 32 bits: a hash of the
+// frame index, so that any frame can be found again without keeping the stream
+static uint32_t lb_sample(uint32_t frame, int channel)
+{
+    uint32_t x = frame * 2 + channel + 1;
+    x ^= x >> 16;
+    x *= 0x7feb352d;
+    x ^= x >> 15;
+    x *= 0x846ca68b;
+    x ^= x >> 16;
+    return x;
+}
+
+static bool lb_equal(const int32_t v[2], uint32_t frame, uint32_t mask)
+{
+    return ((uint32_t) v[0] & mask) == (lb_sample(frame, 0) & mask) &&
+           ((uint32_t) v[1] & mask) == (lb_sample(frame, 1) & mask);
+}
+
+// Checks one IN frame, MSB aligned in 32 bits, against the OUT stream
+static void lb_check_frame(const int32_t v[2], uint32_t mask)
+{
+    bool const silent = v[0] == 0 && v[1] == 0;
+
+    if (s_lb_aligned) {
+        if (silent) {
+            s_stats.lb_silent++;
+            s_lb_aligned = false;
+        }
+        else if (lb_equal(v, s_lb_next, mask)) {
+            s_stats.lb_frames++;
+            s_lb_next++;
+        }
+        else {
+            s_stats.lb_mismatches++;
+            s_lb_aligned = false;
+        }
+        return;
+    }
+    if (silent) {
+        if (s_stats.lb_alignments) s_stats.lb_silent++;
+        else s_stats.lb_skipped++;
+        return;
+    }
+    uint32_t const first = s_out_phase > SIM_LB_SEARCH_FRAMES ? s_out_phase - SIM_LB_SEARCH_FRAMES : 0;
+    for (uint32_t k = s_out_phase; k-- > first; ) {
+        if (lb_equal(v, k, mask)) {
+            s_stats.lb_alignments++;
+            s_stats.lb_offset_frames = s_out_phase - k;
+            s_stats.lb_frames++;
+            s_lb_next = k + 1;
+            s_lb_aligned = true;
+            return;
+        }
+    }
+    s_stats.lb_mismatches++;
+}
+
+void sim_usb_set_loopback_check(bool on)
+{
+    s_lb_check = on;
+    s_lb_aligned = false;
+}
+
+void sim_usb_set_markers(uint32_t period_ms)
+{
+    s_marker_period_ms = period_ms;
+}
+
+void sim_usb_record(FILE *out, FILE *in)
+{
+    s_rec_out = out;
+    s_rec_in = in;
+}
+
+// Counts the 24 bit IN samples that use the bits below the top 16, and those that
+// wrongly set the pad byte
+static void inspect_in_samples(const int32_t *samples, size_t n_samples)
+{
+    for (size_t i = 0; i < n_samples; i++) {
+        int32_t v = samples[i];
+        if (v & 0xff00) s_stats.in_fine_samples++;
+        if (v & 0xff) s_stats.in_pad_bits_set++;
+    }
+}
+
+static void host_in_frame(void)
+{
+    sim_edpt_t *ep = edpt(SIM_EP_AUDIO_IN);
+    if (s_alt[ITF_NUM_AUDIO_STREAMING_MIC] == 0 || !ep->busy) return;
+
+    // the nominal size of this packet: sample_rate / 1000 frames, the remainder carried
+    // over (44.1 kHz: nine packets of 44 frames, then one of 45)
+    s_in_rem += s_sample_rate;
+    uint16_t nominal = s_in_rem / 1000 * sim_usb_frame_bytes(s_alt[ITF_NUM_AUDIO_STREAMING_MIC]);
+    s_in_rem %= 1000;
+    uint16_t n = ep->len;
+    bool const is_24bit = s_alt[ITF_NUM_AUDIO_STREAMING_MIC] == 2;
+    uint16_t const n_frames = n / sim_usb_frame_bytes(s_alt[ITF_NUM_AUDIO_STREAMING_MIC]);
+    if (is_24bit) inspect_in_samples((const int32_t *) ep->buffer, n / 4);
+    if (s_marker_period_ms) {
+        for (uint16_t i = 0; i < n_frames; i++) {
+            int32_t v = is_24bit ? ((const int32_t *) ep->buffer)[2 * i] : (int32_t)((uint32_t)((const int16_t *) ep->buffer)[2 * i] << 16);
+            if (marker_frame(&s_in_detector, v)) marker_received();
+        }
+    }
+    if (s_lb_check) {
+        uint32_t const mask = is_24bit && s_alt[ITF_NUM_AUDIO_STREAMING_SPK] == 2 ? 0xffffff00 : 0xffff0000;
+        for (uint16_t i = 0; i < n_frames; i++) {
+            int32_t v[2];
+            for (int c = 0; c < 2; c++)
+                v[c] = is_24bit ? ((const int32_t *) ep->buffer)[2 * i + c] : (int32_t)((uint32_t)((const int16_t *) ep->buffer)[2 * i + c] << 16);
+            lb_check_frame(v, mask);
+        }
+    }
+    record(s_rec_in, ep->buffer, n_frames, is_24bit);
+
+    s_stats.in_packets++;
+    s_stats.in_bytes += n;
+    s_stats.in_nominal_bytes += nominal;
+    if (n == 0) s_stats.in_zlp++;
+    else if (n < nominal) s_stats.in_short_packets++;
+    else if (n > nominal) s_stats.in_long_packets++;
+
+    ep->busy = false;
+    if (!audiod_xfer_cb(SIM_RHPORT, SIM_EP_AUDIO_IN, XFER_RESULT_SUCCESS, n)) s_stats.xfer_errors++;
+}
+
+// The feedback EP has bInterval 1: the host polls it every frame
+static void host_fb_frame(void)
+{
+    sim_edpt_t *ep = edpt(SIM_EP_AUDIO_FB);
+    if (s_alt[ITF_NUM_AUDIO_STREAMING_SPK] == 0 || !ep->busy) return;
+
+    TU_ASSERT(ep->len == 4,);
+    s_feedback = tu_le32toh(tu_unaligned_read32(ep->buffer));
+    s_stats.fb_reads++;
+
+    ep->busy = false;
+    if (!audiod_xfer_cb(SIM_RHPORT, SIM_EP_AUDIO_FB, XFER_RESULT_SUCCESS, 4)) s_stats.xfer_errors++;
+}
+
+static void host_out_frame(void)
+{
+    sim_edpt_t *ep = edpt(SIM_EP_AUDIO_OUT);
+    if (s_alt[ITF_NUM_AUDIO_STREAMING_SPK] == 0 || !ep->busy) return;
+    if (s_out_skip) {
+        s_out_skip--;
+        return;
+    }
+
+    // nominal packets until the first feedback value: sample_rate / 1000 frames with the
+    // remainder carried over, as for the IN packets
+    uint16_t n_frames;
+    if (s_use_feedback && s_feedback) {
+        s_out_acc += s_feedback;
+        n_frames = s_out_acc >> 16;
+        s_out_acc &= 0xffff;
+    }
+    else {
+        s_out_rem += s_sample_rate;
+        n_frames = s_out_rem / 1000;
+        s_out_rem %= 1000;
+    }
+    uint8_t const alt = s_alt[ITF_NUM_AUDIO_STREAMING_SPK];
+    uint16_t const n = n_frames * sim_usb_frame_bytes(alt);
+    TU_ASSERT(n <= ep->len,);
+
+    // Host plays a 1 kHz tone at -6 dBFS on both channels, at the resolution of the
+    // alternate setting; 24 bit samples are MSB aligned in their 4 byte subslots. In latency
+    // mode it is silence, then a chirp from 1 kHz to a quarter of the sample rate in the last
+    // SIM_MARKER_MS of every period, so that both streams start quiet. For the loopback
+    // check it is the lb_sample() sequence at full scale, numbered by s_out_phase.
+    int32_t const amplitude = alt == 2 ? 0x3fffff : 0x3fff;
+    uint32_t const period = s_marker_period_ms * (s_sample_rate / 1000);
+    double const chirp_s = SIM_MARKER_MS / 1000.0;
+    double const f0 = 1000.0, f1 = s_sample_rate / 4.0;
+    for (uint16_t i = 0; i < n_frames; i++) {
+        int32_t v;
+        if (s_lb_check) {
+            uint32_t const frame = s_out_phase++;
+            if (alt == 2) {
+                int32_t *p = (int32_t *) ep->buffer + 2 * i;
+                p[0] = (int32_t)(lb_sample(frame, 0) & 0xffffff00);
+                p[1] = (int32_t)(lb_sample(frame, 1) & 0xffffff00);
+            }
+            else {
+                int16_t *p = (int16_t *) ep->buffer + 2 * i;
+                p[0] = (int16_t)(lb_sample(frame, 0) >> 16);
+                p[1] = (int16_t)(lb_sample(frame, 1) >> 16);
+            }
+            continue;
+        }
+        if (period) {
+            double t = (double)(s_out_phase++ % period) / s_sample_rate - (s_marker_period_ms / 1000.0 - chirp_s);
+            v = t >= 0 ? (int32_t)(amplitude * sin(2.0 * M_PI * (f0 * t + (f1 - f0) * t * t / (2.0 * chirp_s)))) : 0;
+            if (marker_frame(&s_out_detector, (int32_t)((uint32_t) v << (alt == 2 ? 8 : 16)))) marker_sent();
+        }
+        else {
+            v = (int32_t)(amplitude * sin(2.0 * M_PI * 1000.0 * s_out_phase++ / s_sample_rate));
+        }
+        if (abs(v) > s_stats.out_peak) s_stats.out_peak = abs(v);
+        if (alt == 2) {
+            int32_t *p = (int32_t *) ep->buffer + 2 * i;
+            p[0] = p[1] = (int32_t)((uint32_t) v << 8);
+        }
+        else {
+            int16_t *p = (int16_t *) ep->buffer + 2 * i;
+            p[0] = p[1] = (int16_t) v;
+        }
+    }
+
+    record(s_rec_out, ep->buffer, n_frames, alt == 2);
+
+    // The EP OUT FIFO is overwritable; whatever does not fit replaces the oldest data
+    tu_fifo_t *ff = tud_audio_get_ep_out_ff();
+    uint16_t space = tu_fifo_remaining(ff);
+    if (n > space) s_stats.out_overrun_bytes += n - space;
+
+    s_stats.out_packets++;
+    s_stats.out_bytes += n;
+
+    ep->busy = false;
+    uint64_t t0 = sim_cpu_ns();
+    if (!audiod_xfer_cb(SIM_RHPORT, SIM_EP_AUDIO_OUT, XFER_RESULT_SUCCESS, n)) s_stats.xfer_errors++;
+    sim_timing_add(&s_stats.out_xfer_cb, sim_cpu_ns() - t0);
+}
+
+void sim_usb_skip_out(uint32_t n_frames)
+{
+    s_out_skip = n_frames;
+}
+
+void sim_usb_use_feedback(bool use)
+{
+    s_use_feedback = use;
+}
+
+uint32_t sim_usb_feedback(void)
+{
+    return s_feedback;
+}
+
+void sim_usb_frame(void)
+{
+    s_frame_count = (s_frame_count + 1) & 0x7ff;
+    if (s_sof_enabled) audiod_sof_isr(SIM_RHPORT, s_frame_count);
+
+    host_fb_frame();
+    host_out_frame();
+    host_in_frame();
+}
+
+void sim_usb_get_stats(sim_usb_stats_t *stats)
+{
+    *stats = s_stats;
+}
+
+void sim_usb_reset_stats(void)
+{
+    memset(&s_stats, 0, sizeof(s_stats));
+    memset(&s_out_detector, 0, sizeof(s_out_detector));
+    memset(&s_in_detector, 0, sizeof(s_in_detector));
+    s_marker_head = s_marker_tail = 0;
+    s_lb_aligned = false;
+    sim_timing_reset(&s_stats.out_xfer_cb);
+}
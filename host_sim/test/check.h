@@ -0,0 +1,34 @@
+/*
+ * The checks of the host unit tests: CHECK() reports a condition that does not hold,
+ * with a printf style message, and counts it; check_report() prints the outcome and
+ * returns the exit code.
+ */
+#ifndef CHECK_H
+#define CHECK_H
+
+#include <stdio.h>
+
+static int s_failures;
+
+#define CHECK(cond, ...)                                        \
+    do {                                                        \
+        if (!(cond)) {                                          \
+            printf("FAIL %s:%d: ", __func__, __LINE__);         \
+            printf(__VA_ARGS__);                                \
+            printf("\n");                                       \
+            s_failures++;                                       \
+        }                                                       \
+    } while (0)
+
+// "<name>: all passed" and 0, or the number of failures and 1
+static inline int check_report(const char *name)
+{
+    if (s_failures) {
+        printf("%s: %d failures\n", name, s_failures);
+        return 1;
+    }
+    printf("%s: all passed\n", name);
+    return 0;
+}
+
+#endif
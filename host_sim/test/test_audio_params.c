@@ -0,0 +1,219 @@
+/*
+ * Tests of the parameter handover from the control callbacks to the audio
+ * path (audio_params.c).
+ *
+ * A writer publishes blocks whose fields all follow from the block number
+ * while readers take snapshots as fast as they can; every snapshot has to be
+ * one whole block, and the blocks a reader sees only go forward. The writer
+ * is a thread on another core, and a timer signal that interrupts the reader
+ * anywhere, also in the middle of a read, the way the tinyusb task can
+ * preempt the capture task on the same core. Reports the time of a read and
+ * a publish as well.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <stdatomic.h>
+#include <pthread.h>
+#include <signal.h>
+#include <sys/time.h>
+#include "audio_params.h"
+#include "sim.h"
+#include "check.h"
+
+#define N_PUBLISH   10000000
+#define N_READERS   3
+#define N_SIGNAL_PUBLISH 30000
+#define SIGNAL_US   20
+
+// Block number k; every field differs from those of every other block, and block 0 is the
+// zeroed block the readers find before the first publish
+static void make_params(uint32_t k, audio_params_t *p)
+{
+    p->sample_rate  = k;
+    p->spk_gain[0]  = (int32_t)(k * 3);
+    p->spk_gain[1]  = -(int32_t)k;
+    p->mic_gain[0]  = (int32_t)(k * 0x9e3779b9u);
+    p->mic_gain[1]  = (int32_t)(k ^ (k << 16));
+    p->spk_bytes_ms = k * 7;
+    p->mic_bytes_ms = k * 13;
+}
+
+static bool is_whole(const audio_params_t *p)
+{
+    audio_params_t ref;
+    make_params(p->sample_rate, &ref);
+    return memcmp(p, &ref, sizeof(ref)) == 0;
+}
+
+// Without a writer running a read gives what was published last, with its version
+static void test_sequential(void)
+{
+    static audio_params_block_t block;
+    audio_params_t p, ref;
+
+    memset(&p, 0xff, sizeof(p));
+    CHECK(audio_params_read(&block, &p) == 0, "zeroed block is not version 0");
+    CHECK(p.sample_rate == 0 && p.spk_gain[0] == 0 && p.mic_bytes_ms == 0, "zeroed block read as non-zero");
+
+    for (uint32_t k = 1; k <= 5; k++) {
+        make_params(k, &ref);
+        audio_params_publish(&block, &ref);
+        uint32_t version = audio_params_read(&block, &p);
+        CHECK(version == k, "version %u after %u publishes", version, k);
+        CHECK(memcmp(&p, &ref, sizeof(p)) == 0, "read back block %u as %u", k, p.sample_rate);
+    }
+}
+
+static audio_params_block_t s_block;
+static atomic_bool s_writer_done;
+
+typedef struct {
+    uint32_t n_reads;
+    uint32_t n_torn;
+    uint32_t n_backwards;
+    uint32_t n_version_mismatch;
+    uint32_t n_changes;         // reads that saw a newer block than the one before
+} reader_result_t;
+
+static void *writer_thread(void *arg)
+{
+    (void) arg;
+    audio_params_t p;
+
+    for (uint32_t k = 1; k <= N_PUBLISH; k++) {
+        make_params(k, &p);
+        audio_params_publish(&s_block, &p);
+    }
+    atomic_store(&s_writer_done, true);
+    return NULL;
+}
+
+static void *reader_thread(void *arg)
+{
+    reader_result_t *r = arg;
+    audio_params_t p;
+    uint32_t last = 0;
+
+    while (!atomic_load(&s_writer_done)) {
+        uint32_t version = audio_params_read(&s_block, &p);
+        r->n_reads++;
+        if (!is_whole(&p)) {
+            r->n_torn++;
+            continue;
+        }
+        if (version != p.sample_rate) r->n_version_mismatch++;
+        if (p.sample_rate < last) r->n_backwards++;
+        if (p.sample_rate > last) r->n_changes++;
+        last = p.sample_rate;
+    }
+    return NULL;
+}
+
+// One writer publishing without a pause against readers reading without a pause
+static void test_concurrent(void)
+{
+    pthread_t writer, readers[N_READERS];
+    reader_result_t results[N_READERS];
+
+    memset(results, 0, sizeof(results));
+    memset(&s_block, 0, sizeof(s_block));
+    atomic_store(&s_writer_done, false);
+
+    for (int i = 0; i < N_READERS; i++) pthread_create(&readers[i], NULL, reader_thread, &results[i]);
+    pthread_create(&writer, NULL, writer_thread, NULL);
+    pthread_join(writer, NULL);
+    for (int i = 0; i < N_READERS; i++) pthread_join(readers[i], NULL);
+
+    for (int i = 0; i < N_READERS; i++) {
+        reader_result_t *r = &results[i];
+        printf("reader %d: %u reads, %u saw a new block\n", i, r->n_reads, r->n_changes);
+        CHECK(r->n_torn == 0, "reader %d: %u of %u reads mixed two blocks", i, r->n_torn, r->n_reads);
+        CHECK(r->n_backwards == 0, "reader %d: went back to an older block %u times", i, r->n_backwards);
+        CHECK(r->n_version_mismatch == 0, "reader %d: version not that of the block %u times", i, r->n_version_mismatch);
+    }
+
+    audio_params_t p;
+    CHECK(audio_params_read(&s_block, &p) == N_PUBLISH && p.sample_rate == N_PUBLISH, "last block not read back");
+}
+
+static volatile uint32_t s_signal_k;
+
+// Publishes 1 to 3 blocks; with 2 or more the reader it interrupts may have to read again
+static void publish_handler(int sig)
+{
+    (void) sig;
+    audio_params_t p;
+    uint32_t k = s_signal_k;
+
+    for (uint32_t n = 1 + k % 3; n > 0; n--) {
+        make_params(++k, &p);
+        audio_params_publish(&s_block, &p);
+    }
+    s_signal_k = k;
+}
+
+// The writer interrupting the reader at random points on the same core
+static void test_interrupted(void)
+{
+    struct sigaction sa = { .sa_handler = publish_handler };
+    struct itimerval timer = { .it_interval = { 0, SIGNAL_US }, .it_value = { 0, SIGNAL_US } };
+    struct itimerval stop = { { 0, 0 }, { 0, 0 } };
+    reader_result_t r = { 0 };
+    audio_params_t p;
+    uint32_t last = 0;
+
+    memset(&s_block, 0, sizeof(s_block));
+    s_signal_k = 0;
+    sigemptyset(&sa.sa_mask);
+    sigaction(SIGALRM, &sa, NULL);
+    setitimer(ITIMER_REAL, &timer, NULL);
+
+    while (s_signal_k < N_SIGNAL_PUBLISH) {
+        uint32_t version = audio_params_read(&s_block, &p);
+        r.n_reads++;
+        if (!is_whole(&p)) {
+            r.n_torn++;
+            continue;
+        }
+        if (version != p.sample_rate) r.n_version_mismatch++;
+        if (p.sample_rate < last) r.n_backwards++;
+        if (p.sample_rate > last) r.n_changes++;
+        last = p.sample_rate;
+    }
+    setitimer(ITIMER_REAL, &stop, NULL);
+    signal(SIGALRM, SIG_IGN);
+
+    printf("interrupted reader: %u reads, %u saw a new block\n", r.n_reads, r.n_changes);
+    CHECK(r.n_torn == 0, "%u of %u reads mixed two blocks", r.n_torn, r.n_reads);
+    CHECK(r.n_backwards == 0, "went back to an older block %u times", r.n_backwards);
+    CHECK(r.n_version_mismatch == 0, "version not that of the block %u times", r.n_version_mismatch);
+}
+
+static void time_calls(void)
+{
+    static audio_params_block_t block;
+    static volatile uint32_t sink;
+    const int n = 1000000;
+    audio_params_t p;
+
+    make_params(1, &p);
+    uint64_t t0 = sim_cpu_ns();
+    for (int i = 0; i < n; i++) audio_params_publish(&block, &p);
+    uint64_t t1 = sim_cpu_ns();
+    for (int i = 0; i < n; i++) sink = audio_params_read(&block, &p);
+    uint64_t t2 = sim_cpu_ns();
+    (void) sink;
+    printf("%.1f ns per publish, %.1f ns per read\n", (double)(t1 - t0) / n, (double)(t2 - t1) / n);
+}
+
+int main(void)
+{
+    test_sequential();
+    test_concurrent();
+    test_interrupted();
+    time_calls();
+
+    return check_report("test_audio_params");
+}
@@ -0,0 +1,230 @@
+/*
+ * Tests of the mic DC blocker (dc_block_* in audio_dsp.c), the filter behind
+ * decode_and_cancel_offset().
+ *
+ * All input goes through the filter in 1 ms blocks, the way bsp_i2s_read()
+ * calls it, as 32 bit slots with 24 valid bits.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include "audio_dsp.h"
+#include "check.h"
+
+#define CORNER_HZ   20
+#define MAX_FRAMES  48000
+
+static const uint32_t rates[] = { 16000, 24000, 32000, 48000 };
+
+static int32_t s_frames[2 * MAX_FRAMES];
+
+static int32_t slot(int32_t v24)
+{
+    return (int32_t)((uint32_t)v24 << 8);
+}
+
+static int32_t value(int32_t slot)
+{
+    return slot >> 8;
+}
+
+// |H| in dB of y[n] = x[n] - x[n-1] + a*y[n-1] at freq
+static double model_gain_db(double freq, uint32_t rate)
+{
+    double a = exp(-2.0 * M_PI * CORNER_HZ / rate);
+    double w = 2.0 * M_PI * freq / rate;
+    double num = 2.0 - 2.0 * cos(w);
+    double den = 1.0 + a * a - 2.0 * a * cos(w);
+    return 10.0 * log10(num / den);
+}
+
+// Runs n_frames of s_frames through the filter in blocks of block_frames
+static void run_blocks(dc_block_t *f, int32_t *frames, uint32_t n_frames, uint32_t block_frames)
+{
+    for (uint32_t i = 0; i < n_frames; i += block_frames) {
+        uint32_t n = n_frames - i < block_frames ? n_frames - i : block_frames;
+        dc_block_process(f, frames + 2 * i, n);
+    }
+}
+
+// Output of a step of height A is A * a^n; it must follow the double precision model
+// within a couple of LSBs and decay to nothing
+static void test_step_response(uint32_t rate)
+{
+    const int32_t A = 1 << 22;      // half of the 24 bit full scale
+    const uint32_t n_zero = rate / 1000;
+    const uint32_t n_frames = rate;
+    dc_block_t f;
+
+    dc_block_init(&f, CORNER_HZ, rate);
+    for (uint32_t i = 0; i < n_frames; i++) {
+        int32_t v = i < n_zero ? 0 : A;
+        s_frames[2 * i]     = slot(v);
+        s_frames[2 * i + 1] = slot(-v);
+    }
+    run_blocks(&f, s_frames, n_frames, rate / 1000);
+
+    double a = exp(-2.0 * M_PI * CORNER_HZ / rate);
+    int32_t max_err = 0;
+    for (uint32_t i = 0; i < n_frames; i++) {
+        double expect = i < n_zero ? 0.0 : A * pow(a, i - n_zero);
+        int32_t err_l = abs(value(s_frames[2 * i])     - (int32_t)lround(expect));
+        int32_t err_r = abs(value(s_frames[2 * i + 1]) + (int32_t)lround(expect));
+        if (err_l > max_err) max_err = err_l;
+        if (err_r > max_err) max_err = err_r;
+    }
+    CHECK(value(s_frames[2 * n_zero]) == A, "%u Hz: first sample of the step %d, expected %d",
+          rate, value(s_frames[2 * n_zero]), A);
+    CHECK(max_err <= 2, "%u Hz: step response off the model by %d LSB", rate, max_err);
+
+    // one second after the step (over 100 time constants) nothing is left
+    CHECK(value(s_frames[2 * (n_frames - 1)]) == 0 && value(s_frames[2 * (n_frames - 1) + 1]) == 0,
+          "%u Hz: step response did not decay: %d %d", rate,
+          value(s_frames[2 * (n_frames - 1)]), value(s_frames[2 * (n_frames - 1) + 1]));
+}
+
+// A DC offset plus a 1 kHz tone: after settling the offset is gone, the mean of the
+// output is below one LSB and the tone comes through with the gain of the filter model
+static void test_steady_state_offset(uint32_t rate)
+{
+    const int32_t offsets[2] = { 400000, -123457 };     // about +5% and -1.5% of full scale
+    const double amp = 0.5 * 8388607.0;
+    const uint32_t n_frames = rate;
+    dc_block_t f;
+
+    dc_block_init(&f, CORNER_HZ, rate);
+    for (int pass = 0; pass < 2; pass++) {
+        double sum[2] = { 0, 0 }, sum_sq[2] = { 0, 0 }, in_sq = 0;
+        for (uint32_t i = 0; i < n_frames; i++) {
+            uint64_t n = (uint64_t)pass * n_frames + i;
+            double tone = amp * sin(2.0 * M_PI * 1000.0 * (double)n / rate);
+            s_frames[2 * i]     = slot(offsets[0] + (int32_t)lrint(tone));
+            s_frames[2 * i + 1] = slot(offsets[1] + (int32_t)lrint(tone));
+            in_sq += tone * tone;
+        }
+        run_blocks(&f, s_frames, n_frames, rate / 1000);
+        if (pass == 0) continue;    // first second: settling
+
+        for (uint32_t i = 0; i < n_frames; i++) {
+            for (int ch = 0; ch < 2; ch++) {
+                double v = value(s_frames[2 * i + ch]);
+                sum[ch] += v;
+                sum_sq[ch] += v * v;
+            }
+        }
+        for (int ch = 0; ch < 2; ch++) {
+            double mean = sum[ch] / n_frames;
+            double gain_db = 10.0 * log10(sum_sq[ch] / in_sq);
+            CHECK(fabs(mean) < 1.0, "%u Hz ch %d: residual offset %.3f LSB", rate, ch, mean);
+            double model_db = model_gain_db(1000.0, rate);
+            CHECK(fabs(gain_db - model_db) < 0.001 && fabs(gain_db) < 0.05,
+                  "%u Hz ch %d: 1 kHz gain %.4f dB, model %.4f dB", rate, ch, gain_db, model_db);
+        }
+    }
+
+    // an offset switched on from silence settles to exactly zero (no limit cycle)
+    int32_t silence[2] = { 0, 0 };
+    dc_block_init(&f, CORNER_HZ, rate);
+    dc_block_process(&f, silence, 1);
+    for (int s = 0; s < 3; s++) {
+        for (uint32_t i = 0; i < n_frames; i++) {
+            s_frames[2 * i]     = slot(offsets[0]);
+            s_frames[2 * i + 1] = slot(offsets[1]);
+        }
+        run_blocks(&f, s_frames, n_frames, rate / 1000);
+    }
+    int nonzero = 0;
+    for (uint32_t i = n_frames - rate / 10; i < n_frames; i++) {
+        nonzero += s_frames[2 * i] != 0 || s_frames[2 * i + 1] != 0;
+    }
+    CHECK(nonzero == 0, "%u Hz: %d nonzero outputs for a constant input", rate, nonzero);
+}
+
+// The corner frequency tracks the sample rate: -3 dB at CORNER_HZ for every rate
+static void test_corner(uint32_t rate)
+{
+    const double amp = 0.5 * 8388607.0;
+    const uint32_t n_frames = rate;
+    dc_block_t f;
+
+    dc_block_init(&f, CORNER_HZ, rate);
+    double in_sq = 0, out_sq = 0;
+    for (int pass = 0; pass < 3; pass++) {
+        for (uint32_t i = 0; i < n_frames; i++) {
+            uint64_t n = (uint64_t)pass * n_frames + i;
+            double tone = amp * sin(2.0 * M_PI * CORNER_HZ * (double)n / rate);
+            s_frames[2 * i] = s_frames[2 * i + 1] = slot((int32_t)lrint(tone));
+            if (pass == 2) in_sq += tone * tone;
+        }
+        run_blocks(&f, s_frames, n_frames, rate / 1000);
+        if (pass < 2) continue;
+        for (uint32_t i = 0; i < n_frames; i++) {
+            double v = value(s_frames[2 * i]);
+            out_sq += v * v;
+        }
+    }
+    double gain_db = 10.0 * log10(out_sq / in_sq);
+    double model_db = model_gain_db(CORNER_HZ, rate);
+    CHECK(fabs(gain_db - model_db) < 0.01 && fabs(gain_db + 3.0) < 0.1,
+          "%u Hz: gain at %d Hz %.3f dB, model %.3f dB", rate, CORNER_HZ, gain_db, model_db);
+}
+
+// Block boundaries do not change the result, and a reset starts over without a step
+static void test_blocks_and_reset(uint32_t rate)
+{
+    static int32_t ref[2 * MAX_FRAMES];
+    const uint32_t n_frames = rate / 10;
+    dc_block_t f;
+
+    srand(rate);
+    for (uint32_t i = 0; i < 2 * n_frames; i++) {
+        ref[i] = slot(300000 + (rand() % 2000001) - 1000000);
+    }
+    memcpy(s_frames, ref, sizeof(int32_t) * 2 * n_frames);
+
+    dc_block_init(&f, CORNER_HZ, rate);
+    run_blocks(&f, ref, n_frames, n_frames);
+    dc_block_init(&f, CORNER_HZ, rate);
+    run_blocks(&f, s_frames, n_frames, 7);
+    CHECK(memcmp(ref, s_frames, sizeof(int32_t) * 2 * n_frames) == 0,
+          "%u Hz: output depends on the block size", rate);
+
+    // after a reset the first frame seeds the filter: an offset does not come out as a step
+    for (uint32_t i = 0; i < rate / 1000; i++) {
+        s_frames[2 * i]     = slot(400000);
+        s_frames[2 * i + 1] = slot(-400000);
+    }
+    dc_block_reset(&f);
+    dc_block_process(&f, s_frames, rate / 1000);
+    int nonzero = 0;
+    for (uint32_t i = 0; i < 2 * (rate / 1000); i++) nonzero += s_frames[i] != 0;
+    CHECK(nonzero == 0, "%u Hz: %d nonzero outputs after a reset", rate, nonzero);
+}
+
+// Full scale steps saturate instead of wrapping
+static void test_saturation(void)
+{
+    dc_block_t f;
+    dc_block_init(&f, CORNER_HZ, 48000);
+    s_frames[0] = slot(-8388608);
+    s_frames[1] = slot(8388607);
+    s_frames[2] = slot(8388607);
+    s_frames[3] = slot(-8388608);
+    dc_block_process(&f, s_frames, 2);
+    CHECK(value(s_frames[2]) == 8388607 && value(s_frames[3]) == -8388608,
+          "full scale step gave %d %d", value(s_frames[2]), value(s_frames[3]));
+}
+
+int main(void)
+{
+    for (unsigned r = 0; r < sizeof(rates) / sizeof(rates[0]); r++) {
+        test_step_response(rates[r]);
+        test_steady_state_offset(rates[r]);
+        test_corner(rates[r]);
+        test_blocks_and_reset(rates[r]);
+    }
+    test_saturation();
+
+    return check_report("test_dc_block");
+}
@@ -0,0 +1,86 @@
+/*
+ * Tests of tu_fifo's single producer, single consumer mode (tu_fifo_config_spsc()),
+ * built with the pthread OSAL of include/tusb_os_custom.h so that tu_fifo has its
+ * mutexes as on the FreeRTOS target.
+ *
+ * A writer thread streams a byte sequence through a FIFO the size of the audio EP
+ * FIFOs in chunks of random size while a reader thread, on another core or preempting it,
+ * takes it out in chunks of its own and checks every byte. Both alternate between the copying
+ * calls (tu_fifo_write_n() / tu_fifo_read_n()) and the in place ones the audio class
+ * and mic_packet_load() use (tu_fifo_get_write_info() / tu_fifo_get_read_info() and
+ * the advance calls). It runs with the mutexes skipped and, as a reference, taken.
+ */
+#include <stdio.h>
+#include <string.h>
+#include <stdatomic.h>
+#include <pthread.h>
+#include <time.h>
+#include "fifo_stream.h"
+#include "check.h"
+
+#define N_BYTES     (64u * 1024 * 1024)
+
+// The whole stream through the FIFO, both threads running flat out
+static void test_stream(bool spsc)
+{
+    fifo_stream_t s = { .len = FIFO_STREAM_MAX_LEN, .random = true, .n_bytes = N_BYTES };
+    const char *mode = spsc ? "spsc" : "mutex";
+
+    fifo_stream_setup(spsc);
+    uint64_t ns = fifo_stream_run(&s);
+
+    printf("%-5s: %u MB in %.0f ms, %u empty reads\n", mode, N_BYTES >> 20, (double)ns / 1e6, s.n_empty);
+    CHECK(s.n_bad == 0, "%s: %u bytes differ, the first at %u", mode, s.n_bad, s.first_bad);
+    CHECK(tu_fifo_empty(&fifo_stream_ff), "%s: FIFO not empty at the end", mode);
+    CHECK(!tu_fifo_overflowed(&fifo_stream_ff), "%s: FIFO overflowed", mode);
+}
+
+static atomic_bool s_calls_done;
+
+static void *spsc_calls_thread(void *arg)
+{
+    (void) arg;
+    uint8_t buf[64];
+
+    memset(buf, 0x5a, sizeof(buf));
+    tu_fifo_write_n(&fifo_stream_ff, buf, sizeof(buf));
+    tu_fifo_write(&fifo_stream_ff, buf);
+    tu_fifo_peek(&fifo_stream_ff, buf);
+    tu_fifo_read(&fifo_stream_ff, buf);
+    tu_fifo_read_n(&fifo_stream_ff, buf, sizeof(buf));
+    atomic_store(&s_calls_done, true);
+    return NULL;
+}
+
+// With spsc set the data path does not touch the mutexes: it completes while another
+// thread holds both
+static void test_mutex_skipped(void)
+{
+    pthread_t t;
+    struct timespec deadline;
+
+    fifo_stream_setup(true);
+    atomic_store(&s_calls_done, false);
+    osal_mutex_lock(&fifo_stream_mutex_wr, OSAL_TIMEOUT_WAIT_FOREVER);
+    osal_mutex_lock(&fifo_stream_mutex_rd, OSAL_TIMEOUT_WAIT_FOREVER);
+    pthread_create(&t, NULL, spsc_calls_thread, NULL);
+
+    clock_gettime(CLOCK_REALTIME, &deadline);
+    deadline.tv_sec += 2;
+    int joined = pthread_timedjoin_np(t, NULL, &deadline) == 0;
+    CHECK(joined && atomic_load(&s_calls_done), "spsc: the writes and reads waited for the mutexes");
+
+    osal_mutex_unlock(&fifo_stream_mutex_wr);
+    osal_mutex_unlock(&fifo_stream_mutex_rd);
+    if (!joined) pthread_join(t, NULL);
+    CHECK(tu_fifo_empty(&fifo_stream_ff), "spsc: FIFO not empty after the calls");
+}
+
+int main(void)
+{
+    test_mutex_skipped();
+    test_stream(true);
+    test_stream(false);
+
+    return check_report("test_fifo_spsc");
+}
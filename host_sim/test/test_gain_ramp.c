@@ -0,0 +1,213 @@
+/*
+ * Tests of the gain smoother (gain_ramp_* and the *_ramp kernels in
+ * audio_dsp.c) that takes the audio path from one volume or mute setting to
+ * the next.
+ *
+ * Blocks are 1 ms at 48 kHz unless a test says otherwise, the way the
+ * capture and playback tasks call the kernels.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include "audio_dsp.h"
+#include "check.h"
+
+#define RATE        48000
+#define BLOCK       (RATE / 1000)
+#define RAMP        (RATE * 5 / 1000)       // 5 ms
+#define MAX_FRAMES  2000
+#define UNITY       (1 << 24)
+
+static int16_t s_src16[2 * MAX_FRAMES];
+static int32_t s_src32[2 * MAX_FRAMES];
+
+static void fill_random(unsigned seed)
+{
+    srand(seed);
+    for (int i = 0; i < 2 * MAX_FRAMES; i++) {
+        s_src16[i] = (int16_t)(rand() - RAND_MAX / 2);
+        s_src32[i] = (int32_t)((uint32_t)rand() << 8);
+    }
+}
+
+// Speaker path in blocks of block frames, with gain g till frame change_at and g2 from then on
+static void run_spk(gain_ramp_t *r, const int16_t *src, int32_t *dst, uint32_t n_frames, uint32_t block,
+                    const int32_t *g, uint32_t change_at, const int32_t *g2)
+{
+    for (uint32_t i = 0; i < n_frames; i += block) {
+        uint32_t n = n_frames - i < block ? n_frames - i : block;
+        gain_ramp_update(r, (g2 && i >= change_at) ? g2 : g);
+        spk_convert_gain_ramp(src + 2 * i, dst + 2 * i, n, r);
+    }
+}
+
+// Without a change the ramp kernels are the plain kernels, bit for bit
+static void test_steady(void)
+{
+    static int16_t out16[2 * MAX_FRAMES], ref16[2 * MAX_FRAMES];
+    static int32_t out32[2 * MAX_FRAMES], ref32[2 * MAX_FRAMES];
+    const int32_t gains[][2] = { { UNITY, UNITY }, { 3 << 22, 5 << 23 }, { 0, UNITY }, { 0x7fffffff, 167772 } };
+    gain_ramp_t r;
+
+    fill_random(1);
+    for (unsigned g = 0; g < sizeof(gains) / sizeof(gains[0]); g++) {
+        gain_ramp_init(&r, RAMP);
+        gain_ramp_update(&r, gains[g]);
+        CHECK(r.remaining == 0, "first update started a ramp");
+
+        mic_convert_gain_ramp(s_src32, out16, BLOCK, &r);
+        mic_convert_gain(s_src32, ref16, BLOCK, gains[g]);
+        CHECK(memcmp(out16, ref16, 4 * BLOCK) == 0, "mic: gain %d/%d differs from mic_convert_gain", gains[g][0], gains[g][1]);
+
+        spk_convert_gain_ramp(s_src16, out32, BLOCK, &r);
+        spk_convert_gain(s_src16, ref32, BLOCK, gains[g]);
+        CHECK(memcmp(out32, ref32, 8 * BLOCK) == 0, "spk: gain %d/%d differs from spk_convert_gain", gains[g][0], gains[g][1]);
+
+        memcpy(out32, s_src32, 8 * BLOCK);
+        memcpy(ref32, s_src32, 8 * BLOCK);
+        gain_ramp_update(&r, gains[g]);
+        pcm24_gain_ramp(out32, BLOCK, &r);
+        pcm24_gain(ref32, BLOCK, gains[g]);
+        CHECK(memcmp(out32, ref32, 8 * BLOCK) == 0, "pcm24: gain %d/%d differs from pcm24_gain", gains[g][0], gains[g][1]);
+    }
+}
+
+// Mute from unity: a straight line down to exactly 0 over RAMP frames, whatever the blocks
+static void test_mute_ramp(void)
+{
+    static int16_t src[2 * MAX_FRAMES];
+    static int32_t out[2 * MAX_FRAMES], ref[2 * MAX_FRAMES];
+    const int32_t unity[2] = { UNITY, UNITY };
+    const int32_t mute[2] = { 0, 0 };
+    const uint32_t start = 2 * BLOCK;
+    const uint32_t n_frames = start + RAMP + 3 * BLOCK;
+    gain_ramp_t r;
+
+    for (uint32_t i = 0; i < 2 * n_frames; i++) src[i] = 0x4000;
+
+    gain_ramp_init(&r, RAMP);
+    run_spk(&r, src, out, n_frames, BLOCK, unity, start, mute);
+
+    // the frames before the change are untouched, the ramp steps evenly, the end is 0; the
+    // last step takes up what the truncated step left, less than RAMP gain LSBs
+    const double step = (double)0x4000 * (UNITY / RAMP + RAMP) / 256.0;
+    CHECK(out[2 * (start - 1)] == 0x40000000, "before the change: 0x%08x", (unsigned)out[2 * (start - 1)]);
+    double max_step = 0;
+    for (uint32_t i = start; i < start + RAMP; i++) {
+        double d = (double)out[2 * (i - 1)] - out[2 * i];
+        CHECK(d >= 0, "frame %u: the ramp went up", i);
+        if (d > max_step) max_step = d;
+    }
+    CHECK(max_step <= step, "largest step %.0f, at most %.0f", max_step, step);
+    CHECK(out[2 * (start + RAMP - 2)] > 0, "silent before the end of the ramp");
+    for (uint32_t i = start + RAMP - 1; i < n_frames; i++) {
+        CHECK(out[2 * i] == 0 && out[2 * i + 1] == 0, "frame %u after the ramp: %d %d", i, out[2 * i], out[2 * i + 1]);
+        if (out[2 * i] != 0) break;
+    }
+
+    // blocks that do not line up with the ramp give the same result, once the change is
+    // seen at the same frame
+    gain_ramp_init(&r, RAMP);
+    run_spk(&r, src, ref, start, BLOCK, unity, 0, NULL);
+    for (uint32_t i = start, n = 7; i < n_frames; i += n, n = n % 31 + 5) {
+        if (i + n > n_frames) n = n_frames - i;
+        gain_ramp_update(&r, mute);
+        spk_convert_gain_ramp(src + 2 * i, ref + 2 * i, n, &r);
+    }
+    CHECK(memcmp(out, ref, 8 * n_frames) == 0, "the result depends on the block sizes");
+}
+
+// A change in the middle of a ramp goes on from where the gain is, without a jump
+static void test_retarget(void)
+{
+    static int16_t src[2 * MAX_FRAMES];
+    static int32_t out[2 * MAX_FRAMES];
+    const int32_t g_a[2] = { UNITY, UNITY / 2 };
+    const int32_t g_b[2] = { UNITY / 8, UNITY * 2 };
+    const int32_t g_c[2] = { UNITY * 4, UNITY / 16 };
+    gain_ramp_t r;
+
+    for (uint32_t i = 0; i < 2 * MAX_FRAMES; i++) src[i] = 0x1000;
+
+    gain_ramp_init(&r, RAMP);
+    gain_ramp_update(&r, g_a);
+    spk_convert_gain_ramp(src, out, BLOCK, &r);
+    gain_ramp_update(&r, g_b);
+    spk_convert_gain_ramp(src, out + 2 * BLOCK, 2 * BLOCK, &r);
+    CHECK(r.remaining == RAMP - 2 * BLOCK, "%u frames of the ramp left", r.remaining);
+
+    int32_t at_change[2] = { r.cur[0], r.cur[1] };
+    gain_ramp_update(&r, g_c);
+    CHECK(r.cur[0] == at_change[0] && r.cur[1] == at_change[1], "the gain jumped at the new target");
+    spk_convert_gain_ramp(src, out + 6 * BLOCK, RAMP + BLOCK, &r);
+
+    // largest change from frame to frame, against the largest ramp step of the three plus
+    // what the last frame of a ramp takes up
+    int32_t max_step_gain = RAMP;
+    for (int ch = 0; ch < 2; ch++) {
+        int32_t s1 = abs((g_b[ch] - g_a[ch]) / RAMP) + RAMP;
+        int32_t s2 = abs((g_c[ch] - at_change[ch]) / RAMP) + RAMP;
+        if (s1 > max_step_gain) max_step_gain = s1;
+        if (s2 > max_step_gain) max_step_gain = s2;
+    }
+    double limit = (double)0x1000 * max_step_gain / 256.0 + 1;
+    for (uint32_t i = 1; i < 3 * BLOCK + RAMP + BLOCK; i++) {
+        for (int ch = 0; ch < 2; ch++) {
+            double d = fabs((double)out[2 * i + ch] - out[2 * (i - 1) + ch]);
+            CHECK(d <= limit, "frame %u ch %d: step %.0f, at most %.0f", i, ch, d, limit);
+        }
+    }
+    CHECK(r.remaining == 0 && r.cur[0] == g_c[0] && r.cur[1] == g_c[1], "did not end at the target");
+}
+
+// The mic kernels follow the same ramp; the 24 bit one keeps its relation to the 16 bit one
+static void test_mic_ramp(void)
+{
+    static int16_t out16[2 * MAX_FRAMES];
+    static int32_t out32[2 * MAX_FRAMES];
+    const int32_t g_a[2] = { UNITY, UNITY };
+    const int32_t g_b[2] = { UNITY * 3, 0 };
+    gain_ramp_t r16, r24;
+
+    fill_random(2);
+    memcpy(out32, s_src32, sizeof(out32));
+    gain_ramp_init(&r16, RAMP);
+    gain_ramp_init(&r24, RAMP);
+    for (uint32_t i = 0; i < 8 * BLOCK; i += BLOCK) {
+        gain_ramp_update(&r16, i < BLOCK ? g_a : g_b);
+        gain_ramp_update(&r24, i < BLOCK ? g_a : g_b);
+        mic_convert_gain_ramp(s_src32 + 2 * i, out16 + 2 * i, BLOCK, &r16);
+        pcm24_gain_ramp(out32 + 2 * i, BLOCK, &r24);
+    }
+    for (uint32_t i = 0; i < 2 * 8 * BLOCK; i++) {
+        CHECK((out32[i] >> 16) == out16[i] && (out32[i] & 0xff) == 0,
+              "sample %u: 24 bit 0x%08x, 16 bit %d", i, (unsigned)out32[i], out16[i]);
+        if ((out32[i] >> 16) != out16[i]) break;
+    }
+    CHECK(out16[2 * (8 * BLOCK - 1) + 1] == 0, "right channel not muted after the ramp");
+}
+
+// Without a ramp time changes are taken at once
+static void test_no_ramp(void)
+{
+    const int32_t g_a[2] = { UNITY, UNITY };
+    const int32_t g_b[2] = { UNITY / 2, 0 };
+    gain_ramp_t r;
+
+    gain_ramp_init(&r, 0);
+    gain_ramp_update(&r, g_a);
+    gain_ramp_update(&r, g_b);
+    CHECK(r.remaining == 0 && r.cur[0] == g_b[0] && r.cur[1] == g_b[1], "ramp_frames 0 still ramps");
+}
+
+int main(void)
+{
+    test_steady();
+    test_mute_ramp();
+    test_retarget();
+    test_mic_ramp();
+    test_no_ramp();
+
+    return check_report("test_gain_ramp");
+}
@@ -0,0 +1,160 @@
+/*
+ * Tests of the speaker's jitter buffer control (jitter_buf.c): the frame
+ * insertion and deletion kernels, the steering of the depth to the target
+ * and the moves of the target on underruns and stable periods.
+ *
+ * Blocks are 1 ms at 48 kHz, as the playback task hands them to the DMA.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "jitter_buf.h"
+#include "check.h"
+
+#define RATE        48000
+#define BLOCK       (RATE / 1000)
+
+// A stretched block starts and ends on the frames of the block, a constant stays constant
+static void test_stretch(void)
+{
+    int16_t in16[2 * BLOCK], out16[2 * (BLOCK + 1)];
+    int32_t in32[2 * BLOCK], out32[2 * (BLOCK + 1)];
+
+    srand(1);
+    for (int i = 0; i < 2 * BLOCK; i++) {
+        in16[i] = (int16_t)(rand() - RAND_MAX / 2);
+        in32[i] = (int32_t)((uint32_t)rand() << 8);
+    }
+    for (int delta = -1; delta <= 1; delta++) {
+        uint32_t n = jb_stretch_pcm16(in16, out16, BLOCK, delta);
+        CHECK(n == BLOCK + delta, "pcm16 delta %d: %u frames", delta, n);
+        CHECK(!memcmp(out16, in16, 4) && !memcmp(out16 + 2 * (n - 1), in16 + 2 * (BLOCK - 1), 4),
+              "pcm16 delta %d: does not start and end on the block", delta);
+        n = jb_stretch_pcm32(in32, out32, BLOCK, delta);
+        CHECK(n == BLOCK + delta, "pcm32 delta %d: %u frames", delta, n);
+        CHECK(!memcmp(out32, in32, 8) && !memcmp(out32 + 2 * (n - 1), in32 + 2 * (BLOCK - 1), 8),
+              "pcm32 delta %d: does not start and end on the block", delta);
+        for (uint32_t i = 0; i < 2 * n; i++)
+            CHECK((out32[i] & 0xff) == 0, "pcm32 delta %d: pad byte of sample %u is 0x%02x", delta, i, out32[i] & 0xff);
+    }
+    CHECK(jb_stretch_pcm16(in16, out16, BLOCK, 0) == BLOCK && !memcmp(out16, in16, sizeof(in16)),
+          "delta 0 is not a copy");
+
+    for (int i = 0; i < BLOCK; i++) {
+        in16[2 * i] = 1000;
+        in16[2 * i + 1] = -1000;
+    }
+    for (int delta = -1; delta <= 1; delta += 2) {
+        uint32_t n = jb_stretch_pcm16(in16, out16, BLOCK, delta);
+        for (uint32_t i = 0; i < n; i++)
+            CHECK(out16[2 * i] == 1000 && out16[2 * i + 1] == -1000, "delta %d: frame %u of a constant is %d/%d",
+                  delta, i, out16[2 * i], out16[2 * i + 1]);
+    }
+
+    // too short to fade over: the last frame is repeated or dropped
+    CHECK(jb_stretch_pcm16(in16, out16, 1, 1) == 2 && out16[2] == in16[0], "one frame block");
+    CHECK(jb_stretch_pcm16(in16, out16, 0, 1) == 0, "empty block");
+}
+
+/* The buffer as the playback task sees it: BLOCK frames come in and go out every ms, with
+   the frame inserted or deleted by jb_steer() adding to the DMA queue or taken from it;
+   with hold the depth stays where it is whatever jb_steer() does */
+static uint32_t run_hold(jitter_buf_t *jb, uint32_t depth, uint32_t ms, int hold)
+{
+    for (uint32_t t = 0; t < ms; t++) {
+        int delta = jb_steer(jb, depth, BLOCK);
+        if (!hold) depth += delta;
+    }
+    return depth;
+}
+
+static uint32_t run(jitter_buf_t *jb, uint32_t depth, uint32_t ms)
+{
+    return run_hold(jb, depth, ms, 0);
+}
+
+// The depth is brought to the target at no more than one frame in JB_WARP_FRAMES, and held there
+static void test_steer(void)
+{
+    jitter_buf_t jb;
+    uint32_t const target = 4 * BLOCK;
+
+    jb_init(&jb, RATE, JB_BALANCED);
+    CHECK(jb.target_ms == jb_profiles[JB_BALANCED].start_ms && jb_target_frames(&jb) == target,
+          "balanced starts at %u ms, %u frames", jb.target_ms, jb_target_frames(&jb));
+
+    jb_start(&jb, target + 2 * BLOCK);
+    uint32_t depth = run(&jb, target + 2 * BLOCK, 1000);
+    CHECK(jb.deleted <= 1000 * BLOCK / JB_WARP_FRAMES && jb.inserted == 0, "deleted %u, inserted %u", jb.deleted, jb.inserted);
+    CHECK(depth <= target + BLOCK / 2 && depth + BLOCK / 2 >= target, "depth %u after 1 s, target %u", depth, target);
+    uint32_t steady = jb.inserted + jb.deleted;
+    depth = run(&jb, depth, 1000);
+    CHECK(jb.inserted + jb.deleted == steady, "%u more frames stretched on the target", jb.inserted + jb.deleted - steady);
+
+    jb_init(&jb, RATE, JB_BALANCED);
+    jb_start(&jb, target - 2 * BLOCK);
+    depth = run(&jb, target - 2 * BLOCK, 1000);
+    CHECK(depth <= target + BLOCK / 2 && depth + BLOCK / 2 >= target, "depth %u after 1 s from below, target %u", depth, target);
+
+    // 44.1kHz: the target is in exact frames
+    jb_init(&jb, 44100, JB_ROBUST);
+    CHECK(jb_target_frames(&jb) == 441, "robust at 44.1kHz: %u frames", jb_target_frames(&jb));
+}
+
+// Underruns raise the target up to the profile's max, stable periods lower it with a backoff
+static void test_target(void)
+{
+    jitter_buf_t jb;
+    const jb_profile_params_t *p = &jb_profiles[JB_LOW_LATENCY];
+
+    jb_init(&jb, RATE, JB_LOW_LATENCY);
+    for (uint32_t i = 0; i < p->max_ms; i++) jb_underrun(&jb);
+    CHECK(jb.target_ms == p->max_ms, "target %u after %u underruns, max %u", jb.target_ms, p->max_ms, p->max_ms);
+    CHECK(jb.underruns == p->max_ms && jb.grows == p->max_ms - p->start_ms, "underruns %u grows %u", jb.underruns, jb.grows);
+    CHECK(jb.n_events == p->max_ms, "%u events", jb.n_events);
+
+    // stable with room to spare: one step down per stable_ms
+    uint32_t depth = jb_target_frames(&jb);
+    jb_start(&jb, depth);
+    run(&jb, depth, p->stable_ms + 1);
+    CHECK(jb.target_ms == p->max_ms - JB_SHRINK_MS && jb.shrinks == 1, "target %u after a stable period", jb.target_ms);
+
+    // without room to spare it stays
+    jb_init(&jb, RATE, JB_LOW_LATENCY);
+    jb_underrun(&jb);
+    run_hold(&jb, BLOCK, 2 * p->stable_ms, 1);
+    CHECK(jb.target_ms == p->start_ms + JB_GROW_MS && jb.shrinks == 0, "target %u at a low water of 1 ms", jb.target_ms);
+
+    // an underrun right after a step down: the next one waits twice as long
+    jb_init(&jb, RATE, JB_LOW_LATENCY);
+    jb_underrun(&jb);
+    jb_underrun(&jb);
+    run(&jb, 4 * BLOCK, p->stable_ms + 1);
+    CHECK(jb.shrinks == 1, "%u shrinks", jb.shrinks);
+    jb_underrun(&jb);
+    CHECK(jb.backoff == 1, "backoff %u", jb.backoff);
+    run(&jb, 4 * BLOCK, p->stable_ms + 1);
+    CHECK(jb.shrinks == 1, "stepped down after one stable_ms");
+    run(&jb, 4 * BLOCK, p->stable_ms);
+    CHECK(jb.shrinks == 2, "not stepped down after two stable_ms");
+
+    // the history keeps the last JB_HISTORY changes
+    jb_init(&jb, RATE, JB_ROBUST);
+    for (int i = 0; i < JB_HISTORY + 2; i++) jb_underrun(&jb);
+    jb_set_profile(&jb, JB_BALANCED);
+    const jb_event_t *e = &jb.history[(jb.n_events - 1) % JB_HISTORY];
+    CHECK(e->reason == JB_EVENT_PROFILE && e->to_ms == jb_profiles[JB_BALANCED].start_ms && jb.target_ms == e->to_ms,
+          "last event %u %u -> %u", e->reason, e->from_ms, e->to_ms);
+    e = &jb.history[(jb.n_events - JB_HISTORY) % JB_HISTORY];
+    CHECK(e->reason == JB_EVENT_UNDERRUN && e->from_ms == jb_profiles[JB_ROBUST].start_ms + 3, "oldest event %u -> %u",
+          e->from_ms, e->to_ms);
+}
+
+int main(void)
+{
+    test_stretch();
+    test_steer();
+    test_target();
+
+    return check_report("test_jitter_buf");
+}
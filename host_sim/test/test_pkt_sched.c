@@ -0,0 +1,169 @@
+/*
+ * Tests of the USB frame pacing (frame_pacer_*) and the mic IN packet sizing
+ * (mic_pkt_sched_*) in audio_dsp.c.
+ *
+ * The sample accounting has to be exact over any length of stream: the pacer
+ * gives sample_rate frames in every 1000 USB frames, and the packet sizing
+ * sends every frame the I2S clock delivers, no more and no less, whichever
+ * clock is faster.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <math.h>
+#include "audio_dsp.h"
+#include "check.h"
+
+static const uint32_t rates[] = { 16000, 24000, 32000, 44100, 48000 };
+
+// Every packet is floor or ceil of rate / 1000 and every 1000 packets add up to the rate,
+// for an hour of packets
+static void test_pacer_exact(uint32_t rate)
+{
+    frame_pacer_t p;
+    uint32_t lo = rate / 1000, hi = (rate + 999) / 1000;
+    uint64_t total = 0;
+    int bad_size = 0, bad_second = 0;
+
+    frame_pacer_init(&p, rate);
+    for (uint32_t s = 0; s < 3600; s++) {
+        uint32_t second = 0;
+        for (int i = 0; i < 1000; i++) {
+            uint32_t n = frame_pacer_next(&p);
+            bad_size += n < lo || n > hi;
+            second += n;
+        }
+        bad_second += second != rate;
+        total += second;
+    }
+    CHECK(bad_size == 0, "%u Hz: %d packets not %u or %u frames", rate, bad_size, lo, hi);
+    CHECK(bad_second == 0, "%u Hz: %d seconds not %u frames", rate, bad_second, rate);
+    CHECK(total == (uint64_t)rate * 3600, "%u Hz: %llu frames in an hour", rate, (unsigned long long)total);
+}
+
+// 44.1kHz: nine packets of 44 frames, then one of 45, spread out evenly
+static void test_pacer_441(void)
+{
+    frame_pacer_t p;
+    frame_pacer_init(&p, 44100);
+    for (int block = 0; block < 100; block++) {
+        int n45 = 0;
+        for (int i = 0; i < 10; i++) {
+            uint32_t n = frame_pacer_next(&p);
+            n45 += n == 45;
+            CHECK(n == (i == 9 ? 45u : 44u), "packet %d of block %d: %u frames", i, block, n);
+        }
+        CHECK(n45 == 1, "block %d: %d packets of 45 frames", block, n45);
+    }
+}
+
+/*
+  The mic path in miniature: the I2S clock at rate (1 + ppm) fills DMA buffers of
+  round(rate / 1000) frames, the capture task moves each one to the ring some time
+  after it completes, and the tinyusb task takes a packet out every 1 ms, sized by
+  mic_pkt_sched from the ring fill plus the frames still on their way, as
+  mic_ring_get_data() does.
+*/
+typedef struct {
+    uint64_t produced;      // frames clocked in by the I2S
+    uint64_t captured;      // frames moved to the ring
+    uint64_t sent;          // frames sent in packets
+    uint64_t underrun;      // frames a packet needed that were not in the ring
+    uint32_t fill_min, fill_max;
+} mic_model_t;
+
+static void run_mic_model(uint32_t rate, double ppm, uint32_t seconds, uint32_t capture_jitter_us,
+                          mic_model_t *m, mic_pkt_sched_t *s)
+{
+    const uint32_t buf = (rate + 500) / 1000;
+    const double frame_us = 1e6 / (rate * (1.0 + ppm * 1e-6));
+    const uint32_t start = 2 * (rate / 1000) + 4;
+    uint64_t ring = 0;
+    uint32_t next_lag_us = 0;
+    int primed = 0;
+
+    *m = (mic_model_t) { .fill_min = UINT32_MAX };
+    mic_pkt_sched_init(s, rate, 5);
+    srand(rate);
+
+    for (uint64_t ms = 1; ms <= (uint64_t)seconds * 1000; ms++) {
+        double now_us = ms * 1000.0;
+        uint64_t clocked = (uint64_t)(now_us / frame_us);
+        uint64_t done = clocked - clocked % buf;             // whole DMA buffers
+
+        // the capture task: each completed buffer, some time after the DMA finished it
+        while (m->captured < done) {
+            double buf_done_us = (m->captured + buf) * frame_us;
+            if (buf_done_us + next_lag_us > now_us) break;
+            m->captured += buf;
+            ring += buf;
+            next_lag_us = capture_jitter_us ? (uint32_t)(rand() % capture_jitter_us) : 0;
+        }
+        m->produced = clocked;
+
+        uint32_t fill = (uint32_t)(ring + (clocked - m->captured));
+        uint32_t n;
+        if (!primed) {
+            primed = fill >= start;
+            if (!primed) {
+                frame_pacer_next(&s->pacer);
+                continue;
+            }
+        }
+        n = mic_pkt_sched_next(s, fill);
+        if (ms > 1000) {
+            if (ring < m->fill_min) m->fill_min = (uint32_t)ring;
+            if (ring > m->fill_max) m->fill_max = (uint32_t)ring;
+        }
+        if (n > ring) {
+            m->underrun += n - ring;
+            n = (uint32_t)ring;
+        }
+        ring -= n;
+        m->sent += n;
+    }
+}
+
+static void test_mic_accounting(uint32_t rate, double ppm, uint32_t jitter_us)
+{
+    const uint32_t seconds = 3600;
+    const uint32_t buf = (rate + 500) / 1000;
+    mic_model_t m;
+    mic_pkt_sched_t s;
+
+    run_mic_model(rate, ppm, seconds, jitter_us, &m, &s);
+
+    // no frame was made up, and all but the ones still in the ring or the DMA went out
+    CHECK(m.underrun == 0, "%u Hz %+.0f ppm: %llu frames of underrun", rate, ppm, (unsigned long long)m.underrun);
+    CHECK(m.produced - m.sent <= m.fill_max + buf, "%u Hz %+.0f ppm: %llu frames clocked in, %llu sent",
+          rate, ppm, (unsigned long long)m.produced, (unsigned long long)m.sent);
+    // the ring stays within a DMA buffer and a couple of frames of where it settled
+    CHECK(m.fill_max - m.fill_min <= buf + rate / 1000 + 4, "%u Hz %+.0f ppm: ring fill %u..%u frames",
+          rate, ppm, m.fill_min, m.fill_max);
+    // one adjustment per frame of clock error, no hunting
+    double drift = rate * ppm * 1e-6 * seconds;
+    double net = (double)s.long_packets - (double)s.short_packets;
+    CHECK(fabs(net - drift) <= 4, "%u Hz %+.0f ppm: net %+.0f frames of adjustment for %+.1f frames of clock error",
+          rate, ppm, net, drift);
+    CHECK(s.long_packets + s.short_packets <= fabs(drift) + 4,
+          "%u Hz %+.0f ppm: %u long and %u short packets for %.1f frames of clock error",
+          rate, ppm, s.long_packets, s.short_packets, drift);
+    // at most one adjustment every 2^shift packets
+    CHECK(s.max_per_sec <= 1000 / 32 + 1, "%u Hz %+.0f ppm: %u adjustments in one second", rate, ppm, s.max_per_sec);
+}
+
+int main(void)
+{
+    static const double ppms[] = { 0, 100, -100, 500, -500 };
+
+    for (unsigned r = 0; r < sizeof(rates) / sizeof(rates[0]); r++) {
+        test_pacer_exact(rates[r]);
+        for (unsigned p = 0; p < sizeof(ppms) / sizeof(ppms[0]); p++) {
+            test_mic_accounting(rates[r], ppms[p], 0);
+            test_mic_accounting(rates[r], ppms[p], 300);
+        }
+    }
+    test_pacer_441();
+
+    return check_report("test_pkt_sched");
+}
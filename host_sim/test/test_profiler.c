@@ -0,0 +1,113 @@
+/*
+ * Tests of the pipeline profiler (profiler.h, profiler.c).
+ *
+ * A scope adds its cycles, a call and its worst case to its own stage only,
+ * and prof_print() gives each stage as a share of the cycles of the frames
+ * since prof_reset(). With CONFIG_AUDIO_PROFILER off the scopes must not
+ * leave any code behind (test_profiler_off.c). Reports the cost of a scope.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include "profiler.h"
+#include "sim.h"
+#include "check.h"
+
+uint32_t sampFreq = 48000;
+
+int profiler_off_scopes(int n);
+extern const char profiler_off_begin[], profiler_off_end[];
+
+// Busy for about ns of the host clock, which the host cycle counter counts
+static void spin_ns(uint64_t ns)
+{
+    uint64_t t0 = sim_cpu_ns();
+    while (sim_cpu_ns() - t0 < ns) { }
+}
+
+static void test_accumulate(void)
+{
+    prof_reset();
+    for (int i = 1; i <= 4; i++) {
+        PROF_BEGIN(PROF_MIC_GAIN);
+        spin_ns(i * 20000);
+        PROF_END(PROF_MIC_GAIN);
+    }
+    PROF_BEGIN(PROF_SPK_GAIN);
+    PROF_END(PROF_SPK_GAIN);
+
+    const prof_stage_t *mic = &prof_stages[PROF_MIC_GAIN];
+    const prof_stage_t *spk = &prof_stages[PROF_SPK_GAIN];
+    CHECK(mic->calls == 4 && spk->calls == 1, "%u and %u calls", mic->calls, spk->calls);
+    CHECK(mic->cycles >= 200000 && mic->cycles < 200000 + 4 * 50000, "%llu cycles for 200 us", (unsigned long long)mic->cycles);
+    CHECK(mic->max >= 80000 && mic->max < mic->cycles - 120000 + 1, "max %u of %llu", mic->max, (unsigned long long)mic->cycles);
+    for (int i = 0; i < PROF_N_STAGES; i++) {
+        if (i != PROF_MIC_GAIN && i != PROF_SPK_GAIN)
+            CHECK(prof_stages[i].calls == 0, "stage %d counted", i);
+    }
+
+    prof_reset();
+    CHECK(prof_stages[PROF_MIC_GAIN].calls == 0 && prof_stages[PROF_MIC_GAIN].max == 0, "not cleared");
+}
+
+// 250 us of one stage in 10 ms of simulated time is 2.5 % of the frame
+static void test_share(void)
+{
+    char line[256];
+    double share = -1;
+    FILE *f = tmpfile();
+
+    prof_reset();
+    for (int i = 0; i < 10; i++) {
+        PROF_BEGIN(PROF_I2S_WRITE);
+        spin_ns(25000);
+        PROF_END(PROF_I2S_WRITE);
+        sim_advance_ns(1000000);
+    }
+    prof_print(f);
+    rewind(f);
+    while (fgets(line, sizeof(line), f)) {
+        char name[32];
+        unsigned calls, avg, max, per_frame;
+        double pct;
+        if (sscanf(line, " %31s %u %u %u %u %lf", name, &calls, &avg, &max, &per_frame, &pct) == 6 &&
+            strcmp(name, "i2s_channel_write") == 0) {
+            share = pct;
+        }
+    }
+    fclose(f);
+    CHECK(share >= 2.5 && share < 3.5, "i2s_channel_write at %.3f %% of the frame, expected 2.5", share);
+}
+
+static void test_off(void)
+{
+    CHECK(profiler_off_scopes(3) == 3, "code between the scopes changed");
+    CHECK(profiler_off_begin[0] == 0 && profiler_off_end[0] == 0, "PROF_BEGIN/PROF_END expand to \"%s\" / \"%s\"",
+          profiler_off_begin, profiler_off_end);
+}
+
+static void time_scope(void)
+{
+    const int n = 10000000;
+
+    prof_reset();
+    uint64_t t0 = sim_cpu_ns();
+    for (int i = 0; i < n; i++) {
+        PROF_BEGIN(PROF_TUD_AUDIO_READ);
+        PROF_END(PROF_TUD_AUDIO_READ);
+    }
+    uint64_t t1 = sim_cpu_ns();
+    // the host cycle counter is clock_gettime(); most of the time is in there
+    printf("%.1f ns per scope\n", (double)(t1 - t0) / n);
+}
+
+int main(void)
+{
+    test_accumulate();
+    test_share();
+    test_off();
+    time_scope();
+
+    return check_report("test_profiler");
+}
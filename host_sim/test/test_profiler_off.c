@@ -0,0 +1,24 @@
+/*
+ * profiler.h built with CONFIG_AUDIO_PROFILER off, for test_profiler.c: the
+ * scopes have to expand to nothing.
+ */
+#include "sdkconfig.h"
+#undef CONFIG_AUDIO_PROFILER
+#include "profiler.h"
+
+#define STR(x)  STR_(x)
+#define STR_(x) #x
+
+const char profiler_off_begin[] = STR(PROF_BEGIN(PROF_MIC_GAIN));
+const char profiler_off_end[] = STR(PROF_END(PROF_MIC_GAIN));
+
+int profiler_off_scopes(int n)
+{
+    int sum = 0;
+    for (int i = 0; i < n; i++) {
+        PROF_BEGIN(PROF_MIC_GAIN);
+        sum++;
+        PROF_END(PROF_MIC_GAIN);
+    }
+    return sum;
+}
@@ -0,0 +1,131 @@
+/*
+ * Tests of the audio path trace rings (trace.h, trace.c).
+ *
+ * Records go to the ring of the core they are written on, the newest
+ * overwrite the oldest, and trace_dump() prints what is left oldest first in
+ * the format scripts/trace_decode.py reads. Reports the time of a record as
+ * well.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include "trace.h"
+#include "sim.h"
+#include "check.h"
+
+#define LEN CONFIG_AUDIO_TRACE_LEN
+
+typedef struct {
+    uint32_t n[TRACE_N_CORES];
+    uint32_t overwritten[TRACE_N_CORES];
+    trace_record_t rec[TRACE_N_CORES][LEN];
+    bool started, ended;
+} parsed_dump_t;
+
+// Reads back a dump the way trace_decode.py does
+static void parse_dump(FILE *f, parsed_dump_t *d)
+{
+    char line[1024];
+    unsigned core, records, overwritten;
+
+    memset(d, 0, sizeof(*d));
+    rewind(f);
+    while (fgets(line, sizeof(line), f)) {
+        if (strncmp(line, "TRACE start", 11) == 0) {
+            d->started = true;
+        }
+        else if (sscanf(line, "TRACE core=%u records=%u overwritten=%u", &core, &records, &overwritten) == 3) {
+            if (core < TRACE_N_CORES) d->overwritten[core] = overwritten;
+        }
+        else if (strncmp(line, "TRACE end", 9) == 0) {
+            d->ended = true;
+        }
+        else if (line[0] == 'T' && sscanf(line + 1, "%u", &core) == 1 && core < TRACE_N_CORES) {
+            char *p = strchr(line, ' ');
+            while (p && p[1] && p[1] != '\n' && d->n[core] < LEN) {
+                char word[17] = { 0 };
+                memcpy(word, p + 1, 16);
+                uint64_t v = strtoull(word, NULL, 16);
+                d->rec[core][d->n[core]++] = (trace_record_t){ (uint32_t)(v >> 32), (uint16_t)(v >> 16), (uint16_t)v };
+                p = strchr(p + 1, ' ');
+            }
+        }
+    }
+}
+
+// A few records per core: all of them come back, in order, on their own core
+static void test_per_core(void)
+{
+    static parsed_dump_t d;
+    FILE *f = tmpfile();
+
+    trace_reset();
+    sim_set_core(0);
+    TRACE_BEGIN(TRACE_PRE_LOAD);
+    sim_set_core(1);
+    TRACE_BEGIN(TRACE_CAPTURE);
+    TRACE_END(TRACE_CAPTURE, 384);
+    sim_set_core(0);
+    TRACE_END(TRACE_PRE_LOAD, 192);
+    trace_dump(f);
+    parse_dump(f, &d);
+    fclose(f);
+
+    CHECK(d.started && d.ended, "dump without start or end line");
+    CHECK(d.n[0] == 2 && d.n[1] == 2, "%u and %u records", d.n[0], d.n[1]);
+    CHECK(d.rec[0][0].event == TRACE_PRE_LOAD && d.rec[0][1].event == (TRACE_PRE_LOAD | TRACE_END_FLAG) &&
+          d.rec[0][1].arg == 192, "core 0: %04x %04x/%u", d.rec[0][0].event, d.rec[0][1].event, d.rec[0][1].arg);
+    CHECK(d.rec[1][0].event == TRACE_CAPTURE && d.rec[1][1].event == (TRACE_CAPTURE | TRACE_END_FLAG) &&
+          d.rec[1][1].arg == 384, "core 1: %04x %04x/%u", d.rec[1][0].event, d.rec[1][1].event, d.rec[1][1].arg);
+    CHECK((int32_t)(d.rec[0][1].ccount - d.rec[0][0].ccount) >= 0, "core 0 timestamps go backwards");
+}
+
+// More records than fit: the dump has the newest LEN, oldest first, and counts the rest
+static void test_overwrite(void)
+{
+    static parsed_dump_t d;
+    const uint32_t n_written = 3 * LEN + 5;
+    FILE *f = tmpfile();
+
+    trace_reset();
+    sim_set_core(0);
+    for (uint32_t i = 0; i < n_written; i++) trace_event(TRACE_SPK_STALL, (uint16_t)i);
+    trace_dump(f);
+    parse_dump(f, &d);
+    fclose(f);
+
+    CHECK(d.n[0] == LEN && d.n[1] == 0, "%u and %u records", d.n[0], d.n[1]);
+    CHECK(d.overwritten[0] == n_written - LEN, "%u overwritten", d.overwritten[0]);
+    for (uint32_t i = 0; i < d.n[0]; i++) {
+        uint16_t expected = (uint16_t)(n_written - LEN + i);
+        CHECK(d.rec[0][i].arg == expected, "record %u: arg %u, expected %u", i, d.rec[0][i].arg, expected);
+        if (d.rec[0][i].arg != expected) break;
+    }
+
+    // tracing goes on after the dump
+    uint32_t head = atomic_load(&trace_rings[0].head);
+    TRACE_BEGIN(TRACE_PLAYBACK);
+    CHECK(atomic_load(&trace_rings[0].head) == head + 1, "not recording after the dump");
+}
+
+static void time_records(void)
+{
+    const int n = 10000000;
+
+    trace_reset();
+    uint64_t t0 = sim_cpu_ns();
+    for (int i = 0; i < n; i++) trace_event(TRACE_RX_DONE, (uint16_t)i);
+    uint64_t t1 = sim_cpu_ns();
+    // the host cycle counter is clock_gettime(); most of the time is in there
+    printf("%.1f ns per record\n", (double)(t1 - t0) / n);
+}
+
+int main(void)
+{
+    test_per_core();
+    test_overwrite();
+    time_records();
+
+    return check_report("test_trace");
+}
@@ -0,0 +1,101 @@
+/*
+ * Tests of volume_to_gain() (audio_dsp.c), which turns the UAC2 volume of
+ * the feature units, 1/256 dB, into the 8.24 gain of the audio path.
+ *
+ * Every int16 volume is checked against 10^(dB/20), and the sums of master,
+ * channel and offset that calculate_ch_gain() passes in for saturation and
+ * monotonicity. Reports the time per call as well.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <math.h>
+#include "audio_dsp.h"
+#include "sim.h"
+#include "check.h"
+
+#define VOLUME_MIN      (-32767)
+#define VOLUME_MAX      32767
+#define GAIN_ONE        16777216.0          // 1.0 in 8.24
+
+// The interpolation between 2^(i/64) is off by about (ln2/64)^2/8 = 1.5e-5 of the gain at
+// most, and the result is rounded to 8.24. That is within 0.001 dB where the gain has the bits.
+#define MAX_REL_ERROR   1.6e-5
+#define MAX_ERROR_DB    0.001
+#define FINE_FROM_DB    (-60)
+
+static double ref_gain(int32_t volume)
+{
+    return pow(10.0, volume / 256.0 / 20.0) * GAIN_ONE;
+}
+
+// Every value the host can send, including the ends of the UAC2 range
+static void test_error_bound(void)
+{
+    double max_db = 0, max_rel = 0;
+    int32_t at_db = 0, at_rel = 0;
+
+    for (int32_t v = VOLUME_MIN; v <= VOLUME_MAX; v++) {
+        int32_t g = volume_to_gain(v);
+        double ref = ref_gain(v);
+
+        if (ref >= INT32_MAX) {
+            CHECK(g == INT32_MAX, "%d/256 dB: %d, expected saturation", v, g);
+            continue;
+        }
+        double err = fabs(g - ref);
+        CHECK(err <= 0.5 + ref * MAX_REL_ERROR, "%d/256 dB: %d is %.2f LSB off %.2f", v, g, err, ref);
+        if (ref >= 1 << 20 && err / ref > max_rel) { max_rel = err / ref; at_rel = v; }
+        if (v >= FINE_FROM_DB * 256) {
+            double db = fabs(20.0 * log10(g / ref));
+            if (db > max_db) { max_db = db; at_db = v; }
+            CHECK(db <= MAX_ERROR_DB, "%d/256 dB: %d is %.5f dB off %.1f", v, g, db, ref);
+        }
+    }
+    printf("max error %.5f dB (at %.2f dB) from %d dB up, %.2e of the gain (at %.2f dB) from -24 dB up\n",
+           max_db, at_db / 256.0, FINE_FROM_DB, max_rel, at_rel / 256.0);
+}
+
+// Points the audio path relies on: unity is exact, so pcm24_gain() takes its fast path
+static void test_exact_points(void)
+{
+    CHECK(volume_to_gain(0) == 1 << 24, "0 dB gave %d", volume_to_gain(0));
+    CHECK(volume_to_gain(-256 * 256) == 0, "-256 dB gave %d", volume_to_gain(-256 * 256));
+    CHECK(volume_to_gain(INT32_MAX / 2) == INT32_MAX, "huge volume gave %d", volume_to_gain(INT32_MAX / 2));
+    CHECK(volume_to_gain(-INT32_MAX / 2) == 0, "huge attenuation gave %d", volume_to_gain(-INT32_MAX / 2));
+}
+
+// A louder setting is never quieter, also for the sums of master + channel + offset
+static void test_monotonic(void)
+{
+    int32_t prev = volume_to_gain(3 * VOLUME_MIN);
+    for (int32_t v = 3 * VOLUME_MIN + 1; v <= 3 * VOLUME_MAX; v++) {
+        int32_t g = volume_to_gain(v);
+        CHECK(g >= prev && g >= 0, "%d/256 dB: %d after %d", v, g, prev);
+        prev = g;
+    }
+}
+
+static void time_calls(void)
+{
+    static volatile int32_t sink;
+    const int passes = 20;
+
+    uint64_t t0 = sim_cpu_ns();
+    for (int p = 0; p < passes; p++) {
+        for (int32_t v = VOLUME_MIN; v <= VOLUME_MAX; v++) sink = volume_to_gain(v);
+    }
+    uint64_t t1 = sim_cpu_ns();
+    (void) sink;
+    printf("%.1f ns per call\n", (double)(t1 - t0) / passes / (VOLUME_MAX - VOLUME_MIN + 1));
+}
+
+int main(void)
+{
+    test_error_bound();
+    test_exact_points();
+    test_monotonic();
+    time_calls();
+
+    return check_report("test_volume");
+}
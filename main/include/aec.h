@@ -0,0 +1,53 @@
+// aec.h
+#ifndef _AEC_H_
+#define _AEC_H_
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "sdkconfig.h"
+
+/* Acoustic echo canceller of the mic: a block NLMS filter per mic channel models the path
+   from the speaker to the mic and subtracts its estimate of the echo from the mic signal.
+   The reference is the speaker stream as it goes out over I2S, mixed to mono. The filter
+   runs in the time domain on single precision floats (the ESP32-S3 has an FPU): each block
+   of up to AEC_BLOCK_MAX frames is filtered with the weights of the block before, the
+   weights are then moved once by the error of the whole block, normalized by the energy of
+   the reference in the filter's window. AEC_TAPS taps cover AEC_TAPS / fs of echo path
+   (32mS at 16kHz); the cost is 2 * AEC_TAPS multiply-adds per frame and channel.
+   Samples are 32bit I2S slots with 24 valid bits MSB aligned, as dc_block_process() takes
+   them; the kernel works in place and leaves the low byte clear. With a silent reference
+   the mic passes through bit exact. There is no double talk detector: near end speech
+   while the far end talks disturbs the weights, the less the smaller mu is. */
+
+#ifdef CONFIG_MIC_AEC_TAPS
+#define AEC_TAPS        CONFIG_MIC_AEC_TAPS
+#else
+#define AEC_TAPS        512
+#endif
+#define AEC_CHANNELS    2
+#define AEC_BLOCK_MAX   48          // frames filtered with one set of weights: 1mS at 48kHz
+#define AEC_MU          1.0f        // step size, 0 < mu < 2
+#define AEC_ERLE_MS     250         // ERLE is taken over windows of this length
+
+typedef struct {
+    float    w[AEC_CHANNELS][AEC_TAPS];             // w[c][AEC_TAPS-1] is the weight of the newest reference sample
+    float    x[AEC_TAPS - 1 + AEC_BLOCK_MAX];       // reference, oldest first: the window of the last block and the block
+    float    mu;
+    uint32_t erle_frames;   // frames per ERLE window
+    // ERLE window being summed and the result of the last complete one
+    double   sum_mic;       // energy of the mic, far end active
+    double   sum_err;       // energy of what is left of it
+    uint32_t n_frames;      // frames summed
+    float    erle_db;       // 10 log10(sum_mic / sum_err) of the last window, 0 before the first
+    uint32_t n_windows;
+} aec_t;
+
+void  aec_init(aec_t *a, uint32_t sample_rate, float mu);
+void  aec_reset(aec_t *a);
+
+/* Cancels the echo of ref (n_frames mono samples, -1..1) in frames (n_frames stereo slots),
+   in place, any number of frames at a time */
+void  aec_process(aec_t *a, const float *ref, int32_t *frames, uint32_t n_frames);
+
+#endif
+//end aec.h
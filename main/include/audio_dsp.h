@@ -0,0 +1,145 @@
+// audio_dsp.h
+#ifndef _AUDIO_DSP_H_
+#define _AUDIO_DSP_H_
+
+#include <stdint.h>
+#include <stdbool.h>
+
+/* Block kernels of the audio path. Each one processes a whole DMA buffer (1mS) of
+   interleaved stereo frames per call. The *_ref versions are plain C, one sample at a
+   time, and define the exact result; the optimized versions must match them bit for bit.
+*/
+
+/* mic: 32bit I2S slots (24 valid bits, MSB aligned as the INMP441 sends them) times the
+   per-channel 8.24 gain, saturated to int16. Same arithmetic as mul_1p31x8p24(). */
+void mic_convert_gain(const int32_t *src, int16_t *dst, uint32_t n_frames, const int32_t gain[2]);
+void mic_convert_gain_ref(const int32_t *src, int16_t *dst, uint32_t n_frames, const int32_t gain[2]);
+
+/* speaker: 16bit samples times the per-channel 8.24 gain, MSB aligned in 32bit I2S slots
+   and saturated. With unity gain the result is exactly sample << 16; below unity the
+   extra bits of the product are kept in the low half of the slot. */
+void spk_convert_gain(const int16_t *src, int32_t *dst, uint32_t n_frames, const int32_t gain[2]);
+
+/* 24 bit path, both directions: 32bit slots with 24 valid bits MSB aligned (the I2S slots,
+   and the 4 byte subslots of the 24 bit alternate settings) times the per-channel 8.24
+   gain, in place. The result is the 24 bit value of the product, saturated, with the low
+   byte cleared; its upper 16 bits are exactly what mic_convert_gain() gives for the same
+   slot. At unity gain on both channels the slots pass through unchanged but for the low
+   byte, and no multiply is done.
+*/
+void pcm24_gain(int32_t *frames, uint32_t n_frames, const int32_t gain[2]);
+
+/* Gain smoother. The control callbacks only set the target gains (audio_params_t);
+   the audio path calls gain_ramp_update() with them once per block, and a change starts a
+   linear ramp from the gain in use to the new one over ramp_frames frames, carried across
+   blocks. Mute is a ramp to 0. The *_ramp kernels apply the ramp per frame while it runs
+   and hand the rest of the block to the plain kernel, so a block without a ramp costs one
+   call of the plain kernel and nothing more. The first update after gain_ramp_init() takes
+   the gain without a ramp.
+*/
+typedef struct {
+    int32_t  cur[2];        // gain of the last frame processed, 8.24
+    int32_t  target[2];     // gain the ramp ends at
+    int32_t  step[2];       // change per frame while ramping
+    uint32_t remaining;     // frames left in the ramp; 0: cur == target
+    uint32_t ramp_frames;   // length of a ramp; 0: changes are taken at once
+    bool     primed;
+} gain_ramp_t;
+
+void gain_ramp_init(gain_ramp_t *r, uint32_t ramp_frames);
+void gain_ramp_update(gain_ramp_t *r, const int32_t gain[2]);
+
+void mic_convert_gain_ramp(const int32_t *src, int16_t *dst, uint32_t n_frames, gain_ramp_t *r);
+void spk_convert_gain_ramp(const int16_t *src, int32_t *dst, uint32_t n_frames, gain_ramp_t *r);
+void pcm24_gain_ramp(int32_t *frames, uint32_t n_frames, gain_ramp_t *r);
+
+/* Volume: a UAC2 volume in 1/256 dB (any int16 value, and sums of them) to the 8.24
+   linear gain 10^(dB/20), exact at 0 dB (1 << 24) and within 0.001 dB of it from
+   -60 dB up. Above +42.1 dB it saturates to INT32_MAX; deep negative values round to 0.
+   Does not handle the UAC2 silence code, 0x8000.
+*/
+int32_t volume_to_gain(int32_t volume);
+
+/* DC blocker: first order high pass y[n] = x[n] - x[n-1] + a*y[n-1] per channel, with
+   a = exp(-2*pi*corner/fs) in Q31. Samples are 32bit I2S slots with 24 valid bits MSB
+   aligned; the filter runs on the 24 bit values and writes them back in the same format.
+   The rounding error of each output is carried into the next one (fraction saving), so
+   a constant input settles to exactly 0.
+*/
+typedef struct {
+    int32_t a;          // pole, Q31
+    bool    primed;     // false after a reset: the first frame seeds the state
+    int32_t x1[2];      // previous input, 24 bit
+    int32_t y1[2];      // previous output, 24 bit
+    int64_t err[2];     // rounding error carried over, in units of 2^-31 LSB
+} dc_block_t;
+
+void dc_block_init(dc_block_t *f, uint32_t corner_hz, uint32_t sample_rate);
+void dc_block_reset(dc_block_t *f);
+void dc_block_process(dc_block_t *f, int32_t *frames, uint32_t n_frames);
+
+/* Speaker feedback filter: smooths the I2S frames counted in each USB frame into the
+   16.16 frames-per-frame value of the feedback EP. First order low pass with a time
+   constant of 2^shift updates, written as y = (acc + x) >> shift, acc += x - y: the
+   rounding error stays in acc instead of being lost, so the values sent add up to
+   exactly the frames counted, less the change in acc. The host therefore never sends
+   more or less than the I2S clock consumed, however long the stream runs.
+   The output is limited to nominal -/+ one frame (UAC2 FMT-2.0 section 2.3.1.1).
+*/
+typedef struct {
+    uint32_t nominal;   // sample_rate / 1000 frames per frame, 16.16
+    uint32_t min;       // nominal - 1 frame
+    uint32_t max;       // nominal + 1 frame
+    uint8_t  shift;
+    int64_t  acc;       // about (output << shift) - output
+} fb_filter_t;
+
+void fb_filter_init(fb_filter_t *f, uint32_t sample_rate, uint8_t shift);
+uint32_t fb_filter_update(fb_filter_t *f, int32_t frames_q16);
+
+/* Frames per USB frame (1mS) at the nominal rate. For a rate that is not a whole number
+   of frames per mS the remainder is carried from one frame to the next: 44.1kHz gives
+   nine frames of 44 and one of 45 every 10mS, and any 1000 frames in a row carry exactly
+   sample_rate frames.
+*/
+typedef struct {
+    uint32_t sample_rate;
+    uint32_t rem;           // frames * 1000 owed to the next USB frame
+} frame_pacer_t;
+
+void frame_pacer_init(frame_pacer_t *p, uint32_t sample_rate);
+uint32_t frame_pacer_next(frame_pacer_t *p);
+
+/* Mic IN packet sizing: the mic EP is asynchronous, so instead of letting the difference
+   between the I2S clock and the USB frame clock pile up in (or drain) the capture ring,
+   each packet carries N-1, N or N+1 frames, N being the nominal size from frame_pacer_t. The ring fill is averaged over 2^shift
+   packets, which takes out the jitter of the capture task against the USB frames; the
+   average after the first 2^shift packets is the level held from then on. When the
+   average is more than a frame off that level one packet is a frame longer or shorter,
+   and the next adjustment waits till the average has seen its effect (2^shift packets).
+   Counters per second are kept along with the totals.
+*/
+typedef struct {
+    frame_pacer_t pacer;    // nominal frames of each packet (N); stepped alone for silent packets
+    uint8_t  shift;
+    bool     locked;        // target taken
+    int32_t  avg;           // average ring fill, frames in 24.8
+    int32_t  target;        // ring fill to hold, frames in 24.8
+    uint32_t hold;          // packets before the next adjustment (or before the target is taken)
+
+    uint32_t packets;       // packets sized from the ring since init
+    uint32_t long_packets;  // N+1 frames
+    uint32_t short_packets; // N-1 frames
+    uint16_t sec_packets;   // packets so far in the current second
+    uint16_t sec_long;      // adjustments so far in the current second
+    uint16_t sec_short;
+    uint16_t last_long;     // adjustments in the last complete second
+    uint16_t last_short;
+    uint16_t max_per_sec;   // most adjustments (long + short) in any complete second
+} mic_pkt_sched_t;
+
+void mic_pkt_sched_init(mic_pkt_sched_t *s, uint32_t sample_rate, uint8_t shift);
+uint32_t mic_pkt_sched_next(mic_pkt_sched_t *s, uint32_t fill_frames);
+
+#endif
+//end audio_dsp.h
@@ -0,0 +1,35 @@
+// audio_params.h
+#ifndef _AUDIO_PARAMS_H_
+#define _AUDIO_PARAMS_H_
+
+#include <stdint.h>
+#include <stdatomic.h>
+
+/* The stream parameters the control requests set and the audio path works with */
+typedef struct {
+    uint32_t sample_rate;
+    int32_t  spk_gain[2];       // 8.24 linear gain per channel, the target of the gain ramp
+    int32_t  mic_gain[2];
+    uint32_t spk_bytes_ms;      // bytes in a 1mS block of the open speaker format
+    uint32_t mic_bytes_ms;
+} audio_params_t;
+
+/* Lock-free handover of audio_params_t from one writer (the tinyusb task, in the control
+   callbacks) to any number of readers (the capture and playback tasks, once per 1mS block).
+   The writer publishes a whole new block and a reader always gets one whole block, never
+   some fields of one and some of the next.
+   There are two copies: a publish fills the one the readers are not using and then switches
+   them over by bumping seq, so neither side ever waits for the other. seq is odd while a copy
+   is being written and counts two per publish; a reader only has to read again if the writer
+   came back to the copy it was reading, i.e. published twice while it was reading once.
+   A zeroed block is valid: version 0, all parameters 0. */
+typedef struct {
+    _Atomic uint32_t seq;
+    audio_params_t   slot[2];
+} audio_params_block_t;
+
+void     audio_params_publish(audio_params_block_t *block, const audio_params_t *params);
+uint32_t audio_params_read(audio_params_block_t *block, audio_params_t *params);
+
+#endif
+//end audio_params.h
@@ -0,0 +1,51 @@
+// audio_ring.h
+#ifndef _AUDIO_RING_H_
+#define _AUDIO_RING_H_
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdatomic.h>
+
+/* Lock-free single-producer/single-consumer byte ring.
+   The producer (e.g. the I2S capture task on one core) only writes wr_idx and the
+   consumer (e.g. the tinyusb task on the other core) only writes rd_idx, so no lock
+   is needed; the indices are published with release stores and read with acquire
+   loads. Indices run freely and are masked on access, so the size must be a power
+   of 2. Neither side ever blocks: a write that does not fit is truncated (overrun)
+   and a read that finds too little data returns what is there (underrun).
+*/
+typedef struct {
+    uint8_t          *buffer;
+    uint32_t          size;             // power of 2
+    _Atomic uint32_t  wr_idx;           // written by producer only
+    _Atomic uint32_t  rd_idx;           // written by consumer only
+
+    // statistics; each counter is only written by one side
+    volatile uint32_t overrun_bytes;    // producer: bytes dropped because the ring was full
+    volatile uint32_t underrun_count;   // consumer: reads that got less than requested
+    volatile uint32_t underrun_bytes;   // consumer: bytes missing in those reads
+    volatile uint32_t fill_min;         // consumer: fill level seen before each read
+    volatile uint32_t fill_max;
+} audio_ring_t;
+
+/* Free space of the ring for a producer that writes in place: the part up to the end of the
+   buffer and the wrapped part, as tu_fifo_get_write_info() gives it for a tu_fifo */
+typedef struct {
+    uint8_t  *ptr_lin;
+    uint32_t  len_lin;
+    uint8_t  *ptr_wrap;
+    uint32_t  len_wrap;
+} audio_ring_info_t;
+
+void     audio_ring_init(audio_ring_t *ring, void *buffer, uint32_t size);
+uint32_t audio_ring_write(audio_ring_t *ring, const void *data, uint32_t n_bytes);
+uint32_t audio_ring_read(audio_ring_t *ring, void *data, uint32_t n_bytes);
+uint32_t audio_ring_read_split(audio_ring_t *ring, void *data, uint32_t n_lin, void *data_wrap, uint32_t n_bytes);
+void     audio_ring_get_write_info(audio_ring_t *ring, audio_ring_info_t *info);
+void     audio_ring_advance_write(audio_ring_t *ring, uint32_t n_written, uint32_t n_bytes);
+uint32_t audio_ring_count(audio_ring_t *ring);
+void     audio_ring_flush(audio_ring_t *ring);
+void     audio_ring_reset_stats(audio_ring_t *ring);
+
+#endif
+//end audio_ring.h
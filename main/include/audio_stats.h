@@ -0,0 +1,89 @@
+// audio_stats.h
+#ifndef _AUDIO_STATS_H_
+#define _AUDIO_STATS_H_
+
+#include <stdio.h>
+#include <stdint.h>
+#include "esp_attr.h"
+#include "esp_cpu.h"
+
+/* Counters of the audio streams, always on. Each counter has one writer (a callback of the
+   tinyusb task, the feedback interrupt, the capture or the playback task, an I2S DMA
+   interrupt), which adds to it; there are no locks, so a print taken while the streams
+   run can have one counter a packet ahead of another. When a stream opens the writer
+   clears its own counters: the capture and the playback task at their next block, on a
+   request of mic_ring_restart() and spk_playback_restart(), and the DMA interrupts not at
+   all, their counts for the stream being taken from a base. audio_stats_reset() (console
+   command "stats reset") clears everything from its own task, so an add that runs at the
+   same time can be lost or leave a range half cleared. audio_stats_print() and
+   audio_stats_print_json() show them together with spk_stats, the mic_ring statistics and
+   the IN packet sizing, on the console command "stats" (console.c). */
+
+// Number, smallest, largest and sum of a series of values
+typedef struct {
+    uint32_t n;
+    uint32_t min;
+    uint32_t max;
+    uint64_t total;
+} stats_range_t;
+
+// Run times of the callbacks and task blocks, in CPU cycles; the blocks of trace.h
+enum {
+    STATS_PRE_LOAD,             // tud_audio_tx_done_pre_load_cb()
+    STATS_POST_LOAD,            // tud_audio_tx_done_post_load_cb()
+    STATS_RX_DONE,              // tud_audio_rx_done_post_read_cb()
+    STATS_FEEDBACK,             // tud_audio_feedback_interval_isr()
+    STATS_CAPTURE,              // i2s_capture() after the DMA buffer came in
+    STATS_PLAYBACK,             // bsp_i2s_write() up to the DMA write
+    STATS_N_TIMINGS
+};
+
+typedef struct {
+    // mic: cleared when the mic opens (mic_ring_restart())
+    struct {
+        uint32_t packets;           // IN packets written to the EP IN FIFO
+        uint32_t silent_packets;    // of those, silence sent till mic_ring was primed
+        uint32_t i2s_reads;         // DMA buffers read by the capture task
+        uint32_t i2s_read_errors;   // i2s_channel_read() timed out or failed
+        uint32_t i2s_overruns;      // DMA buffers lost: the capture task did not read them in time
+        uint32_t i2s_overruns_base; // i2s_overruns when the mic opened
+    } mic;
+    // speaker: cleared when the speaker opens (spk_playback_restart())
+    struct {
+        uint32_t packets;           // OUT packets received
+        uint32_t short_packets;     // two frames or more below the nominal size, zero length ones included
+        stats_range_t packet_bytes;
+        stats_range_t fifo_bytes;   // EP OUT FIFO fill at every playback pass
+        uint32_t i2s_underruns;     // DMA buffers played as silence while the interface was open
+        uint32_t i2s_underruns_base;// i2s_underruns when the speaker opened
+    } spk;
+    stats_range_t timing[STATS_N_TIMINGS];
+} audio_stats_t;
+
+extern audio_stats_t audio_stats;
+
+FORCE_INLINE_ATTR void stats_range_add(stats_range_t *r, uint32_t value)
+{
+    if(value < r->min || r->n == 0) r->min = value;
+    if(value > r->max) r->max = value;
+    r->total += value;
+    r->n++;
+}
+
+// Start and end of a timed block: t0 = stats_time_begin(); ... stats_time_end(STATS_xxx, t0);
+FORCE_INLINE_ATTR uint32_t stats_time_begin(void)
+{
+    return esp_cpu_get_cycle_count();
+}
+
+FORCE_INLINE_ATTR void stats_time_end(int timing, uint32_t t0)
+{
+    stats_range_add(&audio_stats.timing[timing], esp_cpu_get_cycle_count() - t0);
+}
+
+void audio_stats_reset(void);
+void audio_stats_print(FILE *out);
+void audio_stats_print_json(FILE *out);
+
+#endif
+//end audio_stats.h
@@ -0,0 +1,11 @@
+// console.h
+#ifndef _CONSOLE_H_
+#define _CONSOLE_H_
+
+/* Serial console with the commands "stats [json|reset]", "prof [reset]", "latency [on|off|reset]",
+   "loopback [on|off]", "jitter [low_latency|balanced|robust]", "aec [on|off|reset]" (with
+   CONFIG_MIC_AEC) and "trace" */
+void console_init(void);
+
+#endif
+//end console.h
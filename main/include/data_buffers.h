@@ -2,11 +2,15 @@
 #ifndef _DATA_BUFFERS_H_
 #define _DATA_BUFFERS_H_
 
-/* data_in_buf is to temporarily store incoming data from I2S (mic); it is read by the USB device callback function*/
-/* data_in_buf is populated in tud_audio_tx_done_post_load_cb() from the circular buffer */
-/* tud_audio_tx_done_pre_cb() copies this data to the endpoint buffer */
-extern size_t  data_in_buf_n_bytes ;      // value is set based on sample rate etc. when the i2s is configured 
-extern int16_t data_in_buf[];
+#include "audio_ring.h"
+
+/* mic_ring carries mic data from the I2S capture task (producer) to the USB IN callback (consumer),
+   which reads it straight into the EP IN FIFO */
+extern audio_ring_t mic_ring;
+
+/* spk_jb_ring holds the speaker data of the jitter buffer (jitter_buf.h), in the format of the
+   open alternate setting; the playback task both fills and empties it */
+extern audio_ring_t spk_jb_ring;
 
 extern volatile size_t data_out_buf_n_bytes ;
 extern int16_t data_out_buf[];
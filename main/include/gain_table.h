@@ -1,45 +0,0 @@
-/* dB to linear gain : 10^(dB/20)*/
-int32_t gain_table[] = { 
-/*   dB  gain             gain * 2^24 (i.e., gain in 8.24 format) */
-/*  -40	0.01          */    167772,
-/*  -38	0.01258925412 */    211213,
-/*  -36	0.01584893192 */    265901,
-/*  -34	0.01995262315 */    334749,
-/*  -32	0.02511886432 */    421425,
-/*  -30	0.0316227766  */    530542,
-/*  -28	0.03981071706 */    667913,
-/*  -26	0.05011872336 */    840853,
-/*  -24	0.06309573445 */    1058571,
-/*  -22	0.07943282347 */    1332662,
-/*  -20	0.1           */    1677722,
-/*  -18	0.1258925412  */    2112126,
-/*  -16	0.1584893192  */    2659010,
-/*  -14	0.1995262315  */    3347495,
-/*  -12	0.2511886432  */    4214246,
-/*  -10	0.316227766   */    5305422,
-/*  -8	0.3981071706  */    6679130,
-/*  -6	0.5011872336  */    8408526,
-/*  -4	0.6309573445  */    10585708,
-/*  -2	0.7943282347  */    13326616,
-/*  0	1	          */    16777216,
-/*  2	1.258925412  */    21121264,
-/*  4	1.584893192  */    26590095,
-/*  6	1.995262315  */    33474947,
-/*  8	2.511886432  */    42142461,
-/*  10	3.16227766   */    53054215,
-/*  12	3.981071706  */    66791300,
-/*  14	5.011872336  */    84085265,
-/*  16	6.309573445  */    105857077,
-/*  18	7.943282347  */    133266164,
-/*  20	10           */    167772160,
-/*  22	12.58925412  */    211212636,
-/*  24	15.84893192  */    265900954,
-/*  26	19.95262315  */    334749468,
-/*  28	25.11886432  */    421424612,
-/*  30	31.6227766   */    530542154,
-/*  32	39.81071706  */    667912999,
-/*  34	50.11872336  */    840852648,
-/*  36	63.09573445  */    1058570766,
-/*  38	79.43282347  */    1332661637,
-/*  40	100          */    1677721600
-  };
\ No newline at end of file
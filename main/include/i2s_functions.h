@@ -2,6 +2,7 @@
 #ifndef _I2S_FUNCTIONS_H_
 #define _I2S_FUNCTIONS_H_
 
+#include <stdio.h>
 #include "esp_idf_version.h"
 #if ESP_IDF_VERSION >= ESP_IDF_VERSION_VAL(5, 0, 0)
 #include "driver/i2s_std.h"
@@ -9,16 +10,76 @@
 #include "driver/i2s.h"
 #endif
 #include "driver/gpio.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "tusb.h"
+#include "audio_dsp.h"
+#include "aec.h"
+#include "jitter_buf.h"
+
+/* I2S DMA buffers per channel, and the length of one, rounded to whole frames (44 at 44.1kHz) */
+#define I2S_DMA_DESC_NUM 2
+#define I2S_DMA_BUF_US   1000
+#define I2S_DMA_FRAME_NUM(sample_rate)  (((sample_rate) * I2S_DMA_BUF_US + 500000) / 1000000)
+
+/* the playback task treats SPK_WAIT_MS without any OUT packet or free DMA buffer as a stall of the stream */
+#define SPK_WAIT_MS 3
+
+/* speaker playback counters, cleared by the playback task when the speaker opens
+   (spk_playback_restart()); feedback is kept */
+typedef struct {
+    uint32_t played_bytes;      // bytes of the USB stream (16 or 24 bit format) handed to the I2S DMA, or to the loopback
+    uint32_t dropped_bytes;     // did not fit into the I2S DMA in time
+    uint32_t stall_count;       // the jitter buffer ran dry while playing; the DMA played silence
+    uint32_t feedback;          // last value sent on the feedback EP, frames per frame in 16.16
+} spk_playback_stats_t;
 
 
 esp_err_t bsp_i2s_init(i2s_port_t i2s_num, uint32_t sample_rate);
 esp_err_t bsp_i2s_reconfig(uint32_t sample_rate);
-uint16_t bsp_i2s_read(void *data_buf, uint16_t count);
+uint16_t bsp_i2s_read(void);
 void bsp_i2s_write(void *data_buf, uint16_t count);
-void decode_and_cancel_offset(int32_t *left_sample_p, int32_t *right_sample_p, bool reset);
+void decode_and_cancel_offset(int32_t *raw_frames, uint32_t n_frames, bool reset);
 void i2s_read_write_task();
 extern uint16_t (*i2s_get_data)(void *data_buf, uint16_t count);
 void i2s_consumer_func_task();
-void i2s_transmit();
+uint32_t i2s_transmit(uint32_t wait_ms);
+void i2s_playback_task(void *param);
+void spk_playback_restart(uint8_t n_bytes_per_sample);
+uint32_t i2s_tx_position(void);
+extern TaskHandle_t spk_task_handle;
+extern volatile spk_playback_stats_t spk_stats;
+uint16_t i2s_capture(void);
+void i2s_capture_task(void *param);
+uint16_t mic_ring_get_data(const tu_fifo_buffer_info_t *fifo);
+extern mic_pkt_sched_t mic_pkt_sched;
+void mic_ring_restart(uint8_t n_bytes_per_sample);
+extern volatile bool audio_loopback;
+void audio_loopback_enable(bool on);
+
+/* jitter buffer of the speaker, between the EP OUT FIFO and the I2S DMA; spk_jb is written by
+   the playback task only and cleared when a stream opens */
+extern jitter_buf_t spk_jb;
+extern volatile jb_profile_t spk_jb_profile;
+void spk_jb_set_profile(jb_profile_t profile);
+
+#ifdef CONFIG_MIC_AEC
+/* echo canceller on the mic path, cleared by mic_aec_reset() */
+typedef struct {
+    uint32_t blocks;            // mic blocks through the canceller
+    uint32_t frames;
+    uint32_t ref_missing;       // reference frames the speaker did not have: silence to the canceller
+    uint32_t ref_dropped;       // reference frames dropped to keep the echo within the taps
+    uint64_t cycles;            // CPU cycles of the canceller, reference handling included
+    uint32_t max_cycles;        // of the longest block
+} mic_aec_stats_t;
+
+extern volatile bool mic_aec_on;
+extern aec_t mic_aec;
+extern mic_aec_stats_t mic_aec_stats;
+void mic_aec_enable(bool on);
+void mic_aec_reset(void);
+void mic_aec_print(FILE *out);
+#endif
 
 #endif
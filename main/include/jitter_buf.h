@@ -0,0 +1,106 @@
+// jitter_buf.h
+#ifndef _JITTER_BUF_H_
+#define _JITTER_BUF_H_
+
+#include <stdio.h>
+#include <stdint.h>
+
+/* Adaptive jitter buffer of the speaker: the control side. The playback task keeps the OUT
+   stream in a ring between the EP OUT FIFO and the I2S DMA and hands it to the DMA as the
+   DMA frees its buffers; the depth is what the ring and the DMA queue hold together, the
+   latency from USB to the I2S pins. Playback (re)starts once the ring holds the target
+   depth. A profile sets where the target starts and how far it moves: each underrun (the
+   DMA ran out and played silence) raises it by JB_GROW_MS, and after stable_ms without one
+   it comes down by JB_SHRINK_MS if the lowest depth of that time had room to spare. An
+   underrun right after a step down doubles stable_ms, up to 2^JB_BACKOFF_MAX times.
+   While playing, jb_steer() keeps the depth on the target one frame at a time: a block is
+   played one frame longer or shorter (jb_stretch_pcm16/32()), crossfaded over the block
+   from the signal to itself shifted by one frame, at most once every JB_WARP_FRAMES frames.
+   The depth is in frames; time is the playback time since jb_init(), in mS. */
+
+#define JB_GROW_MS       1
+#define JB_SHRINK_MS     1
+#define JB_WARP_FRAMES   100        // one frame in 100 at most: a 1% time warp
+#define JB_AVG_SHIFT     4          // the depth is averaged over 2^JB_AVG_SHIFT blocks
+#define JB_HISTORY       8          // target changes kept
+#define JB_BACKOFF_MAX   3
+
+typedef enum {
+    JB_LOW_LATENCY,
+    JB_BALANCED,
+    JB_ROBUST,
+    JB_N_PROFILES
+} jb_profile_t;
+
+typedef struct {
+    const char *name;
+    uint16_t start_ms;          // target when a stream opens
+    uint16_t min_ms;
+    uint16_t max_ms;
+    uint32_t stable_ms;         // without an underrun before the target comes down
+} jb_profile_params_t;
+
+extern const jb_profile_params_t jb_profiles[JB_N_PROFILES];
+
+enum {
+    JB_EVENT_UNDERRUN,          // target raised after an underrun
+    JB_EVENT_STABLE,            // lowered after stable_ms without one
+    JB_EVENT_PROFILE,           // set by jb_set_profile()
+};
+
+typedef struct {
+    uint32_t t_ms;
+    uint8_t  reason;            // JB_EVENT_xxx
+    uint8_t  from_ms;
+    uint8_t  to_ms;
+} jb_event_t;
+
+typedef struct {
+    jb_profile_t profile;
+    uint32_t sample_rate;
+    uint32_t frames_ms;         // frames per mS, rounded down (44 at 44.1kHz)
+    uint32_t target_ms;
+    uint64_t frames;            // played since jb_init()
+    // steering
+    int32_t  avg_q;             // depth averaged over the blocks, << JB_AVG_SHIFT
+    int32_t  pending_q;         // frames inserted (deleted) that avg_q does not show yet, << JB_AVG_SHIFT
+    uint32_t warp_frames;       // played since the last insertion or deletion
+    // stable period
+    uint32_t stable_since_ms;
+    uint32_t backoff;           // stable_ms is doubled these many times
+    uint32_t low_water;         // lowest depth since then
+    // counters, cleared by jb_init()
+    uint32_t underruns;
+    uint32_t grows;
+    uint32_t shrinks;
+    uint32_t inserted;          // frames
+    uint32_t deleted;
+    uint32_t depth_min;         // of the blocks, in frames
+    uint32_t depth_max;
+    jb_event_t history[JB_HISTORY];     // history[n_events % JB_HISTORY] is the next one
+    uint32_t n_events;
+} jitter_buf_t;
+
+void     jb_init(jitter_buf_t *jb, uint32_t sample_rate, jb_profile_t profile);
+void     jb_set_profile(jitter_buf_t *jb, jb_profile_t profile);
+uint32_t jb_target_frames(const jitter_buf_t *jb);
+
+// Playback (re)starts with depth frames
+void     jb_start(jitter_buf_t *jb, uint32_t depth);
+// The DMA played silence: raises the target
+void     jb_underrun(jitter_buf_t *jb);
+
+/* Called for every block of n_frames handed to the DMA, with the depth before it. Returns
+   the number of frames to add to the block: 1 (insert one), -1 (delete one) or 0. */
+int      jb_steer(jitter_buf_t *jb, uint32_t depth, uint32_t n_frames);
+
+/* n_frames stereo frames of in into n_frames + delta frames of out, delta -1, 0 or 1; out
+   must not overlap in. Returns the number of frames in out. */
+uint32_t jb_stretch_pcm16(const int16_t *in, int16_t *out, uint32_t n_frames, int delta);
+uint32_t jb_stretch_pcm32(const int32_t *in, int32_t *out, uint32_t n_frames, int delta);
+
+void     jb_print(const jitter_buf_t *jb, FILE *out);
+void     jb_print_json(const jitter_buf_t *jb, FILE *out);
+
+#endif
+//end jitter_buf.h
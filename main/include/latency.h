@@ -0,0 +1,46 @@
+// latency.h
+#ifndef _LATENCY_H_
+#define _LATENCY_H_
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+/* Round trip latency measurement mode. With the speaker output looped back to the mic input
+   (a wire from DOUT to DIN, or a speaker and a mic), the host plays short markers (chirps, see
+   scripts/latency.py) with silence in between. The playback task tags the time a marker frame
+   goes into the I2S DMA queue and the capture task the time it comes back out of the DMA on
+   the capture path; the difference is the device's share of the round trip: the DMA queue,
+   the wire or the air and the capture DMA buffer. Each side takes the first frame of the left
+   channel at or above LATENCY_THRESHOLD after LATENCY_QUIET_MS below it as a marker, on the
+   raw 32bit slots, before the gains. The times are esp_timer time plus the position of the
+   frame in its block, so the blocks' length does not show up as jitter.
+   Off by default: the console command "latency on" starts it. The tags are only called when
+   latency_mode is set. The results start over at every sample rate change. */
+
+#define LATENCY_THRESHOLD   (INT32_MAX / 32)    // -30 dBFS
+#define LATENCY_QUIET_MS    50
+#define LATENCY_TIMEOUT_MS  1000                // a marker not back by then is lost
+
+typedef struct {
+    uint32_t n;                 // markers that came back
+    uint32_t lost;              // played, not back within LATENCY_TIMEOUT_MS
+    uint32_t unmatched;         // came in with no marker played before them
+    int32_t  last_us;
+    int32_t  min_us;
+    int32_t  max_us;
+    int64_t  sum_us;
+    uint64_t sum_sq_us;         // for the standard deviation, the jitter
+} latency_stats_t;
+
+extern volatile bool latency_mode;
+extern latency_stats_t latency_stats;
+
+void latency_enable(bool on);
+void latency_reset(void);
+void latency_tag_playback(const int32_t *slots, uint32_t n_frames);
+void latency_tag_capture(const int32_t *slots, uint32_t n_frames);
+void latency_print(FILE *out);
+
+#endif
+//end latency.h
@@ -0,0 +1,75 @@
+// profiler.h
+#ifndef _PROFILER_H_
+#define _PROFILER_H_
+
+#include <stdio.h>
+#include <stdint.h>
+#include "sdkconfig.h"
+#include "esp_attr.h"
+#include "esp_cpu.h"
+
+/* Per-stage profiler of the audio pipeline: named scopes around the hot functions add up
+   the CPU cycles they take, the number of calls and the longest call. The cycles come from
+   the cycle counter of the core (CCOUNT on the Xtensa cores, read with one RSR; a monotonic
+   clock in ns on the host build), so a scope costs two register reads and a few adds. Each
+   stage is only entered by one task or callback, so no lock is needed. prof_print() shows
+   each stage as a share of the CPU time of a 1mS frame at the current sampling frequency.
+   Without CONFIG_AUDIO_PROFILER the scopes compile to nothing. */
+
+// Stages; some contain others, see prof_print()
+enum {
+    PROF_I2S_READ,              // i2s_channel_read() in bsp_i2s_read(): copy out of the DMA buffer (on the target, also the wait for it)
+    PROF_MIC_DC_BLOCK,          // decode_and_cancel_offset()
+    PROF_MIC_AEC,               // the echo canceller, reference handling included
+    PROF_MIC_GAIN,              // the mic gain kernels, 16 bit conversion into mic_ring included
+    PROF_MIC_RING_WRITE,        // audio_ring_write() of the 24 bit capture or the loopback
+    PROF_MIC_FIFO_LOAD,         // the IN packet out of mic_ring into the EP IN FIFO
+    PROF_AUDIOD_TX_DONE,        // audiod_tx_done_cb(): the IN packet, the pre/post load callbacks included
+    PROF_AUDIOD_RX_DONE,        // audiod_rx_done_cb(): the OUT packet into the EP OUT FIFO, the callbacks included
+    PROF_TUD_AUDIO_READ,        // tud_audio_read() of the playback task
+    PROF_SPK_JB_STRETCH,        // a block of the jitter buffer played a frame longer or shorter
+    PROF_SPK_GAIN,              // the speaker gain kernels, 32 bit conversion included
+    PROF_I2S_WRITE,             // i2s_channel_write() (on the target, also the wait for a free DMA buffer)
+    PROF_DWC2_ISR,              // dcd_int_handler(): the USB interrupt, the packet copies included
+    PROF_DWC2_RX_PACKET,        // an OUT packet out of the DWC2 RX FIFO into the linear buffer
+    PROF_DWC2_TX_PACKET,        // an IN packet out of the linear buffer into the DWC2 TX FIFO
+    PROF_N_STAGES
+};
+
+#ifdef CONFIG_AUDIO_PROFILER
+
+typedef struct {
+    uint32_t calls;
+    uint32_t max;               // cycles of the longest call
+    uint64_t cycles;
+} prof_stage_t;
+
+extern prof_stage_t prof_stages[PROF_N_STAGES];
+
+FORCE_INLINE_ATTR void prof_add(int stage, uint32_t cycles)
+{
+    prof_stage_t *s = &prof_stages[stage];
+    s->cycles += cycles;
+    s->calls++;
+    if(cycles > s->max) s->max = cycles;
+}
+
+// A scope: PROF_BEGIN(stage); ... PROF_END(stage); in the same block
+#define PROF_BEGIN(stage)   uint32_t prof_t0_##stage = esp_cpu_get_cycle_count()
+#define PROF_END(stage)     prof_add((stage), esp_cpu_get_cycle_count() - prof_t0_##stage)
+
+void prof_reset(void);
+void prof_print(FILE *out);
+
+#else
+
+#define PROF_BEGIN(stage)
+#define PROF_END(stage)
+
+static inline void prof_reset(void) { }
+static inline void prof_print(FILE *out) { fprintf(out, "profiler not built in (CONFIG_AUDIO_PROFILER)\n"); }
+
+#endif
+
+#endif
+//end profiler.h
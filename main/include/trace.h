@@ -0,0 +1,82 @@
+// trace.h
+#ifndef _TRACE_H_
+#define _TRACE_H_
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdatomic.h>
+#include "sdkconfig.h"
+#include "esp_attr.h"
+#include "esp_cpu.h"
+
+/* Trace of the audio path: compact binary records of what ran when, one ring per core.
+   A record is the CPU cycle counter of the core, an event id and a 16 bit argument (bytes
+   of a packet, frames of a block). The rings never fill up: the newest record overwrites
+   the oldest, so a dump shows the last CONFIG_AUDIO_TRACE_LEN records of each core.
+   Writing takes an atomic increment of the ring's head and one 8 byte store, no lock and
+   no kernel call, so it can be used in the callbacks, the tasks and interrupts alike.
+   trace_dump() prints the rings as hex lines; scripts/trace_decode.py turns them into
+   per-callback timing histograms. */
+
+// Events; a *_BEGIN/_END pair brackets one run of a callback or a block of a task
+enum {
+    TRACE_PRE_LOAD = 1,         // tud_audio_tx_done_pre_load_cb(); end: bytes written to the EP IN FIFO
+    TRACE_POST_LOAD,            // tud_audio_tx_done_post_load_cb(); end: bytes of the next IN packet
+    TRACE_RX_DONE,              // tud_audio_rx_done_post_read_cb(); end: bytes received
+    TRACE_FEEDBACK,             // tud_audio_feedback_interval_isr()
+    TRACE_CAPTURE,              // i2s_capture() after the DMA buffer came in; end: bytes captured
+    TRACE_PLAYBACK,             // bsp_i2s_write() up to the DMA write; end: bytes converted
+    TRACE_SPK_STALL,            // the speaker stream stalled; arg: stall count
+    TRACE_N_EVENTS
+};
+#define TRACE_END_FLAG  0x8000
+
+typedef struct {
+    uint32_t ccount;            // CPU cycle counter of the core
+    uint16_t event;             // event id, | TRACE_END_FLAG for the end of a pair
+    uint16_t arg;
+} trace_record_t;
+
+#ifdef CONFIG_AUDIO_TRACE
+
+#define TRACE_N_CORES 2
+
+typedef struct {
+    _Atomic uint32_t head;      // records written so far; runs freely
+    trace_record_t   rec[CONFIG_AUDIO_TRACE_LEN];
+} trace_ring_t;
+
+_Static_assert((CONFIG_AUDIO_TRACE_LEN & (CONFIG_AUDIO_TRACE_LEN - 1)) == 0,
+               "CONFIG_AUDIO_TRACE_LEN must be a power of 2");
+
+extern trace_ring_t trace_rings[TRACE_N_CORES];
+extern volatile bool trace_frozen;
+
+FORCE_INLINE_ATTR void trace_event(uint16_t event, uint16_t arg)
+{
+    if(trace_frozen) return;
+    // the timestamp is taken before the slot: an interrupt in between can put its later
+    // record into the earlier slot, which the decoder sorts out by the timestamps
+    uint32_t ccount = esp_cpu_get_cycle_count();
+    trace_ring_t *ring = &trace_rings[esp_cpu_get_core_id()];
+    uint32_t i = atomic_fetch_add_explicit(&ring->head, 1, memory_order_relaxed);
+    ring->rec[i & (CONFIG_AUDIO_TRACE_LEN - 1)] = (trace_record_t){ ccount, event, arg };
+}
+
+void trace_dump(FILE *out);
+void trace_reset(void);
+
+#else
+
+static inline void trace_event(uint16_t event, uint16_t arg) { (void) event; (void) arg; }
+static inline void trace_dump(FILE *out) { (void) out; }
+static inline void trace_reset(void) { }
+
+#endif
+
+#define TRACE_BEGIN(event)      trace_event((event), 0)
+#define TRACE_END(event, arg)   trace_event((event) | TRACE_END_FLAG, (uint16_t)(arg))
+
+#endif
+//end trace.h
@@ -86,13 +86,12 @@ extern "C" {
 //--------------------------------------------------------------------
 // AUDIO CLASS DRIVER CONFIGURATION
 //--------------------------------------------------------------------
-// DO NOT THINK WE NEED TWO FORMATS -- DELETE IT EVENTUALLY
-
-//#define CFG_TUD_AUDIO_FUNC_1_DESC_LEN                                TUD_AUDIO_HEADSET_STEREO_16_32_DESC_LEN
-#define CFG_TUD_AUDIO_FUNC_1_DESC_LEN                                TUD_AUDIO_HEADSET_STEREO_16_DESC_LEN
+// Two formats per streaming interface: alternate 1 is 16 bit (FORMAT_1), alternate 2 is the
+// 24 bit of the I2S slots (FORMAT_2)
+#define CFG_TUD_AUDIO_FUNC_1_DESC_LEN                                TUD_AUDIO_HEADSET_STEREO_16_32_DESC_LEN
 
 // How many formats are used, need to adjust USB descriptor if changed
-#define CFG_TUD_AUDIO_FUNC_1_N_FORMATS                               1
+#define CFG_TUD_AUDIO_FUNC_1_N_FORMATS                               2
 
 // Audio format type I specifications
 #define CFG_TUD_AUDIO_FUNC_1_MAX_SAMPLE_RATE                         48000     // 16bit/48kHz is the best quality for Renesas RX
@@ -126,26 +125,53 @@ extern "C" {
 #define CFG_TUD_AUDIO_FUNC_1_FORMAT_1_EP_SZ_IN    TUD_AUDIO_EP_SIZE(CFG_TUD_AUDIO_FUNC_1_MAX_SAMPLE_RATE, CFG_TUD_AUDIO_FUNC_1_FORMAT_1_N_BYTES_PER_SAMPLE_TX, CFG_TUD_AUDIO_FUNC_1_N_CHANNELS_TX)
 #define CFG_TUD_AUDIO_FUNC_1_FORMAT_2_EP_SZ_IN    TUD_AUDIO_EP_SIZE(CFG_TUD_AUDIO_FUNC_1_MAX_SAMPLE_RATE, CFG_TUD_AUDIO_FUNC_1_FORMAT_2_N_BYTES_PER_SAMPLE_TX, CFG_TUD_AUDIO_FUNC_1_N_CHANNELS_TX)
 
-#define CFG_TUD_AUDIO_FUNC_1_EP_IN_SW_BUF_SZ      TU_MAX(CFG_TUD_AUDIO_FUNC_1_FORMAT_1_EP_SZ_IN, CFG_TUD_AUDIO_FUNC_1_FORMAT_1_EP_SZ_IN)*CFG_TUD_AUDIO_FUNC_1_EP_IN_SW_BUF_MS
-#define CFG_TUD_AUDIO_FUNC_1_EP_IN_SZ_MAX         TU_MAX(CFG_TUD_AUDIO_FUNC_1_FORMAT_1_EP_SZ_IN, CFG_TUD_AUDIO_FUNC_1_FORMAT_1_EP_SZ_IN) // Maximum EP IN size for all AS alternate settings used
+#define CFG_TUD_AUDIO_FUNC_1_EP_IN_SW_BUF_SZ      TU_MAX(CFG_TUD_AUDIO_FUNC_1_FORMAT_1_EP_SZ_IN, CFG_TUD_AUDIO_FUNC_1_FORMAT_2_EP_SZ_IN)*CFG_TUD_AUDIO_FUNC_1_EP_IN_SW_BUF_MS
+#define CFG_TUD_AUDIO_FUNC_1_EP_IN_SZ_MAX         TU_MAX(CFG_TUD_AUDIO_FUNC_1_FORMAT_1_EP_SZ_IN, CFG_TUD_AUDIO_FUNC_1_FORMAT_2_EP_SZ_IN) // Maximum EP IN size for all AS alternate settings used
 
 // EP and buffer size - for isochronous EP´s, the buffer and EP size are equal (different sizes would not make sense)
 #define CFG_TUD_AUDIO_ENABLE_EP_OUT               1
 
-#define CFG_TUD_AUDIO_FUNC_1_EP_OUT_SW_BUF_MS     2
+// room for the SPK_START_MS of data playback waits for plus the packet that completes it
+#define CFG_TUD_AUDIO_FUNC_1_EP_OUT_SW_BUF_MS     3
 
 #define CFG_TUD_AUDIO_FUNC_1_FORMAT_1_EP_SZ_OUT    TUD_AUDIO_EP_SIZE(CFG_TUD_AUDIO_FUNC_1_MAX_SAMPLE_RATE, CFG_TUD_AUDIO_FUNC_1_FORMAT_1_N_BYTES_PER_SAMPLE_RX, CFG_TUD_AUDIO_FUNC_1_N_CHANNELS_RX)
 #define CFG_TUD_AUDIO_FUNC_1_FORMAT_2_EP_SZ_OUT    TUD_AUDIO_EP_SIZE(CFG_TUD_AUDIO_FUNC_1_MAX_SAMPLE_RATE, CFG_TUD_AUDIO_FUNC_1_FORMAT_2_N_BYTES_PER_SAMPLE_RX, CFG_TUD_AUDIO_FUNC_1_N_CHANNELS_RX)
 
-#define CFG_TUD_AUDIO_FUNC_1_EP_OUT_SW_BUF_SZ     TU_MAX(CFG_TUD_AUDIO_FUNC_1_FORMAT_1_EP_SZ_OUT, CFG_TUD_AUDIO_FUNC_1_FORMAT_1_EP_SZ_OUT)*CFG_TUD_AUDIO_FUNC_1_EP_OUT_SW_BUF_MS
-#define CFG_TUD_AUDIO_FUNC_1_EP_OUT_SZ_MAX        TU_MAX(CFG_TUD_AUDIO_FUNC_1_FORMAT_1_EP_SZ_OUT, CFG_TUD_AUDIO_FUNC_1_FORMAT_1_EP_SZ_OUT) // Maximum EP IN size for all AS alternate settings used
-
+#define CFG_TUD_AUDIO_FUNC_1_EP_OUT_SW_BUF_SZ     TU_MAX(CFG_TUD_AUDIO_FUNC_1_FORMAT_1_EP_SZ_OUT, CFG_TUD_AUDIO_FUNC_1_FORMAT_2_EP_SZ_OUT)*CFG_TUD_AUDIO_FUNC_1_EP_OUT_SW_BUF_MS
+#define CFG_TUD_AUDIO_FUNC_1_EP_OUT_SZ_MAX        TU_MAX(CFG_TUD_AUDIO_FUNC_1_FORMAT_1_EP_SZ_OUT, CFG_TUD_AUDIO_FUNC_1_FORMAT_2_EP_SZ_OUT) // Maximum EP IN size for all AS alternate settings used
+
+// The speaker EP is asynchronous: the host sizes its packets from the explicit feedback EP,
+// which reports the rate of our I2S clock (see tud_audio_feedback_interval_isr()) in 16.16 format.
+// No format correction to 10.14: Windows expects 16.16 even at full speed, Linux and macOS take either.
+#define CFG_TUD_AUDIO_ENABLE_FEEDBACK_EP                   1
+#define CFG_TUD_AUDIO_ENABLE_FEEDBACK_FORMAT_CORRECTION    0
+
+// The EP IN FIFO skips its mutex: the USB task is its only writer (mic_packet_load() in the
+// load callbacks), its only reader and the one that clears it. The EP OUT FIFO keeps its read
+// mutex: the playback task reads it (usb_read_data()) while the USB task clears it on any set
+// interface, an alternate setting change without alternate setting 0 in between included,
+// and on a bus reset.
+#define CFG_TUD_AUDIO_EP_IN_FIFO_SPSC             1
+
+// No support FIFOs (CFG_TUD_AUDIO_ENABLE_ENCODING/DECODING stay 0): the DSP stages work on the
+// interleaved frames. Splitting the channels costs more than the stride-1 kernels save (see
+// host_sim/bench/bench_deinterleave.c), the 24x32 bit products do not fit the PIE lanes anyway,
+// and the encoder would size the IN packets itself instead of mic_pkt_sched.
 // Number of Standard AS Interface Descriptors (4.9.1) defined per audio function - this is required to be able to remember the current alternate settings of these interfaces - We restrict us here to have a constant number for all audio functions (which means this has to be the maximum number of AS interfaces an audio function has and a second audio function with less AS interfaces just wastes a few bytes)
 #define CFG_TUD_AUDIO_FUNC_1_N_AS_INT 	          2
 
 // Size of control request buffer
 #define CFG_TUD_AUDIO_FUNC_1_CTRL_BUF_SZ	64
 
+// Time audiod_tx_done_cb() and audiod_rx_done_cb() with the pipeline profiler
+#include "profiler.h"
+#define TU_AUDIO_PROFILE_BEGIN(_name)   PROF_BEGIN(PROF_AUDIOD_##_name)
+#define TU_AUDIO_PROFILE_END(_name)     PROF_END(PROF_AUDIOD_##_name)
+
+// Time the USB interrupt and its packet copies (dcd_dwc2.c) the same way
+#define TU_DWC2_PROFILE_BEGIN(_name)    PROF_BEGIN(PROF_DWC2_##_name)
+#define TU_DWC2_PROFILE_END(_name)      PROF_END(PROF_DWC2_##_name)
+
 
 
 #ifdef __cplusplus
@@ -2,14 +2,19 @@
 #ifndef _USB_CALLBACKS_H_
 #define _USB_CALLBACKS_H_
 
+#include "tusb.h"
+#include "audio_params.h"
+
 void usb_device_task(void *param);
 void usb_headset_spk(void *pvParam);
 void usb_headset_init(void);
 void usb_phy_init(void);
 uint16_t uad_processed_data(void *buf, uint16_t cnt);
-extern uint16_t (*usb_get_data)(void *buf, uint16_t cnt);
+uint16_t usb_read_data(void *buffer, uint16_t bufsize);
+extern uint16_t (*usb_get_data)(const tu_fifo_buffer_info_t *fifo);   // the next IN packet into the EP IN FIFO
 extern volatile bool s_spk_active ;
 extern volatile bool s_mic_active ;
+extern audio_params_block_t audio_params;
 
 #endif
 //end uad_callbacks.h
\ No newline at end of file
@@ -4,8 +4,4 @@ int32_t q31_multiply(int32_t a, int32_t b);
 int32_t mul_8p24x8p24(int32_t a, int32_t b);
 int16_t mul_1p31x8p24(int32_t sig, int32_t gain);
 
-void txInfoQinit( );
-void log_txbytes(size_t n_bytes);
-void print_txPacketInfo(size_t n_items);
-
 #endif
@@ -11,6 +11,8 @@
 #include "driver/gpio.h"
 #include "blink.h"
 #include "utilities.h"
+#include "trace.h"
+#include "console.h"
 
 static const char *TAG = "main";
 
@@ -21,32 +23,14 @@ extern uint32_t sampleRatesList[]; // sampFreq is one of the vales in this array
 
 extern uint32_t blink_state;
 
-#define I2S_DATA_IN_BUFSIZ (CFG_TUD_AUDIO_FUNC_1_EP_IN_SZ_MAX/ 2)
-#define I2S_DATA_OUT_BUFSIZ (CFG_TUD_AUDIO_FUNC_1_EP_OUT_SW_BUF_SZ/ 2)
-
-// variables declared as extern in data_buffers.h
-
-// Current resolution, update on format change
-// number of bytes to be read from I2S every ms
-
-/* data_in_buf is to temporarily store incoming data from I2S (mic).
-   It is populated by I2S read function and read by the USB device callback function*/
-/* tud_audio_tx_done_pre_cb() copies this data to the endpoint buffer */
-size_t  data_in_buf_n_bytes  = 0;      // value is set based on sample rate etc. when the i2s is configured 
-int16_t data_in_buf[I2S_DATA_IN_BUFSIZ] = {0};
-
-volatile size_t data_out_buf_n_bytes = 0;
-int16_t data_out_buf[I2S_DATA_OUT_BUFSIZ] = {0};
-
-// end extern variables declared in data_buffers.h
-
 TaskHandle_t usb_device_task_handle = NULL; 
+TaskHandle_t i2s_capture_task_handle = NULL;
 
 void app_main()
 {
     BaseType_t ret_val ;
 
-    // Setting up GPIO_1 as input so that we can trigger a txInfodump
+    // Setting up GPIO_1 as input so that pulling it low prints the trace of the audio path
     assert(gpio_set_direction(GPIO_NUM_1, GPIO_MODE_INPUT) == ESP_OK);
     assert(gpio_pullup_en(GPIO_NUM_1) == ESP_OK);
 
@@ -60,9 +44,31 @@ void app_main()
 
     // Initialize the number of samples per mS for TX and RX channels
     usb_headset_init();
-/*
+
+#ifdef CONFIG_AUDIO_LOOPBACK
+    // Speaker stream back to the mic, before any stream opens; "loopback off" on the console ends it
+    audio_loopback_enable(true);
+#endif
+
+    // Create the task that moves mic data from I2S DMA into mic_ring. It runs on core 1,
+    // away from the tinyusb task on core 0, since it blocks on I2S DMA.
+    ret_val = xTaskCreatePinnedToCore(i2s_capture_task, "i2s_capture_task", 3 * 1024, NULL, 3, &i2s_capture_task_handle, 1);
+    if (ret_val != pdPASS) {
+        ESP_LOGE(TAG, "Failed to create i2s_capture_task");
+        return;
+    }
+
+    // Create the playback task; it sleeps till tinyusb signals speaker data and then moves it
+    // to the I2S DMA. Same core as the capture task, one priority higher since it is short.
+    ret_val = xTaskCreatePinnedToCore(i2s_playback_task, "i2s_playback_task", 3 * 1024, NULL, 4, &spk_task_handle, 1);
+    if (ret_val != pdPASS) {
+        ESP_LOGE(TAG, "Failed to create i2s_playback_task");
+        return;
+    }
+
     // Provide the pointer to the function that the tinyusb stack will call to get I2S mic data.
-    usb_get_data = &bsp_i2s_read;
+    // It only copies out of mic_ring and never blocks.
+    usb_get_data = &mic_ring_get_data;
 
     // Create a task for tinyusb device stack
     ret_val = xTaskCreatePinnedToCore(usb_device_task, "usb_device_task", 3 * 1024, NULL, 2, &usb_device_task_handle,0);
@@ -72,15 +78,24 @@ void app_main()
         return;
     }
     ESP_LOGI(TAG, "TinyUSB initialized");
-*/
+
     configure_led();
 
     blink_state = BLINK_NOT_MOUNTED;
 
+    // "stats" and "trace" on the serial console
+    console_init();
+
+    int gpio1_level = 1;
     while(1)
     {
         drive_led();
 
+        int level = gpio_get_level(GPIO_NUM_1);
+        if(level == 0 && gpio1_level == 1)
+            trace_dump(stdout);
+        gpio1_level = level;
+
             vTaskDelay(pdMS_TO_TICKS(50));
 
     } 
@@ -0,0 +1,115 @@
+// aec.c
+#include <string.h>
+#include <math.h>
+#include "aec.h"
+
+#define SLOT_SCALE      (1.0f / 2147483648.0f)  // 32bit slot to -1..1
+#define AEC_EPS         1e-6f                   // regularization of the normalization, in window energy
+#define AEC_ACTIVE      1e-6f                   // mean square of a reference block with the far end active (-60dBFS)
+
+void aec_init(aec_t *a, uint32_t sample_rate, float mu)
+{
+    a->mu = mu;
+    a->erle_frames = sample_rate * AEC_ERLE_MS / 1000;
+    aec_reset(a);
+}
+
+// Clears the weights, the reference history and the ERLE
+void aec_reset(aec_t *a)
+{
+    memset(a->w, 0, sizeof(a->w));
+    memset(a->x, 0, sizeof(a->x));
+    a->sum_mic = a->sum_err = 0.0;
+    a->n_frames = 0;
+    a->erle_db = 0.0f;
+    a->n_windows = 0;
+}
+
+static inline int32_t float_to_slot(float v)
+{
+    float s = v * 2147483648.0f;
+    if(s >= 2147483392.0f) return 0x7fffff00;           // largest 24 bit value
+    if(s <= -2147483648.0f) return INT32_MIN;
+    return (int32_t)lrintf(s) & ~0xff;
+}
+
+/*
+  One block of n <= AEC_BLOCK_MAX frames. The reference of the block is appended to the
+  window of the last one in a->x, so that x + n + k is the window of frame n, oldest first.
+  Both channels go through the same loads of the reference.
+*/
+static void aec_block(aec_t *a, const float *ref, int32_t *frames, uint32_t n)
+{
+    float *x = a->x;
+    float *w0 = a->w[0], *w1 = a->w[1];
+    float e0[AEC_BLOCK_MAX], e1[AEC_BLOCK_MAX];
+    float ref_energy = 0.0f;
+
+    memcpy(x + AEC_TAPS - 1, ref, n * sizeof(float));
+    for(uint32_t i = 0; i < n; i++)
+        ref_energy += ref[i] * ref[i];
+
+    // echo estimate and error with the weights of the last block
+    for(uint32_t i = 0; i < n; i++) {
+        const float *xi = x + i;
+        float y0 = 0.0f, y1 = 0.0f;
+        for(uint32_t k = 0; k < AEC_TAPS; k++) {
+            y0 += w0[k] * xi[k];
+            y1 += w1[k] * xi[k];
+        }
+        float d0 = (float)frames[2 * i] * SLOT_SCALE;
+        float d1 = (float)frames[2 * i + 1] * SLOT_SCALE;
+        e0[i] = d0 - y0;
+        e1[i] = d1 - y1;
+        frames[2 * i]     = float_to_slot(e0[i]);
+        frames[2 * i + 1] = float_to_slot(e1[i]);
+        if(ref_energy > AEC_ACTIVE * n) {
+            a->sum_mic += (double)d0 * d0 + (double)d1 * d1;
+            a->sum_err += (double)e0[i] * e0[i] + (double)e1[i] * e1[i];
+        }
+    }
+    if(ref_energy > AEC_ACTIVE * n && (a->n_frames += n) >= a->erle_frames) {
+        a->erle_db = a->sum_err > 0.0 ? (float)(10.0 * log10(a->sum_mic / a->sum_err)) : 99.0f;
+        a->n_windows++;
+        a->sum_mic = a->sum_err = 0.0;
+        a->n_frames = 0;
+    }
+
+    // NLMS step, the gradient summed over the block and scaled by the reference energy in
+    // the window of its last frame; a silent reference leaves the weights as they are
+    float energy = 0.0f;
+    const float *xw = x + n - 1;
+    for(uint32_t k = 0; k < AEC_TAPS; k++)
+        energy += xw[k] * xw[k];
+    if(energy > AEC_EPS) {
+        float step = a->mu / ((energy + AEC_EPS) * n);
+        for(uint32_t i = 0; i < n; i++) {
+            e0[i] *= step;
+            e1[i] *= step;
+        }
+        for(uint32_t k = 0; k < AEC_TAPS; k++) {
+            const float *xk = x + k;
+            float g0 = 0.0f, g1 = 0.0f;
+            for(uint32_t i = 0; i < n; i++) {
+                g0 += e0[i] * xk[i];
+                g1 += e1[i] * xk[i];
+            }
+            w0[k] += g0;
+            w1[k] += g1;
+        }
+    }
+
+    // the window of the next block
+    memmove(x, x + n, (AEC_TAPS - 1) * sizeof(float));
+}
+
+void aec_process(aec_t *a, const float *ref, int32_t *frames, uint32_t n_frames)
+{
+    while(n_frames) {
+        uint32_t n = n_frames < AEC_BLOCK_MAX ? n_frames : AEC_BLOCK_MAX;
+        aec_block(a, ref, frames, n);
+        ref += n;
+        frames += 2 * n;
+        n_frames -= n;
+    }
+}
@@ -0,0 +1,478 @@
+// audio_dsp.c
+#include <stdint.h>
+#include <string.h>
+#include <math.h>
+#include "audio_dsp.h"
+
+/* The INMP441 sends 24 bits MSB aligned in a 32 bit slot; the lowest byte carries no data */
+#define MIC_VALID_BITS_MASK 0xffffff00
+
+/*
+  Reference mic conversion. For each sample:
+    t = (slot & 0xffffff00) * gain       slot in 1.31, gain in 8.24 -> t in 9.55 (64 bits)
+    out = t >> 40                        1.15 result, saturated to the int16 range
+  Since t >> 40 == (t >> 32) >> 8, only the upper 32 bits of the product are ever needed.
+*/
+static inline int16_t mic_sample(int32_t slot, int32_t gain)
+{
+    int32_t hi = (int32_t)(((int64_t)(slot & (int32_t)MIC_VALID_BITS_MASK) * gain) >> 32);
+    hi >>= 8;
+    if(hi >  32767) return  32767;
+    if(hi < -32768) return -32768;
+    return (int16_t)hi;
+}
+
+void mic_convert_gain_ref(const int32_t *src, int16_t *dst, uint32_t n_frames, const int32_t gain[2])
+{
+    for(uint32_t i = 0; i < n_frames; i++) {
+        dst[2*i]   = mic_sample(src[2*i],   gain[0]);
+        dst[2*i+1] = mic_sample(src[2*i+1], gain[1]);
+    }
+}
+
+#if defined(__XTENSA__)
+/*
+  ESP32-S3: the PIE vector unit only multiplies 8 and 16 bit lanes, so a 24x32 bit product
+  cannot be done there without losing bits. The scalar core has what this needs though:
+  MULSH gives the upper 32 bits of the 32x32 product and CLAMPS saturates to 16 bits, one
+  instruction each. Two frames per iteration keep both multipliers of the pipeline busy
+  and the per-channel gains in registers.
+*/
+static inline int32_t mulsh(int32_t a, int32_t b)
+{
+    int32_t r;
+    __asm__ ("mulsh %0, %1, %2" : "=r"(r) : "r"(a), "r"(b));
+    return r;
+}
+
+static inline int32_t clamps16(int32_t a)
+{
+    int32_t r;
+    __asm__ ("clamps %0, %1, 15" : "=r"(r) : "r"(a));
+    return r;
+}
+
+void mic_convert_gain(const int32_t *src, int16_t *dst, uint32_t n_frames, const int32_t gain[2])
+{
+    const int32_t mask = (int32_t)MIC_VALID_BITS_MASK;
+    const int32_t gl = gain[0];
+    const int32_t gr = gain[1];
+    uint32_t i = 0;
+
+    for(; i + 2 <= n_frames; i += 2) {
+        int32_t l0 = mulsh(src[0] & mask, gl);
+        int32_t r0 = mulsh(src[1] & mask, gr);
+        int32_t l1 = mulsh(src[2] & mask, gl);
+        int32_t r1 = mulsh(src[3] & mask, gr);
+        dst[0] = (int16_t)clamps16(l0 >> 8);
+        dst[1] = (int16_t)clamps16(r0 >> 8);
+        dst[2] = (int16_t)clamps16(l1 >> 8);
+        dst[3] = (int16_t)clamps16(r1 >> 8);
+        src += 4;
+        dst += 4;
+    }
+    if(i < n_frames) {
+        mic_convert_gain_ref(src, dst, 1, gain);
+    }
+}
+
+#else
+/*
+  Portable version: the same arithmetic with the frame loop unrolled by two, which lets
+  compilers for 64 bit hosts keep both gains in registers and vectorize the multiplies.
+*/
+void mic_convert_gain(const int32_t *src, int16_t *dst, uint32_t n_frames, const int32_t gain[2])
+{
+    const int32_t gl = gain[0];
+    const int32_t gr = gain[1];
+    uint32_t i = 0;
+
+    for(; i + 2 <= n_frames; i += 2) {
+        dst[0] = mic_sample(src[0], gl);
+        dst[1] = mic_sample(src[1], gr);
+        dst[2] = mic_sample(src[2], gl);
+        dst[3] = mic_sample(src[3], gr);
+        src += 4;
+        dst += 4;
+    }
+    if(i < n_frames) {
+        mic_convert_gain_ref(src, dst, 1, gain);
+    }
+}
+#endif
+
+/*
+  Speaker conversion. sample << 16 is in 1.31 and gain in 8.24, so the slot value is
+  (sample << 16) * gain >> 24 = sample * gain >> 8. The product of a 16 bit sample and a
+  32 bit gain needs 48 bits; the compiler turns the 64 bit multiply into MULL/MULSH on
+  the ESP32-S3.
+*/
+static inline int32_t spk_sample(int16_t sample, int32_t gain)
+{
+    int64_t t = ((int64_t)sample * gain) >> 8;
+    if(t > INT32_MAX) return INT32_MAX;
+    if(t < INT32_MIN) return INT32_MIN;
+    return (int32_t)t;
+}
+
+void spk_convert_gain(const int16_t *src, int32_t *dst, uint32_t n_frames, const int32_t gain[2])
+{
+    const int32_t gl = gain[0];
+    const int32_t gr = gain[1];
+
+    for(uint32_t i = 0; i < n_frames; i++) {
+        dst[2*i]   = spk_sample(src[2*i],   gl);
+        dst[2*i+1] = spk_sample(src[2*i+1], gr);
+    }
+}
+
+#define PCM24_MAX        8388607
+#define PCM24_MIN       -8388608
+#define GAIN_UNITY       (1 << 24)
+
+/*
+  (slot & 0xffffff00) * gain >> 32 is the 24 bit value of the product (the same upper
+  32 bits mic_sample() takes before its >> 8), so only one 32x32 high multiply is needed;
+  GCC makes it a MULSH on the ESP32-S3. CLAMPS only saturates to 8..23 bit ranges, so the
+  24 bit clamp stays in C.
+*/
+static inline int32_t pcm24_sample(int32_t slot, int32_t gain)
+{
+    int32_t hi = (int32_t)(((int64_t)(slot & (int32_t)MIC_VALID_BITS_MASK) * gain) >> 32);
+    if(hi > PCM24_MAX) hi = PCM24_MAX;
+    if(hi < PCM24_MIN) hi = PCM24_MIN;
+    return (int32_t)((uint32_t)hi << 8);
+}
+
+void pcm24_gain(int32_t *frames, uint32_t n_frames, const int32_t gain[2])
+{
+    const int32_t gl = gain[0];
+    const int32_t gr = gain[1];
+
+    if(gl == GAIN_UNITY && gr == GAIN_UNITY) {
+        for(uint32_t i = 0; i < 2 * n_frames; i++) {
+            frames[i] &= (int32_t)MIC_VALID_BITS_MASK;
+        }
+        return;
+    }
+    // two frames per iteration, as in mic_convert_gain()
+    uint32_t i = 0;
+    for(; i + 2 <= n_frames; i += 2) {
+        frames[0] = pcm24_sample(frames[0], gl);
+        frames[1] = pcm24_sample(frames[1], gr);
+        frames[2] = pcm24_sample(frames[2], gl);
+        frames[3] = pcm24_sample(frames[3], gr);
+        frames += 4;
+    }
+    if(i < n_frames) {
+        frames[0] = pcm24_sample(frames[0], gl);
+        frames[1] = pcm24_sample(frames[1], gr);
+    }
+}
+
+void gain_ramp_init(gain_ramp_t *r, uint32_t ramp_frames)
+{
+    memset(r, 0, sizeof(*r));
+    r->ramp_frames = ramp_frames;
+}
+
+void gain_ramp_update(gain_ramp_t *r, const int32_t gain[2])
+{
+    const int32_t g0 = gain[0];
+    const int32_t g1 = gain[1];
+
+    if(!r->primed || r->ramp_frames == 0) {
+        r->cur[0] = r->target[0] = g0;
+        r->cur[1] = r->target[1] = g1;
+        r->remaining = 0;
+        r->primed = true;
+        return;
+    }
+    if(g0 == r->target[0] && g1 == r->target[1]) return;
+
+    // from wherever the gain is now, also in the middle of a ramp; the division leaves
+    // the last frame of the ramp up to ramp_frames - 1 short, and it is set to the target
+    r->target[0] = g0;
+    r->target[1] = g1;
+    r->step[0] = (int32_t)(((int64_t)g0 - r->cur[0]) / (int64_t)r->ramp_frames);
+    r->step[1] = (int32_t)(((int64_t)g1 - r->cur[1]) / (int64_t)r->ramp_frames);
+    r->remaining = r->ramp_frames;
+}
+
+// Gain of the next frame of a ramp
+static inline void gain_ramp_step(gain_ramp_t *r)
+{
+    if(--r->remaining == 0) {
+        r->cur[0] = r->target[0];
+        r->cur[1] = r->target[1];
+    }
+    else {
+        r->cur[0] += r->step[0];
+        r->cur[1] += r->step[1];
+    }
+}
+
+// Frames of a block of n_frames that are still on the ramp
+static inline uint32_t gain_ramp_frames(const gain_ramp_t *r, uint32_t n_frames)
+{
+    return n_frames < r->remaining ? n_frames : r->remaining;
+}
+
+void mic_convert_gain_ramp(const int32_t *src, int16_t *dst, uint32_t n_frames, gain_ramp_t *r)
+{
+    uint32_t n = gain_ramp_frames(r, n_frames);
+    for(uint32_t i = 0; i < n; i++) {
+        gain_ramp_step(r);
+        dst[2*i]   = mic_sample(src[2*i],   r->cur[0]);
+        dst[2*i+1] = mic_sample(src[2*i+1], r->cur[1]);
+    }
+    if(n < n_frames) {
+        mic_convert_gain(src + 2 * n, dst + 2 * n, n_frames - n, r->cur);
+    }
+}
+
+void spk_convert_gain_ramp(const int16_t *src, int32_t *dst, uint32_t n_frames, gain_ramp_t *r)
+{
+    uint32_t n = gain_ramp_frames(r, n_frames);
+    for(uint32_t i = 0; i < n; i++) {
+        gain_ramp_step(r);
+        dst[2*i]   = spk_sample(src[2*i],   r->cur[0]);
+        dst[2*i+1] = spk_sample(src[2*i+1], r->cur[1]);
+    }
+    if(n < n_frames) {
+        spk_convert_gain(src + 2 * n, dst + 2 * n, n_frames - n, r->cur);
+    }
+}
+
+void pcm24_gain_ramp(int32_t *frames, uint32_t n_frames, gain_ramp_t *r)
+{
+    uint32_t n = gain_ramp_frames(r, n_frames);
+    for(uint32_t i = 0; i < n; i++) {
+        gain_ramp_step(r);
+        frames[2*i]   = pcm24_sample(frames[2*i],   r->cur[0]);
+        frames[2*i+1] = pcm24_sample(frames[2*i+1], r->cur[1]);
+    }
+    if(n < n_frames) {
+        pcm24_gain(frames + 2 * n, n_frames - n, r->cur);
+    }
+}
+
+/*
+  10^(dB/20) = 2^(dB * log2(10)/20). The exponent is split into its integer part, a shift,
+  and its fraction, looked up in 2^(i/64) with linear interpolation between the entries.
+  The interpolation is off by at most (ln2/64)^2/8 = 1.5e-5 of the gain (0.00013 dB).
+*/
+#define VOL_LOG2_10_20   713378682      // log2(10)/20 in 0.32
+#define VOL_EXP2_BITS    6
+#define VOL_FRAC_BITS    24             // the exponent in 8.24
+
+static const uint32_t exp2_table[(1 << VOL_EXP2_BITS) + 1] = {   // 2^(i/64) in 2.30
+    1073741824, 1085434106, 1097253708, 1109202018,
+    1121280436, 1133490379, 1145833280, 1158310587,
+    1170923762, 1183674286, 1196563654, 1209593378,
+    1222764986, 1236080024, 1249540052, 1263146652,
+    1276901417, 1290805962, 1304861917, 1319070932,
+    1333434672, 1347954824, 1362633090, 1377471191,
+    1392470869, 1407633882, 1422962010, 1438457051,
+    1454120821, 1469955159, 1485961921, 1502142985,
+    1518500250, 1535035634, 1551751076, 1568648537,
+    1585730000, 1602997467, 1620452965, 1638098541,
+    1655936265, 1673968228, 1692196547, 1710623359,
+    1729250827, 1748081133, 1767116489, 1786359126,
+    1805811301, 1825475297, 1845353420, 1865448001,
+    1885761398, 1906295993, 1927054196, 1948038440,
+    1969251188, 1990694927, 2012372174, 2034285470,
+    2056437387, 2078830522, 2101467502, 2124350982,
+    2147483648,
+};
+
+int32_t volume_to_gain(int32_t volume)
+{
+    const uint32_t interp_bits = VOL_FRAC_BITS - VOL_EXP2_BITS;
+    int64_t x = ((int64_t)volume * VOL_LOG2_10_20) >> 16;
+    int32_t e = (int32_t)(x >> VOL_FRAC_BITS);
+    uint32_t frac = (uint32_t)(x & ((1 << VOL_FRAC_BITS) - 1));
+    uint32_t i = frac >> interp_bits;
+    uint32_t w = frac & ((1u << interp_bits) - 1);
+
+    // 2^frac in 2.30, then times 2^e in 8.24: a shift of 6 - e
+    uint32_t m = exp2_table[i] + (uint32_t)(((uint64_t)(exp2_table[i + 1] - exp2_table[i]) * w) >> interp_bits);
+    int32_t shift = 6 - e;
+    if(shift < 0) return INT32_MAX;     // 128 and more does not fit 8.24
+    if(shift == 0) return (int32_t)m;
+    if(shift > 31) return 0;
+    return (int32_t)(((uint64_t)m + (1u << (shift - 1))) >> shift);
+}
+
+#define DC_BLOCK_MAX_24  8388607
+#define DC_BLOCK_MIN_24 -8388608
+#define Q31_ONE          ((int64_t)1 << 31)
+
+void dc_block_init(dc_block_t *f, uint32_t corner_hz, uint32_t sample_rate)
+{
+    // computed once per sample rate change, so double precision costs nothing here
+    double a = exp(-2.0 * M_PI * (double)corner_hz / (double)sample_rate);
+    f->a = (int32_t)(a * 2147483648.0);
+    if(a >= 1.0) f->a = INT32_MAX;
+    dc_block_reset(f);
+}
+
+void dc_block_reset(dc_block_t *f)
+{
+    f->primed = false;
+    for(int ch = 0; ch < 2; ch++) {
+        f->x1[ch]  = 0;
+        f->y1[ch]  = 0;
+        f->err[ch] = 0;
+    }
+}
+
+/*
+  One channel of a block. acc holds y[n] * 2^31: the difference of two 24 bit inputs
+  times 2^31 plus a Q31 times a 24 bit output is below 2^57, well inside 64 bits.
+*/
+static void dc_block_channel(dc_block_t *f, int ch, int32_t *p, uint32_t n_frames)
+{
+    const int64_t a = f->a;
+    int32_t x1 = f->x1[ch];
+    int32_t y1 = f->y1[ch];
+    int64_t err = f->err[ch];
+
+    for(uint32_t i = 0; i < n_frames; i++, p += 2) {
+        int32_t x = *p >> 8;
+        int64_t acc = (int64_t)(x - x1) * Q31_ONE + a * y1 + err;
+        int32_t y;
+        if(acc >= ((int64_t)DC_BLOCK_MAX_24 + 1) * Q31_ONE) {
+            y = DC_BLOCK_MAX_24;
+            err = 0;
+        }
+        else if(acc < (int64_t)DC_BLOCK_MIN_24 * Q31_ONE) {
+            y = DC_BLOCK_MIN_24;
+            err = 0;
+        }
+        else {
+            y = (int32_t)(acc >> 31);
+            err = acc - (int64_t)y * Q31_ONE;
+        }
+        *p = (int32_t)((uint32_t)y << 8);
+        x1 = x;
+        y1 = y;
+    }
+    f->x1[ch]  = x1;
+    f->y1[ch]  = y1;
+    f->err[ch] = err;
+}
+
+void dc_block_process(dc_block_t *f, int32_t *frames, uint32_t n_frames)
+{
+    if(n_frames == 0) return;
+    if(!f->primed) {
+        // start from the first input so that an existing offset does not come out as a step
+        f->x1[0] = frames[0] >> 8;
+        f->x1[1] = frames[1] >> 8;
+        f->primed = true;
+    }
+    dc_block_channel(f, 0, frames,     n_frames);
+    dc_block_channel(f, 1, frames + 1, n_frames);
+}
+
+void fb_filter_init(fb_filter_t *f, uint32_t sample_rate, uint8_t shift)
+{
+    f->nominal = (uint32_t)(((uint64_t)sample_rate << 16) / 1000);
+    f->min   = f->nominal - (1u << 16);
+    f->max   = f->nominal + (1u << 16);
+    f->shift = shift;
+    f->acc   = ((int64_t)f->nominal << shift) - f->nominal;   // settled at the nominal rate
+}
+
+/*
+  frames_q16: I2S frames clocked out since the last update, per USB frame, 16.16.
+  y = (acc + x) >> shift and acc keeps the rest, so the sum of the outputs is the sum of
+  the inputs less the change in acc. acc and y are held within the output limits: a
+  stretch without any count (the I2S channel being re-created) cannot wind the filter up.
+*/
+uint32_t fb_filter_update(fb_filter_t *f, int32_t frames_q16)
+{
+    const int64_t lo = (int64_t)f->min << f->shift;
+    const int64_t hi = (int64_t)f->max << f->shift;
+    int64_t acc = f->acc + frames_q16;
+    int64_t y = acc >> f->shift;
+    if(y < f->min) y = f->min;
+    if(y > f->max) y = f->max;
+    acc -= y;
+    if(acc < lo) acc = lo;
+    if(acc > hi) acc = hi;
+    f->acc = acc;
+    return (uint32_t)y;
+}
+
+void frame_pacer_init(frame_pacer_t *p, uint32_t sample_rate)
+{
+    p->sample_rate = sample_rate;
+    p->rem = 0;
+}
+
+uint32_t frame_pacer_next(frame_pacer_t *p)
+{
+    uint32_t due = p->rem + p->sample_rate;
+    p->rem = due % 1000;
+    return due / 1000;
+}
+
+void mic_pkt_sched_init(mic_pkt_sched_t *s, uint32_t sample_rate, uint8_t shift)
+{
+    memset(s, 0, sizeof(*s));
+    frame_pacer_init(&s->pacer, sample_rate);
+    s->shift  = shift;
+    s->hold   = 1u << shift;    // settle before the target is taken
+}
+
+/*
+  fill_frames: frames in the capture ring before this packet is taken out of it.
+  Returns the number of frames the packet is to carry.
+*/
+uint32_t mic_pkt_sched_next(mic_pkt_sched_t *s, uint32_t fill_frames)
+{
+    const int32_t fill = (int32_t)(fill_frames << 8);
+    const uint32_t nominal = frame_pacer_next(&s->pacer);
+    uint32_t n = nominal;
+
+    if(s->packets == 0)     // first packet sized from the ring
+        s->avg = fill;
+    s->avg += (fill - s->avg) >> s->shift;
+
+    if(s->hold) {
+        s->hold--;
+    }
+    else if(!s->locked) {
+        s->target = s->avg;
+        s->locked = true;
+    }
+    else {
+        int32_t err = s->avg - s->target;
+        if(err > (1 << 8) && fill_frames > nominal) {
+            n = nominal + 1;
+            s->long_packets++;
+            s->sec_long++;
+            s->hold = 1u << s->shift;
+        }
+        else if(err < -(1 << 8)) {
+            n = nominal - 1;
+            s->short_packets++;
+            s->sec_short++;
+            s->hold = 1u << s->shift;
+        }
+    }
+
+    s->packets++;
+    if(++s->sec_packets == 1000) {     // one second of full speed frames
+        s->last_long  = s->sec_long;
+        s->last_short = s->sec_short;
+        if(s->sec_long + s->sec_short > s->max_per_sec)
+            s->max_per_sec = s->sec_long + s->sec_short;
+        s->sec_packets = 0;
+        s->sec_long = 0;
+        s->sec_short = 0;
+    }
+    return n;
+}
@@ -0,0 +1,30 @@
+// audio_params.c
+#include "audio_params.h"
+
+/* Writer side; only one thread may publish. Never waits for the readers. */
+void audio_params_publish(audio_params_block_t *block, const audio_params_t *params)
+{
+    uint32_t seq = atomic_load_explicit(&block->seq, memory_order_relaxed);
+
+    // mark the copy the readers do not use as being written before any of it changes
+    atomic_store_explicit(&block->seq, seq + 1, memory_order_relaxed);
+    atomic_thread_fence(memory_order_release);
+    block->slot[((seq >> 1) + 1) & 1] = *params;
+    atomic_store_explicit(&block->seq, seq + 2, memory_order_release);
+}
+
+/* Reader side. Copies the last published block into params and returns its version, the
+   number of publishes so far. Reads again only if the writer has started on the copy being
+   read in the meantime, which takes two publishes during one read. */
+uint32_t audio_params_read(audio_params_block_t *block, audio_params_t *params)
+{
+    uint32_t seq, seq_after;
+
+    do {
+        seq = atomic_load_explicit(&block->seq, memory_order_acquire);
+        *params = block->slot[(seq >> 1) & 1];
+        atomic_thread_fence(memory_order_acquire);
+        seq_after = atomic_load_explicit(&block->seq, memory_order_relaxed);
+    } while(seq_after - (seq & ~1u) > 2);
+    return seq >> 1;
+}
@@ -0,0 +1,131 @@
+// audio_ring.c
+#include <string.h>
+#include <assert.h>
+#include "audio_ring.h"
+
+void audio_ring_init(audio_ring_t *ring, void *buffer, uint32_t size)
+{
+    assert(size != 0 && (size & (size - 1)) == 0);
+
+    ring->buffer = buffer;
+    ring->size   = size;
+    atomic_init(&ring->wr_idx, 0);
+    atomic_init(&ring->rd_idx, 0);
+    audio_ring_reset_stats(ring);
+}
+
+/* Producer side. Copies as much of data as fits and returns the number of bytes
+   written; the rest is counted as overrun. */
+uint32_t audio_ring_write(audio_ring_t *ring, const void *data, uint32_t n_bytes)
+{
+    uint32_t wr = atomic_load_explicit(&ring->wr_idx, memory_order_relaxed);
+    uint32_t rd = atomic_load_explicit(&ring->rd_idx, memory_order_acquire);
+    uint32_t space = ring->size - (wr - rd);
+
+    if(n_bytes > space) {
+        ring->overrun_bytes += n_bytes - space;
+        n_bytes = space;
+    }
+
+    // copy in at most two pieces: up to the end of the buffer and the wrapped part
+    uint32_t offset = wr & (ring->size - 1);
+    uint32_t n_lin  = ring->size - offset;
+    if(n_lin > n_bytes) n_lin = n_bytes;
+    memcpy(ring->buffer + offset, data, n_lin);
+    memcpy(ring->buffer, (const uint8_t *)data + n_lin, n_bytes - n_lin);
+
+    // publish the data only after it has been copied
+    atomic_store_explicit(&ring->wr_idx, wr + n_bytes, memory_order_release);
+    return n_bytes;
+}
+
+/* Producer side, in place: the free space as two regions. The producer writes into them and
+   publishes what it wrote with audio_ring_advance_write(). */
+void audio_ring_get_write_info(audio_ring_t *ring, audio_ring_info_t *info)
+{
+    uint32_t wr = atomic_load_explicit(&ring->wr_idx, memory_order_relaxed);
+    uint32_t rd = atomic_load_explicit(&ring->rd_idx, memory_order_acquire);
+    uint32_t space = ring->size - (wr - rd);
+    uint32_t offset = wr & (ring->size - 1);
+
+    info->ptr_lin  = ring->buffer + offset;
+    info->len_lin  = ring->size - offset < space ? ring->size - offset : space;
+    info->ptr_wrap = ring->buffer;
+    info->len_wrap = space - info->len_lin;
+}
+
+/* Publishes n_written bytes written into the regions of audio_ring_get_write_info(), lin
+   first; the rest of a block of n_bytes that did not fit is counted as overrun. */
+void audio_ring_advance_write(audio_ring_t *ring, uint32_t n_written, uint32_t n_bytes)
+{
+    uint32_t wr = atomic_load_explicit(&ring->wr_idx, memory_order_relaxed);
+
+    if(n_bytes > n_written)
+        ring->overrun_bytes += n_bytes - n_written;
+    atomic_store_explicit(&ring->wr_idx, wr + n_written, memory_order_release);
+}
+
+/* Consumer side. Copies up to n_bytes out of the ring and returns the number of
+   bytes read; a short read is counted as an underrun. */
+uint32_t audio_ring_read(audio_ring_t *ring, void *data, uint32_t n_bytes)
+{
+    return audio_ring_read_split(ring, data, n_bytes, NULL, n_bytes);
+}
+
+/* The same into a destination that wraps as well: the first n_lin bytes go to data, the
+   rest to data_wrap. */
+uint32_t audio_ring_read_split(audio_ring_t *ring, void *data, uint32_t n_lin, void *data_wrap, uint32_t n_bytes)
+{
+    uint32_t rd = atomic_load_explicit(&ring->rd_idx, memory_order_relaxed);
+    uint32_t wr = atomic_load_explicit(&ring->wr_idx, memory_order_acquire);
+    uint32_t count = wr - rd;
+
+    if(count < ring->fill_min) ring->fill_min = count;
+    if(count > ring->fill_max) ring->fill_max = count;
+
+    if(n_bytes > count) {
+        ring->underrun_count++;
+        ring->underrun_bytes += n_bytes - count;
+        n_bytes = count;
+    }
+
+    // up to four pieces: the ring and the destination each wrap at most once
+    uint32_t offset = rd & (ring->size - 1);
+    uint32_t done = 0;
+    while(done < n_bytes) {
+        uint8_t *dst = done < n_lin ? (uint8_t *)data + done : (uint8_t *)data_wrap + (done - n_lin);
+        uint32_t n = (done < n_lin ? n_lin : n_bytes) - done;
+        uint32_t src = (offset + done) & (ring->size - 1);
+        if(n > ring->size - src) n = ring->size - src;
+        if(n > n_bytes - done) n = n_bytes - done;
+        memcpy(dst, ring->buffer + src, n);
+        done += n;
+    }
+
+    // hand the space back to the producer only after the data has been copied out
+    atomic_store_explicit(&ring->rd_idx, rd + n_bytes, memory_order_release);
+    return n_bytes;
+}
+
+uint32_t audio_ring_count(audio_ring_t *ring)
+{
+    uint32_t wr = atomic_load_explicit(&ring->wr_idx, memory_order_acquire);
+    uint32_t rd = atomic_load_explicit(&ring->rd_idx, memory_order_acquire);
+    return wr - rd;
+}
+
+/* Consumer side: discard everything that is in the ring. */
+void audio_ring_flush(audio_ring_t *ring)
+{
+    uint32_t wr = atomic_load_explicit(&ring->wr_idx, memory_order_acquire);
+    atomic_store_explicit(&ring->rd_idx, wr, memory_order_release);
+}
+
+void audio_ring_reset_stats(audio_ring_t *ring)
+{
+    ring->overrun_bytes  = 0;
+    ring->underrun_count = 0;
+    ring->underrun_bytes = 0;
+    ring->fill_min       = UINT32_MAX;
+    ring->fill_max       = 0;
+}
@@ -0,0 +1,113 @@
+// audio_stats.c
+#include <string.h>
+#include <inttypes.h>
+#include "sdkconfig.h"
+#include "audio_stats.h"
+#include "i2s_functions.h"
+#include "data_buffers.h"
+#include "uad_callbacks.h"
+
+extern uint32_t sampFreq;
+
+audio_stats_t audio_stats;
+
+static const char *const timing_names[STATS_N_TIMINGS] = {
+    "pre_load", "post_load", "rx_done", "feedback", "capture", "playback"
+};
+
+static uint32_t cycles_to_ns(uint64_t cycles)
+{
+    return (uint32_t)(cycles * 1000 / CONFIG_ESP_DEFAULT_CPU_FREQ_MHZ);
+}
+
+static uint32_t range_avg(const stats_range_t *r)
+{
+    return r->n ? (uint32_t)(r->total / r->n) : 0;
+}
+
+// Clears all counters, the run times included
+void audio_stats_reset(void)
+{
+    memset(&audio_stats, 0, sizeof(audio_stats));
+}
+
+void audio_stats_print(FILE *out)
+{
+    const audio_stats_t *s = &audio_stats;
+    uint32_t const overruns = s->mic.i2s_overruns - s->mic.i2s_overruns_base;
+    uint32_t const underruns = s->spk.i2s_underruns - s->spk.i2s_underruns_base;
+
+    fprintf(out, "%" PRIu32 " Hz, mic %s, speaker %s\n", sampFreq,
+            s_mic_active ? "open" : "closed", s_spk_active ? "open" : "closed");
+    fprintf(out, "mic  IN packets %" PRIu32 " (silent %" PRIu32 ", N+1 %" PRIu32 ", N-1 %" PRIu32 ")"
+            "  I2S reads %" PRIu32 ", errors %" PRIu32 ", overruns %" PRIu32 " buffers\n",
+            s->mic.packets, s->mic.silent_packets, mic_pkt_sched.long_packets, mic_pkt_sched.short_packets,
+            s->mic.i2s_reads, s->mic.i2s_read_errors, overruns);
+    fprintf(out, "mic  mic_ring fill %" PRIu32 "..%" PRIu32 " B  underruns %" PRIu32 " (%" PRIu32 " B)  overrun %" PRIu32 " B\n",
+            mic_ring.fill_min, mic_ring.fill_max, mic_ring.underrun_count, mic_ring.underrun_bytes, mic_ring.overrun_bytes);
+    fprintf(out, "spk  OUT packets %" PRIu32 " (short %" PRIu32 ") %" PRIu32 "..%" PRIu32 " B"
+            "  FIFO %" PRIu32 "..%" PRIu32 " B (avg %" PRIu32 ")  I2S underruns %" PRIu32 " buffers\n",
+            s->spk.packets, s->spk.short_packets, s->spk.packet_bytes.min, s->spk.packet_bytes.max,
+            s->spk.fifo_bytes.min, s->spk.fifo_bytes.max, range_avg(&s->spk.fifo_bytes), underruns);
+    fprintf(out, "spk  played %" PRIu32 " B  dropped %" PRIu32 " B  stalls %" PRIu32 "  feedback %" PRIu32 " Hz\n",
+            spk_stats.played_bytes, spk_stats.dropped_bytes, spk_stats.stall_count,
+            (uint32_t)(((uint64_t)spk_stats.feedback * 1000) >> 16));
+    fprintf(out, "spk  ");
+    jb_print(&spk_jb, out);
+    fprintf(out, "%-10s %10s %8s %8s %8s ns\n", "", "runs", "min", "avg", "max");
+    for(int i = 0; i < STATS_N_TIMINGS; i++) {
+        const stats_range_t *t = &s->timing[i];
+        fprintf(out, "%-10s %10" PRIu32 " %8" PRIu32 " %8" PRIu32 " %8" PRIu32 "\n", timing_names[i], t->n,
+                cycles_to_ns(t->min), cycles_to_ns(range_avg(t)), cycles_to_ns(t->max));
+    }
+}
+
+static void print_json_range(FILE *out, const char *name, uint32_t n, uint32_t min, uint32_t avg, uint32_t max)
+{
+    fprintf(out, "\"%s\":{\"n\":%" PRIu32 ",\"min\":%" PRIu32 ",\"avg\":%" PRIu32 ",\"max\":%" PRIu32 "}",
+            name, n, min, avg, max);
+}
+
+/*
+  The same as one line of JSON, for scripts: {"sample_rate":..,"mic":{..},"spk":{..},"jitter":{..},
+  "timing_ns":{..}}. Sizes are in bytes, run times in ns; a range is {"n","min","avg","max"};
+  jitter is the speaker's jitter buffer with its last target changes in "history".
+*/
+void audio_stats_print_json(FILE *out)
+{
+    const audio_stats_t *s = &audio_stats;
+    uint32_t const overruns = s->mic.i2s_overruns - s->mic.i2s_overruns_base;
+    uint32_t const underruns = s->spk.i2s_underruns - s->spk.i2s_underruns_base;
+
+    fprintf(out, "{\"sample_rate\":%" PRIu32 ",", sampFreq);
+    fprintf(out, "\"mic\":{\"active\":%s,\"packets\":%" PRIu32 ",\"silent_packets\":%" PRIu32 ","
+            "\"long_packets\":%" PRIu32 ",\"short_packets\":%" PRIu32 ","
+            "\"i2s_reads\":%" PRIu32 ",\"i2s_read_errors\":%" PRIu32 ",\"i2s_overruns\":%" PRIu32 ","
+            "\"ring_fill_min\":%" PRIu32 ",\"ring_fill_max\":%" PRIu32 ",\"ring_underruns\":%" PRIu32 ","
+            "\"ring_underrun_bytes\":%" PRIu32 ",\"ring_overrun_bytes\":%" PRIu32 "},",
+            s_mic_active ? "true" : "false", s->mic.packets, s->mic.silent_packets,
+            mic_pkt_sched.long_packets, mic_pkt_sched.short_packets,
+            s->mic.i2s_reads, s->mic.i2s_read_errors, overruns,
+            mic_ring.fill_min, mic_ring.fill_max, mic_ring.underrun_count,
+            mic_ring.underrun_bytes, mic_ring.overrun_bytes);
+    fprintf(out, "\"spk\":{\"active\":%s,\"packets\":%" PRIu32 ",\"short_packets\":%" PRIu32 ",",
+            s_spk_active ? "true" : "false", s->spk.packets, s->spk.short_packets);
+    const stats_range_t *r = &s->spk.packet_bytes;
+    print_json_range(out, "packet_bytes", r->n, r->min, range_avg(r), r->max);
+    fputc(',', out);
+    r = &s->spk.fifo_bytes;
+    print_json_range(out, "fifo_bytes", r->n, r->min, range_avg(r), r->max);
+    fprintf(out, ",\"i2s_underruns\":%" PRIu32 ",\"played_bytes\":%" PRIu32 ",\"dropped_bytes\":%" PRIu32 ","
+            "\"stalls\":%" PRIu32 ",\"feedback_q16\":%" PRIu32 "},",
+            underruns, spk_stats.played_bytes, spk_stats.dropped_bytes,
+            spk_stats.stall_count, spk_stats.feedback);
+    fprintf(out, "\"jitter\":");
+    jb_print_json(&spk_jb, out);
+    fprintf(out, ",\"timing_ns\":{");
+    for(int i = 0; i < STATS_N_TIMINGS; i++) {
+        const stats_range_t *t = &s->timing[i];
+        if(i) fputc(',', out);
+        print_json_range(out, timing_names[i], t->n, cycles_to_ns(t->min), cycles_to_ns(range_avg(t)), cycles_to_ns(t->max));
+    }
+    fprintf(out, "}}\n");
+}
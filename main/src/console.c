@@ -0,0 +1,186 @@
+// console.c
+#include <stdio.h>
+#include <string.h>
+#include "esp_console.h"
+#include "esp_err.h"
+#include "esp_log.h"
+#include "audio_stats.h"
+#include "trace.h"
+#include "profiler.h"
+#include "latency.h"
+#include "i2s_functions.h"
+#include "console.h"
+
+static const char *TAG = "console";
+
+static int cmd_stats(int argc, char **argv)
+{
+    if(argc == 1)
+        audio_stats_print(stdout);
+    else if(strcmp(argv[1], "json") == 0)
+        audio_stats_print_json(stdout);
+    else if(strcmp(argv[1], "reset") == 0)
+        audio_stats_reset();
+    else {
+        printf("usage: stats [json|reset]\n");
+        return 1;
+    }
+    return 0;
+}
+
+static int cmd_prof(int argc, char **argv)
+{
+    if(argc == 1)
+        prof_print(stdout);
+    else if(strcmp(argv[1], "reset") == 0)
+        prof_reset();
+    else {
+        printf("usage: prof [reset]\n");
+        return 1;
+    }
+    return 0;
+}
+
+static int cmd_latency(int argc, char **argv)
+{
+    if(argc == 1)
+        latency_print(stdout);
+    else if(strcmp(argv[1], "on") == 0)
+        latency_enable(true);
+    else if(strcmp(argv[1], "off") == 0)
+        latency_enable(false);
+    else if(strcmp(argv[1], "reset") == 0)
+        latency_reset();
+    else {
+        printf("usage: latency [on|off|reset]\n");
+        return 1;
+    }
+    return 0;
+}
+
+static int cmd_loopback(int argc, char **argv)
+{
+    if(argc == 1)
+        printf("loopback %s\n", audio_loopback ? "on" : "off");
+    else if(strcmp(argv[1], "on") == 0)
+        audio_loopback_enable(true);
+    else if(strcmp(argv[1], "off") == 0)
+        audio_loopback_enable(false);
+    else {
+        printf("usage: loopback [on|off]\n");
+        return 1;
+    }
+    return 0;
+}
+
+#ifdef CONFIG_MIC_AEC
+static int cmd_aec(int argc, char **argv)
+{
+    if(argc == 1)
+        mic_aec_print(stdout);
+    else if(strcmp(argv[1], "on") == 0)
+        mic_aec_enable(true);
+    else if(strcmp(argv[1], "off") == 0)
+        mic_aec_enable(false);
+    else if(strcmp(argv[1], "reset") == 0)
+        mic_aec_reset();
+    else {
+        printf("usage: aec [on|off|reset]\n");
+        return 1;
+    }
+    return 0;
+}
+#endif
+
+static int cmd_jitter(int argc, char **argv)
+{
+    if(argc == 1) {
+        jb_print(&spk_jb, stdout);
+        return 0;
+    }
+    for(int p = 0; p < JB_N_PROFILES; p++) {
+        if(strcmp(argv[1], jb_profiles[p].name) == 0) {
+            spk_jb_set_profile((jb_profile_t)p);
+            return 0;
+        }
+    }
+    printf("usage: jitter [low_latency|balanced|robust]\n");
+    return 1;
+}
+
+static int cmd_trace(int argc, char **argv)
+{
+    (void) argc; (void) argv;
+    trace_dump(stdout);
+    return 0;
+}
+
+/*
+  Starts a REPL on the console UART. Its task runs on core 0 below the tinyusb task, so that
+  printing a long dump never holds up USB or the audio tasks on core 1.
+*/
+void console_init(void)
+{
+    esp_console_repl_t *repl = NULL;
+    esp_console_repl_config_t repl_config = ESP_CONSOLE_REPL_CONFIG_DEFAULT();
+    repl_config.prompt = "uad>";
+    repl_config.task_priority = 1;
+    repl_config.task_core_id = 0;
+    esp_console_dev_uart_config_t uart_config = ESP_CONSOLE_DEV_UART_CONFIG_DEFAULT();
+    ESP_ERROR_CHECK(esp_console_new_repl_uart(&uart_config, &repl_config, &repl));
+
+    const esp_console_cmd_t stats_cmd = {
+        .command = "stats",
+        .help = "Streaming statistics; json: as one line of JSON, reset: clear the counters",
+        .hint = "[json|reset]",
+        .func = &cmd_stats,
+    };
+    const esp_console_cmd_t trace_cmd = {
+        .command = "trace",
+        .help = "Print the trace rings for scripts/trace_decode.py",
+        .hint = NULL,
+        .func = &cmd_trace,
+    };
+    const esp_console_cmd_t prof_cmd = {
+        .command = "prof",
+        .help = "CPU cycles of the audio pipeline stages per 1mS frame since the last reset",
+        .hint = "[reset]",
+        .func = &cmd_prof,
+    };
+    const esp_console_cmd_t latency_cmd = {
+        .command = "latency",
+        .help = "Round trip latency of markers looped back from the speaker to the mic; on: start measuring",
+        .hint = "[on|off|reset]",
+        .func = &cmd_latency,
+    };
+    const esp_console_cmd_t loopback_cmd = {
+        .command = "loopback",
+        .help = "Digital loopback of the speaker stream to the mic, bypassing I2S",
+        .hint = "[on|off]",
+        .func = &cmd_loopback,
+    };
+    const esp_console_cmd_t jitter_cmd = {
+        .command = "jitter",
+        .help = "Speaker jitter buffer: target, depth and the last target changes; a profile name sets the profile",
+        .hint = "[low_latency|balanced|robust]",
+        .func = &cmd_jitter,
+    };
+#ifdef CONFIG_MIC_AEC
+    const esp_console_cmd_t aec_cmd = {
+        .command = "aec",
+        .help = "Echo canceller of the mic: ERLE, reference frames missing or dropped, CPU load; on: start adapting",
+        .hint = "[on|off|reset]",
+        .func = &cmd_aec,
+    };
+    ESP_ERROR_CHECK(esp_console_cmd_register(&aec_cmd));
+#endif
+    ESP_ERROR_CHECK(esp_console_cmd_register(&stats_cmd));
+    ESP_ERROR_CHECK(esp_console_cmd_register(&prof_cmd));
+    ESP_ERROR_CHECK(esp_console_cmd_register(&latency_cmd));
+    ESP_ERROR_CHECK(esp_console_cmd_register(&loopback_cmd));
+    ESP_ERROR_CHECK(esp_console_cmd_register(&jitter_cmd));
+    ESP_ERROR_CHECK(esp_console_cmd_register(&trace_cmd));
+    ESP_ERROR_CHECK(esp_console_register_help_command());
+    ESP_ERROR_CHECK(esp_console_start_repl(repl));
+    ESP_LOGI(TAG, "console started; \"stats\" prints the streaming statistics");
+}
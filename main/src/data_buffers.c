@@ -0,0 +1,26 @@
+// data_buffers.c
+#include <stdint.h>
+#include <stddef.h>
+#include "tusb.h"
+#include "tusb_config.h"
+#include "data_buffers.h"
+
+#define I2S_DATA_OUT_BUFSIZ (CFG_TUD_AUDIO_FUNC_1_EP_OUT_SW_BUF_SZ/ 2)
+#define MIC_RING_SZ         8192   // power of 2; ~21mS at 48kHz, 24bit stereo in 32bit slots
+#define SPK_JB_RING_SZ      16384  // power of 2; ~42mS at 48kHz, 24bit stereo in 32bit slots
+
+// variables declared as extern in data_buffers.h
+
+/* mic_ring is filled by the I2S capture task and drained into the EP IN FIFO in tud_audio_tx_done_post_load_cb() */
+static uint8_t mic_ring_buf[MIC_RING_SZ];
+audio_ring_t mic_ring = { .buffer = mic_ring_buf, .size = MIC_RING_SZ, .fill_min = UINT32_MAX };
+
+/* spk_jb_ring is the speaker's jitter buffer: the playback task fills it from the EP OUT FIFO
+   and empties it into the I2S DMA */
+static uint8_t spk_jb_ring_buf[SPK_JB_RING_SZ];
+audio_ring_t spk_jb_ring = { .buffer = spk_jb_ring_buf, .size = SPK_JB_RING_SZ, .fill_min = UINT32_MAX };
+
+volatile size_t data_out_buf_n_bytes = 0;
+int16_t data_out_buf[I2S_DATA_OUT_BUFSIZ] = {0};
+
+// end extern variables declared in data_buffers.h
@@ -1,3 +1,7 @@
+#include <string.h>
+#include <inttypes.h>
+#include <stdatomic.h>
+#include "sdkconfig.h"
 #include "i2s_functions.h"
 #include "data_buffers.h"
 #include "esp_err.h"
@@ -6,7 +10,19 @@
 #include "tusb.h"
 #include "tusb_config.h"
 #include "esp_task_wdt.h"
+#include "esp_timer.h"
+#include "esp_attr.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
 #include "utilities.h"
+#include "audio_dsp.h"
+#include "uad_callbacks.h"
+#include "trace.h"
+#include "audio_stats.h"
+#include "profiler.h"
+#include "latency.h"
+#include "aec.h"
+#include "jitter_buf.h"
 
 static const char* TAG = "i2s_functions";
 
@@ -19,13 +35,109 @@ static i2s_chan_handle_t                rx_handle = NULL;        // I2S rx chann
 #define I2S_GPIO_BCLK    GPIO_NUM_37
 
 /*raw buffer to read data from I2S dma buffers*/
-static char rx_sample_buf [CFG_TUD_AUDIO_FUNC_1_EP_IN_SW_BUF_SZ];
+static int32_t rx_sample_buf [CFG_TUD_AUDIO_FUNC_1_EP_IN_SW_BUF_SZ/4];
 static size_t  rx_sample_buflen = 0;// value is set based on sample rate etc. when the i2s is configured 
 
 static int32_t tx_sample_buf [CFG_TUD_AUDIO_FUNC_1_EP_OUT_SW_BUF_SZ/2];
 
-extern int32_t mic_gain[2];
-extern int32_t spk_gain[2];
+/* playback task: woken by tud_audio_rx_done_post_read_cb() */
+TaskHandle_t spk_task_handle = NULL;
+volatile spk_playback_stats_t spk_stats;
+static volatile bool spk_primed = false;
+
+/* held by the capture task while it reads from rx_handle and by bsp_i2s_reconfig() while
+   the channels are deleted and re-created, so that a sampling frequency change never pulls
+   the channel out from under a blocked read */
+static SemaphoreHandle_t i2s_rx_mutex = NULL;
+static SemaphoreHandle_t i2s_tx_mutex = NULL;   // the same for the playback task and tx_handle
+
+/* USB IN starts taking data out of mic_ring once it holds these many mS of data, counting
+   the frames still on their way in from the DMA, plus MIC_RING_START_FRAMES: one DMA buffer
+   can be missing from the ring when a packet is taken out of it, and the packet can be two
+   frames longer than sampFreq/1000 (45 + 1 at 44.1kHz) */
+#define MIC_RING_START_MS     2
+#define MIC_RING_START_FRAMES 4
+static volatile bool mic_ring_primed = false;
+
+/* Digital loopback: the speaker stream goes into mic_ring instead of out over I2S, and the
+   capture task leaves mic_ring alone. Set by audio_loopback_enable(); the tinyusb task sees
+   mic_ring_reprime and starts the ring over, so the two sources never mix in it. */
+volatile bool audio_loopback = false;
+static volatile bool mic_ring_reprime = false;
+
+/* The counters of audio_stats and spk_stats that the capture and the playback task write
+   are cleared by those tasks: mic_ring_restart() and spk_playback_restart() run in the
+   tinyusb task and only ask for it. The DMA interrupts' counters are never cleared but
+   from audio_stats_reset(); a stream opening takes their value as its base instead. */
+static atomic_bool mic_stats_reset_req = false;   // served by the capture task
+static atomic_bool spk_stats_reset_req = false;   // served by the playback task
+
+/* IN packet sizing from the mic_ring fill; the fill is averaged over 2^MIC_PKT_AVG_SHIFT packets */
+#define MIC_PKT_AVG_SHIFT 5
+mic_pkt_sched_t mic_pkt_sched;
+
+/* Bytes per sample of the open streams, set from the alternate setting by mic_ring_restart()
+   and spk_playback_restart(): 2 for the 16 bit format, which is converted to and from the
+   32bit I2S slots, 4 for the 24 bit format, which is carried in the slots as they are */
+static volatile uint8_t mic_sample_bytes = 2;
+static volatile uint8_t spk_sample_bytes = 2;
+#define MIC_FRAME_BYTES   (CFG_TUD_AUDIO_FUNC_1_N_CHANNELS_TX * mic_sample_bytes)     // frames in mic_ring
+
+/* The digital loopback bypasses the jitter buffer: it starts once the EP OUT FIFO holds
+   these many mS of data */
+#define SPK_START_MS          2
+#define SPK_WRITE_TIMEOUT_MS  2
+
+/* Jitter buffer of the speaker (jitter_buf.h): spk_jb_ring holds the OUT stream between the
+   EP OUT FIFO and the I2S DMA, and the playback task writes it to the DMA as the DMA frees
+   its buffers; the TX DMA callback wakes the task for each one. i2s_tx_written counts the
+   frames written to the DMA the way i2s_tx_clock.frames counts those it has sent, so the
+   difference is what is queued in it. spk_jb_restart (a stream opens, the loopback switches)
+   and spk_jb_new_profile (spk_jb_set_profile()) are taken up by the playback task, which is
+   the only one to touch spk_jb_ring and spk_jb. */
+#if defined(CONFIG_SPK_JITTER_LOW_LATENCY)
+#define SPK_JB_PROFILE        JB_LOW_LATENCY
+#elif defined(CONFIG_SPK_JITTER_ROBUST)
+#define SPK_JB_PROFILE        JB_ROBUST
+#else
+#define SPK_JB_PROFILE        JB_BALANCED
+#endif
+jitter_buf_t spk_jb;
+volatile jb_profile_t spk_jb_profile = SPK_JB_PROFILE;
+static volatile bool spk_jb_restart = true;
+static volatile bool spk_jb_new_profile = false;
+static volatile uint32_t i2s_tx_written = 0;
+static int32_t spk_jb_block[CFG_TUD_AUDIO_FUNC_1_EP_OUT_SZ_MAX/4];
+
+/* The parameters set by the control requests as the capture and the playback task see them:
+   each task takes a snapshot of audio_params once per 1mS block, so a block is processed with
+   one set of gains and sizes even if the host changes them in the middle of it */
+static audio_params_t mic_params;
+static audio_params_t spk_params;
+
+/* the gains the audio path applies: they follow mic_params.mic_gain[] and spk_params.spk_gain[]
+   in ramps of CONFIG_GAIN_RAMP_MS, so that a volume change or a mute does not click */
+static gain_ramp_t mic_ramp;
+static gain_ramp_t spk_ramp;
+
+/* I2S clock as seen by the DMA of one channel: frames sent or received (the silence of
+   auto_clear included) and the esp_timer time at which the last DMA buffer finished.
+   Written by the DMA callbacks, read by i2s_dma_clock_position(). TX: for the speaker
+   feedback; RX: for the frames on their way into mic_ring, for the IN packet sizing. */
+typedef struct {
+    volatile uint32_t frames;
+    volatile int64_t  us;
+    uint32_t buf_frames;        // dma_frame_num
+    uint32_t buf_us;            // time to clock one DMA buffer
+    uint32_t frames_per_us;     // sample rate in frames per uS, 0.32 fixed point
+} i2s_dma_clock_t;
+
+static i2s_dma_clock_t i2s_tx_clock;
+static i2s_dma_clock_t i2s_rx_clock;
+static volatile uint32_t i2s_rx_captured_frames = 0;    // frames i2s_capture() has put into mic_ring
+
+/* start of the capture block in bsp_i2s_read() or bsp_i2s_read_slots(), for its run time */
+static uint32_t capture_t0;
 
 /* For I2S on ESP32 info and how to configure it, please see the documentation at
    https://docs.espressif.com/projects/esp-idf/en/stable/esp32/api-reference/peripherals/i2s.html .
@@ -34,18 +146,96 @@ extern int32_t spk_gain[2];
 */
 
 
+static IRAM_ATTR bool i2s_dma_done_cb(i2s_chan_handle_t handle, i2s_event_data_t *event, void *user_ctx)
+{
+    (void) handle; (void) event;
+    i2s_dma_clock_t *clock = user_ctx;
+    clock->us = esp_timer_get_time();
+    clock->frames += clock->buf_frames;
+    return false;
+}
+
+/* the I2S driver calls these when a DMA buffer completes and the queue of completed buffers
+   is full: RX, the capture task has not read the buffers in time and the oldest is lost;
+   TX, nothing was written into the freed buffers and auto_clear plays silence. The TX one
+   runs whenever the speaker is not playing, so only the buffers of an open stream that is
+   not looped back count. */
+static IRAM_ATTR bool i2s_rx_overrun_cb(i2s_chan_handle_t handle, i2s_event_data_t *event, void *user_ctx)
+{
+    (void) handle; (void) event; (void) user_ctx;
+    audio_stats.mic.i2s_overruns++;
+    return false;
+}
+
+/* TX: the jitter buffer has room in the DMA for another buffer; the loopback leaves the
+   DMA alone */
+static IRAM_ATTR bool i2s_tx_done_cb(i2s_chan_handle_t handle, i2s_event_data_t *event, void *user_ctx)
+{
+    BaseType_t woken = pdFALSE;
+    i2s_dma_done_cb(handle, event, user_ctx);
+    if(s_spk_active && !audio_loopback && spk_task_handle != NULL)
+        vTaskNotifyGiveFromISR(spk_task_handle, &woken);
+    return woken == pdTRUE;
+}
+
+static IRAM_ATTR bool i2s_tx_underrun_cb(i2s_chan_handle_t handle, i2s_event_data_t *event, void *user_ctx)
+{
+    (void) handle; (void) event; (void) user_ctx;
+    if(s_spk_active && !audio_loopback)
+        audio_stats.spk.i2s_underruns++;
+    return false;
+}
+
+static void i2s_dma_clock_init(i2s_dma_clock_t *clock, uint32_t dma_frame_num, uint32_t sample_rate)
+{
+    clock->frames        = 0;
+    clock->buf_frames    = dma_frame_num;
+    clock->buf_us        = (uint32_t)((uint64_t)dma_frame_num * 1000000 / sample_rate);
+    clock->frames_per_us = (uint32_t)(((uint64_t)sample_rate << 32) / 1000000);
+    clock->us            = esp_timer_get_time();
+}
+
+/*
+  Position of an I2S clock in frames, 16.16, wrapping at 2^16 frames: the frames of the
+  DMA buffers completed so far plus the part of the current buffer clocked since the last
+  one finished, from the elapsed esp_timer time. The count only moves a whole buffer
+  (about 1mS) at a time; the interpolation is what lets a reading taken at every SOF
+  resolve the rate to a fraction of a frame.
+*/
+static uint32_t i2s_dma_clock_position(const i2s_dma_clock_t *clock)
+{
+    uint32_t frames;
+    int64_t t;
+    do {
+        frames = clock->frames;
+        t = clock->us;
+    } while(frames != clock->frames);     // the DMA callback ran in between
+
+    int64_t dt = esp_timer_get_time() - t;
+    if(dt < 0) dt = 0;
+    if(dt > clock->buf_us) dt = clock->buf_us;
+    return (frames << 16) + (uint32_t)(((uint64_t)dt * clock->frames_per_us) >> 16);
+}
+
 esp_err_t bsp_i2s_init(i2s_port_t i2s_num, uint32_t sample_rate)
 {
     esp_err_t ret_val = ESP_OK;
 
+    if(i2s_rx_mutex == NULL)
+        i2s_rx_mutex = xSemaphoreCreateMutex();
+    if(i2s_tx_mutex == NULL)
+        i2s_tx_mutex = xSemaphoreCreateMutex();
+
     i2s_slot_mode_t channel_fmt = I2S_SLOT_MODE_STEREO;
 
     // default chan_cfg : 
     // { .id = <i2s_num>, .role = <I2S_ROLE_MASTER>, .dma_desc_num = 6, .dma_frame_num = 240, .auto_clear = 0, .intr_priority = 0, }
     i2s_chan_config_t chan_cfg = I2S_CHANNEL_DEFAULT_CONFIG(i2s_num, I2S_ROLE_MASTER);
-    chan_cfg.dma_desc_num = 2;
-    // dma_frame_num is changed from dafult value of 240 to reduce latency
-    chan_cfg.dma_frame_num = sample_rate/1000;  // number of frames in 1mS; cannot handle sample_rate like 44.1kHz
+    chan_cfg.dma_desc_num = I2S_DMA_DESC_NUM;
+    // dma_frame_num is changed from dafult value of 240 to reduce latency: the whole number of
+    // frames closest to I2S_DMA_BUF_US (44 at 44.1kHz). It need not match the USB packets;
+    // mic_ring and the EP OUT FIFO take up the difference.
+    chan_cfg.dma_frame_num = I2S_DMA_FRAME_NUM(sample_rate);
     chan_cfg.auto_clear_before_cb = true;       // this flag makes sure that only 0 is sent if no more data is provided
     
     ret_val |= i2s_new_channel(&chan_cfg, &tx_handle, &rx_handle);
@@ -79,10 +269,30 @@ esp_err_t bsp_i2s_init(i2s_port_t i2s_num, uint32_t sample_rate)
     */
     rx_sample_buflen  = chan_cfg.dma_frame_num * std_cfg.slot_cfg.slot_mode * std_cfg.slot_cfg.data_bit_width / 8;
     assert(rx_sample_buflen <= sizeof(rx_sample_buf));
-    // Even though 32 bits for each data samples are read from I2S (for the specific Mic used), only 16 bits
-    // per sample is sent out over USB.
-    data_in_buf_n_bytes   = chan_cfg.dma_frame_num * std_cfg.slot_cfg.slot_mode *2 ;
-    ESP_LOGI(TAG,"rx_sample_buflen: %d, data_in_buf_n_bytes: %d", rx_sample_buflen, data_in_buf_n_bytes);
+    ESP_LOGI(TAG,"rx_sample_buflen: %zu", rx_sample_buflen);
+
+    // the offset canceller on the read channel starts over with coefficients for the new rate
+    decode_and_cancel_offset(NULL, 0, true);
+    // so do the gain ramps, with the gains of the moment
+    gain_ramp_init(&mic_ramp, sample_rate * CONFIG_GAIN_RAMP_MS / 1000);
+    gain_ramp_init(&spk_ramp, sample_rate * CONFIG_GAIN_RAMP_MS / 1000);
+    // and the latency measurement, whose results are per sample rate
+    latency_reset();
+#ifdef CONFIG_MIC_AEC
+    // and the echo canceller, whose model of the echo path is in frames of the old rate
+    mic_aec_reset();
+#endif
+
+    // count the TX clock for the speaker feedback and the RX clock for the mic packet sizing;
+    // callbacks can only be registered before enabling
+    i2s_dma_clock_init(&i2s_tx_clock, chan_cfg.dma_frame_num, sample_rate);
+    i2s_dma_clock_init(&i2s_rx_clock, chan_cfg.dma_frame_num, sample_rate);
+    i2s_rx_captured_frames = 0;
+    i2s_tx_written = 0;
+    const i2s_event_callbacks_t tx_cbs = { .on_sent = i2s_tx_done_cb, .on_send_q_ovf = i2s_tx_underrun_cb };
+    const i2s_event_callbacks_t rx_cbs = { .on_recv = i2s_dma_done_cb, .on_recv_q_ovf = i2s_rx_overrun_cb };
+    ret_val |= i2s_channel_register_event_callback(tx_handle, &tx_cbs, &i2s_tx_clock);
+    ret_val |= i2s_channel_register_event_callback(rx_handle, &rx_cbs, &i2s_rx_clock);
 
     ret_val |= i2s_channel_enable(tx_handle);
     ret_val |= i2s_channel_enable(rx_handle);
@@ -94,19 +304,22 @@ esp_err_t bsp_i2s_reconfig(uint32_t sample_rate)
 {
     esp_err_t ret_val = ESP_OK;
     esp_err_t ret_val2 ;
+    xSemaphoreTake(i2s_rx_mutex, portMAX_DELAY);
+    xSemaphoreTake(i2s_tx_mutex, portMAX_DELAY);
     ret_val |= i2s_channel_disable(rx_handle);
     ret_val |= i2s_channel_disable(tx_handle);
     ret_val |= i2s_del_channel(rx_handle);
     ret_val |= i2s_del_channel(tx_handle);
     ESP_ERROR_CHECK(ret_val2 = bsp_i2s_init(I2S_NUM_1, sample_rate));
     ret_val |= ret_val2;
+    xSemaphoreGive(i2s_tx_mutex);
+    xSemaphoreGive(i2s_rx_mutex);
     //const i2s_std_clk_config_t clk_cfg  = I2S_STD_CLK_DEFAULT_CONFIG(sample_rate);
     
     //ret_val |= i2s_channel_reconfig_std_clock(rx_handle, &clk_cfg);
     //ret_val |= i2s_channel_enable(rx_handle);
 
-    // init the offset canceller filter on the read channel
-    //decode_and_cancel_offset(NULL, NULL, true);
+    // the offset canceller filter on the read channel is re-initialised by bsp_i2s_init()
     
     return ret_val;
 }
@@ -114,13 +327,166 @@ esp_err_t bsp_i2s_reconfig(uint32_t sample_rate)
 
 extern uint32_t sampFreq;
 
+#ifdef CONFIG_MIC_DC_BLOCK
+static dc_block_t mic_dc_block;
+#endif
+
+/*
+  Removes the DC offset of the microphone (SPH0645 has a large one; INMP441 a small one)
+  from a block of raw stereo frames, in place. The frames stay 32bit slots with 24 valid
+  bits so that the result goes through the same conversion as unfiltered data.
+  reset: sets up the filter for the current sampFreq and clears its state; raw_frames is
+  not used. Called from bsp_i2s_init() so that every sample rate change resets it.
+*/
+void decode_and_cancel_offset(int32_t *raw_frames, uint32_t n_frames, bool reset)
+{
+#ifdef CONFIG_MIC_DC_BLOCK
+    if(reset) {
+        dc_block_init(&mic_dc_block, CONFIG_MIC_DC_BLOCK_CORNER_HZ, sampFreq);
+        return;
+    }
+    dc_block_process(&mic_dc_block, raw_frames, n_frames);
+#else
+    (void) raw_frames; (void) n_frames; (void) reset;
+#endif
+}
+
+#ifdef CONFIG_MIC_AEC
+/* Echo canceller of the mic (aec.h), turned on by mic_aec_enable() and only at sampling
+   frequencies up to CONFIG_MIC_AEC_MAX_RATE, where it fits into the 1mS of the capture task.
+   The playback task puts the slots it hands to the I2S DMA into aec_ref_ring, mixed to mono;
+   the capture task takes as many of them as it has mic frames, in order. The TX and RX DMA
+   run off the same clock, so the reference stays the same number of frames ahead of its echo
+   as long as the speaker plays: up to a DMA queue plus the time through the air. Frames the
+   speaker did not get (before it starts, or in a stall) are silence to the canceller; a
+   backlog over AEC_REF_MAX_MS is dropped so the echo stays within the taps. */
+#define AEC_REF_RING_FRAMES 1024
+#define AEC_REF_MAX_MS      4
+static float aec_ref_buf[AEC_REF_RING_FRAMES];
+static audio_ring_t aec_ref_ring = { .buffer = (uint8_t*)aec_ref_buf, .size = sizeof(aec_ref_buf), .fill_min = UINT32_MAX };
+aec_t mic_aec;
+volatile bool mic_aec_on = false;
+static atomic_bool mic_aec_reset_req = false;     // set by mic_aec_reset(), served by the capture task
+mic_aec_stats_t mic_aec_stats;
+
+static bool mic_aec_active(void)
+{
+    return mic_aec_on && sampFreq <= CONFIG_MIC_AEC_MAX_RATE;
+}
+
+// Playback task: n_frames stereo slots that went into the DMA
+static void mic_aec_reference(const int32_t *slots, uint32_t n_frames)
+{
+    float ref[AEC_BLOCK_MAX];
+
+    while(n_frames) {
+        uint32_t n = n_frames < AEC_BLOCK_MAX ? n_frames : AEC_BLOCK_MAX;
+        for(uint32_t i = 0; i < n; i++)
+            ref[i] = (float)((slots[2 * i] >> 1) + (slots[2 * i + 1] >> 1)) * (1.0f / 2147483648.0f);
+        audio_ring_write(&aec_ref_ring, ref, n * sizeof(float));
+        slots += 2 * n;
+        n_frames -= n;
+    }
+}
+
+// Capture task: cancels the echo in n_frames raw stereo slots, in place
+static void mic_aec_process(int32_t *frames, uint32_t n_frames)
+{
+    float ref[AEC_BLOCK_MAX];
+    uint32_t t0 = esp_cpu_get_cycle_count();
+
+    mic_aec_stats.blocks++;
+    while(n_frames) {
+        uint32_t n = n_frames < AEC_BLOCK_MAX ? n_frames : AEC_BLOCK_MAX;
+        uint32_t got = audio_ring_read(&aec_ref_ring, ref, n * sizeof(float)) / sizeof(float);
+        if(got < n) {
+            memset(ref + got, 0, (n - got) * sizeof(float));
+            mic_aec_stats.ref_missing += n - got;
+        }
+        aec_process(&mic_aec, ref, frames, n);
+        mic_aec_stats.frames += n;
+        frames += 2 * n;
+        n_frames -= n;
+    }
+    uint32_t backlog = audio_ring_count(&aec_ref_ring) / sizeof(float);
+    uint32_t max_frames = AEC_REF_MAX_MS * sampFreq / 1000;
+    while(backlog > max_frames) {
+        uint32_t n = backlog - max_frames < AEC_BLOCK_MAX ? backlog - max_frames : AEC_BLOCK_MAX;
+        audio_ring_read(&aec_ref_ring, ref, n * sizeof(float));
+        mic_aec_stats.ref_dropped += n;
+        backlog -= n;
+    }
+
+    uint32_t cycles = esp_cpu_get_cycle_count() - t0;
+    mic_aec_stats.cycles += cycles;
+    if(cycles > mic_aec_stats.max_cycles) mic_aec_stats.max_cycles = cycles;
+}
+
+/*
+  Capture task, before a block: the reset mic_aec_reset() asked for. The capture task runs
+  the canceller and is the consumer of aec_ref_ring, so it is the one task that can start
+  them over without a block in progress on them.
+*/
+static void mic_aec_poll(void)
+{
+    if(atomic_exchange(&mic_aec_reset_req, false)) {
+        aec_init(&mic_aec, sampFreq, AEC_MU);
+        audio_ring_flush(&aec_ref_ring);
+        memset(&mic_aec_stats, 0, sizeof(mic_aec_stats));
+    }
+}
+
+/*
+  Turns the canceller on or off; on starts it over from no model of the echo path. Takes
+  effect at the next block of each task.
+*/
+void mic_aec_enable(bool on)
+{
+    // the reset is asked for before the canceller is turned on: a block that sees it on
+    // also sees the request (bsp_i2s_read())
+    if(on)
+        mic_aec_reset();
+    mic_aec_on = on;
+}
+
+// Starts the canceller over for the current sampFreq and clears its counters, at the next
+// block of the capture task
+void mic_aec_reset(void)
+{
+    atomic_store(&mic_aec_reset_req, true);
+}
+
+/*
+  One line of key=value pairs: whether it runs at the current sampling frequency, the ERLE
+  of the last AEC_ERLE_MS with the far end active, the reference frames the speaker did not
+  have or that were dropped, and the cycles per mic block, also as a share of the core.
+*/
+void mic_aec_print(FILE *out)
+{
+    const mic_aec_stats_t *s = &mic_aec_stats;
+    double per_ms = s->frames ? (double)s->cycles * (sampFreq / 1000) / s->frames : 0.0;
+
+    fprintf(out, "AEC %s rate=%" PRIu32 " active=%d taps=%d mu=%.2f erle_db=%.1f windows=%" PRIu32 " blocks=%" PRIu32
+            " ref_missing=%" PRIu32 " ref_dropped=%" PRIu32 " avg_cycles=%" PRIu64 " max_cycles=%" PRIu32 " load_pct=%.1f\n",
+            mic_aec_on ? "on" : "off", sampFreq, mic_aec_active(), AEC_TAPS, mic_aec.mu, mic_aec.erle_db,
+            mic_aec.n_windows, s->blocks, s->ref_missing, s->ref_dropped, s->blocks ? s->cycles / s->blocks : 0,
+            s->max_cycles, 100.0 * per_ms / (CONFIG_ESP_DEFAULT_CPU_FREQ_MHZ * 1000));
+}
+#else
+#define mic_aec_active()                    false
+#define mic_aec_poll()
+#define mic_aec_reference(slots, n_frames)
+#define mic_aec_process(frames, n_frames)
+#endif
+
 /*
 T = 16000 // 62.5uS in .8 format for fs=16kHz
 T = 10667 // 41.67uS in .8 format for fs=24kHz
 T =  8000 // 31.25 in .8 format for fs=32kHz
 T =  5805 // 22.68uS in .8 format for fs=44.1kHz
+T =  5333 // 20.83uS in .8 format for fs=48kHz
 */
-#define getPeriod(f) (f==16000?16000:(f==24000?10667:(f==32000?8000:5805)))
+#define getPeriod(f) (f==16000?16000:(f==24000?10667:(f==32000?8000:(f==44100?5805:5333))))
 
 #define HALF_PERIOD_441HZ 290249 /* in 0.8 format*/
 #define HALF_PERIOD_220HZ 581818 /* in 0.8 format*/
@@ -129,83 +495,521 @@ T =  5805 // 22.68uS in .8 format for fs=44.1kHz
 #define SIGNAL_ON_DURATION  256000000L /* 1s or 1000000uS in 0.8 format */
 #define SIGNAL_OFF_DURATION 256000000L /* 1s or 1000000uS in 0.8 format */
 /*
-  This function is called by tud_audio_tx_done_post_load_cb(). 
-  It reads 32bits raw data for both left and right channels from I2S DMA buffers, 
-  gets upper 24bits LSB aligned. After amplification, 16 bits are returned in 
-  data_buf. count is the requested number of bytes. Actual number of bytes read is 
-  returned.
+  Uncomment to replace the microphone by a synthetic square wave (220Hz, 1s on / 1s off).
+  The data is still paced by the I2S receiver.
 */
+//#define MIC_TEST_SIGNAL
+
+#ifdef MIC_TEST_SIGNAL
+// next sample of the test signal, 16 bit
+static int16_t mic_test_signal_next(void)
+{
+    int32_t T = getPeriod(mic_params.sample_rate);
+    static int16_t sig_value = 16000;
+    static int n_samples_from_last_edge = 0;
+    static uint32_t n_samples_from_last_on_edge = 0;
+
+    if(n_samples_from_last_edge*T > SIGNAL_HALF_PERIOD) {
+        sig_value = sig_value == 200 ? -200 : 200;
+        n_samples_from_last_edge = 0;
+    }
+    else
+        n_samples_from_last_edge ++;
+
+    if(n_samples_from_last_on_edge*T > (SIGNAL_ON_DURATION + SIGNAL_OFF_DURATION)){
+        n_samples_from_last_on_edge  = 0;
+    }
+    else if(n_samples_from_last_on_edge*T > SIGNAL_ON_DURATION){
+        sig_value = 0;
+        n_samples_from_last_on_edge ++;
+    }
+    else 
+        n_samples_from_last_on_edge ++;
+    return sig_value;
+}
+#endif
 
 /*
-  This function feeds synthetic data (square wave) to the receive channel 
-  bypassing actual I2S receiver.
+  This function is called by the capture task through i2s_capture(). It reads a DMA buffer of
+  32bits raw data for both left and right channels from I2S (INMP441: 24 valid bits MSB
+  aligned) into rx_sample_buf, and cancels the offset and the echo there. Returns the number
+  of bytes read.
 */
+uint16_t bsp_i2s_read(void)
+{
+    size_t n_raw_bytes = 0;
+    PROF_BEGIN(PROF_I2S_READ);
+    esp_err_t ret = i2s_channel_read(rx_handle, rx_sample_buf, rx_sample_buflen, &n_raw_bytes, portMAX_DELAY);
+    PROF_END(PROF_I2S_READ);
+    capture_t0 = stats_time_begin();
+    TRACE_BEGIN(TRACE_CAPTURE);
+    if(atomic_exchange(&mic_stats_reset_req, false)) {
+        audio_stats.mic.i2s_reads = 0;
+        audio_stats.mic.i2s_read_errors = 0;
+    }
+    audio_stats.mic.i2s_reads++;
+    if(ret != ESP_OK)
+        audio_stats.mic.i2s_read_errors++;
+    if(latency_mode)
+        latency_tag_capture(rx_sample_buf, n_raw_bytes / 8);
+    uint32_t n_frames = n_raw_bytes / 8;
+
+#ifndef MIC_TEST_SIGNAL
+    PROF_BEGIN(PROF_MIC_DC_BLOCK);
+    decode_and_cancel_offset(rx_sample_buf, n_frames, false);
+    PROF_END(PROF_MIC_DC_BLOCK);
+    bool aec_active = mic_aec_active();
+    mic_aec_poll();
+    if(aec_active) {
+        PROF_BEGIN(PROF_MIC_AEC);
+        mic_aec_process(rx_sample_buf, n_frames);
+        PROF_END(PROF_MIC_AEC);
+    }
+#else
+    for(uint32_t i = 0; i < n_frames; i++){
+        rx_sample_buf[2*i] = rx_sample_buf[2*i+1] = (int32_t)mic_test_signal_next() << 16;
+    }
+#endif
+    return n_raw_bytes;
+}
 
-uint16_t bsp_i2s_read(void *data_buf, uint16_t count /* bytes*/)
+/*
+  The mic gain of a block of n_frames in rx_sample_buf and its copy into mic_ring, in the
+  format of the open alternate setting. 16 bit: the gain kernel converts straight into the
+  free space of the ring, so the conversion is the copy. 24 bit: the slots already are in
+  the format of the IN packets; the gain works on them in place and they are copied in.
+  Frames that do not fit are counted as overrun.
+*/
+static void mic_ring_put(uint32_t n_frames, uint8_t sample_bytes)
 {
-    int16_t *out_buf = (int16_t*)data_buf;
+    uint32_t const frame_bytes = CFG_TUD_AUDIO_FUNC_1_N_CHANNELS_TX * sample_bytes;
+
+    PROF_BEGIN(PROF_MIC_GAIN);
+    gain_ramp_update(&mic_ramp, mic_params.mic_gain);
+    if(sample_bytes == 4) {
+        pcm24_gain_ramp(rx_sample_buf, n_frames, &mic_ramp);
+        PROF_END(PROF_MIC_GAIN);
+        PROF_BEGIN(PROF_MIC_RING_WRITE);
+        audio_ring_write(&mic_ring, rx_sample_buf, n_frames * frame_bytes);
+        PROF_END(PROF_MIC_RING_WRITE);
+        return;
+    }
+    audio_ring_info_t info;
+    audio_ring_get_write_info(&mic_ring, &info);
+    // the ring and its free space are in whole frames: the regions are too
+    uint32_t n_lin  = info.len_lin / frame_bytes < n_frames ? info.len_lin / frame_bytes : n_frames;
+    uint32_t n_wrap = info.len_wrap / frame_bytes < n_frames - n_lin ? info.len_wrap / frame_bytes : n_frames - n_lin;
+    mic_convert_gain_ramp(rx_sample_buf, (int16_t*)info.ptr_lin, n_lin, &mic_ramp);
+    mic_convert_gain_ramp(rx_sample_buf + 2 * n_lin, (int16_t*)info.ptr_wrap, n_wrap, &mic_ramp);
+    audio_ring_advance_write(&mic_ring, (n_lin + n_wrap) * frame_bytes, n_frames * frame_bytes);
+    PROF_END(PROF_MIC_GAIN);
+}
 
-    int32_t T = getPeriod(sampFreq);
-    static int16_t sig_value = 16000;
-    static int n_samples_from_last_edge = 0;
-    static uint32_t n_samples_from_last_on_edge = 0;
-    for(int i = 0; i < count/4; i++){ /* each frame has 4 bytes*/
-        if(n_samples_from_last_edge*T > SIGNAL_HALF_PERIOD) {
-            sig_value = sig_value == 200 ? -200 : 200;
-            n_samples_from_last_edge = 0;
-        }
-        else
-            n_samples_from_last_edge ++;
+/*
+  One pass of the capture task: waits for the next DMA buffer from I2S and puts its
+  frames into mic_ring, in the format of the open mic alternate setting. Returns the
+  number of bytes captured.
+*/
+uint16_t i2s_capture(void)
+{
+    uint8_t sample_bytes = mic_sample_bytes;
+    uint16_t n_raw_bytes;
+
+    audio_params_read(&audio_params, &mic_params);
+    xSemaphoreTake(i2s_rx_mutex, portMAX_DELAY);
+    n_raw_bytes = bsp_i2s_read();
+    xSemaphoreGive(i2s_rx_mutex);
+    uint32_t n_frames = n_raw_bytes / 8;
+
+    // a block converted for the format the mic was open with before mic_ring_restart()
+    // would put frames of the wrong size into the ring; the restart dropped the old data anyway.
+    // In the digital loopback the ring is the speaker's: the block is read to keep the DMA
+    // going and dropped. Both are checked after the read, before the ring is touched.
+    if(sample_bytes == mic_sample_bytes && !audio_loopback)
+        mic_ring_put(n_frames, sample_bytes);
+    i2s_rx_captured_frames += n_frames;
+    // frames the DMA overwrote before they were read never come: catch up with the clock
+    if(i2s_rx_clock.frames - i2s_rx_captured_frames > I2S_DMA_DESC_NUM * i2s_rx_clock.buf_frames)
+        i2s_rx_captured_frames = i2s_rx_clock.frames;
+    uint16_t n_bytes = n_frames * CFG_TUD_AUDIO_FUNC_1_N_CHANNELS_TX * sample_bytes;
+    TRACE_END(TRACE_CAPTURE, n_bytes);
+    stats_time_end(STATS_CAPTURE, capture_t0);
+    return n_bytes;
+}
 
-        if(n_samples_from_last_on_edge*T > (SIGNAL_ON_DURATION + SIGNAL_OFF_DURATION)){
-            n_samples_from_last_on_edge  = 0;
-        }
-        else if(n_samples_from_last_on_edge*T > SIGNAL_ON_DURATION){
-            sig_value = 0;
-            n_samples_from_last_on_edge ++;
-        }
-        else 
-            n_samples_from_last_on_edge ++;
+/*
+  Capture task; pinned to the core not running the tinyusb task so that waiting
+  for I2S DMA never holds up the USB stack.
+*/
+void i2s_capture_task(void *param)
+{
+    (void) param;
+    while(1) {
+        i2s_capture();
+    }
+    vTaskDelete(NULL);
+}
 
-        *out_buf = sig_value;
-        out_buf++;
-        *out_buf = sig_value; /*for stereo */
-        out_buf++;
+/*
+  Consumer side of mic_ring; usb_get_data points here so it is called from
+  tud_audio_tx_done_post_load_cb() in the tinyusb task. The packet is read out of the ring
+  straight into the free space of the EP IN FIFO, fifo as tu_fifo_get_write_info() gives it:
+  its linear part and the part that wraps to the start of the FIFO. The caller advances the
+  FIFO's write pointer by the packet. mic_pkt_sched sizes the packet: the nominal frames of this USB frame (44 or 45 at
+  44.1kHz), one frame more or less to keep the ring fill where it settled, whichever of
+  the I2S and USB clocks is faster. It never blocks: if the ring does not have the packet
+  the rest of it is filled with silence. Returns the size of the packet in bytes.
+*/
+uint16_t mic_ring_get_data(const tu_fifo_buffer_info_t *fifo)
+{
+    uint16_t const count = fifo->len_lin + fifo->len_wrap;
+    uint16_t n_bytes = 0;
+    uint16_t packet;
+
+    // the ring takes a whole DMA buffer at a time: count the frames the I2S has clocked in
+    // that are not in it yet as well, or the fill would jump by a buffer whenever the DMA
+    // and the USB frames slide past each other
+    // and the loopback has no frames on their way: the playback task writes whole packets
+    uint32_t pending = audio_loopback ? 0 : ((i2s_dma_clock_position(&i2s_rx_clock) >> 16) - i2s_rx_captured_frames) & 0xffff;
+    uint32_t fill;
+
+    if(mic_ring_reprime) {
+        mic_ring_reprime = false;
+        mic_ring_primed = false;
+        audio_ring_flush(&mic_ring);
     }
-    return count;
+    fill = audio_ring_count(&mic_ring) / MIC_FRAME_BYTES + pending;
 
+    if(!mic_ring_primed) {
+        if(fill >= MIC_RING_START_MS * (sampFreq / 1000) + MIC_RING_START_FRAMES) {
+            mic_ring_primed = true;
+        }
+    }
+    if(mic_ring_primed) {
+        packet = mic_pkt_sched_next(&mic_pkt_sched, fill) * MIC_FRAME_BYTES;
+    }
+    else {
+        // silence at the nominal rate till the ring is primed
+        packet = frame_pacer_next(&mic_pkt_sched.pacer) * MIC_FRAME_BYTES;
+        audio_stats.mic.silent_packets++;
+    }
+    if(packet > count) packet = count;
+    if(mic_ring_primed)
+        n_bytes = audio_ring_read_split(&mic_ring, fifo->ptr_lin, fifo->len_lin, fifo->ptr_wrap, packet);
+    if(n_bytes < packet) {
+        uint16_t n_lin = fifo->len_lin;
+        if(n_bytes < n_lin)
+            memset((uint8_t*)fifo->ptr_lin + n_bytes, 0, (packet < n_lin ? packet : n_lin) - n_bytes);
+        if(packet > n_lin)
+            memset((uint8_t*)fifo->ptr_wrap + (n_bytes > n_lin ? n_bytes - n_lin : 0), 0,
+                   packet - (n_bytes > n_lin ? n_bytes : n_lin));
+    }
+    return packet;
 }
 
 /*
-  This function formats the data (16 bits to MSB aligned 32 bits etc..) using a local buffer
-  tx_sample_buf and writes to the I2S DMA buffer to be sent out over I2S.
+  Called when the mic interface is opened: drops stale data and waits for
+  MIC_RING_START_MS of fresh data before USB IN starts reading the ring. The packet
+  sizing starts over; it counts USB frames from the first (silent) packet on.
+  n_bytes_per_sample is that of the alternate setting: the capture task puts 16 bit
+  samples (2) or the 32bit slots (4) into the ring from the next DMA buffer on.
+*/
+void mic_ring_restart(uint8_t n_bytes_per_sample)
+{
+    mic_ring_primed = false;
+    mic_sample_bytes = n_bytes_per_sample;
+    audio_ring_flush(&mic_ring);
+    mic_pkt_sched_init(&mic_pkt_sched, sampFreq, MIC_PKT_AVG_SHIFT);
+    audio_ring_reset_stats(&mic_ring);
+    audio_stats.mic.packets = 0;
+    audio_stats.mic.silent_packets = 0;
+    audio_stats.mic.i2s_overruns_base = audio_stats.mic.i2s_overruns;
+    atomic_store(&mic_stats_reset_req, true);
+}
+
+/*
+  This function formats the data (16 bits to MSB aligned 32 bits, times the speaker gain) using a
+  local buffer tx_sample_buf and writes to the I2S DMA buffer to be sent out over I2S.
+  24 bit data is already in 32bit slots: spk_jb_transmit() reads it straight into
+  tx_sample_buf and data_buf is tx_sample_buf itself, where the gain is applied in place.
+  The jitter buffer only writes what the DMA has room for, so i2s_channel_write() does not
+  have to wait for a free DMA buffer; whatever does not fit within SPK_WRITE_TIMEOUT_MS all
+  the same is dropped and counted.
 */
 void bsp_i2s_write(void *data_buf, uint16_t n_bytes){
 
-    /* each sample is 32bits and there are 2 channels; so an EP buffer of CFG_TUD_AUDIO_FUNC_1_EP_OUT_SW_BUF_SZ (N) 
-     * bytes (each data is 16bits) will produce (N/2)*2=N 32bits total o/p samples for L+R  
-     */
+    uint32_t t0 = stats_time_begin();
+    TRACE_BEGIN(TRACE_PLAYBACK);
+    uint8_t sample_bytes = spk_sample_bytes;
+    uint32_t n_frames = n_bytes / (CFG_TUD_AUDIO_FUNC_1_N_CHANNELS_RX * sample_bytes);
+    if(n_frames > sizeof(tx_sample_buf) / 8) n_frames = sizeof(tx_sample_buf) / 8;
 
+    PROF_BEGIN(PROF_SPK_GAIN);
+    gain_ramp_update(&spk_ramp, spk_params.spk_gain);
+    if(sample_bytes == 4) {
+        pcm24_gain_ramp((int32_t*)data_buf, n_frames, &spk_ramp);
+    }
+    else {
+        /* each sample is 32bits and there are 2 channels; so an EP buffer of CFG_TUD_AUDIO_FUNC_1_EP_OUT_SW_BUF_SZ (N)
+         * bytes (each data is 16bits) will produce (N/2)*2=N 32bits total o/p samples for L+R
+         */
+        spk_convert_gain_ramp((const int16_t*)data_buf, tx_sample_buf, n_frames, &spk_ramp);
+    }
+    PROF_END(PROF_SPK_GAIN);
+
+    TRACE_END(TRACE_PLAYBACK, n_bytes);
+    stats_time_end(STATS_PLAYBACK, t0);
+    // Total number of bytes in tx_sample_buf is n_frames*8 for both formats
+    size_t n_written = 0;
+    xSemaphoreTake(i2s_tx_mutex, portMAX_DELAY);
+    PROF_BEGIN(PROF_I2S_WRITE);
+    i2s_channel_write(tx_handle, tx_sample_buf, n_frames * 8, &n_written, SPK_WRITE_TIMEOUT_MS);
+    PROF_END(PROF_I2S_WRITE);
+    i2s_tx_written += n_written / 8;
+    if(mic_aec_active())
+        mic_aec_reference(tx_sample_buf, n_written / 8);
+    xSemaphoreGive(i2s_tx_mutex);
+    if(latency_mode)
+        latency_tag_playback(tx_sample_buf, n_written / 8);
+
+    uint32_t n_played = n_written / 8 * CFG_TUD_AUDIO_FUNC_1_N_CHANNELS_RX * sample_bytes;
+    spk_stats.played_bytes += n_played;
+    spk_stats.dropped_bytes += n_bytes - n_played;
+}
 
-    // USE i2s_channel_write() to copy the buffer to TX DMA buffers
-    // Total number of bytes in tx_sample_buf is n_bytes*2 since each 16bit sample in 
-    // data_buf made into a 32bit value.
+/*
+  The digital loopback's bsp_i2s_write(): puts a block of speaker data into mic_ring in the
+  format of the open mic alternate setting, the samples as the host sent them, without the
+  gains. The 16 bit format goes to 32bit slots MSB aligned and back by its top 16 bits, so
+  the host gets back exactly what it sent when both directions use the same format. What
+  does not fit into the ring (the mic is closed, or the host does not read it) is dropped.
+*/
+static void loopback_write(const void *data_buf, uint16_t n_bytes)
+{
+    static int32_t lb_buf[CFG_TUD_AUDIO_FUNC_1_EP_OUT_SW_BUF_SZ/2];
+    uint8_t in_bytes = spk_sample_bytes;
+    uint8_t out_bytes = mic_sample_bytes;
+    uint32_t n_samples = n_bytes / in_bytes;
+    const void *frames = data_buf;
+
+    if(n_samples > sizeof(lb_buf) / 4) n_samples = sizeof(lb_buf) / 4;
+    if(in_bytes == 2 && out_bytes == 4) {
+        for(uint32_t i = 0; i < n_samples; i++)
+            lb_buf[i] = (int32_t)((uint32_t)((const int16_t*)data_buf)[i] << 16);
+        frames = lb_buf;
+    }
+    else if(in_bytes == 4 && out_bytes == 2) {
+        for(uint32_t i = 0; i < n_samples; i++)
+            ((int16_t*)lb_buf)[i] = (int16_t)(((const int32_t*)data_buf)[i] >> 16);
+        frames = lb_buf;
+    }
+    PROF_BEGIN(PROF_MIC_RING_WRITE);
+    uint32_t n_played = audio_ring_write(&mic_ring, frames, n_samples * out_bytes) / out_bytes * in_bytes;
+    PROF_END(PROF_MIC_RING_WRITE);
+    spk_stats.played_bytes += n_played;
+    spk_stats.dropped_bytes += n_bytes - n_played;
+}
 
+/*
+  Turns the digital loopback on or off. mic_ring starts over and is primed again with data
+  of the new source; a stream that is open while it switches has a few mS of silence.
+*/
+void audio_loopback_enable(bool on)
+{
+    if(on == audio_loopback)
+        return;
+    audio_loopback = on;
+    mic_ring_reprime = true;
+    ESP_LOGI(TAG, "digital loopback %s", on ? "on" : "off");
+}
+
+// The speaker ran out of data while playing: the DMA plays silence till it is primed again
+static void spk_stall(void)
+{
+    spk_primed = false;
+    spk_stats.stall_count++;
+    trace_event(TRACE_SPK_STALL, spk_stats.stall_count);
+    if(!audio_loopback)
+        jb_underrun(&spk_jb);
 }
 
-/* The following variable is declared in tinyusb stack. Its value indicates the number of
-   bytes present in 1mS frame of the audio data. Its value is set in one of the functions of 
-   the tinyusb stack based on sampling frequency, number of channels (fixed at 2 now) and
-   number of bytes in each audio sample (fixed at 2 now). Each call of tud_audio_read() 
-   requests 's_spk_bytes_ms' bytes from the USB. 
+// Frames queued in the I2S TX DMA, of those written to it
+static uint32_t i2s_tx_queued(void)
+{
+    int32_t queued = (int32_t)(i2s_tx_written - i2s_tx_clock.frames);
+    return queued > 0 ? (uint32_t)queued : 0;
+}
+
+/*
+  Moves the EP OUT FIFO into spk_jb_ring and as much of the ring into the I2S DMA as the DMA
+  has room for, a DMA buffer at a time: each block through jb_steer(), which may have it
+  played one frame longer or shorter to keep the depth on the target. Playback (re)starts
+  once the ring holds the target depth; the DMA having sent all that was written to it while
+  playing is an underrun. Returns the number of bytes taken from the FIFO.
 */
-extern size_t s_spk_bytes_ms;
+static uint32_t spk_jb_transmit(void)
+{
+    uint8_t const sample_bytes = spk_sample_bytes;
+    uint32_t const frame_bytes = CFG_TUD_AUDIO_FUNC_1_N_CHANNELS_RX * sample_bytes;
+    uint32_t n_bytes = 0;
+    uint16_t n;
+
+    if(spk_jb_restart || spk_params.sample_rate != spk_jb.sample_rate) {
+        spk_jb_restart = false;
+        spk_jb_new_profile = false;
+        spk_primed = false;
+        audio_ring_flush(&spk_jb_ring);
+        jb_init(&spk_jb, spk_params.sample_rate, spk_jb_profile);
+    }
+    if(spk_jb_new_profile) {
+        spk_jb_new_profile = false;
+        jb_set_profile(&spk_jb, spk_jb_profile);
+    }
+
+    stats_range_add(&audio_stats.spk.fifo_bytes, tud_audio_available());
+    while((n = usb_read_data(data_out_buf, spk_params.spk_bytes_ms)) != 0) {
+        spk_stats.dropped_bytes += n - audio_ring_write(&spk_jb_ring, data_out_buf, n);
+        n_bytes += n;
+    }
+
+    // the DMA went past the frames written to it and has been sending silence since
+    uint32_t const clocked = i2s_tx_clock.frames;
+    if((int32_t)(clocked - i2s_tx_written) > 0) {
+        i2s_tx_written = clocked;
+        if(spk_primed)
+            spk_stall();
+    }
+    if(!spk_primed) {
+        if(audio_ring_count(&spk_jb_ring) / frame_bytes < jb_target_frames(&spk_jb))
+            return n_bytes;
+        spk_primed = true;
+        jb_start(&spk_jb, audio_ring_count(&spk_jb_ring) / frame_bytes + i2s_tx_queued());
+    }
+
+    // 24 bit data is played from tx_sample_buf, where bsp_i2s_write() applies the gain in place
+    void *buf = sample_bytes == 4 ? (void*)tx_sample_buf : (void*)data_out_buf;
+    uint32_t const buf_frames = i2s_tx_clock.buf_frames;
+    uint32_t const capacity = I2S_DMA_DESC_NUM * buf_frames;
+    uint32_t queued, in_ring;
+    while((queued = i2s_tx_queued()) < capacity &&
+          (in_ring = audio_ring_count(&spk_jb_ring) / frame_bytes) != 0) {
+        uint32_t n_out = capacity - queued < buf_frames ? capacity - queued : buf_frames;
+        int delta = jb_steer(&spk_jb, in_ring + queued, n_out);
+        uint32_t n_in = n_out - delta < in_ring ? n_out - delta : in_ring;
+        if(delta == 0) {
+            n_out = audio_ring_read(&spk_jb_ring, buf, n_in * frame_bytes) / frame_bytes;
+        }
+        else {
+            PROF_BEGIN(PROF_SPK_JB_STRETCH);
+            audio_ring_read(&spk_jb_ring, spk_jb_block, n_in * frame_bytes);
+            if(sample_bytes == 4)
+                n_out = jb_stretch_pcm32(spk_jb_block, buf, n_in, delta);
+            else
+                n_out = jb_stretch_pcm16((const int16_t*)spk_jb_block, buf, n_in, delta);
+            PROF_END(PROF_SPK_JB_STRETCH);
+        }
+        bsp_i2s_write(buf, n_out * frame_bytes);
+        audio_params_read(&audio_params, &spk_params);
+    }
+    return n_bytes;
+}
+
+/*
+  One pass of the playback task: waits up to wait_ms for tud_audio_rx_done_post_read_cb()
+  to signal new data in the EP OUT FIFO, or the TX DMA callback a free DMA buffer, and
+  moves the data on through the jitter buffer (spk_jb_transmit()). In the digital loopback
+  it goes to mic_ring a 1mS block at a time once the FIFO holds SPK_START_MS of it. If
+  nothing happens in wait_ms the stream has stalled: the DMA plays silence by itself
+  (auto_clear) and the next data is primed again instead of being played out as it trickles in.
+  spk_params.spk_bytes_ms, the bytes in a 1mS block, follows the sampling frequency, number
+  of channels (fixed at 2 now) and number of bytes in each audio sample (2 or 4, by the
+  alternate setting). Returns the number of bytes taken from the FIFO.
+*/
+uint32_t i2s_transmit(uint32_t wait_ms) {
+    uint32_t n_bytes = 0;
+    uint32_t const notified = ulTaskNotifyTake(pdTRUE, pdMS_TO_TICKS(wait_ms));
+
+    if(atomic_exchange(&spk_stats_reset_req, false)) {
+        memset(&audio_stats.spk.fifo_bytes, 0, sizeof(audio_stats.spk.fifo_bytes));
+        spk_stats.played_bytes = 0;
+        spk_stats.dropped_bytes = 0;
+        spk_stats.stall_count = 0;
+    }
+    if(notified == 0) {
+        if(spk_primed)
+            spk_stall();
+        return 0;
+    }
+
+    audio_params_read(&audio_params, &spk_params);
+    if(!audio_loopback)
+        return spk_jb_transmit();
+
+    if(!spk_jb_restart) {
+        // the jitter buffer starts over when the loopback ends
+        spk_jb_restart = true;
+        spk_primed = false;
+    }
+    if(!spk_primed) {
+        if(tud_audio_available() < SPK_START_MS * spk_params.spk_bytes_ms)
+            return 0;
+        spk_primed = true;
+    }
+    stats_range_add(&audio_stats.spk.fifo_bytes, tud_audio_available());
+
+    uint16_t n;
+    while((n = usb_read_data(data_out_buf, spk_params.spk_bytes_ms)) != 0) {
+        loopback_write(data_out_buf, n);
+        n_bytes += n;
+        audio_params_read(&audio_params, &spk_params);
+    }
+    return n_bytes;
+}
 
-/* We get s_spk_bytes_ms bytes from our data generator every time; which good for 1mS
+/*
+  Sets the profile of the speaker's jitter buffer, also for the streams opened after; the
+  playback task moves the target at its next pass.
 */
+void spk_jb_set_profile(jb_profile_t profile)
+{
+    spk_jb_profile = profile;
+    spk_jb_new_profile = true;
+    ESP_LOGI(TAG, "jitter buffer profile %s", jb_profiles[profile].name);
+}
 
-void i2s_transmit() {
-    // READ s_spk_bytes_ms by calling bsp_i2s_read() which provides synthetic data for now
+/*
+  Playback task; sleeps till the USB stack has received speaker data.
+*/
+void i2s_playback_task(void *param)
+{
+    (void) param;
+    while(1) {
+        i2s_transmit(SPK_WAIT_MS);
+    }
+    vTaskDelete(NULL);
+}
+
+/*
+  Position of the I2S TX clock in frames, 16.16, wrapping at 2^16 frames. Called from the
+  SOF interrupt for the speaker feedback.
+*/
+uint32_t i2s_tx_position(void)
+{
+    return i2s_dma_clock_position(&i2s_tx_clock);
+}
 
-    // USE bsp_i2s_write() to format 16bits to 32bits and send to DMA
-}
\ No newline at end of file
+/*
+  Called when the speaker interface is opened: the next data is primed before it is played.
+  n_bytes_per_sample is that of the alternate setting (2: 16 bit, 4: 24 bit in 32bit slots).
+*/
+void spk_playback_restart(uint8_t n_bytes_per_sample)
+{
+    spk_primed = false;
+    spk_jb_restart = true;
+    spk_sample_bytes = n_bytes_per_sample;
+    audio_stats.spk.packets = 0;
+    audio_stats.spk.short_packets = 0;
+    memset(&audio_stats.spk.packet_bytes, 0, sizeof(audio_stats.spk.packet_bytes));
+    audio_stats.spk.i2s_underruns_base = audio_stats.spk.i2s_underruns;
+    atomic_store(&spk_stats_reset_req, true);
+}
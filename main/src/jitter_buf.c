@@ -0,0 +1,213 @@
+// jitter_buf.c
+#include <string.h>
+#include <inttypes.h>
+#include "jitter_buf.h"
+
+const jb_profile_params_t jb_profiles[JB_N_PROFILES] = {
+    //                                start min max stable_ms
+    [JB_LOW_LATENCY] = { "low_latency",  2,  2,  6,  2000 },
+    [JB_BALANCED]    = { "balanced",     4,  3, 10, 10000 },
+    [JB_ROBUST]      = { "robust",      10,  6, 20, 30000 },
+};
+
+static const char *const event_names[] = { "underrun", "stable", "profile" };
+
+static uint32_t jb_now_ms(const jitter_buf_t *jb)
+{
+    return (uint32_t)(jb->frames * 1000 / jb->sample_rate);
+}
+
+static void jb_set_target(jitter_buf_t *jb, uint32_t target_ms, uint8_t reason)
+{
+    jb_event_t *e = &jb->history[jb->n_events++ % JB_HISTORY];
+    e->t_ms = jb_now_ms(jb);
+    e->reason = reason;
+    e->from_ms = (uint8_t)jb->target_ms;
+    e->to_ms = (uint8_t)target_ms;
+    jb->target_ms = target_ms;
+    jb->stable_since_ms = e->t_ms;
+    jb->low_water = UINT32_MAX;
+}
+
+// Starts over at the profile's start target for a stream of sample_rate, counters and history cleared
+void jb_init(jitter_buf_t *jb, uint32_t sample_rate, jb_profile_t profile)
+{
+    memset(jb, 0, sizeof(*jb));
+    jb->profile = profile;
+    jb->sample_rate = sample_rate ? sample_rate : 1000;
+    jb->frames_ms = jb->sample_rate / 1000;
+    jb->target_ms = jb_profiles[profile].start_ms;
+    jb->low_water = UINT32_MAX;
+    jb->depth_min = UINT32_MAX;
+}
+
+// A new profile takes effect at once: the target moves to its start and is steered to from where the depth is
+void jb_set_profile(jitter_buf_t *jb, jb_profile_t profile)
+{
+    jb->profile = profile;
+    jb_set_target(jb, jb_profiles[profile].start_ms, JB_EVENT_PROFILE);
+}
+
+uint32_t jb_target_frames(const jitter_buf_t *jb)
+{
+    return jb->target_ms * jb->sample_rate / 1000;
+}
+
+void jb_start(jitter_buf_t *jb, uint32_t depth)
+{
+    jb->avg_q = (int32_t)(depth << JB_AVG_SHIFT);
+    jb->pending_q = 0;
+    jb->warp_frames = 0;
+}
+
+void jb_underrun(jitter_buf_t *jb)
+{
+    const jb_profile_params_t *p = &jb_profiles[jb->profile];
+    uint32_t target = jb->target_ms + JB_GROW_MS;
+
+    jb->underruns++;
+    // the last step down was one too many: the next one waits twice as long
+    if(jb->n_events && jb->history[(jb->n_events - 1) % JB_HISTORY].reason == JB_EVENT_STABLE &&
+       jb->backoff < JB_BACKOFF_MAX)
+        jb->backoff++;
+    if(target > p->max_ms) target = p->max_ms;
+    if(target != jb->target_ms) jb->grows++;
+    jb_set_target(jb, target, JB_EVENT_UNDERRUN);
+}
+
+/*
+  The depth is averaged over the last blocks so that the packets coming in and the DMA
+  buffers going out do not count as a change of it; pending_q follows what an insertion or
+  deletion will do to the average once it has gone through it, so that the next step is
+  not taken on an average that does not show the last one yet. Outside of half a mS around
+  the target one frame goes in or out.
+*/
+int jb_steer(jitter_buf_t *jb, uint32_t depth, uint32_t n_frames)
+{
+    const jb_profile_params_t *p = &jb_profiles[jb->profile];
+    int delta = 0;
+
+    if(depth < jb->depth_min) jb->depth_min = depth;
+    if(depth > jb->depth_max) jb->depth_max = depth;
+    if(depth < jb->low_water) jb->low_water = depth;
+    jb->frames += n_frames;
+
+    // stable: the target comes down if the depth never went below what is taken off plus a mS
+    uint32_t now = jb_now_ms(jb);
+    if(now - jb->stable_since_ms >= p->stable_ms << jb->backoff) {
+        if(jb->target_ms > p->min_ms && jb->low_water >= (JB_SHRINK_MS + 1) * jb->frames_ms) {
+            uint32_t target = jb->target_ms > p->min_ms + JB_SHRINK_MS ? jb->target_ms - JB_SHRINK_MS : p->min_ms;
+            jb->shrinks++;
+            jb_set_target(jb, target, JB_EVENT_STABLE);
+        }
+        else {
+            jb->stable_since_ms = now;
+            jb->low_water = UINT32_MAX;
+        }
+    }
+
+    jb->avg_q += ((int32_t)(depth << JB_AVG_SHIFT) - jb->avg_q) >> JB_AVG_SHIFT;
+    jb->pending_q -= jb->pending_q / (1 << JB_AVG_SHIFT);
+    jb->warp_frames += n_frames;
+    if(jb->warp_frames >= JB_WARP_FRAMES) {
+        int32_t err = jb->avg_q + jb->pending_q - (int32_t)(jb_target_frames(jb) << JB_AVG_SHIFT);
+        int32_t tol = (int32_t)(jb->frames_ms << JB_AVG_SHIFT) / 2;
+        if(err < -tol) {
+            delta = 1;
+            jb->inserted++;
+        }
+        else if(err > tol) {
+            delta = -1;
+            jb->deleted++;
+        }
+        if(delta) {
+            jb->warp_frames = 0;
+            jb->pending_q += delta << JB_AVG_SHIFT;
+        }
+    }
+    return delta;
+}
+
+/*
+  Frame i of out is in[i] crossfaded into in[i - 1] (insertion) or in[i + 1] (deletion) by
+  i / (n_out - 1): the block starts on in[0] and ends on in[n_frames - 1], so it joins the
+  blocks around it, and the frame that goes in or out is spread over the whole block.
+  Blocks too short to fade over repeat or drop their last frame.
+*/
+// Frame i of out: in[p] faded into in[q] by a, 0.16
+static inline void jb_stretch_frame(uint32_t i, uint32_t n_frames, uint32_t n_out, int delta,
+                                    uint32_t *p, uint32_t *q, int64_t *a)
+{
+    *p = i < n_frames ? i : n_frames - 1;
+    if(delta == 0 || n_out < 2 || n_frames < 2) {
+        *q = *p;
+        *a = 0;
+        return;
+    }
+    *q = delta > 0 ? (i ? i - 1 : 0) : i + 1;
+    *a = (int64_t)(((uint64_t)i << 16) / (n_out - 1));
+}
+
+uint32_t jb_stretch_pcm16(const int16_t *in, int16_t *out, uint32_t n_frames, int delta)
+{
+    if(n_frames == 0) return 0;
+    uint32_t const n_out = n_frames + delta;
+    for(uint32_t i = 0; i < n_out; i++) {
+        uint32_t p, q;
+        int64_t a;
+        jb_stretch_frame(i, n_frames, n_out, delta, &p, &q, &a);
+        for(int c = 0; c < 2; c++) {
+            int64_t x = in[2 * p + c], y = in[2 * q + c];
+            out[2 * i + c] = (int16_t)(x + (((y - x) * a) >> 16));
+        }
+    }
+    return n_out;
+}
+
+// 24 bit samples MSB aligned in 32bit slots: the pad byte stays clear
+uint32_t jb_stretch_pcm32(const int32_t *in, int32_t *out, uint32_t n_frames, int delta)
+{
+    if(n_frames == 0) return 0;
+    uint32_t const n_out = n_frames + delta;
+    for(uint32_t i = 0; i < n_out; i++) {
+        uint32_t p, q;
+        int64_t a;
+        jb_stretch_frame(i, n_frames, n_out, delta, &p, &q, &a);
+        for(int c = 0; c < 2; c++) {
+            int64_t x = in[2 * p + c], y = in[2 * q + c];
+            out[2 * i + c] = (int32_t)(x + (((y - x) * a) >> 16)) & ~0xff;
+        }
+    }
+    return n_out;
+}
+
+void jb_print(const jitter_buf_t *jb, FILE *out)
+{
+    fprintf(out, "jitter %s target %" PRIu32 " ms  depth %" PRIu32 "..%" PRIu32 " frames (avg %" PRIu32 ")"
+            "  underruns %" PRIu32 "  grown %" PRIu32 "  shrunk %" PRIu32 "  inserted %" PRIu32 "  deleted %" PRIu32 "\n",
+            jb_profiles[jb->profile].name, jb->target_ms, jb->depth_min == UINT32_MAX ? 0 : jb->depth_min,
+            jb->depth_max, (uint32_t)(jb->avg_q >> JB_AVG_SHIFT), jb->underruns, jb->grows, jb->shrinks,
+            jb->inserted, jb->deleted);
+    uint32_t first = jb->n_events > JB_HISTORY ? jb->n_events - JB_HISTORY : 0;
+    for(uint32_t i = first; i < jb->n_events; i++) {
+        const jb_event_t *e = &jb->history[i % JB_HISTORY];
+        fprintf(out, "jitter %10" PRIu32 " ms  %-8s %u -> %u ms\n", e->t_ms, event_names[e->reason], e->from_ms, e->to_ms);
+    }
+}
+
+void jb_print_json(const jitter_buf_t *jb, FILE *out)
+{
+    fprintf(out, "{\"profile\":\"%s\",\"target_ms\":%" PRIu32 ",\"depth_frames\":{\"min\":%" PRIu32 ",\"avg\":%" PRIu32
+            ",\"max\":%" PRIu32 "},\"underruns\":%" PRIu32 ",\"grows\":%" PRIu32 ",\"shrinks\":%" PRIu32 ","
+            "\"inserted\":%" PRIu32 ",\"deleted\":%" PRIu32 ",\"history\":[",
+            jb_profiles[jb->profile].name, jb->target_ms, jb->depth_min == UINT32_MAX ? 0 : jb->depth_min,
+            (uint32_t)(jb->avg_q >> JB_AVG_SHIFT), jb->depth_max, jb->underruns, jb->grows, jb->shrinks,
+            jb->inserted, jb->deleted);
+    uint32_t first = jb->n_events > JB_HISTORY ? jb->n_events - JB_HISTORY : 0;
+    for(uint32_t i = first; i < jb->n_events; i++) {
+        const jb_event_t *e = &jb->history[i % JB_HISTORY];
+        fprintf(out, "%s{\"t_ms\":%" PRIu32 ",\"reason\":\"%s\",\"from_ms\":%u,\"to_ms\":%u}",
+                i == first ? "" : ",", e->t_ms, event_names[e->reason], e->from_ms, e->to_ms);
+    }
+    fprintf(out, "]}");
+}
@@ -0,0 +1,132 @@
+// latency.c
+#include <string.h>
+#include <inttypes.h>
+#include <math.h>
+#include "esp_timer.h"
+#include "tusb_config.h"
+#include "i2s_functions.h"
+#include "latency.h"
+
+extern uint32_t sampFreq;
+
+volatile bool latency_mode = false;
+latency_stats_t latency_stats;
+
+/* marker detector of one side: frames of the left channel below the threshold in a row */
+typedef struct {
+    uint32_t quiet_frames;
+} latency_detector_t;
+
+static latency_detector_t playback_detector;
+static latency_detector_t capture_detector;
+
+/* time the last marker went into the DMA queue; set by the playback task, taken by the capture task */
+static volatile int64_t marker_out_us;
+static volatile bool marker_pending = false;
+
+/* Index of the first marker frame in a block of stereo 32bit slots, -1 if there is none */
+static int32_t find_marker(latency_detector_t *d, const int32_t *slots, uint32_t n_frames)
+{
+    uint32_t quiet = LATENCY_QUIET_MS * (sampFreq / 1000);
+    int32_t found = -1;
+
+    for(uint32_t i = 0; i < n_frames; i++) {
+        int32_t v = slots[2 * i];
+        if(v < LATENCY_THRESHOLD && v > -LATENCY_THRESHOLD) {
+            d->quiet_frames++;
+            continue;
+        }
+        if(found < 0 && d->quiet_frames >= quiet)
+            found = i;
+        d->quiet_frames = 0;
+    }
+    return found;
+}
+
+static int64_t frame_time_us(int64_t block_us, int32_t frame)
+{
+    return block_us + (int64_t)frame * 1000000 / sampFreq;
+}
+
+// Starts or stops the measurement; starting clears the results
+void latency_enable(bool on)
+{
+    if(on) latency_reset();
+    latency_mode = on;
+}
+
+void latency_reset(void)
+{
+    memset(&latency_stats, 0, sizeof(latency_stats));
+    memset(&playback_detector, 0, sizeof(playback_detector));
+    memset(&capture_detector, 0, sizeof(capture_detector));
+    marker_pending = false;
+}
+
+/*
+  Playback task, after a block of slots went into the DMA queue: a marker in it starts a
+  measurement. One still waiting for its way back is given up.
+*/
+void latency_tag_playback(const int32_t *slots, uint32_t n_frames)
+{
+    int64_t now = esp_timer_get_time();
+    int32_t frame = find_marker(&playback_detector, slots, n_frames);
+
+    if(frame < 0) {
+        if(marker_pending && now - marker_out_us > LATENCY_TIMEOUT_MS * 1000) {
+            marker_pending = false;
+            latency_stats.lost++;
+        }
+        return;
+    }
+    if(marker_pending)
+        latency_stats.lost++;
+    marker_out_us = frame_time_us(now, frame);
+    marker_pending = true;
+}
+
+/*
+  Capture task, after a block of raw slots came out of the DMA: a marker in it ends the
+  measurement of the one played last.
+*/
+void latency_tag_capture(const int32_t *slots, uint32_t n_frames)
+{
+    int64_t now = esp_timer_get_time();
+    int32_t frame = find_marker(&capture_detector, slots, n_frames);
+
+    if(frame < 0)
+        return;
+    if(!marker_pending) {
+        latency_stats.unmatched++;
+        return;
+    }
+    int32_t us = (int32_t)(frame_time_us(now, frame) - marker_out_us);
+    marker_pending = false;
+
+    latency_stats_t *s = &latency_stats;
+    if(s->n == 0 || us < s->min_us) s->min_us = us;
+    if(s->n == 0 || us > s->max_us) s->max_us = us;
+    s->last_us = us;
+    s->sum_us += us;
+    s->sum_sq_us += (uint64_t)((int64_t)us * us);
+    s->n++;
+}
+
+/*
+  One line of key=value pairs, for scripts/send_n_receive.py: the sample rate and the
+  buffer configuration it was measured with, then the results in uS. jitter_us is the
+  standard deviation.
+*/
+void latency_print(FILE *out)
+{
+    const latency_stats_t *s = &latency_stats;
+    double avg = s->n ? (double)s->sum_us / s->n : 0.0;
+    double var = s->n ? (double)s->sum_sq_us / s->n - avg * avg : 0.0;
+
+    fprintf(out, "LATENCY %s rate=%" PRIu32 " ep_in_buf_ms=%d ep_out_buf_ms=%d dma_desc_num=%d dma_frame_num=%" PRIu32
+            " n=%" PRIu32 " lost=%" PRIu32 " unmatched=%" PRIu32 " min_us=%" PRId32 " avg_us=%.1f max_us=%" PRId32
+            " jitter_us=%.1f last_us=%" PRId32 "\n",
+            latency_mode ? "on" : "off", sampFreq, CFG_TUD_AUDIO_FUNC_1_EP_IN_SW_BUF_MS,
+            CFG_TUD_AUDIO_FUNC_1_EP_OUT_SW_BUF_MS, I2S_DMA_DESC_NUM, I2S_DMA_FRAME_NUM(sampFreq),
+            s->n, s->lost, s->unmatched, s->min_us, avg, s->max_us, var > 0 ? sqrt(var) : 0.0, s->last_us);
+}
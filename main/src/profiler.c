@@ -0,0 +1,53 @@
+// profiler.c
+#include <string.h>
+#include <inttypes.h>
+#include "esp_timer.h"
+#include "profiler.h"
+
+#ifdef CONFIG_AUDIO_PROFILER
+
+extern uint32_t sampFreq;
+
+prof_stage_t prof_stages[PROF_N_STAGES];
+static int64_t prof_start_us;
+
+static const char *const stage_names[PROF_N_STAGES] = {
+    "i2s_channel_read", "mic_dc_block", "mic_aec", "mic_gain", "mic_ring_write", "mic_fifo_load",
+    "audiod_tx_done_cb", "audiod_rx_done_cb", "tud_audio_read", "spk_jb_stretch", "spk_gain", "i2s_channel_write",
+    "dwc2_isr", "dwc2_rx_packet", "dwc2_tx_packet"
+};
+
+// Clears the stages; the shares of the frame are taken over the time from here on
+void prof_reset(void)
+{
+    memset(prof_stages, 0, sizeof(prof_stages));
+    prof_start_us = esp_timer_get_time();
+}
+
+/*
+  Prints a line per stage: calls, average and longest call in cycles, and the cycles it took
+  per 1mS frame as a share of the cycles of a frame (CONFIG_ESP_DEFAULT_CPU_FREQ_MHZ * 1000).
+  The stages of the tinyusb task and the audio tasks run on different cores; each share is
+  of one core. audiod_tx_done_cb contains mic_fifo_load, the mic_ring read of the packet
+  into the EP IN FIFO, and on the target the I2S stages contain the waits for the DMA.
+  dwc2_isr, the USB interrupt, contains dwc2_rx_packet and dwc2_tx_packet.
+*/
+void prof_print(FILE *out)
+{
+    int64_t elapsed_us = esp_timer_get_time() - prof_start_us;
+    uint64_t frames = elapsed_us / 1000 ? elapsed_us / 1000 : 1;
+    uint32_t frame_cycles = CONFIG_ESP_DEFAULT_CPU_FREQ_MHZ * 1000;
+
+    fprintf(out, "profile at %" PRIu32 " Hz over %" PRIu64 " ms, %" PRIu32 " cycles per 1ms frame\n",
+            sampFreq, frames, frame_cycles);
+    fprintf(out, "  %-18s %10s %10s %10s %10s %8s\n", "stage", "calls", "avg", "max", "per frame", "% frame");
+    for(int i = 0; i < PROF_N_STAGES; i++) {
+        const prof_stage_t *s = &prof_stages[i];
+        uint64_t per_frame = s->cycles / frames;
+        fprintf(out, "  %-18s %10" PRIu32 " %10" PRIu64 " %10" PRIu32 " %10" PRIu64 " %8.3f\n",
+                stage_names[i], s->calls, s->calls ? s->cycles / s->calls : 0, s->max,
+                per_frame, 100.0 * s->cycles / ((double)frames * frame_cycles));
+    }
+}
+
+#endif
@@ -0,0 +1,50 @@
+// trace.c
+#include <inttypes.h>
+#include "trace.h"
+
+#ifdef CONFIG_AUDIO_TRACE
+
+trace_ring_t trace_rings[TRACE_N_CORES];
+volatile bool trace_frozen = false;
+
+#define TRACE_RECORDS_PER_LINE 16
+
+/*
+  Prints the records of each core, oldest first, as lines of hex: "T<core>" and up to
+  TRACE_RECORDS_PER_LINE records of ccount (8 digits), event and arg (4 digits each),
+  between a "TRACE start" line with the cycle counter frequency and a "TRACE end" line.
+  Tracing stops while the rings are printed, so that they are not overwritten under the
+  dump; the events in the meantime are not recorded.
+*/
+void trace_dump(FILE *out)
+{
+    trace_frozen = true;
+    fprintf(out, "TRACE start cpu_mhz=%d cores=%d len=%d\n",
+            CONFIG_ESP_DEFAULT_CPU_FREQ_MHZ, TRACE_N_CORES, CONFIG_AUDIO_TRACE_LEN);
+    for(int core = 0; core < TRACE_N_CORES; core++) {
+        trace_ring_t *ring = &trace_rings[core];
+        uint32_t head = atomic_load_explicit(&ring->head, memory_order_acquire);
+        uint32_t n = head < CONFIG_AUDIO_TRACE_LEN ? head : CONFIG_AUDIO_TRACE_LEN;
+
+        fprintf(out, "TRACE core=%d records=%" PRIu32 " overwritten=%" PRIu32 "\n", core, n, head - n);
+        for(uint32_t i = 0; i < n; i++) {
+            const trace_record_t *rec = &ring->rec[(head - n + i) & (CONFIG_AUDIO_TRACE_LEN - 1)];
+            if(i % TRACE_RECORDS_PER_LINE == 0)
+                fprintf(out, "T%d", core);
+            fprintf(out, " %08" PRIx32 "%04x%04x", rec->ccount, rec->event, rec->arg);
+            if(i % TRACE_RECORDS_PER_LINE == TRACE_RECORDS_PER_LINE - 1 || i == n - 1)
+                fputc('\n', out);
+        }
+    }
+    fprintf(out, "TRACE end\n");
+    trace_frozen = false;
+}
+
+// Empties the rings; the next dump only shows what happened from here on
+void trace_reset(void)
+{
+    for(int core = 0; core < TRACE_N_CORES; core++)
+        atomic_store_explicit(&trace_rings[core].head, 0, memory_order_relaxed);
+}
+
+#endif
@@ -3,6 +3,7 @@
  */
 
 #include <string.h>
+#include <inttypes.h>
 #include <math.h>
 #include <sys/time.h>
 #include "freertos/FreeRTOS.h"
@@ -17,37 +18,45 @@
 #include "i2s_functions.h"
 #include "data_buffers.h"
 #include "utilities.h"
+#include "audio_dsp.h"
+#include "audio_params.h"
+#include "trace.h"
+#include "audio_stats.h"
+#include "profiler.h"
 
-#include "gain_table.h"
 
 #include "blink.h"
   
 
-//#define I2S_EXTERNAL_LOOPBACK
-
 //#define TU_LOG2 printf
 
 static const char *TAG = "uad_callbacks";
 
 extern uint32_t blink_state;
 
-size_t (*usb_get_data)(void *data_buf, size_t count);
+uint16_t (*usb_get_data)(const tu_fifo_buffer_info_t *fifo);
 
 //extern TaskHandle_t spk_task_handle; 
 
 // Speaker and microphone status
 volatile bool s_spk_active = false;
 volatile bool s_mic_active = false;
-// Resolution per format, Note: due to the limitation of the codec, we currently just support one resolution
-const uint8_t spk_resolutions_per_format[CFG_TUD_AUDIO_FUNC_1_N_FORMATS] = {CFG_TUD_AUDIO_FUNC_1_FORMAT_1_RESOLUTION_RX
-                                                                           };
-const uint8_t mic_resolutions_per_format[CFG_TUD_AUDIO_FUNC_1_N_FORMATS] = {CFG_TUD_AUDIO_FUNC_1_FORMAT_1_RESOLUTION_TX
-                                                                           }; 
-
-// Current resolution, update on format change. However we adtertise only 16bit, so its value is always 16btsi
+// Resolution and bytes per sample per format (alternate setting - 1): 16 bit, and 24 bit in 4 byte subslots
+const uint8_t spk_resolutions_per_format[CFG_TUD_AUDIO_FUNC_1_N_FORMATS] = {CFG_TUD_AUDIO_FUNC_1_FORMAT_1_RESOLUTION_RX,
+                                                                            CFG_TUD_AUDIO_FUNC_1_FORMAT_2_RESOLUTION_RX};
+const uint8_t mic_resolutions_per_format[CFG_TUD_AUDIO_FUNC_1_N_FORMATS] = {CFG_TUD_AUDIO_FUNC_1_FORMAT_1_RESOLUTION_TX,
+                                                                            CFG_TUD_AUDIO_FUNC_1_FORMAT_2_RESOLUTION_TX};
+const uint8_t spk_n_bytes_per_format[CFG_TUD_AUDIO_FUNC_1_N_FORMATS] = {CFG_TUD_AUDIO_FUNC_1_FORMAT_1_N_BYTES_PER_SAMPLE_RX,
+                                                                        CFG_TUD_AUDIO_FUNC_1_FORMAT_2_N_BYTES_PER_SAMPLE_RX};
+const uint8_t mic_n_bytes_per_format[CFG_TUD_AUDIO_FUNC_1_N_FORMATS] = {CFG_TUD_AUDIO_FUNC_1_FORMAT_1_N_BYTES_PER_SAMPLE_TX,
+                                                                        CFG_TUD_AUDIO_FUNC_1_FORMAT_2_N_BYTES_PER_SAMPLE_TX};
+
+// Current resolution and bytes per sample, updated when an alternate setting is opened
 uint8_t s_spk_resolution = spk_resolutions_per_format[0];
 static uint8_t s_mic_resolution = mic_resolutions_per_format[0];
-size_t s_spk_bytes_ms = 0;
+static uint8_t s_spk_n_bytes = spk_n_bytes_per_format[0];
+static uint8_t s_mic_n_bytes = mic_n_bytes_per_format[0];
+static size_t s_spk_bytes_ms = 0;
 static size_t s_mic_bytes_ms = 0;
 
 // Audio controls
@@ -56,24 +65,46 @@ static size_t s_mic_bytes_ms = 0;
 #if (CFG_TUD_AUDIO_FUNC_1_N_CHANNELS_RX==1)
 static int8_t  spk_mute   [2] = {0,0};       // +1 for master channel 0
 static int16_t spk_volume [2] = {20,20};    // +1 for master channel 0
-int32_t spk_gain   [1] = {16777216};
+static int32_t spk_gain   [1] = {16777216};
 #endif
 #if (CFG_TUD_AUDIO_FUNC_1_N_CHANNELS_RX==2)
 static int8_t  spk_mute   [3] = {0,0,0};       // +1 for master channel 0
 static int16_t spk_volume [3];    // +1 for master channel 0
-int32_t spk_gain   [2] ; //= {16777216,16777216};
+static int32_t spk_gain   [2] ; //= {16777216,16777216};
 #endif
 #if (CFG_TUD_AUDIO_FUNC_1_N_CHANNELS_TX==1)
 static int8_t  mic_mute   [2] = {0,0};       // +1 for master channel 0
 static int16_t mic_volume [2] = {20,20};    // +1 for master channel 0
-int32_t mic_gain   [1] = {16777216};
+static int32_t mic_gain   [1] = {16777216};
 #endif
 #if (CFG_TUD_AUDIO_FUNC_1_N_CHANNELS_TX==2)
 static int8_t  mic_mute   [3] = {0,0};       // +1 for master channel 0
-static int16_t mic_volume [3];// = {20,20,20};    // +1 for master channel 0
-int32_t mic_gain   [2];// = {16777216,16777216};
+static int16_t mic_volume [3] = {0, -20 * 256, -20 * 256};    // +1 for master channel 0; 0dB with MIC_VOLUME_OFFSET
+static int32_t mic_gain   [2];// = {16777216,16777216};
 #endif
 
+/* Windows drivers refuse to send a mic volume above 0dB, even if the range is programmed to be
+   e.g. -40 - +20dB. So this is a hack: the mic gain is 20dB more than the volume the host set.
+   The power-on channel volumes are -20dB, which makes the gain 0dB till the host sets one. */
+#define MIC_VOLUME_OFFSET   (20 * 256)
+
+void calculate_ch_gain(int8_t *mute, int16_t *volume, int16_t offset, int32_t *ch_linear_gain);
+
+/* The gains and bytes per mS above and sampFreq are only changed here, in the tinyusb task;
+   the capture and playback tasks take them from audio_params, a whole block at a time, once
+   per 1mS block. publish_audio_params() hands over a new block after every change. */
+audio_params_block_t audio_params;
+static void publish_audio_params(void);
+
+// Speaker feedback: time constant of the filter in feedback intervals (2^8 x 1mS)
+#define SPK_FB_FILTER_SHIFT 8
+static fb_filter_t spk_fb;
+static uint32_t spk_fb_last_pos;
+static volatile bool spk_fb_restart = true;     // set when the speaker opens; the ISR starts over
+
+// Size of the next mic IN packet, put into the EP IN FIFO by tud_audio_tx_done_post_load_cb()
+static uint16_t mic_packet_n_bytes;
+
 // Volume control range
 // From UAC2.0:
 // The settings for the CUR, MIN, and MAX attributes can range from +127.9961 dB (0x7FFF)
@@ -109,7 +140,7 @@ static audio_control_range_2_n_t(1) mic_range_vol = {
     .subrange[0] = { .bMin = tu_htole16(-VOLUME_CTRL_40_DB), tu_htole16(VOLUME_CTRL_20_DB), tu_htole16(512) }
 };
 // List of supported sample rates
-const uint32_t sampleRatesList[] = { 16000, 24000, 32000 };
+const uint32_t sampleRatesList[] = { 16000, 24000, 32000, 44100, 48000 };
 
 uint32_t sampFreq;
 uint8_t clkValid = 0;
@@ -148,50 +179,43 @@ void usb_device_task(void *param)
     vTaskDelete(NULL);
 }
 
-#ifdef DISPLAY_STATS
-size_t spk_bytes_available_ary[256] = {0};
-static size_t mic_bytes_available_ary[256] = {0};
-static size_t mic_bytes_sent_ary[256] = {0};
-
-static void display_stats(size_t *data,int size, char *info){
-    // find max
-    size_t max = data[0];
-    for(int i=0; i< size; i++){
-        if(data[i]>max) max=data[i];
-    }
-    if(max == 0){
-        printf("Maximum bytes available: 0\n");
-        return;
-    }
-    printf("Statistics of the available bytes (%s)\n==============================================================\n",info);
-    for(int i=0; i< size; i++){
-        if(data[i] > 0){
-            printf("%3d ",i);
-            printf("[%6d] ",data[i]);
-            for(int j=0;j<(int)(50*data[i]/max);j++){
-                printf("+");
-            }
-            printf("\n");
-        }
-    }
+void usb_headset_init(void)
+{
+    // bytes in a 1mS block, rounded down for 44.1kHz (44 frames); the packets themselves
+    // alternate between 44 and 45 frames, see frame_pacer_t
+    s_spk_bytes_ms = sampFreq / 1000 * s_spk_n_bytes * CFG_TUD_AUDIO_FUNC_1_N_CHANNELS_RX;
+    s_mic_bytes_ms = sampFreq / 1000 * s_mic_n_bytes * CFG_TUD_AUDIO_FUNC_1_N_CHANNELS_TX;
+
+    // linear gains for the power-on mute/volume settings; till the host sets a volume
+    // these would otherwise stay 0 and both paths would be silent
+    calculate_ch_gain(spk_mute, spk_volume, 0, spk_gain);
+    calculate_ch_gain(mic_mute, mic_volume, MIC_VOLUME_OFFSET, mic_gain);
+    publish_audio_params();
 }
-#endif
 
-
-void usb_headset_init(void)
+static void publish_audio_params(void)
 {
-    s_spk_bytes_ms = sampFreq / 1000 * s_spk_resolution * CFG_TUD_AUDIO_FUNC_1_N_CHANNELS_RX/ 8;
-    s_mic_bytes_ms = sampFreq / 1000 * s_mic_resolution * CFG_TUD_AUDIO_FUNC_1_N_CHANNELS_TX/ 8;
+    audio_params_t params = {
+        .sample_rate  = sampFreq,
+        .spk_bytes_ms = s_spk_bytes_ms,
+        .mic_bytes_ms = s_mic_bytes_ms,
+    };
+    memcpy(params.spk_gain, spk_gain, sizeof(spk_gain));
+    memcpy(params.mic_gain, mic_gain, sizeof(mic_gain));
+    audio_params_publish(&audio_params, &params);
 }
 
+/*
+  Reads up to bufsize bytes of speaker data from the EP OUT FIFO. Packets of 44 and 45
+  frames (44.1kHz), or a frame off the nominal size under the feedback, do not add up to
+  whole 1mS blocks, so whatever is there is taken rather than left behind in the FIFO.
+*/
 uint16_t usb_read_data (void* buffer, uint16_t bufsize)
 {
-    if(tud_audio_available() > bufsize){
-        return tud_audio_read(buffer, bufsize);
-    }
-    else
-        return 0;
-
+    PROF_BEGIN(PROF_TUD_AUDIO_READ);
+    uint16_t n_bytes = tud_audio_read(buffer, bufsize);
+    PROF_END(PROF_TUD_AUDIO_READ);
+    return n_bytes;
 }
 
 //--------------------------------------------------------------------+
@@ -280,54 +304,49 @@ bool tud_audio_set_itf_cb(uint8_t rhport, tusb_control_request_t const * p_reque
   if (ITF_NUM_AUDIO_STREAMING_SPK == itf) {
     if(alt != 0) {
         s_spk_resolution = spk_resolutions_per_format[alt - 1];
-        s_spk_bytes_ms = sampFreq / 1000 * s_spk_resolution * CFG_TUD_AUDIO_FUNC_1_N_CHANNELS_RX/ 8;
+        s_spk_n_bytes = spk_n_bytes_per_format[alt - 1];
+        s_spk_bytes_ms = sampFreq / 1000 * s_spk_n_bytes * CFG_TUD_AUDIO_FUNC_1_N_CHANNELS_RX;
+        publish_audio_params();
         //rx_bytes_required = (CFG_TUD_AUDIO_FUNC_1_EP_OUT_SW_BUF_MS - 1) * s_spk_bytes_ms;
         s_spk_active = true;
         // Clear buffer when streaming format is changed
         data_out_buf_n_bytes = 0;
-        //xTaskNotifyGive(spk_task_handle);
+        spk_playback_restart(s_spk_n_bytes);
+        spk_fb_restart = true;
         TU_LOG1("Speaker interface %d-%d opened (%d bits)\n", itf, alt, s_spk_resolution);
-        ESP_LOGI(TAG,"Speaker interface %d opened (alt=%d) : %d bits @%lu Hz", itf, alt, s_spk_resolution,sampFreq);
-
-#ifdef DISPLAY_STATS
-        for(int i=0; i< 256; i++)
-            spk_bytes_available_ary[i] = 0;
-#endif
+        ESP_LOGI(TAG,"Speaker interface %d opened (alt=%d) : %d bits @%" PRIu32 " Hz", itf, alt, s_spk_resolution,sampFreq);
 
     }
     else {
         s_spk_active = false;
         ESP_LOGI(TAG,"Speaker interface %d closed (alt=%d)", itf, alt);
-#ifdef DISPLAY_STATS
-        display_stats(spk_bytes_available_ary,256,"speaker");
-#endif
+        ESP_LOGI(TAG, "speaker played: %" PRIu32 " bytes, dropped: %" PRIu32 " bytes, stalls: %" PRIu32 ", I2S clock %" PRIu32 " Hz by feedback",
+                 spk_stats.played_bytes, spk_stats.dropped_bytes, spk_stats.stall_count,
+                 (uint32_t)(((uint64_t)spk_stats.feedback * 1000) >> 16));
     }
   } else if (ITF_NUM_AUDIO_STREAMING_MIC == itf ) {
     if(alt != 0) {
-        uint8_t mic_resolution = mic_resolutions_per_format[alt - 1];
-        s_mic_resolution = mic_resolution;
-        s_mic_bytes_ms = sampFreq / 1000 * s_mic_resolution * CFG_TUD_AUDIO_FUNC_1_N_CHANNELS_TX/ 8;
+        s_mic_resolution = mic_resolutions_per_format[alt - 1];
+        s_mic_n_bytes = mic_n_bytes_per_format[alt - 1];
+        s_mic_bytes_ms = sampFreq / 1000 * s_mic_n_bytes * CFG_TUD_AUDIO_FUNC_1_N_CHANNELS_TX;
+        publish_audio_params();
 
+        // mic_ring was started over, empty, by the first tud_audio_tx_done_pre_load_cb() so that
+        // the mic latency does not depend on how long the interface was closed
         s_mic_active = true; 
         //xTaskNotifyGive(mic_task_handle);
         TU_LOG1("Microphone interface %d-%d opened (%d bits)\n", itf, alt, s_mic_resolution);
-        ESP_LOGI(TAG,"Microphone interface %d opened (alt=%d) : %d bits @%lu Hz", itf, alt, s_mic_resolution,sampFreq);
-#ifdef DISPLAY_STATS
-        for(int i=0; i< 256; i++) {
-            mic_bytes_available_ary[i] = 0;
-            mic_bytes_sent_ary[i] = 0;
-        }
-#endif
+        ESP_LOGI(TAG,"Microphone interface %d opened (alt=%d) : %d bits @%" PRIu32 " Hz", itf, alt, s_mic_resolution,sampFreq);
     }
     else {
         s_mic_active = false;
+        mic_packet_n_bytes = 0;     // the next open starts over
         ESP_LOGI(TAG, "Microphone interface %d closed (alt=%d)", itf, alt);
-
-#ifdef DISPLAY_STATS
-        display_stats(mic_bytes_available_ary,256,"mic - bytes read from I2S");
-        display_stats(mic_bytes_sent_ary,256,"mic - bytes sent over USB");
-#endif
-
+        ESP_LOGI(TAG, "mic_ring fill: %" PRIu32 "..%" PRIu32 " bytes, underruns: %" PRIu32 " (%" PRIu32 " bytes), overrun: %" PRIu32 " bytes",
+                 mic_ring.fill_min, mic_ring.fill_max, mic_ring.underrun_count, mic_ring.underrun_bytes, mic_ring.overrun_bytes);
+        ESP_LOGI(TAG, "mic packets: %" PRIu32 ", N+1 frames: %" PRIu32 ", N-1 frames: %" PRIu32 ", last second: +%u/-%u, most in a second: %u",
+                 mic_pkt_sched.packets, mic_pkt_sched.long_packets, mic_pkt_sched.short_packets,
+                 mic_pkt_sched.last_long, mic_pkt_sched.last_short, mic_pkt_sched.max_per_sec);
     }
   }   
 
@@ -388,6 +407,7 @@ bool tud_audio_get_req_entity_cb(uint8_t rhport, tusb_control_request_t const *p
             //return tud_control_xfer(rhport, p_request, &mute[channelNum], 1);
             switch(p_request->bRequest){
                 case AUDIO_CS_REQ_CUR:
+                    TU_VERIFY(channelNum < TU_ARRAY_SIZE(spk_mute));
                     audio_control_cur_1_t mute1 = { .bCur = spk_mute[channelNum]};
                     TU_LOG2("Get channel %u spk_mute %d\r\n", channelNum, mute1.bCur);
                     return tud_audio_buffer_and_schedule_control_xfer(rhport, p_request, &mute1, sizeof(mute1));
@@ -401,6 +421,7 @@ bool tud_audio_get_req_entity_cb(uint8_t rhport, tusb_control_request_t const *p
             case AUDIO_CS_REQ_CUR:
                 TU_LOG2("    Get Volume of channel: %u\r\n", channelNum);
                 //return tud_control_xfer(rhport, p_request, &volume[channelNum], sizeof(volume[channelNum]));
+                TU_VERIFY(channelNum < TU_ARRAY_SIZE(spk_volume));
                 audio_control_cur_2_t cur_vol = { .bCur = tu_htole16(spk_volume[channelNum]) };
                 TU_LOG1("Get channel %u spk_volume %d dB\r\n", channelNum, cur_vol.bCur / 256);
                 return tud_audio_buffer_and_schedule_control_xfer(rhport, p_request, &cur_vol, sizeof(cur_vol));
@@ -436,6 +457,7 @@ bool tud_audio_get_req_entity_cb(uint8_t rhport, tusb_control_request_t const *p
             //return tud_control_xfer(rhport, p_request, &mute[channelNum], 1);
             switch(p_request->bRequest){
                 case AUDIO_CS_REQ_CUR:
+                    TU_VERIFY(channelNum < TU_ARRAY_SIZE(mic_mute));
                     audio_control_cur_1_t mute1 = { .bCur = mic_mute[channelNum]};
                     TU_LOG2("Get channel %u mic_mute %d\r\n", channelNum, mute1.bCur);
                     return tud_audio_buffer_and_schedule_control_xfer(rhport, p_request, &mute1, sizeof(mute1));
@@ -449,6 +471,7 @@ bool tud_audio_get_req_entity_cb(uint8_t rhport, tusb_control_request_t const *p
             case AUDIO_CS_REQ_CUR:
                 //TU_LOG2("    Get Volume of channel: %u\r\n", channelNum);
                 //return tud_control_xfer(rhport, p_request, &volume[channelNum], sizeof(volume[channelNum]));
+                TU_VERIFY(channelNum < TU_ARRAY_SIZE(mic_volume));
                 audio_control_cur_2_t cur_vol = { .bCur = tu_htole16(mic_volume[channelNum]) };
                 TU_LOG1("Get channel %u mic_volume %d dB\r\n", channelNum, cur_vol.bCur / 256);
                 return tud_audio_buffer_and_schedule_control_xfer(rhport, p_request, &cur_vol, sizeof(cur_vol));
@@ -527,16 +550,26 @@ bool tud_audio_get_req_entity_cb(uint8_t rhport, tusb_control_request_t const *p
 
 #define CHNL_STR(chN) (chN==0?"Master":(chN==1?"L":(chN==2?"R":"??")))
 
-void calculate_ch_gain(int8_t *mute, int16_t *db_gain_scaled, int32_t *ch_linear_gain){
-    int ch0_volume_db = db_gain_scaled[0] / 256; // Convert to dB
-    int ch0_gain_table_idx = (ch0_volume_db + 40) / 2; // gain table is -40dB to 0dB in steps of 2dB; vol change request should also be in steps of 2dB
-    int ch1_volume_db = db_gain_scaled[1] / 256; // Convert to dB
-    int ch1_gain_table_idx = (ch1_volume_db + 40) / 2; // gain table is -40dB to 0dB in steps of 2dB; vol change request should also be in steps of 2dB
-    int ch2_volume_db = db_gain_scaled[2] / 256; // Convert to dB
-    int ch2_gain_table_idx = (ch2_volume_db + 40) / 2; // gain table is -40dB to 0dB in steps of 2dB; vol change request should also be in steps of 2dB
+/*
+  Linear 8.24 gains of the L and R channels from the mute and volume (1/256 dB) controls of
+  the master channel (0) and the channel itself. The volumes add up in dB, plus offset, and
+  are converted once, at the full 1/256 dB resolution.
+*/
+void calculate_ch_gain(int8_t *mute, int16_t *volume, int16_t offset, int32_t *ch_linear_gain){
+    for(int ch = 1; ch <= 2; ch++) {
+        bool silent = mute[0] || mute[ch] ||
+                      volume[0] == (int16_t)VOLUME_CTRL_SILENCE || volume[ch] == (int16_t)VOLUME_CTRL_SILENCE;
+        ch_linear_gain[ch - 1] = silent ? 0 : volume_to_gain((int32_t)volume[0] + volume[ch] + offset);
+    }
+}
 
-    ch_linear_gain[0] =  (mute[0] || mute[1]) ? 0 : mul_8p24x8p24 (gain_table[ch0_gain_table_idx],gain_table[ch1_gain_table_idx]);
-    ch_linear_gain[1] =  (mute[0] || mute[2]) ? 0 : mul_8p24x8p24 (gain_table[ch0_gain_table_idx],gain_table[ch2_gain_table_idx]);
+// A volume the host sets outside the range we advertised is taken as the nearest end of it
+static int16_t volume_in_range(int16_t volume, int16_t min, int16_t max)
+{
+    if(volume == (int16_t)VOLUME_CTRL_SILENCE) return volume;
+    if(volume < min) return min;
+    if(volume > max) return max;
+    return volume;
 }
 
 // Invoked when audio class specific set request received for an entity
@@ -562,13 +595,13 @@ bool tud_audio_set_req_entity_cb(uint8_t rhport, tusb_control_request_t const *p
         case AUDIO_FU_CTRL_MUTE:
             // Request uses format layout 1
             TU_VERIFY(p_request->wLength == sizeof(audio_control_cur_1_t));
+            TU_VERIFY(channelNum < TU_ARRAY_SIZE(spk_mute));
 
             spk_mute[channelNum] = ((audio_control_cur_1_t *) pBuff)->bCur;
 
             // recalculate the gain multiplier for the channel
-            calculate_ch_gain(spk_mute, spk_volume, spk_gain);
-            //spk_gain[0] =  (spk_mute[0] || spk_mute[1]) ? 0 : mul_8p24x8p24 (gain_table[spk_volume_idx[0]],gain_table[spk_volume_idx[1]]);
-            //spk_gain[1] =  (spk_mute[0] || spk_mute[2]) ? 0 : mul_8p24x8p24 (gain_table[spk_volume_idx[0]],gain_table[spk_volume_idx[2]]);
+            calculate_ch_gain(spk_mute, spk_volume, 0, spk_gain);
+            publish_audio_params();
 
             TU_LOG2("    Set speaker Mute: %d of channel: %u \r\n", spk_mute[channelNum], channelNum);
             //ESP_LOGI(TAG,"    Set speaker Mute: %d of channel: %u \n       gains: %ld, %ld", spk_mute[channelNum], channelNum,spk_gain[0],spk_gain[1]);
@@ -579,19 +612,13 @@ bool tud_audio_set_req_entity_cb(uint8_t rhport, tusb_control_request_t const *p
         case AUDIO_FU_CTRL_VOLUME:
             // Request uses format layout 2
             TU_VERIFY(p_request->wLength == sizeof(audio_control_cur_2_t));
+            TU_VERIFY(channelNum < TU_ARRAY_SIZE(spk_volume));
 
-            spk_volume[channelNum] = ((audio_control_cur_2_t *) pBuff)->bCur;
-
-            calculate_ch_gain(spk_mute, spk_volume, spk_gain);
-/*
-            int spk_volume_db = spk_volume[channelNum] / 256; // Convert to dB
-            int volume = (spk_volume_db + 40) / 2; // gain table is -40dB to 0dB in steps of 2dB; vol change request should also be in steps of 2dB
-            spk_volume_idx[channelNum] = volume;
-            ESP_LOGI(TAG,"spk_volume[%d]: %d",channelNum,volume);
+            spk_volume[channelNum] = volume_in_range(((audio_control_cur_2_t *) pBuff)->bCur,
+                                                     spk_range_vol.subrange[0].bMin, spk_range_vol.subrange[0].bMax);
 
-            spk_gain[0] =  (spk_mute[0] || spk_mute[1]) ? 0 : mul_8p24x8p24 (gain_table[spk_volume_idx[0]],gain_table[spk_volume_idx[1]]);
-            spk_gain[1] =  (spk_mute[0] || spk_mute[2]) ? 0 : mul_8p24x8p24 (gain_table[spk_volume_idx[0]],gain_table[spk_volume_idx[2]]);
-*/
+            calculate_ch_gain(spk_mute, spk_volume, 0, spk_gain);
+            publish_audio_params();
             TU_LOG2("    Set Volume: %d dB of channel: %u\r\n", spk_volume[channelNum]/256, channelNum);
             //ESP_LOGI(TAG,"spk_gain: %ld, %ld",spk_gain[0],spk_gain[1]);
             return true;
@@ -607,38 +634,28 @@ bool tud_audio_set_req_entity_cb(uint8_t rhport, tusb_control_request_t const *p
         case AUDIO_FU_CTRL_MUTE:
             // Request uses format layout 1
             TU_VERIFY(p_request->wLength == sizeof(audio_control_cur_1_t));
+            TU_VERIFY(channelNum < TU_ARRAY_SIZE(mic_mute));
 
             mic_mute[channelNum] = ((audio_control_cur_1_t *) pBuff)->bCur;
 
             // recalculate the gain multiplier for the channel
-            calculate_ch_gain(mic_mute, mic_volume, mic_gain);
-            //mic_gain[0] =  (mic_mute[0] || mic_mute[1]) ? 0 : mul_8p24x8p24 (gain_table[mic_volume[0]],gain_table[mic_volume[1]]);
-            //mic_gain[1] =  (mic_mute[0] || mic_mute[2]) ? 0 : mul_8p24x8p24 (gain_table[mic_volume[0]],gain_table[mic_volume[2]]);
+            calculate_ch_gain(mic_mute, mic_volume, MIC_VOLUME_OFFSET, mic_gain);
+            publish_audio_params();
             TU_LOG2("    Set mic Mute: %d of channel: %u\r\n", mic_mute[channelNum], channelNum);
-            ESP_LOGI(TAG,"    Set mic Mute: %d of channel: %u (%s)\n     mic_gain: %ld, %ld", mic_mute[channelNum], channelNum, CHNL_STR(channelNum), mic_gain[0], mic_gain[1]);
+            ESP_LOGI(TAG,"    Set mic Mute: %d of channel: %u (%s)\n     mic_gain: %" PRId32 ", %" PRId32, mic_mute[channelNum], channelNum, CHNL_STR(channelNum), mic_gain[0], mic_gain[1]);
             return true;
 
         case AUDIO_FU_CTRL_VOLUME:
             // Request uses format layout 2
             TU_VERIFY(p_request->wLength == sizeof(audio_control_cur_2_t));
+            TU_VERIFY(channelNum < TU_ARRAY_SIZE(mic_volume));
 
-            mic_volume[channelNum] = ((audio_control_cur_2_t *) pBuff)->bCur;
-
-            /* Windows drivers refuses to send a volume more than 0dB, even if the range is programmed to be e.g., +20 - -40dB.
-               SO THIS IS A HACK. we just bump it up here by 20dB.
-            */
-            mic_volume[channelNum] += 20 * 256;
+            mic_volume[channelNum] = volume_in_range(((audio_control_cur_2_t *) pBuff)->bCur,
+                                                     mic_range_vol.subrange[0].bMin, mic_range_vol.subrange[0].bMax);
 
-            calculate_ch_gain(mic_mute, mic_volume, mic_gain);
-/*
-            int mic_volume_db = mic_volume[channelNum] / 256; // Convert to dB
-
-            int volume = (mic_volume_db + 40) / 2; // gain table is -40dB to +40dB in steps of 2dB; vol change request should also be in steps of 2dB
-            mic_volume[channelNum] = volume; 
-            // recalculate the gain multiplier for the channel
-            mic_gain[0] =  (mic_mute[0] || mic_mute[1]) ? 0 : mul_8p24x8p24 (gain_table[mic_volume[0]],gain_table[mic_volume[1]]);
-            mic_gain[1] =  (mic_mute[0] || mic_mute[2]) ? 0 : mul_8p24x8p24 (gain_table[mic_volume[0]],gain_table[mic_volume[2]]);
-*/
+            // the gain includes MIC_VOLUME_OFFSET; what the host reads back is what it set
+            calculate_ch_gain(mic_mute, mic_volume, MIC_VOLUME_OFFSET, mic_gain);
+            publish_audio_params();
 
             //ESP_LOGI(TAG,"    Set mic volume: %d dB of channel: %u", mic_volume[channelNum]/256, channelNum);
             //ESP_LOGI(TAG,"     mic_gain: %ld, %ld", mic_gain[0],mic_gain[1]);
@@ -675,10 +692,12 @@ bool tud_audio_set_req_entity_cb(uint8_t rhport, tusb_control_request_t const *p
                     return false;
                 }
                 sampFreq = target_sampFreq;
-                s_spk_bytes_ms = sampFreq / 1000 * s_spk_resolution * CFG_TUD_AUDIO_FUNC_1_N_CHANNELS_RX/ 8;
-                s_mic_bytes_ms = sampFreq / 1000 * s_mic_resolution * CFG_TUD_AUDIO_FUNC_1_N_CHANNELS_TX/ 8;
+                s_spk_bytes_ms = sampFreq / 1000 * s_spk_n_bytes * CFG_TUD_AUDIO_FUNC_1_N_CHANNELS_RX;
+                s_mic_bytes_ms = sampFreq / 1000 * s_mic_n_bytes * CFG_TUD_AUDIO_FUNC_1_N_CHANNELS_TX;
+                publish_audio_params();
                 TU_LOG1("Mic/Speaker frequency %" PRIu32 ", resolution %d, ch %d", target_sampFreq, s_spk_resolution, CFG_TUD_AUDIO_FUNC_1_N_CHANNELS_TX);
                 ESP_ERROR_CHECK(bsp_i2s_reconfig(sampFreq));
+                spk_fb_restart = true;      // the feedback starts over at the new nominal rate
 
                 ESP_LOGI(TAG,"Mic/Speaker frequency %" PRIu32 ", resolution %d, ch %d", target_sampFreq, s_spk_resolution, CFG_TUD_AUDIO_FUNC_1_N_CHANNELS_TX);
             }
@@ -693,23 +712,49 @@ bool tud_audio_set_req_entity_cb(uint8_t rhport, tusb_control_request_t const *p
     return false;    // Yet not implemented
 }
 
+/*
+  The next mic IN packet straight into the free space of the EP IN FIFO, where
+  audiod_tx_done_cb() takes it from after the next pre-load; no copy in between.
+  Returns its size in bytes.
+*/
+static uint16_t mic_packet_load(void)
+{
+    tu_fifo_t *ff = tud_audio_get_ep_in_ff();
+    tu_fifo_buffer_info_t info;
+    uint16_t n_bytes;
+
+    if(ff == NULL)
+        return 0;
+    PROF_BEGIN(PROF_MIC_FIFO_LOAD);
+    tu_fifo_get_write_info(ff, &info);
+    n_bytes = (*usb_get_data)(&info);
+    tu_fifo_advance_write_pointer(ff, n_bytes);
+    PROF_END(PROF_MIC_FIFO_LOAD);
+    return n_bytes;
+}
+
 bool tud_audio_tx_done_pre_load_cb(uint8_t rhport, uint8_t itf, uint8_t ep_in, uint8_t cur_alt_setting)
 {
     (void) rhport;
     (void) itf;
     (void) ep_in;
-    (void) cur_alt_setting;
 
-    /*** Here to send audio buffer, only use in audio transmission begin ***/
-    if(data_in_buf_n_bytes > 0) {
-        tud_audio_write(data_in_buf, data_in_buf_n_bytes);
-#ifdef DISPLAY_STATS
-        mic_bytes_sent_ary[data_in_buf_n_bytes]++;
-#endif
-    }
-    else {
-        ESP_LOGI(TAG,"tud_audio_tx_done_pre_load_cb: data_in_buf_n_bytes: %d",data_in_buf_n_bytes);
+    uint32_t t0 = stats_time_begin();
+    TRACE_BEGIN(TRACE_PRE_LOAD);
+    /*** The packet is in the EP IN FIFO already, put there by the last post-load ***/
+    if(cur_alt_setting != 0) {
+        // first packet after the interface opened (tinyusb asks for it before calling
+        // tud_audio_set_itf_cb(), but with the new alternate setting, and has cleared the
+        // FIFO): start mic_ring over in the format of that setting and send silence till it
+        // is primed
+        if(mic_packet_n_bytes == 0) {
+            mic_ring_restart(mic_n_bytes_per_format[cur_alt_setting - 1]);
+            mic_packet_n_bytes = mic_packet_load();
+        }
+        audio_stats.mic.packets++;
     }
+    TRACE_END(TRACE_PRE_LOAD, mic_packet_n_bytes);
+    stats_time_end(STATS_PRE_LOAD, t0);
     return true;
 }
 
@@ -721,18 +766,72 @@ bool tud_audio_tx_done_post_load_cb(uint8_t rhport, uint16_t n_bytes_copied, uin
     (void) ep_in;
     (void) cur_alt_setting;
 
-    size_t  n_bytes = (*usb_get_data)(data_in_buf, data_in_buf_n_bytes) ;
+    uint32_t t0 = stats_time_begin();
+    TRACE_BEGIN(TRACE_POST_LOAD);
+    // the packet carries the frames of this USB frame (44 or 45 at 44.1kHz), one more or
+    // less when the I2S clock is off the USB clock; shortfalls of the ring are counted in
+    // mic_ring's statistics
+    mic_packet_n_bytes = mic_packet_load();
+    TRACE_END(TRACE_POST_LOAD, mic_packet_n_bytes);
+    stats_time_end(STATS_POST_LOAD, t0);
+    return true;
+}
 
-    if(n_bytes != data_in_buf_n_bytes)
-        ESP_LOGI(TAG,"Requested %d bytes, got %d bytes\n",data_in_buf_n_bytes,n_bytes );
-    //TU_ASSERT((n_bytes == data_in_buf_n_bytes));
+// Invoked after an OUT packet has been put into the EP OUT FIFO; wakes the playback task
+bool tud_audio_rx_done_post_read_cb(uint8_t rhport, uint16_t n_bytes_received, uint8_t func_id, uint8_t ep_out, uint8_t cur_alt_setting)
+{
+    (void) rhport;
+    (void) n_bytes_received;
+    (void) func_id;
+    (void) ep_out;
+    (void) cur_alt_setting;
 
-#ifdef DISPLAY_STATS
-    mic_bytes_available_ary[n_bytes]++;
-#endif
+    uint32_t t0 = stats_time_begin();
+    TRACE_BEGIN(TRACE_RX_DONE);
+    if(spk_task_handle != NULL)
+        xTaskNotifyGive(spk_task_handle);
+
+    // the feedback can ask for one frame less than the nominal packet; anything shorter is
+    // the host falling behind
+    audio_stats.spk.packets++;
+    stats_range_add(&audio_stats.spk.packet_bytes, n_bytes_received);
+    if(n_bytes_received < (sampFreq / 1000 - 1) * s_spk_n_bytes * CFG_TUD_AUDIO_FUNC_1_N_CHANNELS_RX)
+        audio_stats.spk.short_packets++;
+    TRACE_END(TRACE_RX_DONE, n_bytes_received);
+    stats_time_end(STATS_RX_DONE, t0);
     return true;
 }
 
+/*
+  Invoked from the SOF interrupt every feedback EP interval while the speaker is open.
+  The I2S frames clocked out since the last SOF, smoothed by spk_fb, are the number of
+  frames per USB frame the host is to send: the host follows our I2S clock and the EP OUT
+  FIFO stays at the level playback started with, however far the two clocks are apart.
+*/
+TU_ATTR_FAST_FUNC void tud_audio_feedback_interval_isr(uint8_t func_id, uint32_t frame_number, uint8_t interval_shift)
+{
+    (void) frame_number;
+    uint32_t t0 = stats_time_begin();
+    TRACE_BEGIN(TRACE_FEEDBACK);
+    uint32_t pos = i2s_tx_position();
+
+    if(spk_fb_restart) {
+        spk_fb_restart = false;
+        fb_filter_init(&spk_fb, sampFreq, SPK_FB_FILTER_SHIFT);
+        spk_fb_last_pos = pos;
+        spk_stats.feedback = spk_fb.nominal;
+        tud_audio_n_fb_set(func_id, spk_fb.nominal);
+    }
+    else {
+        int32_t frames_q16 = (int32_t)(pos - spk_fb_last_pos) >> interval_shift;
+        spk_fb_last_pos = pos;
+        spk_stats.feedback = fb_filter_update(&spk_fb, frames_q16);
+        tud_audio_n_fb_set(func_id, spk_stats.feedback);
+    }
+    TRACE_END(TRACE_FEEDBACK, 0);
+    stats_time_end(STATS_FEEDBACK, t0);
+}
+
 bool tud_audio_set_itf_close_EP_cb(uint8_t rhport, tusb_control_request_t const *p_request)
 {
     (void) rhport;
@@ -750,6 +849,7 @@ bool tud_audio_set_itf_close_EP_cb(uint8_t rhport, tusb_control_request_t const
     if (ITF_NUM_AUDIO_STREAMING_MIC == itf && alt == 0){
         blink_state = BLINK_MOUNTED;
         s_mic_active = false;
+        mic_packet_n_bytes = 0;     // the next open starts over
         ESP_LOGI(TAG, "Microphone interface %d closed (alt=%d)", itf, alt);
     }
 
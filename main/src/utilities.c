@@ -1,12 +1,5 @@
+#include <stdint.h>
 #include <math.h>
-#include "esp_log.h"
-#include "FreeRTOS.h"
-#include "freertos/queue.h"
-#include "sys/time.h"
-
-char *TAG = "utilities";
-
-uint32_t micros(); // defined in blink_led.c
 
 int32_t q31_multiply(int32_t a, int32_t b){
     // Q31 format numbers are assumed to be in 1.31 format (ranges from -1 to 0.99999)
@@ -63,74 +56,9 @@ int16_t mul_1p31x8p24(int32_t sig, int32_t gain)
     // m has the most significant 9 bits of t. We want to make sure that these
     // are all zero's or all 1's. Otherwise there is overflow or underflow.
 
-    if(m < -1) return 0xffff; // most negative in 16bits 
+    if(m < -1) return (int16_t)0x8000; // most negative in 16bits 
     if(m >  0) return 0x7fff; // most positive in 16bits
 
     t = t<<8;
     return *(p+3);
 }
-
-/*=============== queue code used for debug ===============*/
-struct tx_data_info
-{
- int64_t timestamp;
- size_t   n_bytes;
-} typedef txPacketInfo;
-
-QueueHandle_t txInfoQ;
-#define NUM_Q_ITEMS 1024
-
-// Task to create a queue and post a value.
-void txInfoQinit( )
-{
-
- // Create a queue capable of containing 1024 txPacketInfo
- // These should be passed by pointer as they contain a lot of data.
- txInfoQ = xQueueCreate( NUM_Q_ITEMS, sizeof( struct tx_data_info ) );
- if( txInfoQ == 0 )
- {
-     ESP_LOGE(TAG,"Failed to create Queue");
- }
-
-}
- // this keep writing to the queue discarding older items so that we
- // can get a snapshot of most recent elements in the queue
-void put_txPacketInfo(txPacketInfo *data)
-{
- char buf[sizeof(txPacketInfo)];
- if(xQueueSend( txInfoQ, ( void * ) data, ( TickType_t ) 0 ) == pdFALSE){
-    // if a send failed, queue may be full. In that case, remove an item and try again
-    xQueueReceive(txInfoQ, buf, (TickType_t)0);
-    if(xQueueSend( txInfoQ, ( void * ) data, ( TickType_t ) 0 ) == pdFALSE){
-        // it failed again; so bail out
-        ESP_LOGE(TAG,"Failed to send data to queue");
-    }
-
- }
-
-}
-
-void print_txPacketInfo(size_t n_items){
- char buf[sizeof(txPacketInfo)];
- txPacketInfo *p;
-    if(n_items == 0) n_items = NUM_Q_ITEMS;
-    printf("==== Tx packets info =====\n");
-    printf("  timestamp : n_bytes \n");
-    for(size_t i=0; i<n_items; i++){
-        if(xQueueReceive(txInfoQ, buf, (TickType_t)0) == pdTRUE){
-            p = (txPacketInfo*)buf;
-            printf("%lld : %d\n",p->timestamp,p->n_bytes);
-        }
-        else {
-            return;
-        }
-    }
-}
-
-
-void log_txbytes(size_t n_bytes){
-    txPacketInfo s;
-    s.timestamp = micros();
-    s.n_bytes = n_bytes;
-    put_txPacketInfo(&s);
-}
\ No newline at end of file
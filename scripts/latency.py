@@ -0,0 +1,189 @@
+#!/usr/bin/env python3
+"""
+Round trip latency from a chirp train: the played signal has a short chirp every
+period with silence in between, the recorded one is what came back through the
+loopback (a wire from the dongle's I2S out to its I2S in, or a speaker and a mic).
+Each chirp is found in the recording by its first loud sample and then placed to a
+fraction of a sample by cross-correlating the chirp with the recording around it.
+The latency of each chirp is the difference of its position in the two streams; the
+summary gives their spread (max - min) and standard deviation as the jitter.
+
+Used by send_n_receive.py --latency, which plays the chirps through the dongle, and
+on its own on a pair of recordings, e.g. the ones uad_sim -l 200 -w lat writes:
+  python3 scripts/latency.py lat_48000_out.wav lat_48000_in.wav
+
+Plain Python (no numpy), so it runs wherever the simulation is built; the search is
+kept to a few ms around each chirp.
+"""
+
+import argparse
+import math
+import struct
+import sys
+import wave
+
+CHIRP_MS = 5            # as SIM_MARKER_MS in host_sim/src/sim.h
+CHIRP_F0 = 1000.0
+THRESHOLD = 10 ** (-30 / 20.0)      # first loud sample, as LATENCY_THRESHOLD in main/include/latency.h
+QUIET_MS = 50
+
+
+def chirp(rate, ms=CHIRP_MS, f0=CHIRP_F0, f1=None, amplitude=0.5):
+    """Linear chirp from f0 to f1 (a quarter of the rate by default), samples in -1..1"""
+    f1 = rate / 4.0 if f1 is None else f1
+    n = int(rate * ms / 1000)
+    length = n / float(rate)
+    return [amplitude * math.sin(2 * math.pi * (f0 * t + (f1 - f0) * t * t / (2 * length)))
+            for t in (i / float(rate) for i in range(n))]
+
+
+def chirp_train(rate, seconds, period_ms, **kwargs):
+    """Silence with a chirp at the end of every period, so that it starts quiet; returns the
+       samples and the index of each chirp's first sample"""
+    c = chirp(rate, **kwargs)
+    period = rate * period_ms // 1000
+    samples = [0.0] * (rate * seconds)
+    starts = []
+    for start in range(period - len(c), len(samples) - len(c), period):
+        samples[start:start + len(c)] = c
+        starts.append(start)
+    return samples, starts
+
+
+def read_wav(path, channel=0):
+    """Sample rate and one channel of a PCM wav file, in -1..1"""
+    with wave.open(path, 'rb') as w:
+        rate, n_channels, width = w.getframerate(), w.getnchannels(), w.getsampwidth()
+        data = w.readframes(w.getnframes())
+    if width == 2:
+        values = struct.unpack('<%dh' % (len(data) // 2), data)
+        scale = 32768.0
+    elif width == 4:
+        values = struct.unpack('<%di' % (len(data) // 4), data)
+        scale = 2147483648.0
+    elif width == 3:
+        values = [int.from_bytes(data[i:i + 3], 'little', signed=True) for i in range(0, len(data), 3)]
+        scale = 8388608.0
+    else:
+        raise ValueError('%s: %d bytes per sample' % (path, width))
+    return rate, [v / scale for v in values[channel::n_channels]]
+
+
+def onsets(x, rate, threshold=THRESHOLD, quiet_ms=QUIET_MS):
+    """Indices of the first sample at or above threshold after quiet_ms below it"""
+    quiet_needed = rate * quiet_ms // 1000
+    quiet = 0
+    found = []
+    for i, v in enumerate(x):
+        if -threshold < v < threshold:
+            quiet += 1
+            continue
+        if quiet >= quiet_needed:
+            found.append(i)
+        quiet = 0
+    return found
+
+
+def correlate_at(x, template, lag):
+    if lag < 0 or lag + len(template) > len(x):
+        return 0.0
+    return sum(t * v for t, v in zip(template, x[lag:lag + len(template)]))
+
+
+def locate(x, template, first, last):
+    """Where template fits x best between sample indices first and last, to a fraction of a
+       sample (a parabola through the peak of the correlation and its neighbours). The sign of
+       the correlation is left out: an acoustic path may invert."""
+    best, best_c = None, -1.0
+    corr = {}
+    for lag in range(max(first, 0), last + 1):
+        c = abs(correlate_at(x, template, lag))
+        corr[lag] = c
+        if c > best_c:
+            best, best_c = lag, c
+    if best is None:
+        return None
+    left, right = corr.get(best - 1), corr.get(best + 1)
+    if left is None or right is None:
+        return float(best)
+    denom = left - 2 * best_c + right
+    return best + (0.5 * (left - right) / denom if denom else 0.0)
+
+
+def measure(recorded, rate, starts, template, max_ms=100.0, search_ms=None):
+    """Latency in ms of each chirp of the played stream starting at starts[], None for the
+       ones not found in the recording within max_ms; the ones the recording ends in the
+       middle of are left out. A chirp is first found by the first sample of the recording
+       after its start at a quarter of the peak there, then placed by correlation from a chirp
+       length before that to 1 ms after."""
+    search_back = len(template) if search_ms is None else int(rate * search_ms / 1000)
+    max_lag = int(rate * max_ms / 1000)
+    out = []
+    for s in starts:
+        window = recorded[s:s + max_lag + len(template)]
+        complete = s + max_lag + len(template) <= len(recorded)
+        peak = max((abs(v) for v in window), default=0.0)
+        if peak < THRESHOLD:
+            if complete:
+                out.append(None)
+            continue
+        coarse = next(i for i, v in enumerate(window) if abs(v) >= peak / 4)
+        if s + coarse + len(template) + rate // 1000 > len(recorded):
+            continue        # the recording stopped in the middle of it
+        pos = locate(recorded, template, s + coarse - search_back, s + coarse + rate // 1000)
+        out.append(None if pos is None else (pos - s) * 1000.0 / rate)
+    return out
+
+
+def measure_files(played_path, recorded_path, max_ms=100.0):
+    """Latencies of the chirps in a pair of recordings: the chirps are found in the played
+       stream by their first loud sample after silence, and each is looked for in the
+       recorded stream as it was played"""
+    rate, played = read_wav(played_path)
+    rate_in, recorded = read_wav(recorded_path)
+    if rate != rate_in:
+        raise ValueError('%s is %d Hz, %s %d Hz' % (played_path, rate, recorded_path, rate_in))
+    n = rate * CHIRP_MS // 1000
+    starts = [s for s in onsets(played, rate) if s + n <= len(played)]
+    out = []
+    for s in starts:
+        out += measure(recorded, rate, [s], played[s:s + n], max_ms)
+    return rate, out
+
+
+class Summary:
+    def __init__(self, latencies):
+        found = [v for v in latencies if v is not None]
+        self.n = len(found)
+        self.lost = len(latencies) - self.n
+        self.min = min(found) if found else 0.0
+        self.max = max(found) if found else 0.0
+        self.avg = sum(found) / self.n if found else 0.0
+        self.jitter = math.sqrt(sum((v - self.avg) ** 2 for v in found) / self.n) if found else 0.0
+
+    def __str__(self):
+        return '%d chirps (%d lost)  min %.3f  avg %.3f  max %.3f ms  jitter %.3f ms (p-p %.3f)' % (
+            self.n, self.lost, self.min, self.avg, self.max, self.jitter, self.max - self.min)
+
+
+def main():
+    ap = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    ap.add_argument('played', help='wav file of the played stream')
+    ap.add_argument('recorded', help='wav file of the recorded stream')
+    ap.add_argument('--max-ms', type=float, default=100.0, help='longest latency looked for; less than the chirp period')
+    ap.add_argument('--check', action='store_true',
+                    help='exit with 1 with fewer than --min-chirps found, any lost or more than --max-jitter-ms')
+    ap.add_argument('--min-chirps', type=int, default=2)
+    ap.add_argument('--max-jitter-ms', type=float, default=1.0)
+    args = ap.parse_args()
+
+    rate, latencies = measure_files(args.played, args.recorded, args.max_ms)
+    s = Summary(latencies)
+    print('%d Hz: %s' % (rate, s))
+    if args.check and (s.n < args.min_chirps or s.lost or s.jitter > args.max_jitter_ms):
+        return 1
+    return 0
+
+
+if __name__ == '__main__':
+    sys.exit(main())
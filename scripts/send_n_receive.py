@@ -4,9 +4,20 @@ This python program uses pyaudio to play and record audio.
 Input audio is selected from one of the three sources: an input .wav file, a tone generator or from recorder.
 Received audio is saved in a file, if a name provided or discarded.
 
+With --latency it measures the round trip latency instead: it plays a chirp every
+--period_ms on the dongle and records what comes back through a loopback from its
+output to its input, at each of --rates, and finds the chirps in the recording by
+cross-correlation (latency.py). With --serial it also reads the firmware's own measure
+of the I2S part of the round trip over the console (command "latency") together with
+the buffer configuration it was built with, and --csv appends both to a file.
+
+  python3 send_n_receive.py --latency --rates 16000,48000 --serial /dev/ttyUSB0 --csv latency.csv "ESP Audio"
 """
 
 import sys
+import os
+import re
+import time
 import argparse, readline
 import pyaudio
 import wave
@@ -17,6 +28,7 @@ import signal
 from threading import Event
 from enum import Enum
 from siggen import Signal
+import latency
 
 waitThread = Event()
 
@@ -52,6 +64,13 @@ parser.add_argument('-fs','--sampling_rate',default=RATE,help='Sampling rate of
 parser.add_argument('-ch','--channels',default=CHANNELS,help='Number of channels ; default=1(mono). If playing from a file, this argument is ignored.')
 parser.add_argument('--chunk',default=CHUNK,help='Chunk size used by pyaudio; default=256')
 parser.add_argument('--siggen_freq',default=100,help='Signal generator frequency; default=100')
+parser.add_argument('--latency',action='store_true',help='measure the round trip latency with chirps looped back from the output to the input; devices: recording device, then playback device if it is another one')
+parser.add_argument('--rates',help='--latency: comma separated sampling rates to measure at; default: --sampling_rate')
+parser.add_argument('--seconds',type=int,default=5,help='--latency: seconds of chirps per sampling rate; default=5')
+parser.add_argument('--period_ms',type=int,default=250,help='--latency: one chirp every period_ms; default=250')
+parser.add_argument('--serial',help='--latency: serial port of the firmware console, to read its own measure')
+parser.add_argument('--config',default='',help='--latency: label of the buffer configuration for the report')
+parser.add_argument('--csv',help='--latency: append the results to this file')
 
 args = parser.parse_args()
 RATE = int(args.sampling_rate)
@@ -253,6 +272,77 @@ def cancel_noise(in_data, frame_count, time_info, flag):
     #return in_data, pyaudio.paContinue
 
 
+def firmware_command(port, command):
+    """Sends a command to the firmware console; returns the fields of the LATENCY line it
+       printed, if any"""
+    port.reset_input_buffer()
+    port.write((command + '\n').encode())
+    deadline = time.time() + 1.0
+    while time.time() < deadline:
+        m = re.search(r'LATENCY \w+ (.*)', port.readline().decode(errors='replace'))
+        if m:
+            return dict(kv.split('=', 1) for kv in m.group(1).split())
+    return None
+
+
+def measure_latency(rate, input_dev, output_dev):
+    """Plays the chirp train at rate and records at the same time; returns the latency of
+       each chirp in ms"""
+    samples, starts = latency.chirp_train(rate, args.seconds, args.period_ms)
+    stream = p.open(format=FORMAT, channels=CHANNELS, rate=rate,
+                    input=True, input_device_index=input_dev,
+                    output=True, output_device_index=output_dev,
+                    frames_per_buffer=CHUNK)
+    recorded = []
+    for i in range(0, len(samples), CHUNK):
+        chunk = [int(v * 32767) for v in samples[i:i + CHUNK]]
+        chunk += [0] * (CHUNK - len(chunk))
+        stream.write(struct.pack('<%dh' % (CHUNK * CHANNELS), *[v for v in chunk for _ in range(CHANNELS)]))
+        data = stream.read(CHUNK, exception_on_overflow=False)
+        recorded += [v / 32768.0 for v in struct.unpack('<%dh' % (len(data) // 2), data)[::CHANNELS]]
+    stream.stop_stream()
+    stream.close()
+    return latency.measure(recorded, rate, starts, latency.chirp(rate), max_ms=args.period_ms / 2)
+
+
+def run_latency():
+    """--latency: host and, with --serial, firmware latency per sampling rate"""
+    input_dev, input_devname = getDevID("input", devName=args.devices[0])
+    output_dev, output_devname = getDevID("output", devName=args.devices[-1])
+    if input_dev < 0 or output_dev < 0:
+        print("Something did not work out as expected. Exiting..")
+        return
+    port = None
+    if args.serial:
+        import serial
+        port = serial.Serial(args.serial, 115200, timeout=0.2)
+        firmware_command(port, 'latency on')
+
+    rates = [int(r) for r in args.rates.split(',')] if args.rates else [RATE]
+    rows = []
+    for rate in rates:
+        s = latency.Summary(measure_latency(rate, input_dev, output_dev))
+        print('%6d Hz %s host round trip: %s' % (rate, args.config, s))
+        fw = firmware_command(port, 'latency') if port else None
+        if fw:
+            print('          I2S out to I2S in: %s markers (%s lost)  min %s  avg %s  max %s us  jitter %s us'
+                  '  (EP IN/OUT buffers %s/%s ms, I2S DMA %s x %s frames)' % (
+                      fw['n'], fw['lost'], fw['min_us'], fw['avg_us'], fw['max_us'], fw['jitter_us'],
+                      fw['ep_in_buf_ms'], fw['ep_out_buf_ms'], fw['dma_desc_num'], fw['dma_frame_num']))
+        fw = fw or {}
+        rows.append([args.config, rate, s.n, s.lost, '%.3f' % s.min, '%.3f' % s.avg, '%.3f' % s.max, '%.3f' % s.jitter] +
+                    [fw.get(k, '') for k in ('n', 'lost', 'avg_us', 'jitter_us', 'ep_in_buf_ms', 'ep_out_buf_ms',
+                                             'dma_desc_num', 'dma_frame_num')])
+    if args.csv:
+        new_file = not os.path.exists(args.csv)
+        with open(args.csv, 'a') as f:
+            if new_file:
+                f.write('config,rate,n,lost,min_ms,avg_ms,max_ms,jitter_ms,fw_n,fw_lost,fw_avg_us,fw_jitter_us,'
+                        'ep_in_buf_ms,ep_out_buf_ms,dma_desc_num,dma_frame_num\n')
+            for row in rows:
+                f.write(','.join(str(v) for v in row) + '\n')
+
+
 def quit(signo, _frame):
     print("Interrupted by %d, shutting down" % signo)
     waitThread.set()
@@ -267,6 +357,10 @@ if args.list_devices:
     getDevID("output",devName="",only_list=True)
     exit()
 
+if args.latency:
+    run_latency()
+    closeAndExit(p)
+
 of = 0
 SOURCE = sources.NULL
 if(args.input_filename == 'loopback'):
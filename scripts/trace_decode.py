@@ -0,0 +1,211 @@
+#!/usr/bin/env python3
+"""
+Decodes the audio path trace printed by trace_dump() (main/src/trace.c) into
+per-callback timing histograms.
+
+The input is a console log (e.g. saved from idf.py monitor) or the file
+uad_sim -t writes; everything but the TRACE/T<core> lines is ignored. For each
+event that is traced as a begin/end pair it prints the time from begin to end
+(how long the callback or block took) and the time from one begin to the next
+(how regularly it runs), and a histogram of the former.
+
+Example:
+  python3 scripts/trace_decode.py monitor.log
+  python3 scripts/trace_decode.py --check --expect PRE_LOAD,CAPTURE trace.txt
+"""
+
+import argparse
+import os
+import re
+import sys
+
+END_FLAG = 0x8000
+TRACE_H = os.path.join(os.path.dirname(os.path.abspath(__file__)), '..', 'main', 'include', 'trace.h')
+
+
+def read_event_names(path):
+    """Event ids by name from the enum in trace.h"""
+    names = {}
+    value = None
+    in_enum = False
+    with open(path) as f:
+        for line in f:
+            line = line.split('//')[0].strip()
+            if line.startswith('enum'):
+                in_enum = True
+                continue
+            if not in_enum:
+                continue
+            if line.startswith('}'):
+                break
+            m = re.match(r'TRACE_(\w+)\s*(?:=\s*(\d+))?\s*,?$', line)
+            if not m:
+                continue
+            value = int(m.group(2)) if m.group(2) else value + 1
+            if m.group(1) != 'N_EVENTS':
+                names[value] = m.group(1)
+    return names
+
+
+class Dump:
+    def __init__(self, cpu_mhz):
+        self.cpu_mhz = cpu_mhz
+        self.records = {}       # core: [(ccount, event, arg)] oldest first
+        self.overwritten = {}
+
+
+def parse(lines):
+    """Returns the dumps in the log, complete ones only"""
+    dumps = []
+    dump = None
+    for line in lines:
+        line = line.strip()
+        m = re.search(r'TRACE start cpu_mhz=(\d+)', line)
+        if m:
+            dump = Dump(int(m.group(1)))
+            continue
+        if dump is None:
+            continue
+        m = re.search(r'TRACE core=(\d+) records=(\d+) overwritten=(\d+)', line)
+        if m:
+            dump.records[int(m.group(1))] = []
+            dump.overwritten[int(m.group(1))] = int(m.group(3))
+            continue
+        if 'TRACE end' in line:
+            dumps.append(dump)
+            dump = None
+            continue
+        m = re.match(r'.*?T(\d+)((?: [0-9a-f]{16})+)$', line)
+        if m:
+            recs = dump.records.setdefault(int(m.group(1)), [])
+            for word in m.group(2).split():
+                recs.append((int(word[0:8], 16), int(word[8:12], 16), int(word[12:16], 16)))
+    return dumps
+
+
+def timeline(records):
+    """Records in time order with the 32 bit cycle counter unwrapped to 64 bits.
+       Records are at most a few ms apart, far less than half a wrap, so the difference to the
+       previous one taken as signed is the time between them, also when an interrupt put a
+       later record into an earlier slot."""
+    out = []
+    t = 0
+    prev = None
+    for ccount, event, arg in records:
+        if prev is not None:
+            d = (ccount - prev) & 0xffffffff
+            t += d - (1 << 32) if d & 0x80000000 else d
+        prev = ccount
+        out.append((t, event, arg))
+    out.sort(key=lambda r: r[0])
+    return out
+
+
+class EventStats:
+    def __init__(self):
+        self.durations = []     # us
+        self.intervals = []     # us, begin to begin
+        self.unmatched = 0
+        self.count = 0          # single events
+
+
+def analyse(dumps, names):
+    stats = {}
+    for dump in dumps:
+        for core, records in sorted(dump.records.items()):
+            open_at = {}
+            last_begin = {}
+            first_seen = set()
+            for t, event, arg in timeline(records):
+                eid = event & ~END_FLAG
+                name = names.get(eid, 'EVENT_%d' % eid)
+                s = stats.setdefault(name, EventStats())
+                us = t / dump.cpu_mhz
+                if event & END_FLAG:
+                    if eid in open_at:
+                        s.durations.append(us - open_at.pop(eid))
+                    elif eid in first_seen:
+                        s.unmatched += 1
+                    first_seen.add(eid)
+                    continue
+                first_seen.add(eid)
+                if eid in open_at:
+                    s.unmatched += 1
+                open_at[eid] = us
+                if eid in last_begin:
+                    s.intervals.append(us - last_begin[eid])
+                last_begin[eid] = us
+                s.count += 1
+    return stats
+
+
+def percentile(values, p):
+    v = sorted(values)
+    return v[min(len(v) - 1, int(p / 100.0 * len(v)))]
+
+
+def summary(values):
+    return 'min %8.2f  avg %8.2f  p50 %8.2f  p99 %8.2f  max %8.2f us' % (
+        min(values), sum(values) / len(values), percentile(values, 50), percentile(values, 99), max(values))
+
+
+def histogram(values, n_bins, width=50):
+    top = percentile(values, 99.9)
+    bin_us = max(top / n_bins, 0.01)
+    bins = [0] * (n_bins + 1)
+    for v in values:
+        bins[min(int(v / bin_us), n_bins)] += 1
+    peak = max(bins)
+    for i, n in enumerate(bins):
+        if n == 0:
+            continue
+        label = '%8.2f - %8.2f' % (i * bin_us, (i + 1) * bin_us) if i < n_bins else '%8.2f -         ' % (i * bin_us)
+        print('    %s us %7d %s' % (label, n, '#' * max(1, n * width // peak)))
+
+
+def main():
+    ap = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    ap.add_argument('log', nargs='?', help='console log or uad_sim -t file (default: stdin)')
+    ap.add_argument('--bins', type=int, default=20, help='histogram bins up to the 99.9th percentile')
+    ap.add_argument('--check', action='store_true',
+                    help='exit with 1 if there is no trace, a begin/end pair is broken or an --expect event is missing')
+    ap.add_argument('--expect', default='', help='comma separated events that must have begin/end pairs')
+    ap.add_argument('--header', default=TRACE_H, help='trace.h with the event ids')
+    args = ap.parse_args()
+
+    names = read_event_names(args.header)
+    lines = open(args.log) if args.log else sys.stdin
+    dumps = parse(lines)
+    if not dumps:
+        print('no trace found')
+        return 1 if args.check else 0
+
+    n_records = sum(len(r) for d in dumps for r in d.records.values())
+    n_lost = sum(n for d in dumps for n in d.overwritten.values())
+    print('%d dump(s), %d records (%d older ones overwritten)' % (len(dumps), n_records, n_lost))
+    stats = analyse(dumps, names)
+
+    problems = 0
+    ids = {name: eid for eid, name in names.items()}
+    for name in sorted(stats, key=lambda n: ids.get(n, 1 << 16)):
+        s = stats[name]
+        if s.durations:
+            print('\n%s: %d runs' % (name, len(s.durations)))
+            print('  duration  ' + summary(s.durations))
+            if s.intervals:
+                print('  interval  ' + summary(s.intervals))
+            histogram(s.durations, args.bins)
+        else:
+            print('\n%s: %d times' % (name, s.count))
+        if s.unmatched:
+            print('  %d begin/end without its other half' % s.unmatched)
+            problems += 1
+    for name in filter(None, args.expect.split(',')):
+        if name not in stats or not stats[name].durations:
+            print('\n%s: expected, not in the trace' % name)
+            problems += 1
+    return 1 if args.check and problems else 0
+
+
+if __name__ == '__main__':
+    sys.exit(main())